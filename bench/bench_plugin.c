@@ -0,0 +1,279 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <cbor.h>
+
+#include "mock_broker.h"
+
+#define TARGET_BYTES_PER_CASE (64u * 1024u * 1024u)
+#define MIN_ITERATIONS 20u
+#define MAX_ITERATIONS 20000u
+#define SIZE_CASE_PAIRS 16u
+
+typedef struct {
+  unsigned char *data;
+  size_t size;
+  size_t capacity;
+} payload_buffer;
+
+typedef struct {
+  const char *name;
+  size_t width;
+  size_t depth;
+  size_t target_size;
+} bench_case;
+
+static const size_t PAYLOAD_SIZES[] = {100, 1000, 10000, 100000, 1000000};
+static const size_t MAP_WIDTHS[] = {1, 16, 256, 4096};
+static const size_t NESTING_DEPTHS[] = {1, 4, 16, 48};
+
+typedef struct {
+  const char *payload_mode;
+  const char *sign_mode;
+  const char *key_format;
+  const char *envelope;
+} bench_config;
+
+static const bench_config CONFIGS[] = {
+    {.payload_mode = "tree",
+     .sign_mode = "message",
+     .key_format = "text",
+     .envelope = "map"},
+    {.payload_mode = "splice",
+     .sign_mode = "message",
+     .key_format = "text",
+     .envelope = "map"},
+    {.payload_mode = "splice",
+     .sign_mode = "chain",
+     .key_format = "text",
+     .envelope = "map"},
+    {.payload_mode = "splice",
+     .sign_mode = "message",
+     .key_format = "integer",
+     .envelope = "cose"},
+    {.payload_mode = "splice",
+     .sign_mode = "message",
+     .key_format = "text",
+     .envelope = "properties"},
+};
+
+static unsigned char *reserve(payload_buffer *buffer, size_t size) {
+  if (buffer->capacity - buffer->size < size) {
+    size_t capacity = buffer->capacity == 0 ? 256 : buffer->capacity;
+    while (capacity - buffer->size < size) {
+      capacity *= 2;
+    }
+
+    unsigned char *data = realloc(buffer->data, capacity);
+    if (data == NULL) {
+      fprintf(stderr, "Out of memory generating payload\n");
+      exit(EXIT_FAILURE);
+    }
+    buffer->data = data;
+    buffer->capacity = capacity;
+  }
+  return buffer->data + buffer->size;
+}
+
+static void put_head(payload_buffer *buffer,
+                     size_t (*encode)(size_t, unsigned char *, size_t),
+                     size_t value) {
+  buffer->size += encode(value, reserve(buffer, 9), 9);
+}
+
+static void put_uint(payload_buffer *buffer, uint64_t value) {
+  buffer->size += cbor_encode_uint(value, reserve(buffer, 9), 9);
+}
+
+static void put_byte(payload_buffer *buffer, unsigned char byte) {
+  *reserve(buffer, 1) = byte;
+  buffer->size++;
+}
+
+static void put_bytes(payload_buffer *buffer, const void *bytes,
+                      size_t length) {
+  memcpy(reserve(buffer, length), bytes, length);
+  buffer->size += length;
+}
+
+static void put_string(payload_buffer *buffer, const char *string) {
+  size_t length = strlen(string);
+  put_head(buffer, cbor_encode_string_start, length);
+  put_bytes(buffer, string, length);
+}
+
+/**
+ * Generates an indefinite map with the shape of the case:
+ * - target_size: SIZE_CASE_PAIRS pairs of byte strings totalling the size
+ * - width: width pairs of unsigned integers
+ * - depth: a single value nested in depth - 1 arrays
+ */
+static void generate_payload(const bench_case *bc, payload_buffer *buffer) {
+  buffer->size = 0;
+  put_byte(buffer, 0xbf);
+
+  if (bc->target_size > 0) {
+    size_t value_size = bc->target_size / SIZE_CASE_PAIRS;
+    // Account the key, the value head and the map delimiters
+    value_size = value_size > 16 ? value_size - 16 : 1;
+
+    unsigned char *value = calloc(1, value_size);
+    for (size_t i = 0; i < SIZE_CASE_PAIRS; i++) {
+      char key[16];
+      snprintf(key, sizeof(key), "k%02zu", i);
+      put_string(buffer, key);
+      put_head(buffer, cbor_encode_bytestring_start, value_size);
+      put_bytes(buffer, value, value_size);
+    }
+    free(value);
+  } else if (bc->width > 0) {
+    for (size_t i = 0; i < bc->width; i++) {
+      put_uint(buffer, i);
+      put_uint(buffer, i * 7);
+    }
+  } else {
+    put_string(buffer, "v");
+    for (size_t i = 1; i < bc->depth; i++) {
+      put_head(buffer, cbor_encode_array_start, 1);
+    }
+    put_uint(buffer, 1);
+  }
+
+  put_byte(buffer, 0xff);
+}
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static int sign_once(const payload_buffer *payload) {
+  struct mosquitto_evt_message ed = {
+      .topic = "bench/topic",
+      .payload = payload->data,
+      .payloadlen = (uint32_t)payload->size,
+      .qos = 0,
+  };
+
+  int result = mock_broker_dispatch(MOSQ_EVT_MESSAGE, &ed);
+  if (result == MOSQ_ERR_SUCCESS && ed.payload != payload->data) {
+    // The broker owns the new payload and frees it after delivery
+    mosquitto_free(ed.payload);
+  }
+  // And the properties added by the properties envelope
+  mosquitto_property_free_all(&ed.properties);
+  return result;
+}
+
+static void run_case(FILE *out, const bench_config *config,
+                     const bench_case *bc, bool *first) {
+  payload_buffer payload = {0};
+  generate_payload(bc, &payload);
+
+  size_t iterations = TARGET_BYTES_PER_CASE / payload.size;
+  if (iterations < MIN_ITERATIONS) {
+    iterations = MIN_ITERATIONS;
+  } else if (iterations > MAX_ITERATIONS) {
+    iterations = MAX_ITERATIONS;
+  }
+
+  // Warm up caches and let the arena reach its steady state
+  size_t failures = 0;
+  for (size_t i = 0; i < iterations / 10 + 1; i++) {
+    sign_once(&payload);
+  }
+
+  mock_broker_reset_alloc_stats();
+  mock_broker_count_allocations(true);
+  uint64_t start = now_ns();
+
+  for (size_t i = 0; i < iterations; i++) {
+    if (sign_once(&payload) != MOSQ_ERR_SUCCESS) {
+      failures++;
+    }
+  }
+
+  uint64_t elapsed = now_ns() - start;
+  mock_broker_count_allocations(false);
+  mock_broker_alloc_stats stats = mock_broker_get_alloc_stats();
+
+  fprintf(out,
+          "%s    {\"case\": \"%s\", \"payload_mode\": \"%s\", "
+          "\"sign_mode\": \"%s\", \"key_format\": \"%s\", "
+          "\"envelope\": \"%s\", \"payload_size\": %zu, "
+          "\"width\": %zu, \"depth\": %zu, \"iterations\": %zu, "
+          "\"failures\": %zu, \"ns_per_message\": %.1f, "
+          "\"allocations_per_message\": %.2f, \"bytes_per_message\": %.1f}",
+          *first ? "" : ",\n", bc->name, config->payload_mode,
+          config->sign_mode, config->key_format, config->envelope,
+          payload.size, bc->width, bc->depth, iterations, failures,
+          (double)elapsed / iterations,
+          (double)stats.allocations / iterations,
+          (double)stats.bytes / iterations);
+  *first = false;
+
+  free(payload.data);
+}
+
+int main(int argc, char **argv) {
+  FILE *out = stdout;
+  if (argc > 1) {
+    out = fopen(argv[1], "w");
+    if (out == NULL) {
+      perror(argv[1]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  bool first = true;
+  fprintf(out, "{\n  \"benchmarks\": [\n");
+
+  for (size_t c = 0; c < sizeof(CONFIGS) / sizeof(CONFIGS[0]); c++) {
+    const bench_config *config = &CONFIGS[c];
+    struct mosquitto_opt opts[] = {
+        {.key = "db_connection_string", .value = "mock"},
+        {.key = "payload_mode", .value = (char *)config->payload_mode},
+        {.key = "sign_mode", .value = (char *)config->sign_mode},
+        {.key = "key_format", .value = (char *)config->key_format},
+        {.key = "envelope", .value = (char *)config->envelope},
+    };
+
+    if (mock_broker_load_plugin(opts, sizeof(opts) / sizeof(opts[0])) !=
+        MOSQ_ERR_SUCCESS) {
+      fprintf(stderr, "Failed to load plugin with %s payload mode and %s "
+                      "sign mode\n",
+              config->payload_mode, config->sign_mode);
+      return EXIT_FAILURE;
+    }
+
+    for (size_t i = 0; i < sizeof(PAYLOAD_SIZES) / sizeof(PAYLOAD_SIZES[0]);
+         i++) {
+      bench_case bc = {.name = "payload_size",
+                       .target_size = PAYLOAD_SIZES[i]};
+      run_case(out, config, &bc, &first);
+    }
+
+    for (size_t i = 0; i < sizeof(MAP_WIDTHS) / sizeof(MAP_WIDTHS[0]); i++) {
+      bench_case bc = {.name = "map_width", .width = MAP_WIDTHS[i]};
+      run_case(out, config, &bc, &first);
+    }
+
+    for (size_t i = 0; i < sizeof(NESTING_DEPTHS) / sizeof(NESTING_DEPTHS[0]);
+         i++) {
+      bench_case bc = {.name = "nesting_depth", .depth = NESTING_DEPTHS[i]};
+      run_case(out, config, &bc, &first);
+    }
+
+    mock_broker_unload_plugin();
+  }
+
+  fprintf(out, "\n  ]\n}\n");
+
+  if (out != stdout) {
+    fclose(out);
+  }
+  return EXIT_SUCCESS;
+}
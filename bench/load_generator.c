@@ -0,0 +1,837 @@
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <mosquitto.h>
+#include <mqtt_protocol.h>
+
+#include "cbor_validator.h"
+#include "metrics.h"
+
+#define DEFAULT_PORT 1883
+#define DEFAULT_TOPIC "load"
+#define KEEPALIVE_S 60
+
+/** Time given to the clients to connect and subscribe */
+#define CONNECT_TIMEOUT_MS 5000
+
+/** The drain after the last publication ends when every message arrived, or
+ * when no message arrived for DRAIN_IDLE_MS, or after DRAIN_TIMEOUT_MS */
+#define DRAIN_IDLE_MS 1000
+#define DRAIN_TIMEOUT_MS 10000
+
+/** Wait for the metrics of the plugin covering the end of the run */
+#define METRICS_SETTLE_MS 1500
+
+#define REJECTED_TOPIC_PREFIX "$SYS/plugins/message-sign/messages/rejected/"
+
+#define CBOR_INDEFINITE_MAP_START 0xbf
+#define CBOR_BREAK 0xff
+#define CBOR_UINT64_HEAD 0x1b
+#define CBOR_TAG_EPOCH_TIME 0xc1
+#define CBOR_FLOAT64_HEAD 0xfb
+#define COSE_SIGN1_TAG 0xd2
+#define CBOR_ARRAY_FOUR_ITEMS 0x84
+
+/** Keys of the pairs written by the generator, and of the ingestion time
+ * written by the plugin: "INGESTION_TIME" and -1 */
+static const uint8_t SEQUENCE_KEY[] = {0x63, 's', 'e', 'q'};
+static const uint8_t SENT_KEY[] = {0x64, 's', 'e', 'n', 't'};
+static const uint8_t INGESTION_TIME_TEXT_KEY[] = {
+    0x6e, 'I', 'N', 'G', 'E', 'S', 'T', 'I',
+    'O',  'N', '_', 'T', 'I', 'M', 'E'};
+static const uint8_t INGESTION_TIME_INT_KEY[] = {0x20};
+
+typedef struct {
+  const char *host;
+  int port;
+  const char *topic;
+  size_t publishers;
+  double rate;
+  double duration_s;
+  size_t width;
+  size_t value_size;
+  int qos;
+  uint64_t precision_ns;
+  const char *output;
+} load_options;
+
+/**
+ * State shared by the publishers and the subscriber. The counters of the
+ * publishers are atomic, the histograms are only written by the network
+ * thread of the subscriber and read once it is stopped.
+ */
+typedef struct {
+  const load_options *options;
+  uint64_t start_ns;
+  uint64_t end_ns;
+
+  /** Realtime minus monotonic clock, to stamp the scheduled send times with
+   * the clock of INGESTION_TIME */
+  int64_t realtime_offset_ns;
+
+  atomic_uint_fast64_t sent;
+  atomic_uint_fast64_t publish_errors;
+  atomic_uint_fast64_t broker_rejected;
+  atomic_uint_fast64_t behind_schedule;
+  atomic_uint_fast64_t disconnects;
+  atomic_uint_fast64_t received;
+  atomic_int subscriptions;
+
+  uint64_t unsigned_messages;
+  uint64_t malformed;
+  latency_histogram end_to_end;
+  latency_histogram ingestion;
+  latency_histogram delivery;
+
+  /** Rejection counters published by the plugin, first and last values */
+  uint64_t rejections_first[METRICS_REJECTED_COUNT];
+  uint64_t rejections_last[METRICS_REJECTED_COUNT];
+  bool rejections_seen[METRICS_REJECTED_COUNT];
+} load_state;
+
+typedef struct {
+  load_state *state;
+  size_t index;
+  pthread_t thread;
+  struct mosquitto *client;
+  char topic[256];
+
+  /** Payload built once, the sequence and the send time are patched in
+   * place before every publication */
+  uint8_t *payload;
+  size_t payload_size;
+  size_t sequence_offset;
+  size_t sent_offset;
+} publisher;
+
+static void usage(const char *program) {
+  fprintf(stderr,
+          "Usage: %s [-H HOST] [-p PORT] [-t TOPIC] [-n PUBLISHERS] [-r RATE] "
+          "[-d SECONDS]\n"
+          "       [-w WIDTH] [-s VALUE_SIZE] [-q QOS] [-P ms|us|ns] "
+          "[-o FILE]\n"
+          "Publishes CBOR indefinite maps at a fixed open-loop rate to a "
+          "broker running the\n"
+          "message sign plugin, subscribes to the signed messages and "
+          "reports the\n"
+          "throughput, the latency percentiles and the lost messages as "
+          "JSON.\n"
+          "  -H HOST        broker host, localhost by default\n"
+          "  -p PORT        broker port, %d by default\n"
+          "  -t TOPIC       topic prefix, every publisher uses TOPIC/INDEX, "
+          "%s by default\n"
+          "  -n PUBLISHERS  publishing threads, each with its own "
+          "connection, 1 by default\n"
+          "  -r RATE        total messages per second, 1000 by default\n"
+          "  -d SECONDS     duration of the publication, 10 by default\n"
+          "  -w WIDTH       byte string pairs added to every map, 4 by "
+          "default\n"
+          "  -s VALUE_SIZE  size of every byte string, 32 by default\n"
+          "  -q QOS         QoS of the publications and subscription, 0 by "
+          "default\n"
+          "  -P PRECISION   time_precision of the plugin, ms by default\n"
+          "  -o FILE        writes the report to FILE instead of standard "
+          "output\n",
+          program, DEFAULT_PORT, DEFAULT_TOPIC);
+}
+
+static uint64_t clock_ns(clockid_t clock) {
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t monotonic_ns) {
+  struct timespec ts = {
+      .tv_sec = (time_t)(monotonic_ns / 1000000000u),
+      .tv_nsec = (long)(monotonic_ns % 1000000000u),
+  };
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0) {
+  }
+}
+
+static void sleep_ms(uint64_t ms) {
+  sleep_until(clock_ns(CLOCK_MONOTONIC) + ms * 1000000u);
+}
+
+static size_t put_head(uint8_t *out, uint8_t major, uint64_t value) {
+  major <<= 5;
+  if (value < 24) {
+    out[0] = major | (uint8_t)value;
+    return 1;
+  }
+  if (value <= UINT8_MAX) {
+    out[0] = major | 24;
+    out[1] = (uint8_t)value;
+    return 2;
+  }
+  if (value <= UINT16_MAX) {
+    out[0] = major | 25;
+    out[1] = (uint8_t)(value >> 8);
+    out[2] = (uint8_t)value;
+    return 3;
+  }
+  out[0] = major | 26;
+  for (int i = 0; i < 4; i++) {
+    out[1 + i] = (uint8_t)(value >> (24 - 8 * i));
+  }
+  return 5;
+}
+
+static void put_uint64(uint8_t *out, uint64_t value) {
+  for (int i = 0; i < 8; i++) {
+    out[i] = (uint8_t)(value >> (56 - 8 * i));
+  }
+}
+
+/**
+ * Builds the map published by a publisher:
+ * {_ "seq": uint64, "sent": uint64, "f0": bytes, ...}, the integers being
+ * encoded on 8 bytes so that they can be patched in place
+ */
+static bool build_payload(publisher *pub, size_t width, size_t value_size) {
+  size_t capacity = 1 + 2 * (sizeof(SENT_KEY) + 9) +
+                    width * (16 + 5 + value_size) + 1;
+  uint8_t *out = (uint8_t *)malloc(capacity);
+  if (out == NULL) {
+    return false;
+  }
+
+  size_t size = 0;
+  out[size++] = CBOR_INDEFINITE_MAP_START;
+
+  memcpy(out + size, SEQUENCE_KEY, sizeof(SEQUENCE_KEY));
+  size += sizeof(SEQUENCE_KEY);
+  out[size++] = CBOR_UINT64_HEAD;
+  pub->sequence_offset = size;
+  size += 8;
+
+  memcpy(out + size, SENT_KEY, sizeof(SENT_KEY));
+  size += sizeof(SENT_KEY);
+  out[size++] = CBOR_UINT64_HEAD;
+  pub->sent_offset = size;
+  size += 8;
+
+  for (size_t i = 0; i < width; i++) {
+    char key[16];
+    int key_size = snprintf(key, sizeof(key), "f%zu", i);
+    size += put_head(out + size, 3, (uint64_t)key_size);
+    memcpy(out + size, key, (size_t)key_size);
+    size += (size_t)key_size;
+
+    size += put_head(out + size, 2, value_size);
+    for (size_t j = 0; j < value_size; j++) {
+      out[size++] = (uint8_t)(i + j);
+    }
+  }
+  out[size++] = CBOR_BREAK;
+
+  pub->payload = out;
+  pub->payload_size = size;
+  return true;
+}
+
+/**
+ * Reads the head of a definite item
+ *
+ * \returns false if the item is truncated or has an indefinite length
+ */
+static bool read_head(const uint8_t *data, size_t size, size_t *position,
+                      uint8_t *major, uint64_t *value) {
+  if (*position >= size) {
+    return false;
+  }
+  uint8_t initial = data[(*position)++];
+  uint8_t info = initial & 0x1f;
+  *major = initial >> 5;
+
+  if (info < 24) {
+    *value = info;
+    return true;
+  }
+  if (info > 27) {
+    return false;
+  }
+
+  size_t length = (size_t)1 << (info - 24);
+  if (size - *position < length) {
+    return false;
+  }
+  *value = 0;
+  for (size_t i = 0; i < length; i++) {
+    *value = (*value << 8) | data[(*position)++];
+  }
+  return true;
+}
+
+/**
+ * Reads an ingestion time written by the plugin: an unsigned integer in the
+ * time precision unit, or an epoch-based date/time of float64 seconds
+ */
+static bool read_ingestion_time(const uint8_t *value, size_t size,
+                                uint64_t precision_ns, uint64_t *ns) {
+  if (size == 10 && value[0] == CBOR_TAG_EPOCH_TIME &&
+      value[1] == CBOR_FLOAT64_HEAD) {
+    uint64_t bits = 0;
+    for (int i = 0; i < 8; i++) {
+      bits = (bits << 8) | value[2 + i];
+    }
+    double seconds = 0;
+    memcpy(&seconds, &bits, sizeof(seconds));
+    *ns = (uint64_t)(seconds * 1e9);
+    return true;
+  }
+
+  size_t position = 0;
+  uint8_t major = 0;
+  uint64_t time = 0;
+  if (!read_head(value, size, &position, &major, &time) || major != 0) {
+    return false;
+  }
+  *ns = time * precision_ns;
+  return true;
+}
+
+/**
+ * Finds the send time and the ingestion time in a signed map, or in the map
+ * of a COSE_Sign1 message
+ *
+ * \param has_ingestion out false if the plugin did not sign the message
+ * \returns false if the message is not a map written by the generator
+ */
+static bool parse_message(const uint8_t *data, size_t size,
+                          uint64_t precision_ns, uint64_t *sent_ns,
+                          uint64_t *ingestion_ns, bool *has_ingestion) {
+  size_t position = 0;
+  size_t item_size = 0;
+
+  if (size > 2 && data[0] == COSE_SIGN1_TAG &&
+      data[1] == CBOR_ARRAY_FOUR_ITEMS) {
+    // Skip the protected and unprotected headers to the payload
+    position = 2;
+    for (int i = 0; i < 2; i++) {
+      if (cbor_validate_item(data + position, size - position, NULL,
+                             &item_size) != CBOR_VALIDATION_OK) {
+        return false;
+      }
+      position += item_size;
+    }
+
+    uint8_t major = 0;
+    uint64_t length = 0;
+    if (!read_head(data, size, &position, &major, &length) || major != 2 ||
+        length > size - position) {
+      return false;
+    }
+    return parse_message(data + position, (size_t)length, precision_ns,
+                         sent_ns, ingestion_ns, has_ingestion);
+  }
+
+  if (size == 0 || data[0] != CBOR_INDEFINITE_MAP_START) {
+    return false;
+  }
+
+  bool has_sent = false;
+  *has_ingestion = false;
+  position = 1;
+  while (position < size && data[position] != CBOR_BREAK) {
+    const uint8_t *key = data + position;
+    size_t key_size = 0;
+    if (cbor_validate_item(key, size - position, NULL, &key_size) !=
+        CBOR_VALIDATION_OK) {
+      return false;
+    }
+    position += key_size;
+
+    const uint8_t *value = data + position;
+    size_t value_size = 0;
+    if (cbor_validate_item(value, size - position, NULL, &value_size) !=
+        CBOR_VALIDATION_OK) {
+      return false;
+    }
+    position += value_size;
+
+    if (key_size == sizeof(SENT_KEY) &&
+        memcmp(key, SENT_KEY, sizeof(SENT_KEY)) == 0) {
+      size_t value_position = 0;
+      uint8_t major = 0;
+      has_sent = read_head(value, value_size, &value_position, &major,
+                           sent_ns) &&
+                 major == 0;
+    } else if ((key_size == sizeof(INGESTION_TIME_TEXT_KEY) &&
+                memcmp(key, INGESTION_TIME_TEXT_KEY,
+                       sizeof(INGESTION_TIME_TEXT_KEY)) == 0) ||
+               (key_size == sizeof(INGESTION_TIME_INT_KEY) &&
+                memcmp(key, INGESTION_TIME_INT_KEY,
+                       sizeof(INGESTION_TIME_INT_KEY)) == 0)) {
+      *has_ingestion = read_ingestion_time(value, value_size, precision_ns,
+                                           ingestion_ns);
+    }
+  }
+  return has_sent;
+}
+
+/**
+ * Finds the ingestion time in the user properties of a message signed with
+ * the properties envelope
+ */
+static bool read_ingestion_property(const mosquitto_property *props,
+                                    uint64_t precision_ns, uint64_t *ns) {
+  bool found = false;
+  char *name = NULL;
+  char *value = NULL;
+  const mosquitto_property *prop = mosquitto_property_read_string_pair(
+      props, MQTT_PROP_USER_PROPERTY, &name, &value, false);
+  while (prop != NULL) {
+    if (!found && strcmp(name, "INGESTION_TIME") == 0) {
+      char *end = NULL;
+      uint64_t time = strtoull(value, &end, 10);
+      found = end != value && *end == '\0';
+      *ns = time * precision_ns;
+    }
+    free(name);
+    free(value);
+    prop = mosquitto_property_read_string_pair(prop, MQTT_PROP_USER_PROPERTY,
+                                               &name, &value, true);
+  }
+  return found;
+}
+
+static void record_latency(latency_histogram *histogram, uint64_t from_ns,
+                           uint64_t to_ns) {
+  // Clocks of coarse precision can stamp the ingestion before the send time
+  latency_histogram_record(histogram, to_ns > from_ns ? to_ns - from_ns : 0);
+}
+
+static void on_rejection_counter(load_state *state, const char *reason,
+                                 const struct mosquitto_message *message) {
+  char text[32];
+  size_t length = (size_t)message->payloadlen < sizeof(text) - 1
+                      ? (size_t)message->payloadlen
+                      : sizeof(text) - 1;
+  memcpy(text, message->payload, length);
+  text[length] = '\0';
+  uint64_t value = strtoull(text, NULL, 10);
+
+  for (int i = 0; i < METRICS_REJECTED_COUNT; i++) {
+    if (strcmp(reason, metrics_rejection_name((metrics_rejection)i)) == 0) {
+      if (!state->rejections_seen[i]) {
+        state->rejections_first[i] = value;
+        state->rejections_seen[i] = true;
+      }
+      state->rejections_last[i] = value;
+      return;
+    }
+  }
+}
+
+static void on_message(struct mosquitto *client, void *userdata,
+                       const struct mosquitto_message *message,
+                       const mosquitto_property *props) {
+  (void)client; // Unused
+  load_state *state = (load_state *)userdata;
+  uint64_t received_ns = clock_ns(CLOCK_REALTIME);
+
+  if (strncmp(message->topic, REJECTED_TOPIC_PREFIX,
+              strlen(REJECTED_TOPIC_PREFIX)) == 0) {
+    on_rejection_counter(state,
+                         message->topic + strlen(REJECTED_TOPIC_PREFIX),
+                         message);
+    return;
+  }
+
+  uint64_t sent_ns = 0;
+  uint64_t ingestion_ns = 0;
+  bool has_ingestion = false;
+  if (!parse_message((const uint8_t *)message->payload,
+                     (size_t)message->payloadlen,
+                     state->options->precision_ns, &sent_ns, &ingestion_ns,
+                     &has_ingestion)) {
+    state->malformed++;
+    return;
+  }
+  if (!has_ingestion) {
+    has_ingestion = read_ingestion_property(
+        props, state->options->precision_ns, &ingestion_ns);
+  }
+
+  record_latency(&state->end_to_end, sent_ns, received_ns);
+  if (has_ingestion) {
+    record_latency(&state->ingestion, sent_ns, ingestion_ns);
+    record_latency(&state->delivery, ingestion_ns, received_ns);
+  } else {
+    state->unsigned_messages++;
+  }
+  atomic_fetch_add(&state->received, 1);
+}
+
+static void on_connect(struct mosquitto *client, void *userdata, int result) {
+  load_state *state = (load_state *)userdata;
+  if (result != 0) {
+    return;
+  }
+
+  char filter[256];
+  snprintf(filter, sizeof(filter), "%s/#", state->options->topic);
+  mosquitto_subscribe(client, NULL, filter, state->options->qos);
+  mosquitto_subscribe(client, NULL, REJECTED_TOPIC_PREFIX "+", 0);
+}
+
+static void on_subscribe(struct mosquitto *client, void *userdata, int mid,
+                         int qos_count, const int *granted_qos) {
+  (void)client;      // Unused
+  (void)mid;         // Unused
+  (void)qos_count;   // Unused
+  (void)granted_qos; // Unused
+  load_state *state = (load_state *)userdata;
+  atomic_fetch_add(&state->subscriptions, 1);
+}
+
+static void on_publish(struct mosquitto *client, void *userdata, int mid,
+                       int reason_code, const mosquitto_property *props) {
+  (void)client; // Unused
+  (void)mid;    // Unused
+  (void)props;  // Unused
+  load_state *state = (load_state *)userdata;
+
+  // Reason codes from 0x80 are failures, e.g. a message refused by a plugin
+  if (reason_code >= 0x80) {
+    atomic_fetch_add(&state->broker_rejected, 1);
+  }
+}
+
+static void on_disconnect(struct mosquitto *client, void *userdata,
+                          int result) {
+  (void)client; // Unused
+  load_state *state = (load_state *)userdata;
+
+  // Mosquitto closes the connection of some clients whose message is refused
+  if (result != 0) {
+    atomic_fetch_add(&state->disconnects, 1);
+  }
+}
+
+static struct mosquitto *connect_client(load_state *state) {
+  struct mosquitto *client = mosquitto_new(NULL, true, state);
+  if (client == NULL) {
+    return NULL;
+  }
+  mosquitto_int_option(client, MOSQ_OPT_PROTOCOL_VERSION, MQTT_PROTOCOL_V5);
+  mosquitto_disconnect_callback_set(client, on_disconnect);
+
+  if (mosquitto_connect(client, state->options->host, state->options->port,
+                        KEEPALIVE_S) != MOSQ_ERR_SUCCESS ||
+      mosquitto_loop_start(client) != MOSQ_ERR_SUCCESS) {
+    mosquitto_destroy(client);
+    return NULL;
+  }
+  return client;
+}
+
+static void disconnect_client(struct mosquitto *client) {
+  mosquitto_disconnect(client);
+  mosquitto_loop_stop(client, false);
+  mosquitto_destroy(client);
+}
+
+/**
+ * Publishes at fixed times whatever the latency of the broker, so that a
+ * saturated broker shows in the latencies measured from the scheduled times
+ * instead of slowing down the publication
+ */
+static void *publisher_run(void *arg) {
+  publisher *pub = (publisher *)arg;
+  load_state *state = pub->state;
+  const load_options *options = state->options;
+
+  uint64_t interval_ns =
+      (uint64_t)(1e9 * (double)options->publishers / options->rate);
+  uint64_t first_ns =
+      state->start_ns + interval_ns * pub->index / options->publishers;
+
+  for (uint64_t sequence = 0;; sequence++) {
+    uint64_t scheduled_ns = first_ns + sequence * interval_ns;
+    if (scheduled_ns >= state->end_ns) {
+      break;
+    }
+    sleep_until(scheduled_ns);
+    if (clock_ns(CLOCK_MONOTONIC) - scheduled_ns > interval_ns) {
+      atomic_fetch_add(&state->behind_schedule, 1);
+    }
+
+    put_uint64(pub->payload + pub->sequence_offset, sequence);
+    put_uint64(pub->payload + pub->sent_offset,
+               (uint64_t)((int64_t)scheduled_ns + state->realtime_offset_ns));
+
+    if (mosquitto_publish_v5(pub->client, NULL, pub->topic,
+                             (int)pub->payload_size, pub->payload,
+                             options->qos, false,
+                             NULL) == MOSQ_ERR_SUCCESS) {
+      atomic_fetch_add(&state->sent, 1);
+    } else {
+      atomic_fetch_add(&state->publish_errors, 1);
+    }
+  }
+  return NULL;
+}
+
+static void write_latency(FILE *out, const char *name,
+                          const latency_histogram *histogram, bool last) {
+  fprintf(out,
+          "    \"%s\": {\"count\": %" PRIu64 ", \"p50\": %.1f, "
+          "\"p99\": %.1f, \"p999\": %.1f, \"max\": %.1f}%s\n",
+          name, histogram->interval_count,
+          latency_histogram_percentile(histogram, 50.0) / 1e3,
+          latency_histogram_percentile(histogram, 99.0) / 1e3,
+          latency_histogram_percentile(histogram, 99.9) / 1e3,
+          histogram->interval_max / 1e3, last ? "" : ",");
+}
+
+static void write_report(FILE *out, const load_state *state,
+                         size_t payload_size) {
+  const load_options *options = state->options;
+  uint64_t sent = atomic_load(&state->sent);
+  uint64_t received = atomic_load(&state->received);
+
+  fprintf(out,
+          "{\n"
+          "  \"publishers\": %zu, \"rate\": %.0f, \"duration_s\": %.1f, "
+          "\"qos\": %d, \"payload_size\": %zu,\n"
+          "  \"sent\": %" PRIu64 ", \"received\": %" PRIu64
+          ", \"dropped\": %" PRIu64 ",\n"
+          "  \"publish_errors\": %" PRIu64 ", \"broker_rejected\": %" PRIu64
+          ", \"disconnects\": %" PRIu64 ",\n"
+          "  \"behind_schedule\": %" PRIu64 ", \"unsigned\": %" PRIu64
+          ", \"malformed\": %" PRIu64 ",\n"
+          "  \"throughput\": %.1f,\n"
+          "  \"plugin_rejected\": {",
+          options->publishers, options->rate, options->duration_s,
+          options->qos, payload_size, sent, received,
+          sent > received ? sent - received : 0,
+          atomic_load(&state->publish_errors),
+          atomic_load(&state->broker_rejected),
+          atomic_load(&state->disconnects),
+          atomic_load(&state->behind_schedule), state->unsigned_messages,
+          state->malformed, (double)received / options->duration_s);
+
+  bool first = true;
+  for (int i = 0; i < METRICS_REJECTED_COUNT; i++) {
+    if (state->rejections_seen[i]) {
+      fprintf(out, "%s\"%s\": %" PRIu64, first ? "" : ", ",
+              metrics_rejection_name((metrics_rejection)i),
+              state->rejections_last[i] - state->rejections_first[i]);
+      first = false;
+    }
+  }
+
+  fprintf(out, "},\n  \"latency_us\": {\n");
+  write_latency(out, "end_to_end", &state->end_to_end, false);
+  write_latency(out, "ingestion", &state->ingestion, false);
+  write_latency(out, "delivery", &state->delivery, true);
+  fprintf(out, "  }\n}\n");
+}
+
+static bool parse_options(int argc, char **argv, load_options *options) {
+  int option;
+  while ((option = getopt(argc, argv, "H:p:t:n:r:d:w:s:q:P:o:h")) != -1) {
+    switch (option) {
+    case 'H':
+      options->host = optarg;
+      break;
+    case 'p':
+      options->port = atoi(optarg);
+      break;
+    case 't':
+      options->topic = optarg;
+      break;
+    case 'n':
+      options->publishers = strtoul(optarg, NULL, 10);
+      break;
+    case 'r':
+      options->rate = strtod(optarg, NULL);
+      break;
+    case 'd':
+      options->duration_s = strtod(optarg, NULL);
+      break;
+    case 'w':
+      options->width = strtoul(optarg, NULL, 10);
+      break;
+    case 's':
+      options->value_size = strtoul(optarg, NULL, 10);
+      break;
+    case 'q':
+      options->qos = atoi(optarg);
+      break;
+    case 'P':
+      if (strcmp(optarg, "ms") == 0) {
+        options->precision_ns = 1000000;
+      } else if (strcmp(optarg, "us") == 0) {
+        options->precision_ns = 1000;
+      } else if (strcmp(optarg, "ns") == 0) {
+        options->precision_ns = 1;
+      } else {
+        return false;
+      }
+      break;
+    case 'o':
+      options->output = optarg;
+      break;
+    default:
+      return false;
+    }
+  }
+
+  return optind == argc && options->publishers > 0 && options->rate > 0 &&
+         options->duration_s > 0 && options->qos >= 0 && options->qos <= 2 &&
+         options->width < 1000 && options->value_size <= UINT32_MAX;
+}
+
+int main(int argc, char **argv) {
+  load_options options = {
+      .host = "localhost",
+      .port = DEFAULT_PORT,
+      .topic = DEFAULT_TOPIC,
+      .publishers = 1,
+      .rate = 1000,
+      .duration_s = 10,
+      .width = 4,
+      .value_size = 32,
+      .qos = 0,
+      .precision_ns = 1000000,
+      .output = NULL,
+  };
+  if (!parse_options(argc, argv, &options)) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  static load_state state;
+  state.options = &options;
+  mosquitto_lib_init();
+
+  struct mosquitto *subscriber = mosquitto_new(NULL, true, &state);
+  if (subscriber == NULL) {
+    fprintf(stderr, "Failed to create the subscriber\n");
+    return EXIT_FAILURE;
+  }
+  mosquitto_int_option(subscriber, MOSQ_OPT_PROTOCOL_VERSION,
+                       MQTT_PROTOCOL_V5);
+  mosquitto_connect_callback_set(subscriber, on_connect);
+  mosquitto_subscribe_callback_set(subscriber, on_subscribe);
+  mosquitto_message_v5_callback_set(subscriber, on_message);
+  if (mosquitto_connect(subscriber, options.host, options.port,
+                        KEEPALIVE_S) != MOSQ_ERR_SUCCESS ||
+      mosquitto_loop_start(subscriber) != MOSQ_ERR_SUCCESS) {
+    fprintf(stderr, "Failed to connect to %s:%d\n", options.host,
+            options.port);
+    return EXIT_FAILURE;
+  }
+
+  publisher *publishers =
+      (publisher *)calloc(options.publishers, sizeof(publisher));
+  if (publishers == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    return EXIT_FAILURE;
+  }
+  for (size_t i = 0; i < options.publishers; i++) {
+    publisher *pub = &publishers[i];
+    pub->state = &state;
+    pub->index = i;
+    snprintf(pub->topic, sizeof(pub->topic), "%s/%zu", options.topic, i);
+    pub->client = connect_client(&state);
+    if (pub->client == NULL ||
+        !build_payload(pub, options.width, options.value_size)) {
+      fprintf(stderr, "Failed to start publisher %zu\n", i);
+      return EXIT_FAILURE;
+    }
+    mosquitto_publish_v5_callback_set(pub->client, on_publish);
+  }
+
+  uint64_t deadline_ns =
+      clock_ns(CLOCK_MONOTONIC) + CONNECT_TIMEOUT_MS * 1000000ull;
+  while (atomic_load(&state.subscriptions) < 2) {
+    if (clock_ns(CLOCK_MONOTONIC) > deadline_ns) {
+      fprintf(stderr, "Timed out subscribing to %s/#\n", options.topic);
+      return EXIT_FAILURE;
+    }
+    sleep_ms(10);
+  }
+  // Let the retained rejection counters arrive before the first message
+  sleep_ms(100);
+
+  // Starts a little later so that every publisher is ready
+  state.start_ns = clock_ns(CLOCK_MONOTONIC) + 100000000u;
+  state.end_ns = state.start_ns + (uint64_t)(options.duration_s * 1e9);
+  state.realtime_offset_ns = (int64_t)clock_ns(CLOCK_REALTIME) -
+                             (int64_t)clock_ns(CLOCK_MONOTONIC);
+
+  for (size_t i = 0; i < options.publishers; i++) {
+    if (pthread_create(&publishers[i].thread, NULL, publisher_run,
+                       &publishers[i]) != 0) {
+      fprintf(stderr, "Failed to start publisher thread %zu\n", i);
+      return EXIT_FAILURE;
+    }
+  }
+  for (size_t i = 0; i < options.publishers; i++) {
+    pthread_join(publishers[i].thread, NULL);
+  }
+
+  // Wait for the messages still in flight
+  uint64_t drain_start_ms = clock_ns(CLOCK_MONOTONIC) / 1000000u;
+  uint64_t progress_ms = drain_start_ms;
+  uint64_t received = atomic_load(&state.received);
+  while (received < atomic_load(&state.sent)) {
+    sleep_ms(10);
+    uint64_t now_ms = clock_ns(CLOCK_MONOTONIC) / 1000000u;
+    uint64_t now_received = atomic_load(&state.received);
+    if (now_received != received) {
+      received = now_received;
+      progress_ms = now_ms;
+    } else if (now_ms - progress_ms > DRAIN_IDLE_MS ||
+               now_ms - drain_start_ms > DRAIN_TIMEOUT_MS) {
+      break;
+    }
+  }
+  sleep_ms(METRICS_SETTLE_MS);
+
+  for (size_t i = 0; i < options.publishers; i++) {
+    disconnect_client(publishers[i].client);
+  }
+  disconnect_client(subscriber);
+
+  FILE *out = stdout;
+  if (options.output != NULL) {
+    out = fopen(options.output, "w");
+    if (out == NULL) {
+      perror(options.output);
+      return EXIT_FAILURE;
+    }
+  }
+  write_report(out, &state, publishers[0].payload_size);
+  if (out != stdout) {
+    fclose(out);
+  }
+
+  fprintf(stderr,
+          "%" PRIu64 "/%" PRIu64 " messages received, %.0f msg/s, "
+          "end to end p50 %.1f us p99 %.1f us p999 %.1f us\n",
+          atomic_load(&state.received), atomic_load(&state.sent),
+          (double)atomic_load(&state.received) / options.duration_s,
+          latency_histogram_percentile(&state.end_to_end, 50.0) / 1e3,
+          latency_histogram_percentile(&state.end_to_end, 99.0) / 1e3,
+          latency_histogram_percentile(&state.end_to_end, 99.9) / 1e3);
+
+  for (size_t i = 0; i < options.publishers; i++) {
+    free(publishers[i].payload);
+  }
+  free(publishers);
+  mosquitto_lib_cleanup();
+  return EXIT_SUCCESS;
+}
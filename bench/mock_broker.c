@@ -0,0 +1,199 @@
+#include "mock_broker.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_CALLBACKS 16
+
+typedef struct {
+  int event;
+  MOSQ_FUNC_generic_callback callback;
+  void *userdata;
+} registered_callback;
+
+static registered_callback callbacks[MAX_CALLBACKS];
+static size_t callback_count = 0;
+
+static void *plugin_userdata = NULL;
+static struct mosquitto_opt *plugin_opts = NULL;
+static int plugin_opt_count = 0;
+
+static bool counting = false;
+static mock_broker_alloc_stats alloc_stats = {0};
+static uint64_t published = 0;
+
+/*
+ * Heap functions are wrapped at link time (-Wl,--wrap) to count the
+ * allocations made by the plugin and by libcbor through its allocator hooks
+ */
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+static void count_allocation(size_t size) {
+  if (counting) {
+    alloc_stats.allocations++;
+    alloc_stats.bytes += size;
+  }
+}
+
+void *__wrap_malloc(size_t size) {
+  count_allocation(size);
+  return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size) {
+  count_allocation(nmemb * size);
+  return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+  count_allocation(size);
+  return __real_realloc(ptr, size);
+}
+
+void mock_broker_reset_alloc_stats(void) {
+  alloc_stats = (mock_broker_alloc_stats){0};
+}
+
+mock_broker_alloc_stats mock_broker_get_alloc_stats(void) {
+  return alloc_stats;
+}
+
+void mock_broker_count_allocations(bool enabled) { counting = enabled; }
+
+int mock_broker_load_plugin(struct mosquitto_opt *opts, int opt_count) {
+  int versions[] = {5};
+  if (mosquitto_plugin_version(1, versions) != 5) {
+    return MOSQ_ERR_NOT_SUPPORTED;
+  }
+
+  plugin_opts = opts;
+  plugin_opt_count = opt_count;
+  return mosquitto_plugin_init(NULL, &plugin_userdata, opts, opt_count);
+}
+
+int mock_broker_unload_plugin(void) {
+  int result =
+      mosquitto_plugin_cleanup(plugin_userdata, plugin_opts, plugin_opt_count);
+  plugin_userdata = NULL;
+  return result;
+}
+
+int mock_broker_dispatch(int event, void *event_data) {
+  for (size_t i = 0; i < callback_count; i++) {
+    if (callbacks[i].event == event) {
+      return callbacks[i].callback(event, event_data, callbacks[i].userdata);
+    }
+  }
+  return MOSQ_ERR_NOT_FOUND;
+}
+
+uint64_t mock_broker_published_count(void) { return published; }
+
+/* Broker API used by the plugin */
+
+void mosquitto_log_printf(int level, const char *fmt, ...) {
+  if (level != MOSQ_LOG_ERR && getenv("MOCK_BROKER_VERBOSE") == NULL) {
+    return;
+  }
+
+  va_list args;
+  va_start(args, fmt);
+  vfprintf(stderr, fmt, args);
+  va_end(args);
+  fputc('\n', stderr);
+}
+
+void *mosquitto_calloc(size_t nmemb, size_t size) {
+  return calloc(nmemb, size);
+}
+
+void *mosquitto_malloc(size_t size) { return malloc(size); }
+
+void *mosquitto_realloc(void *ptr, size_t size) { return realloc(ptr, size); }
+
+void mosquitto_free(void *mem) { free(mem); }
+
+char *mosquitto_strdup(const char *s) {
+  size_t length = strlen(s) + 1;
+  char *copy = malloc(length);
+  if (copy != NULL) {
+    memcpy(copy, s, length);
+  }
+  return copy;
+}
+
+int mosquitto_callback_register(mosquitto_plugin_id_t *identifier, int event,
+                                MOSQ_FUNC_generic_callback cb_func,
+                                const void *event_data, void *userdata) {
+  (void)identifier;
+  (void)event_data;
+
+  if (callback_count == MAX_CALLBACKS) {
+    return MOSQ_ERR_NOMEM;
+  }
+
+  callbacks[callback_count++] = (registered_callback){
+      .event = event, .callback = cb_func, .userdata = userdata};
+  return MOSQ_ERR_SUCCESS;
+}
+
+int mosquitto_callback_unregister(mosquitto_plugin_id_t *identifier,
+                                  int event,
+                                  MOSQ_FUNC_generic_callback cb_func,
+                                  const void *event_data) {
+  (void)identifier;
+  (void)event_data;
+
+  for (size_t i = 0; i < callback_count; i++) {
+    if (callbacks[i].event == event && callbacks[i].callback == cb_func) {
+      callbacks[i] = callbacks[--callback_count];
+      return MOSQ_ERR_SUCCESS;
+    }
+  }
+  return MOSQ_ERR_NOT_FOUND;
+}
+
+int mosquitto_broker_publish(const char *clientid, const char *topic,
+                             int payloadlen, void *payload, int qos,
+                             bool retain, mosquitto_property *properties) {
+  (void)clientid;
+  (void)topic;
+  (void)payloadlen;
+  (void)qos;
+  (void)retain;
+  (void)properties;
+
+  published++;
+  free(payload);
+  return MOSQ_ERR_SUCCESS;
+}
+
+int mosquitto_broker_publish_copy(const char *clientid, const char *topic,
+                                  int payloadlen, const void *payload, int qos,
+                                  bool retain,
+                                  mosquitto_property *properties) {
+  (void)clientid;
+  (void)topic;
+  (void)payloadlen;
+  (void)payload;
+  (void)qos;
+  (void)retain;
+  (void)properties;
+
+  published++;
+  return MOSQ_ERR_SUCCESS;
+}
+
+const char *mosquitto_client_id(const struct mosquitto *client) {
+  (void)client;
+  return "bench";
+}
+
+const char *mosquitto_client_username(const struct mosquitto *client) {
+  (void)client;
+  return "bench";
+}
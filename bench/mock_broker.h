@@ -0,0 +1,65 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "mosquitto_broker.h"
+#include "mosquitto_plugin.h"
+
+/**
+ * Heap usage observed by the mock broker
+ */
+typedef struct {
+  /** Number of malloc, calloc and realloc calls */
+  uint64_t allocations;
+
+  /** Bytes requested by those calls */
+  uint64_t bytes;
+} mock_broker_alloc_stats;
+
+/**
+ * Starts counting heap allocations from zero
+ */
+void mock_broker_reset_alloc_stats(void);
+
+/**
+ * Returns the heap allocations counted since the last reset
+ */
+mock_broker_alloc_stats mock_broker_get_alloc_stats(void);
+
+/**
+ * Enables or disables counting of heap allocations
+ *
+ * \param enabled true to count allocations
+ */
+void mock_broker_count_allocations(bool enabled);
+
+/**
+ * Loads the plugin with the given options, like the broker does on startup
+ *
+ * \param opts plugin options
+ * \param opt_count number of plugin options
+ * \returns the result of mosquitto_plugin_init
+ */
+int mock_broker_load_plugin(struct mosquitto_opt *opts, int opt_count);
+
+/**
+ * Unloads the plugin, like the broker does on shutdown
+ *
+ * \returns the result of mosquitto_plugin_cleanup
+ */
+int mock_broker_unload_plugin(void);
+
+/**
+ * Delivers an event to the callback the plugin registered for it
+ *
+ * \param event event identifier, e.g. MOSQ_EVT_MESSAGE
+ * \param event_data event specific data
+ * \returns the result of the callback, MOSQ_ERR_NOT_FOUND if none is
+ * registered
+ */
+int mock_broker_dispatch(int event, void *event_data);
+
+/**
+ * Returns the number of messages published through mosquitto_broker_publish
+ */
+uint64_t mock_broker_published_count(void);
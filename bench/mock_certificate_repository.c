@@ -0,0 +1,102 @@
+#include "certificate_repository.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * In memory replacement of the PostgreSQL repository, so that the plugin can
+ * be initialized without a database. Certificates are stored by the first
+ * poll after they are added.
+ */
+typedef struct {
+  char *entity;
+  uint64_t create_time_unix;
+  char *public_key;
+  char *algorithm;
+} mock_certificate;
+
+struct certificate_repository {
+  certificate_repository_options options;
+  size_t certificate_count;
+
+  /** Certificates not reported to the stored callback yet */
+  mock_certificate *pending;
+  size_t pending_count;
+};
+
+certificate_repository *
+certificate_repository_new(const certificate_repository_options *options) {
+  certificate_repository *repo =
+      (certificate_repository *)calloc(1, sizeof(certificate_repository));
+  if (repo != NULL) {
+    repo->options = *options;
+  }
+  return repo;
+}
+
+static void free_mock_certificate(mock_certificate *cert) {
+  free(cert->entity);
+  free(cert->public_key);
+  free(cert->algorithm);
+}
+
+error_code certificate_repository_add_batch(certificate_repository *repo,
+                                            const certificate *certs,
+                                            size_t count) {
+  mock_certificate *pending = (mock_certificate *)realloc(
+      repo->pending, (repo->pending_count + count) * sizeof(mock_certificate));
+  if (pending == NULL) {
+    return ERROR_NO_MEMORY;
+  }
+  repo->pending = pending;
+
+  for (size_t i = 0; i < count; i++) {
+    mock_certificate *cert = &repo->pending[repo->pending_count + i];
+    *cert = (mock_certificate){
+        .entity = strdup(certs[i].entity),
+        .create_time_unix = certs[i].create_time_unix,
+        .public_key = strdup(certs[i].public_key),
+        .algorithm =
+            certs[i].algorithm != NULL ? strdup(certs[i].algorithm) : NULL,
+    };
+  }
+  repo->pending_count += count;
+  repo->certificate_count += count;
+  return SUCCESS;
+}
+
+error_code certificate_repository_add(certificate_repository *repo,
+                                      const certificate *cert) {
+  return certificate_repository_add_batch(repo, cert, 1);
+}
+
+void certificate_repository_poll(certificate_repository *repo,
+                                 uint64_t now_ms) {
+  (void)now_ms;
+
+  for (size_t i = 0; i < repo->pending_count; i++) {
+    mock_certificate *pending = &repo->pending[i];
+    certificate cert = {
+        .entity = pending->entity,
+        .create_time_unix = pending->create_time_unix,
+        .public_key = pending->public_key,
+        .algorithm = pending->algorithm,
+    };
+    if (repo->options.stored_callback != NULL) {
+      repo->options.stored_callback(&cert, repo->options.userdata);
+    }
+    free_mock_certificate(pending);
+  }
+  repo->pending_count = 0;
+}
+
+size_t certificate_repository_pending(const certificate_repository *repo) {
+  return repo->pending_count;
+}
+
+void certificate_repository_destroy(certificate_repository *repo) {
+  for (size_t i = 0; i < repo->pending_count; i++) {
+    free_mock_certificate(&repo->pending[i]);
+  }
+  free(repo->pending);
+  free(repo);
+}
@@ -0,0 +1,79 @@
+#!/bin/sh
+# Runs the load generator against a disposable mosquitto loading the plugin
+# built in BUILD_DIR. The broker is configured from mosquitto-example.conf
+# with a sealed key file instead of the database, so nothing but mosquitto
+# is needed.
+#
+# Usage: bench/run_load.sh BUILD_DIR [LOAD_GENERATOR_OPTIONS...]
+#
+# Environment:
+#   PLUGIN_OPTS  space separated plugin options, e.g. "payload_mode=splice"
+#   LOAD_PORT    port of the broker, 18830 by default
+#   BROKER_CPU   CPU the broker is pinned to, to measure a single core
+#   MOSQUITTO    mosquitto executable, found in PATH by default
+set -eu
+
+if [ $# -lt 1 ]; then
+    sed -n '2,15s/^# \{0,1\}//p' "$0" >&2
+    exit 1
+fi
+
+BUILD_DIR=$(cd "$1" && pwd)
+shift
+SOURCE_DIR=$(cd "$(dirname "$0")/.." && pwd)
+PORT=${LOAD_PORT:-18830}
+MOSQUITTO=${MOSQUITTO:-mosquitto}
+BROKER_PID=
+
+WORK_DIR=$(mktemp -d)
+cleanup() {
+    if [ -n "$BROKER_PID" ]; then
+        kill "$BROKER_PID" 2>/dev/null || true
+        wait "$BROKER_PID" 2>/dev/null || true
+    fi
+    rm -rf "$WORK_DIR"
+}
+trap cleanup EXIT INT TERM
+
+# The key file replaces the certificate repository: the plugin loads the key
+# at startup and never connects to a database
+head -c 32 /dev/urandom | od -An -tx1 | tr -d ' \n' > "$WORK_DIR/secret"
+"$BUILD_DIR/tools/signing_key_seal" -s "$WORK_DIR/secret" -e LOAD \
+    "$WORK_DIR/key" > /dev/null
+
+CONF="$WORK_DIR/mosquitto.conf"
+sed -e "s|^listener .*|listener $PORT 127.0.0.1|" \
+    -e "s|^plugin .*|plugin $BUILD_DIR/lib/mosquitto-message-sign-plugin.so|" \
+    -e '/^plugin_opt_db_connection_string/d' \
+    "$SOURCE_DIR/mosquitto-example.conf" > "$CONF"
+cat >> "$CONF" <<CONF
+log_dest file $WORK_DIR/mosquitto.log
+max_queued_messages 0
+plugin_opt_key_file $WORK_DIR/key
+plugin_opt_key_secret_file $WORK_DIR/secret
+plugin_opt_metrics_interval_ms 1000
+CONF
+for option in ${PLUGIN_OPTS:-}; do
+    echo "plugin_opt_${option%%=*} ${option#*=}" >> "$CONF"
+done
+
+if [ -n "${BROKER_CPU:-}" ]; then
+    taskset -c "$BROKER_CPU" "$MOSQUITTO" -c "$CONF" &
+else
+    "$MOSQUITTO" -c "$CONF" &
+fi
+BROKER_PID=$!
+
+for _ in $(seq 50); do
+    if grep -q "running" "$WORK_DIR/mosquitto.log" 2>/dev/null; then
+        break
+    fi
+    if ! kill -0 "$BROKER_PID" 2>/dev/null; then
+        cat "$WORK_DIR/mosquitto.log" >&2 2>/dev/null || true
+        echo "mosquitto failed to start" >&2
+        exit 1
+    fi
+    sleep 0.1
+done
+
+"$BUILD_DIR/bench/load_generator" -H 127.0.0.1 -p "$PORT" "$@"
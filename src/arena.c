@@ -0,0 +1,242 @@
+#include "arena.h"
+#include <cbor.h>
+#include <stdalign.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ALIGNMENT alignof(max_align_t)
+#define ALIGN_UP(x) (((x) + ALIGNMENT - 1) & ~(ALIGNMENT - 1))
+
+// Every allocation is preceded by its size, needed to implement realloc
+#define HEADER_SIZE ALIGN_UP(sizeof(size_t))
+
+typedef struct block {
+  struct block *next;
+  size_t capacity;
+  size_t used;
+  alignas(max_align_t) unsigned char data[];
+} block;
+
+struct arena {
+  /** Block where new allocations are made, followed by the full ones */
+  block *head;
+
+  /** Bytes allocated since the last reset */
+  size_t used;
+
+  /** Maximum number of bytes allocated since the last reset */
+  size_t cycle_peak;
+
+  /** Maximum number of bytes allocated between two resets, over the cycles
+   * that fit the retained size */
+  size_t high_water;
+
+  size_t initial_size;
+  size_t max_retained_size;
+
+  /** Last allocation, which can be grown or released in place */
+  unsigned char *last;
+};
+
+static _Thread_local arena *active_arena = NULL;
+
+static block *block_new(size_t capacity) {
+  block *b = (block *)malloc(sizeof(block) + capacity);
+  if (b == NULL) {
+    return NULL;
+  }
+
+  b->next = NULL;
+  b->capacity = capacity;
+  b->used = 0;
+  return b;
+}
+
+static void blocks_free(block *b) {
+  while (b != NULL) {
+    block *next = b->next;
+    free(b);
+    b = next;
+  }
+}
+
+static size_t *allocation_size(void *ptr) {
+  return (size_t *)((unsigned char *)ptr - HEADER_SIZE);
+}
+
+static bool arena_owns(arena *a, void *ptr) {
+  unsigned char *p = (unsigned char *)ptr;
+  for (block *b = a->head; b != NULL; b = b->next) {
+    if (p >= b->data && p < b->data + b->capacity) {
+      return true;
+    }
+  }
+  return false;
+}
+
+arena *arena_new(size_t initial_size, size_t max_retained_size) {
+  arena *a = (arena *)calloc(1, sizeof(arena));
+  if (a == NULL) {
+    return NULL;
+  }
+
+  a->initial_size = ALIGN_UP(initial_size);
+  a->max_retained_size = max_retained_size;
+  a->head = block_new(a->initial_size);
+  if (a->head == NULL) {
+    free(a);
+    return NULL;
+  }
+
+  return a;
+}
+
+void *arena_alloc(arena *a, size_t size) {
+  if (size > SIZE_MAX - 2 * ALIGNMENT - HEADER_SIZE) {
+    return NULL;
+  }
+
+  size_t total = HEADER_SIZE + ALIGN_UP(size);
+
+  if (a->head == NULL || a->head->capacity - a->head->used < total) {
+    size_t capacity = a->head != NULL ? a->head->capacity * 2 : a->initial_size;
+    if (capacity < total) {
+      capacity = total;
+    }
+
+    block *b = block_new(capacity);
+    if (b == NULL) {
+      return NULL;
+    }
+
+    b->next = a->head;
+    a->head = b;
+  }
+
+  unsigned char *ptr = a->head->data + a->head->used + HEADER_SIZE;
+  *allocation_size(ptr) = ALIGN_UP(size);
+
+  a->head->used += total;
+  a->used += total;
+  if (a->used > a->cycle_peak) {
+    a->cycle_peak = a->used;
+  }
+
+  a->last = ptr;
+  return ptr;
+}
+
+/**
+ * Resizes an allocation, in place when it is the last one of the arena
+ */
+static void *arena_realloc(arena *a, void *ptr, size_t size) {
+  size_t old_size = *allocation_size(ptr);
+
+  if (ptr == a->last && size <= SIZE_MAX - 2 * ALIGNMENT) {
+    size_t new_size = ALIGN_UP(size);
+    if (new_size <= old_size ||
+        a->head->capacity - a->head->used >= new_size - old_size) {
+      a->head->used = a->head->used - old_size + new_size;
+      a->used = a->used - old_size + new_size;
+      if (a->used > a->cycle_peak) {
+        a->cycle_peak = a->used;
+      }
+      *allocation_size(ptr) = new_size;
+      return ptr;
+    }
+  }
+
+  void *new_ptr = arena_alloc(a, size);
+  if (new_ptr != NULL) {
+    memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+  }
+  return new_ptr;
+}
+
+/**
+ * Releases an allocation, only reclaiming memory if it is the last one
+ */
+static void arena_free(arena *a, void *ptr) {
+  if (ptr != a->last) {
+    return;
+  }
+
+  size_t total = HEADER_SIZE + *allocation_size(ptr);
+  a->head->used -= total;
+  a->used -= total;
+  a->last = NULL;
+}
+
+void arena_reset(arena *a) {
+  // A cycle bigger than the retained size is an outlier, it must not shrink
+  // the block sized for the usual ones
+  if (a->cycle_peak <= a->max_retained_size &&
+      a->cycle_peak > a->high_water) {
+    a->high_water = a->cycle_peak;
+  }
+  size_t retained = a->high_water > a->initial_size ? a->high_water
+                                                    : a->initial_size;
+  // Also when the initial size is bigger, otherwise the block would be
+  // released and allocated again by every reset
+  if (retained > a->max_retained_size) {
+    retained = a->max_retained_size;
+  }
+
+  if (a->head != NULL && a->head->next == NULL &&
+      a->head->capacity <= a->max_retained_size) {
+    // Steady state, a single block big enough for every cycle so far
+    a->head->used = 0;
+  } else {
+    blocks_free(a->head);
+    a->head = block_new(retained);
+  }
+
+  a->used = 0;
+  a->cycle_peak = 0;
+  a->last = NULL;
+}
+
+void arena_destroy(arena *a) {
+  if (active_arena == a) {
+    active_arena = NULL;
+  }
+
+  blocks_free(a->head);
+  free(a);
+}
+
+static void *cbor_malloc_hook(size_t size) {
+  if (active_arena != NULL) {
+    return arena_alloc(active_arena, size);
+  }
+  return malloc(size);
+}
+
+static void *cbor_realloc_hook(void *ptr, size_t size) {
+  if (ptr == NULL) {
+    return cbor_malloc_hook(size);
+  }
+  if (active_arena != NULL && arena_owns(active_arena, ptr)) {
+    return arena_realloc(active_arena, ptr, size);
+  }
+  return realloc(ptr, size);
+}
+
+void arena_cbor_free(void *ptr) {
+  if (ptr == NULL) {
+    return;
+  }
+  if (active_arena != NULL && arena_owns(active_arena, ptr)) {
+    arena_free(active_arena, ptr);
+    return;
+  }
+  free(ptr);
+}
+
+void arena_register_cbor_allocator(void) {
+  cbor_set_allocs(cbor_malloc_hook, cbor_realloc_hook, arena_cbor_free);
+}
+
+void arena_activate(arena *a) { active_arena = a; }
@@ -0,0 +1,68 @@
+#pragma once
+#include <stddef.h>
+
+/**
+ * Opaque struct representing a bump pointer arena. Memory is released all at
+ * once by resetting the arena, single allocations are never freed.
+ */
+typedef struct arena arena;
+
+/**
+ * Creates a new arena
+ *
+ * \param initial_size size of the first block
+ * \param max_retained_size maximum size of the block kept across resets,
+ * blocks bigger than this are released when the arena is reset
+ * \returns handle to the created arena on success, null otherwise
+ */
+arena *arena_new(size_t initial_size, size_t max_retained_size);
+
+/**
+ * Allocates memory from the arena, aligned for any type
+ *
+ * \param a handle to the arena
+ * \param size size of the allocation
+ * \returns pointer to the allocated memory, null if out of memory
+ */
+void *arena_alloc(arena *a, size_t size);
+
+/**
+ * Releases every allocation of the arena. If the arena needed more than one
+ * block since the last reset, they are replaced by a single block as large as
+ * the biggest cycle so far, so that the next cycles do not allocate. Cycles
+ * bigger than the maximum retained size are not taken into account, and the
+ * retained block never exceeds it, even when the initial size does.
+ *
+ * \param a handle to the arena
+ */
+void arena_reset(arena *a);
+
+/**
+ * Destroys the arena freeing memory
+ *
+ * \param a handle to the arena
+ */
+void arena_destroy(arena *a);
+
+/**
+ * Installs the arena aware allocator in libcbor. Allocations made by libcbor
+ * use the arena activated on the calling thread, or the standard allocator
+ * when there is none. Must be called once before using libcbor.
+ */
+void arena_register_cbor_allocator(void);
+
+/**
+ * Frees memory allocated by libcbor, through the arena activated on the
+ * calling thread when it owns it. This is the free function installed by
+ * arena_register_cbor_allocator.
+ *
+ * \param ptr memory to free, may be null
+ */
+void arena_cbor_free(void *ptr);
+
+/**
+ * Activates an arena for libcbor allocations made on the calling thread
+ *
+ * \param a handle to the arena, null to go back to the standard allocator
+ */
+void arena_activate(arena *a);
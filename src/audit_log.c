@@ -0,0 +1,534 @@
+#include "audit_log.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+/** Alignment of the record region, a page on common systems */
+#define DATA_ALIGNMENT 4096
+
+/** Alignment of every record */
+#define RECORD_ALIGNMENT 8
+
+typedef struct audit_segment {
+  audit_log_header *header;
+  audit_log_index_entry *index;
+  uint8_t *data;
+  size_t mapped_size;
+  char *path;
+
+  /** Copies of the header counters, only updated by the writer */
+  uint64_t data_size;
+  uint64_t record_count;
+  uint64_t index_count;
+
+  /** End of the region already flushed, only used by the flusher */
+  uint64_t flushed_size;
+
+  /** Next segment waiting to be closed by the flusher */
+  struct audit_segment *next_retired;
+} audit_segment;
+
+struct audit_log {
+  audit_log_options options;
+
+  /** Segment written by the appending thread */
+  audit_segment *current;
+  uint64_t next_sequence;
+
+  /** Current segment as seen by the flusher */
+  _Atomic(audit_segment *) active;
+
+  /** Segment allocated by the flusher for the next rotation */
+  _Atomic(audit_segment *) spare;
+
+  _Atomic uint64_t dropped;
+
+  /** Protects the retired segments and the stop request */
+  pthread_mutex_t mutex;
+  pthread_cond_t wake;
+  audit_segment *retired;
+  bool stopping;
+  pthread_t flusher;
+};
+
+static uint64_t align_up(uint64_t value, uint64_t alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+static uint64_t realtime_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void destroy_segment(audit_segment *segment, bool remove) {
+  munmap(segment->header, segment->mapped_size);
+  if (remove) {
+    unlink(segment->path);
+  }
+  free(segment->path);
+  free(segment);
+}
+
+/**
+ * Opens a new segment file named after the current time, retrying with the
+ * next nanosecond when the name is taken
+ */
+static int create_segment_file(const audit_log *log, char **path) {
+  uint64_t name = realtime_ns();
+  size_t path_size = strlen(log->options.directory) + 32;
+  *path = (char *)malloc(path_size);
+  if (*path == NULL) {
+    return -1;
+  }
+
+  for (int attempt = 0; attempt < 16; attempt++, name++) {
+    snprintf(*path, path_size, "%s/%020" PRIu64 AUDIT_LOG_SEGMENT_EXTENSION,
+             log->options.directory, name);
+    int fd = open(*path, O_RDWR | O_CREAT | O_EXCL, 0640);
+    if (fd >= 0 || errno != EEXIST) {
+      return fd;
+    }
+  }
+  return -1;
+}
+
+/**
+ * Creates a segment file of the configured size and maps it in memory
+ */
+static audit_segment *create_segment(const audit_log *log) {
+  size_t segment_size = log->options.segment_size;
+  uint64_t index_capacity = segment_size / AUDIT_LOG_INDEX_INTERVAL + 1;
+  uint64_t index_offset = AUDIT_LOG_HEADER_SIZE;
+  uint64_t data_offset = align_up(
+      index_offset + index_capacity * sizeof(audit_log_index_entry),
+      DATA_ALIGNMENT);
+  if (data_offset >= segment_size) {
+    return NULL;
+  }
+
+  audit_segment *segment = (audit_segment *)calloc(1, sizeof(audit_segment));
+  if (segment == NULL) {
+    return NULL;
+  }
+
+  int fd = create_segment_file(log, &segment->path);
+  if (fd < 0) {
+    free(segment->path);
+    free(segment);
+    return NULL;
+  }
+
+  // Allocate the blocks now, so that appends never fault on a full disk
+  void *data = MAP_FAILED;
+  if (posix_fallocate(fd, 0, (off_t)segment_size) == 0) {
+    data =
+        mmap(NULL, segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (data == MAP_FAILED) {
+    unlink(segment->path);
+    free(segment->path);
+    free(segment);
+    return NULL;
+  }
+
+  segment->mapped_size = segment_size;
+  segment->header = (audit_log_header *)data;
+  segment->index = (audit_log_index_entry *)((uint8_t *)data + index_offset);
+  segment->data = (uint8_t *)data + data_offset;
+
+  audit_log_header *header = segment->header;
+  header->version = AUDIT_LOG_VERSION;
+  header->index_offset = index_offset;
+  header->index_capacity = index_capacity;
+  header->data_offset = data_offset;
+  header->data_capacity = segment_size - data_offset;
+
+  // Written last, so that readers ignore a file being initialized
+  atomic_thread_fence(memory_order_release);
+  header->magic = AUDIT_LOG_MAGIC;
+  return segment;
+}
+
+/**
+ * Writes the records appended since the last flush to disk, with the header
+ * and the index they updated
+ */
+static void flush_segment(audit_segment *segment) {
+  const audit_log_header *header = segment->header;
+  uint64_t data_size =
+      atomic_load_explicit(&header->data_size, memory_order_acquire);
+  if (data_size == segment->flushed_size &&
+      atomic_load_explicit(&header->sealed, memory_order_relaxed) == 0) {
+    return;
+  }
+
+  uint8_t *base = (uint8_t *)segment->header;
+  uint64_t page_size = (uint64_t)sysconf(_SC_PAGESIZE);
+  uint64_t from = (header->data_offset + segment->flushed_size) / page_size *
+                  page_size;
+  uint64_t to = header->data_offset + data_size;
+  msync(base, header->data_offset, MS_SYNC);
+  if (to > from) {
+    msync(base + from, to - from, MS_SYNC);
+  }
+  segment->flushed_size = data_size;
+}
+
+/**
+ * Background thread flushing the current segment periodically, closing the
+ * retired segments and allocating the next segment
+ */
+static void *run_flusher(void *arg) {
+  audit_log *log = (audit_log *)arg;
+
+  pthread_mutex_lock(&log->mutex);
+  while (!log->stopping) {
+    if (log->retired == NULL &&
+        atomic_load_explicit(&log->spare, memory_order_acquire) != NULL) {
+      struct timespec deadline;
+      clock_gettime(CLOCK_REALTIME, &deadline);
+      uint64_t wake_ns = (uint64_t)deadline.tv_nsec +
+                         log->options.flush_interval_ms * 1000000u;
+      deadline.tv_sec += (time_t)(wake_ns / 1000000000u);
+      deadline.tv_nsec = (long)(wake_ns % 1000000000u);
+      pthread_cond_timedwait(&log->wake, &log->mutex, &deadline);
+    }
+    audit_segment *retired = log->retired;
+    log->retired = NULL;
+    pthread_mutex_unlock(&log->mutex);
+
+    // Segments are only unmapped by this thread, after the writer stopped
+    // using them, so the active segment stays mapped while it is flushed
+    flush_segment(atomic_load_explicit(&log->active, memory_order_acquire));
+
+    while (retired != NULL) {
+      audit_segment *next = retired->next_retired;
+      flush_segment(retired);
+      destroy_segment(retired, false);
+      retired = next;
+    }
+
+    if (atomic_load_explicit(&log->spare, memory_order_acquire) == NULL) {
+      audit_segment *spare = create_segment(log);
+      atomic_store_explicit(&log->spare, spare, memory_order_release);
+      if (spare == NULL) {
+        // Retried in a second, the writer creates the segments it needs
+        // meanwhile
+        pthread_mutex_lock(&log->mutex);
+        if (!log->stopping) {
+          struct timespec deadline;
+          clock_gettime(CLOCK_REALTIME, &deadline);
+          deadline.tv_sec += 1;
+          pthread_cond_timedwait(&log->wake, &log->mutex, &deadline);
+        }
+        continue;
+      }
+    }
+    pthread_mutex_lock(&log->mutex);
+  }
+  pthread_mutex_unlock(&log->mutex);
+  return NULL;
+}
+
+audit_log *audit_log_open(const audit_log_options *options) {
+  if (options->directory == NULL || options->flush_interval_ms == 0) {
+    return NULL;
+  }
+
+  audit_log *log = (audit_log *)calloc(1, sizeof(audit_log));
+  if (log == NULL) {
+    return NULL;
+  }
+  log->options = *options;
+
+  log->current = create_segment(log);
+  if (log->current == NULL) {
+    free(log);
+    return NULL;
+  }
+  atomic_store_explicit(&log->active, log->current, memory_order_relaxed);
+  atomic_store_explicit(&log->spare, NULL, memory_order_relaxed);
+  atomic_store_explicit(&log->dropped, 0, memory_order_relaxed);
+
+  pthread_mutex_init(&log->mutex, NULL);
+  pthread_cond_init(&log->wake, NULL);
+  if (pthread_create(&log->flusher, NULL, run_flusher, log) != 0) {
+    pthread_cond_destroy(&log->wake);
+    pthread_mutex_destroy(&log->mutex);
+    destroy_segment(log->current, true);
+    free(log);
+    return NULL;
+  }
+  return log;
+}
+
+static void seal_segment(audit_segment *segment) {
+  atomic_store_explicit(&segment->header->sealed, 1, memory_order_release);
+}
+
+/**
+ * Replaces the current segment by the spare one, or by a segment created
+ * right away when the flusher did not allocate it yet
+ */
+static error_code rotate_segment(audit_log *log) {
+  audit_segment *next =
+      atomic_exchange_explicit(&log->spare, NULL, memory_order_acq_rel);
+  if (next == NULL) {
+    next = create_segment(log);
+    if (next == NULL) {
+      return ERROR_UNKNOWN;
+    }
+  }
+
+  audit_segment *previous = log->current;
+  log->current = next;
+  atomic_store_explicit(&log->active, next, memory_order_release);
+  seal_segment(previous);
+
+  pthread_mutex_lock(&log->mutex);
+  previous->next_retired = log->retired;
+  log->retired = previous;
+  pthread_cond_signal(&log->wake);
+  pthread_mutex_unlock(&log->mutex);
+  return SUCCESS;
+}
+
+static uint64_t record_size(const audit_record *record) {
+  return align_up(sizeof(audit_log_record_head) + record->topic_length +
+                      record->payload_size + record->signature_size,
+                  RECORD_ALIGNMENT);
+}
+
+/**
+ * Adds the record about to be written at the current size to the index,
+ * starting a new block every AUDIT_LOG_INDEX_INTERVAL bytes
+ */
+static void index_record(audit_segment *segment, uint64_t time_ns,
+                         uint64_t sequence) {
+  audit_log_index_entry *entry =
+      segment->index_count > 0 ? &segment->index[segment->index_count - 1]
+                               : NULL;
+  if (entry == NULL ||
+      segment->data_size - entry->offset >= AUDIT_LOG_INDEX_INTERVAL) {
+    entry = &segment->index[segment->index_count++];
+    entry->offset = segment->data_size;
+    entry->first_sequence = sequence;
+    atomic_store_explicit(&entry->min_time_ns, time_ns, memory_order_relaxed);
+    atomic_store_explicit(&entry->max_time_ns, time_ns, memory_order_relaxed);
+    atomic_store_explicit(&segment->header->index_count, segment->index_count,
+                          memory_order_release);
+    return;
+  }
+
+  if (time_ns <
+      atomic_load_explicit(&entry->min_time_ns, memory_order_relaxed)) {
+    atomic_store_explicit(&entry->min_time_ns, time_ns, memory_order_relaxed);
+  }
+  if (time_ns >
+      atomic_load_explicit(&entry->max_time_ns, memory_order_relaxed)) {
+    atomic_store_explicit(&entry->max_time_ns, time_ns, memory_order_relaxed);
+  }
+}
+
+error_code audit_log_append(audit_log *log, const audit_record *record) {
+  uint64_t size = record_size(record);
+  if (size > log->current->header->data_capacity ||
+      record->topic_length > UINT32_MAX || record->payload_size > UINT32_MAX ||
+      record->signature_size > UINT32_MAX) {
+    atomic_fetch_add_explicit(&log->dropped, 1, memory_order_relaxed);
+    return ERROR_INVALID_ARGUMENT;
+  }
+
+  audit_segment *segment = log->current;
+  uint64_t duration_ns = log->options.segment_duration_ms * 1000000u;
+  if (segment->record_count > 0 &&
+      (segment->header->data_capacity - segment->data_size < size ||
+       (duration_ns > 0 &&
+        record->time_ns >= segment->header->start_time_ns + duration_ns))) {
+    if (rotate_segment(log) != SUCCESS) {
+      atomic_fetch_add_explicit(&log->dropped, 1, memory_order_relaxed);
+      return ERROR_UNKNOWN;
+    }
+    segment = log->current;
+  }
+
+  uint64_t sequence = log->next_sequence++;
+  if (segment->record_count == 0) {
+    segment->header->start_time_ns = record->time_ns;
+    segment->header->first_sequence = sequence;
+  }
+  index_record(segment, record->time_ns, sequence);
+
+  audit_log_record_head head = {
+      .time_ns = record->time_ns,
+      .sequence = sequence,
+      .topic_length = (uint32_t)record->topic_length,
+      .payload_size = (uint32_t)record->payload_size,
+      .signature_size = (uint32_t)record->signature_size,
+  };
+  uint8_t *out = segment->data + segment->data_size;
+  memcpy(out, &head, sizeof(head));
+  out += sizeof(head);
+  if (record->topic_length > 0) {
+    memcpy(out, record->topic, record->topic_length);
+    out += record->topic_length;
+  }
+  if (record->payload_size > 0) {
+    memcpy(out, record->payload, record->payload_size);
+    out += record->payload_size;
+  }
+  if (record->signature_size > 0) {
+    memcpy(out, record->signature, record->signature_size);
+  }
+
+  // Published last, so that readers only see complete records
+  segment->data_size += size;
+  segment->record_count++;
+  atomic_store_explicit(&segment->header->record_count, segment->record_count,
+                        memory_order_relaxed);
+  atomic_store_explicit(&segment->header->data_size, segment->data_size,
+                        memory_order_release);
+  return SUCCESS;
+}
+
+uint64_t audit_log_dropped(const audit_log *log) {
+  return atomic_load_explicit(&log->dropped, memory_order_relaxed);
+}
+
+void audit_log_close(audit_log *log) {
+  if (log == NULL) {
+    return;
+  }
+
+  pthread_mutex_lock(&log->mutex);
+  log->stopping = true;
+  pthread_cond_signal(&log->wake);
+  pthread_mutex_unlock(&log->mutex);
+  pthread_join(log->flusher, NULL);
+
+  while (log->retired != NULL) {
+    audit_segment *next = log->retired->next_retired;
+    flush_segment(log->retired);
+    destroy_segment(log->retired, false);
+    log->retired = next;
+  }
+
+  audit_segment *spare = atomic_load(&log->spare);
+  if (spare != NULL) {
+    destroy_segment(spare, true);
+  }
+
+  seal_segment(log->current);
+  flush_segment(log->current);
+  destroy_segment(log->current, log->current->record_count == 0);
+
+  pthread_cond_destroy(&log->wake);
+  pthread_mutex_destroy(&log->mutex);
+  free(log);
+}
+
+bool audit_log_check(const void *data, size_t size) {
+  const audit_log_header *header = (const audit_log_header *)data;
+
+  if (size < AUDIT_LOG_HEADER_SIZE || header->magic != AUDIT_LOG_MAGIC ||
+      header->version != AUDIT_LOG_VERSION ||
+      header->index_offset < AUDIT_LOG_HEADER_SIZE ||
+      header->index_capacity > size / sizeof(audit_log_index_entry) ||
+      header->data_offset < header->index_offset +
+                                header->index_capacity *
+                                    sizeof(audit_log_index_entry) ||
+      header->data_offset > size) {
+    return false;
+  }
+  return header->data_capacity <= size - header->data_offset;
+}
+
+/**
+ * Reads the record at an offset of the record region
+ *
+ * \returns the size of the record, 0 if it does not fit the written region
+ */
+static uint64_t read_record(const uint8_t *records, uint64_t data_size,
+                            uint64_t offset, audit_record *record) {
+  audit_log_record_head head;
+  if (data_size - offset < sizeof(head)) {
+    return 0;
+  }
+  memcpy(&head, records + offset, sizeof(head));
+
+  record->time_ns = head.time_ns;
+  record->sequence = head.sequence;
+  record->topic_length = head.topic_length;
+  record->payload_size = head.payload_size;
+  record->signature_size = head.signature_size;
+  uint64_t size = record_size(record);
+  if (data_size - offset < size) {
+    return 0;
+  }
+
+  const uint8_t *content = records + offset + sizeof(head);
+  record->topic = (const char *)content;
+  record->payload = content + head.topic_length;
+  record->signature = record->payload + head.payload_size;
+  return size;
+}
+
+size_t audit_log_scan(const void *data, uint64_t from_ns, uint64_t to_ns,
+                      audit_log_callback callback, void *userdata) {
+  const audit_log_header *header = (const audit_log_header *)data;
+  const audit_log_index_entry *index =
+      (const audit_log_index_entry *)((const uint8_t *)data +
+                                      header->index_offset);
+  const uint8_t *records = (const uint8_t *)data + header->data_offset;
+
+  // The index covers at least the records written before the data size
+  uint64_t data_size =
+      atomic_load_explicit(&header->data_size, memory_order_acquire);
+  uint64_t index_count =
+      atomic_load_explicit(&header->index_count, memory_order_acquire);
+  if (data_size > header->data_capacity) {
+    data_size = header->data_capacity;
+  }
+  if (index_count > header->index_capacity) {
+    index_count = header->index_capacity;
+  }
+
+  size_t reported = 0;
+  for (uint64_t i = 0; i < index_count; i++) {
+    const audit_log_index_entry *entry = &index[i];
+    if (atomic_load_explicit(&entry->max_time_ns, memory_order_relaxed) <
+            from_ns ||
+        atomic_load_explicit(&entry->min_time_ns, memory_order_relaxed) >
+            to_ns) {
+      continue;
+    }
+
+    uint64_t end = i + 1 < index_count ? index[i + 1].offset : data_size;
+    if (end > data_size) {
+      end = data_size;
+    }
+    uint64_t offset = entry->offset;
+    while (offset < end) {
+      audit_record record;
+      uint64_t size = read_record(records, data_size, offset, &record);
+      if (size == 0) {
+        break;
+      }
+      if (record.time_ns >= from_ns && record.time_ns <= to_ns) {
+        callback(&record, userdata);
+        reported++;
+      }
+      offset += size;
+    }
+  }
+  return reported;
+}
@@ -0,0 +1,199 @@
+#pragma once
+#include "error.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define AUDIT_LOG_MAGIC 0x4c41534du /* "MSAL" */
+#define AUDIT_LOG_VERSION 1
+
+/** Size reserved for the header at the start of a segment file */
+#define AUDIT_LOG_HEADER_SIZE 256
+
+/** Bytes of records between two entries of the sparse index */
+#define AUDIT_LOG_INDEX_INTERVAL (64 * 1024)
+
+/** Size of the segment files when none is configured */
+#define AUDIT_LOG_DEFAULT_SEGMENT_SIZE (64 * 1024 * 1024)
+
+/** File name extension of the segment files */
+#define AUDIT_LOG_SEGMENT_EXTENSION ".msa"
+
+/**
+ * Header at the start of a segment file. A segment is a header, a sparse
+ * index and a region of records appended one after the other.
+ */
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+
+  /** Offsets in the file and capacities of the index and of the records */
+  uint64_t index_offset;
+  uint64_t index_capacity;
+  uint64_t data_offset;
+  uint64_t data_capacity;
+
+  /** Time and sequence number of the first record, valid once a record has
+   * been written */
+  uint64_t start_time_ns;
+  uint64_t first_sequence;
+
+  /** Bytes of records written so far, a reader never looks past them */
+  _Atomic uint64_t data_size;
+  _Atomic uint64_t record_count;
+  _Atomic uint64_t index_count;
+
+  /** Set once no record will be appended to the segment anymore */
+  _Atomic uint32_t sealed;
+} audit_log_header;
+
+_Static_assert(sizeof(audit_log_header) <= AUDIT_LOG_HEADER_SIZE,
+               "The header must fit its reserved size");
+
+/**
+ * Entry of the sparse index, one every AUDIT_LOG_INDEX_INTERVAL bytes of
+ * records. It covers the records up to the next entry, and keeps their
+ * earliest and latest times so that range scans skip the blocks outside the
+ * range even if the clock went backwards.
+ */
+typedef struct {
+  /** Offset of the first record of the block in the record region */
+  uint64_t offset;
+  uint64_t first_sequence;
+  _Atomic uint64_t min_time_ns;
+  _Atomic uint64_t max_time_ns;
+} audit_log_index_entry;
+
+/**
+ * Head of a record in a segment, followed by the topic, the payload and the
+ * signature, the record being padded to 8 bytes
+ */
+typedef struct {
+  uint64_t time_ns;
+  uint64_t sequence;
+  uint32_t topic_length;
+  uint32_t payload_size;
+  uint32_t signature_size;
+  uint32_t reserved;
+} audit_log_record_head;
+
+/**
+ * Message kept by the audit log
+ */
+typedef struct {
+  /** Ingestion time in nanoseconds since the Unix epoch */
+  uint64_t time_ns;
+
+  /** Position of the message in the log, assigned when appended and
+   * restarting from 0 when the log is opened */
+  uint64_t sequence;
+
+  const char *topic;
+  size_t topic_length;
+
+  /** Payload as delivered to subscribers */
+  const uint8_t *payload;
+  size_t payload_size;
+
+  /** Signature carried next to the payload, empty when the payload carries
+   * it */
+  const uint8_t *signature;
+  size_t signature_size;
+} audit_record;
+
+/**
+ * Options of an audit log
+ */
+typedef struct {
+  /** Directory of the segment files, must outlive the log */
+  const char *directory;
+
+  /** Size in bytes of every segment file */
+  size_t segment_size;
+
+  /** Time in milliseconds after which a segment is replaced by the next one,
+   * 0 to only replace full segments */
+  uint64_t segment_duration_ms;
+
+  /** Interval in milliseconds between two flushes of the written records to
+   * disk */
+  uint64_t flush_interval_ms;
+} audit_log_options;
+
+/**
+ * Opaque struct representing an audit log appending messages to memory
+ * mapped segment files. The files are allocated ahead of time by a
+ * background thread, which also flushes them with msync, so that appending a
+ * message only copies it into the mapped region, without system calls.
+ * Segments can be read while they are written.
+ */
+typedef struct audit_log audit_log;
+
+/**
+ * Opens an audit log, creating its first segment and starting its
+ * background thread
+ *
+ * \param options options of the log
+ * \returns handle to the audit log on success, null otherwise
+ */
+audit_log *audit_log_open(const audit_log_options *options);
+
+/**
+ * Appends a message, moving to the next segment when the current one is
+ * full or too old. Must be called from a single thread.
+ *
+ * \param log handle to the audit log
+ * \param record message to append, its sequence is ignored
+ * \returns ERROR_INVALID_ARGUMENT if the message does not fit a segment,
+ * ERROR_UNKNOWN if the next segment cannot be created, success otherwise
+ */
+error_code audit_log_append(audit_log *log, const audit_record *record);
+
+/**
+ * Returns the number of messages that could not be appended since the log
+ * was opened
+ */
+uint64_t audit_log_dropped(const audit_log *log);
+
+/**
+ * Stops the background thread, flushes and seals the current segment and
+ * closes the log. Segments without any record are removed.
+ *
+ * \param log handle to the audit log, may be null
+ */
+void audit_log_close(audit_log *log);
+
+/**
+ * Checks the header of a mapped segment file
+ *
+ * \param data mapped file
+ * \param size size of the mapped file
+ * \returns true if the file is a segment of this version
+ */
+bool audit_log_check(const void *data, size_t size);
+
+/**
+ * Called for every record found by audit_log_scan, the record points into
+ * the mapped segment
+ *
+ * \param record record found
+ * \param userdata data given to audit_log_scan
+ */
+typedef void (*audit_log_callback)(const audit_record *record,
+                                   void *userdata);
+
+/**
+ * Reports the records of a segment whose time is within a range, in the
+ * order they were appended. Only the blocks of the index that overlap the
+ * range are read.
+ *
+ * \param data mapped segment, checked with audit_log_check
+ * \param from_ns earliest time of the range, included
+ * \param to_ns latest time of the range, included
+ * \param callback function called for every record in the range
+ * \param userdata data given to the callback
+ * \returns the number of records reported
+ */
+size_t audit_log_scan(const void *data, uint64_t from_ns, uint64_t to_ns,
+                      audit_log_callback callback, void *userdata);
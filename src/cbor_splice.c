@@ -0,0 +1,133 @@
+#include "cbor_splice.h"
+#include <cbor.h>
+#include <string.h>
+
+#define CBOR_BREAK 0xff
+
+size_t cbor_splice_head_size(uint64_t value) {
+  if (value < 24) {
+    return 1;
+  } else if (value <= UINT8_MAX) {
+    return 2;
+  } else if (value <= UINT16_MAX) {
+    return 3;
+  } else if (value <= UINT32_MAX) {
+    return 5;
+  }
+  return 9;
+}
+
+size_t cbor_splice_string_size(const char *string) {
+  size_t length = strlen(string);
+  return cbor_splice_head_size(length) + length;
+}
+
+size_t cbor_splice_bytes_size(size_t length) {
+  return cbor_splice_head_size(length) + length;
+}
+
+bool cbor_splice_key_text(cbor_splice_key *key, const char *text) {
+  size_t length = strlen(text);
+  size_t head = cbor_encode_string_start(length, key->data, sizeof(key->data));
+  if (head == 0 || sizeof(key->data) - head < length) {
+    key->size = 0;
+    return false;
+  }
+  memcpy(key->data + head, text, length);
+  key->size = head + length;
+  return true;
+}
+
+void cbor_splice_key_int(cbor_splice_key *key, int64_t value) {
+  if (value < 0) {
+    // Negative integers encode -1 - value
+    key->size = cbor_encode_negint((uint64_t)(-1 - value), key->data,
+                                   sizeof(key->data));
+  } else {
+    key->size = cbor_encode_uint((uint64_t)value, key->data, sizeof(key->data));
+  }
+}
+
+/**
+ * Returns the free space, keeping one byte for the closing break
+ */
+static size_t available(const cbor_splice *splice) {
+  if (splice->overflow || splice->capacity - splice->size < 1) {
+    return 0;
+  }
+  return splice->capacity - splice->size - 1;
+}
+
+static void advance(cbor_splice *splice, size_t written) {
+  if (written == 0) {
+    splice->overflow = true;
+  }
+  splice->size += written;
+}
+
+void cbor_splice_init(cbor_splice *splice, uint8_t *buffer, size_t capacity,
+                      const uint8_t *map, size_t map_size) {
+  splice->buffer = buffer;
+  splice->capacity = capacity;
+  splice->size = 0;
+  splice->overflow = map_size == 0 || capacity < map_size;
+
+  if (!splice->overflow) {
+    // Copy the map without its closing break
+    memcpy(buffer, map, map_size - 1);
+    splice->size = map_size - 1;
+  }
+}
+
+void cbor_splice_put_raw(cbor_splice *splice, const uint8_t *data,
+                         size_t size) {
+  if (available(splice) < size) {
+    splice->overflow = true;
+    return;
+  }
+  memcpy(splice->buffer + splice->size, data, size);
+  splice->size += size;
+}
+
+void cbor_splice_put_string(cbor_splice *splice, const char *string) {
+  size_t length = strlen(string);
+  advance(splice, cbor_encode_string_start(length,
+                                           splice->buffer + splice->size,
+                                           available(splice)));
+  cbor_splice_put_raw(splice, (const uint8_t *)string, length);
+}
+
+void cbor_splice_put_key(cbor_splice *splice, const cbor_splice_key *key) {
+  cbor_splice_put_raw(splice, key->data, key->size);
+}
+
+void cbor_splice_put_uint64(cbor_splice *splice, uint64_t value) {
+  advance(splice, cbor_encode_uint64(value, splice->buffer + splice->size,
+                                     available(splice)));
+}
+
+void cbor_splice_put_bytes(cbor_splice *splice, const uint8_t *data,
+                           size_t length) {
+  advance(splice,
+          cbor_encode_bytestring_start(length, splice->buffer + splice->size,
+                                       available(splice)));
+  cbor_splice_put_raw(splice, data, length);
+}
+
+const uint8_t *cbor_splice_closed_view(cbor_splice *splice, size_t *size) {
+  if (splice->overflow || splice->size >= splice->capacity) {
+    return NULL;
+  }
+
+  splice->buffer[splice->size] = CBOR_BREAK;
+  *size = splice->size + 1;
+  return splice->buffer;
+}
+
+size_t cbor_splice_finish(cbor_splice *splice) {
+  size_t size = 0;
+  if (cbor_splice_closed_view(splice, &size) == NULL) {
+    return 0;
+  }
+  return size;
+}
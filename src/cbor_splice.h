@@ -0,0 +1,137 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Writer that appends encoded pairs to an encoded indefinite length map.
+ * The map is copied into the output buffer without its closing break, pairs
+ * are encoded after it, and the break is written back when the writer is
+ * finished. Writes past the end of the buffer are discarded and reported by
+ * cbor_splice_finish.
+ */
+typedef struct {
+  uint8_t *buffer;
+  size_t capacity;
+
+  /** Number of bytes written so far, the closing break excluded */
+  size_t size;
+
+  /** Set when a write did not fit in the buffer */
+  bool overflow;
+} cbor_splice;
+
+/** Encoded size of a 64 bit unsigned integer written by cbor_splice */
+#define CBOR_SPLICE_UINT64_SIZE 9
+
+/** Maximum encoded size of a map key */
+#define CBOR_SPLICE_MAX_KEY_SIZE 32
+
+/**
+ * Map key encoded once when the plugin is configured, and copied as is into
+ * every message
+ */
+typedef struct {
+  uint8_t data[CBOR_SPLICE_MAX_KEY_SIZE];
+  size_t size;
+} cbor_splice_key;
+
+/**
+ * Size of the head (type and argument) of an encoded CBOR item
+ *
+ * \param value argument of the item (length or value)
+ * \returns size in bytes of the head
+ */
+size_t cbor_splice_head_size(uint64_t value);
+
+/**
+ * Encoded size of a text string
+ *
+ * \param string null terminated text
+ * \returns size in bytes of the encoded string
+ */
+size_t cbor_splice_string_size(const char *string);
+
+/**
+ * Encoded size of a byte string
+ *
+ * \param length length of the byte string
+ * \returns size in bytes of the encoded byte string
+ */
+size_t cbor_splice_bytes_size(size_t length);
+
+/**
+ * Encodes a text string map key
+ *
+ * \param key out key
+ * \param text null terminated text
+ * \returns false if the encoded key is longer than CBOR_SPLICE_MAX_KEY_SIZE
+ */
+bool cbor_splice_key_text(cbor_splice_key *key, const char *text);
+
+/**
+ * Encodes an integer map key
+ *
+ * \param key out key
+ * \param value integer key, negative keys are the compact ones
+ */
+void cbor_splice_key_int(cbor_splice_key *key, int64_t value);
+
+/**
+ * Starts a writer copying an encoded indefinite map without its closing break
+ *
+ * \param splice writer to initialize
+ * \param buffer output buffer
+ * \param capacity size of the output buffer
+ * \param map encoded indefinite map, validated with
+ * cbor_validate_indefinite_map
+ * \param map_size size of the encoded map, its closing break included
+ */
+void cbor_splice_init(cbor_splice *splice, uint8_t *buffer, size_t capacity,
+                      const uint8_t *map, size_t map_size);
+
+/**
+ * Appends already encoded bytes
+ */
+void cbor_splice_put_raw(cbor_splice *splice, const uint8_t *data,
+                         size_t size);
+
+/**
+ * Appends a text string
+ */
+void cbor_splice_put_string(cbor_splice *splice, const char *string);
+
+/**
+ * Appends a map key encoded with cbor_splice_key_text or cbor_splice_key_int
+ */
+void cbor_splice_put_key(cbor_splice *splice, const cbor_splice_key *key);
+
+/**
+ * Appends an unsigned integer, always encoded on 64 bits like the items built
+ * with cbor_build_uint64
+ */
+void cbor_splice_put_uint64(cbor_splice *splice, uint64_t value);
+
+/**
+ * Appends a byte string
+ */
+void cbor_splice_put_bytes(cbor_splice *splice, const uint8_t *data,
+                           size_t length);
+
+/**
+ * Closes the map written so far with a break, without advancing the writer,
+ * so that the bytes can be signed and more pairs can be appended later
+ *
+ * \param splice writer
+ * \param size out size of the closed map
+ * \returns pointer to the closed map, null if the buffer is too small
+ */
+const uint8_t *cbor_splice_closed_view(cbor_splice *splice, size_t *size);
+
+/**
+ * Writes the closing break
+ *
+ * \param splice writer
+ * \returns the size of the encoded map, 0 if the buffer was too small
+ */
+size_t cbor_splice_finish(cbor_splice *splice);
@@ -0,0 +1,374 @@
+#include "cbor_validator.h"
+#include <cbor.h>
+#include <stdbool.h>
+
+#define CBOR_INDEFINITE_MAP_START 0xbf
+#define INDEFINITE UINT64_MAX
+
+const cbor_validator_limits CBOR_VALIDATOR_DEFAULT_LIMITS = {
+    .max_payload_size = 0,
+    .max_depth = CBOR_VALIDATOR_MAX_DEPTH,
+    .max_items = 0,
+};
+
+typedef enum {
+  FRAME_ARRAY,
+  FRAME_MAP,
+  FRAME_TAG,
+  FRAME_BYTE_STRING,
+  FRAME_STRING
+} frame_kind;
+
+typedef struct {
+  frame_kind kind;
+
+  /** Items left to close the frame, INDEFINITE if closed by a break */
+  uint64_t remaining;
+
+  /** Number of items read so far in an indefinite map, used for parity */
+  uint64_t count;
+} frame;
+
+typedef struct {
+  frame stack[CBOR_VALIDATOR_MAX_DEPTH];
+  size_t depth;
+  size_t max_depth;
+  size_t items;
+  size_t max_items;
+  bool done;
+  cbor_validation_result result;
+} walk_state;
+
+static void fail(walk_state *state, cbor_validation_result result) {
+  if (state->result == CBOR_VALIDATION_OK) {
+    state->result = result;
+  }
+}
+
+/**
+ * Accounts a completed item in the enclosing frame, closing every definite
+ * frame that reaches its item count
+ */
+static void item_done(walk_state *state) {
+  while (state->depth > 0) {
+    frame *top = &state->stack[state->depth - 1];
+
+    if (top->kind == FRAME_BYTE_STRING || top->kind == FRAME_STRING) {
+      // Chunks of an indefinite string must be definite strings of the same
+      // type, they are checked by the chunk callbacks
+      return;
+    }
+
+    if (top->remaining == INDEFINITE) {
+      top->count++;
+      return;
+    }
+
+    if (--top->remaining > 0) {
+      return;
+    }
+
+    state->depth--;
+  }
+
+  state->done = true;
+}
+
+/**
+ * Accounts a new data item, checking the item count limit
+ */
+static bool count_item(walk_state *state) {
+  state->items++;
+  if (state->max_items != 0 && state->items > state->max_items) {
+    fail(state, CBOR_VALIDATION_TOO_MANY_ITEMS);
+    return false;
+  }
+  return true;
+}
+
+static void push(walk_state *state, frame_kind kind, uint64_t remaining) {
+  if (state->depth == state->max_depth) {
+    fail(state, CBOR_VALIDATION_TOO_DEEP);
+    return;
+  }
+
+  state->stack[state->depth++] =
+      (frame){.kind = kind, .remaining = remaining, .count = 0};
+}
+
+static bool in_indefinite_string(walk_state *state) {
+  if (state->depth == 0) {
+    return false;
+  }
+
+  frame_kind kind = state->stack[state->depth - 1].kind;
+  return kind == FRAME_BYTE_STRING || kind == FRAME_STRING;
+}
+
+static void on_item(void *context) {
+  walk_state *state = (walk_state *)context;
+  if (in_indefinite_string(state)) {
+    fail(state, CBOR_VALIDATION_MALFORMED);
+    return;
+  }
+  if (count_item(state)) {
+    item_done(state);
+  }
+}
+
+static void on_uint8(void *context, uint8_t value) { on_item(context); }
+static void on_uint16(void *context, uint16_t value) { on_item(context); }
+static void on_uint32(void *context, uint32_t value) { on_item(context); }
+static void on_uint64(void *context, uint64_t value) { on_item(context); }
+static void on_float(void *context, float value) { on_item(context); }
+static void on_double(void *context, double value) { on_item(context); }
+static void on_boolean(void *context, bool value) { on_item(context); }
+
+static void on_chunk(walk_state *state, frame_kind kind) {
+  if (state->depth > 0) {
+    frame_kind top = state->stack[state->depth - 1].kind;
+    if ((top == FRAME_BYTE_STRING || top == FRAME_STRING) && top != kind) {
+      fail(state, CBOR_VALIDATION_MALFORMED);
+      return;
+    }
+  }
+  if (count_item(state)) {
+    item_done(state);
+  }
+}
+
+static void on_byte_string(void *context, cbor_data data, uint64_t length) {
+  on_chunk((walk_state *)context, FRAME_BYTE_STRING);
+}
+
+static void on_string(void *context, cbor_data data, uint64_t length) {
+  on_chunk((walk_state *)context, FRAME_STRING);
+}
+
+static void on_indefinite_start(walk_state *state, frame_kind kind) {
+  if (in_indefinite_string(state)) {
+    fail(state, CBOR_VALIDATION_MALFORMED);
+    return;
+  }
+  if (count_item(state)) {
+    push(state, kind, INDEFINITE);
+  }
+}
+
+static void on_byte_string_start(void *context) {
+  on_indefinite_start((walk_state *)context, FRAME_BYTE_STRING);
+}
+
+static void on_string_start(void *context) {
+  on_indefinite_start((walk_state *)context, FRAME_STRING);
+}
+
+static void on_indef_array_start(void *context) {
+  on_indefinite_start((walk_state *)context, FRAME_ARRAY);
+}
+
+static void on_indef_map_start(void *context) {
+  on_indefinite_start((walk_state *)context, FRAME_MAP);
+}
+
+static void on_collection_start(walk_state *state, frame_kind kind,
+                                uint64_t items) {
+  if (in_indefinite_string(state)) {
+    fail(state, CBOR_VALIDATION_MALFORMED);
+    return;
+  }
+
+  if (!count_item(state)) {
+    return;
+  }
+
+  if (items == 0) {
+    item_done(state);
+    return;
+  }
+
+  push(state, kind, items);
+}
+
+static void on_array_start(void *context, uint64_t size) {
+  on_collection_start((walk_state *)context, FRAME_ARRAY, size);
+}
+
+static void on_map_start(void *context, uint64_t size) {
+  if (size > INDEFINITE / 2) {
+    fail((walk_state *)context, CBOR_VALIDATION_MALFORMED);
+    return;
+  }
+  on_collection_start((walk_state *)context, FRAME_MAP, size * 2);
+}
+
+static void on_tag(void *context, uint64_t value) {
+  on_collection_start((walk_state *)context, FRAME_TAG, 1);
+}
+
+static void on_indef_break(void *context) {
+  walk_state *state = (walk_state *)context;
+
+  if (state->depth == 0) {
+    fail(state, CBOR_VALIDATION_MALFORMED);
+    return;
+  }
+
+  frame *top = &state->stack[state->depth - 1];
+  if (top->remaining != INDEFINITE ||
+      (top->kind == FRAME_MAP && top->count % 2 != 0)) {
+    fail(state, CBOR_VALIDATION_MALFORMED);
+    return;
+  }
+
+  state->depth--;
+  item_done(state);
+}
+
+static const struct cbor_callbacks VALIDATOR_CALLBACKS = {
+    .uint8 = on_uint8,
+    .uint16 = on_uint16,
+    .uint32 = on_uint32,
+    .uint64 = on_uint64,
+    .negint64 = on_uint64,
+    .negint32 = on_uint32,
+    .negint16 = on_uint16,
+    .negint8 = on_uint8,
+    .byte_string_start = on_byte_string_start,
+    .byte_string = on_byte_string,
+    .string = on_string,
+    .string_start = on_string_start,
+    .indef_array_start = on_indef_array_start,
+    .array_start = on_array_start,
+    .indef_map_start = on_indef_map_start,
+    .map_start = on_map_start,
+    .tag = on_tag,
+    .float2 = on_float,
+    .float4 = on_float,
+    .float8 = on_double,
+    .undefined = on_item,
+    .null = on_item,
+    .boolean = on_boolean,
+    .indef_break = on_indef_break,
+};
+
+/**
+ * Walks the first item of the payload
+ *
+ * \param item_size out size of the item, set when the walk succeeds
+ */
+static cbor_validation_result walk_item(const uint8_t *payload,
+                                        size_t payload_size,
+                                        const cbor_validator_limits *limits,
+                                        size_t *item_size) {
+  walk_state state = {
+      .depth = 0,
+      .max_depth = limits->max_depth < CBOR_VALIDATOR_MAX_DEPTH
+                       ? limits->max_depth
+                       : CBOR_VALIDATOR_MAX_DEPTH,
+      .items = 0,
+      .max_items = limits->max_items,
+      .done = false,
+      .result = CBOR_VALIDATION_OK,
+  };
+  size_t offset = 0;
+
+  while (!state.done) {
+    if (offset == payload_size) {
+      return CBOR_VALIDATION_MALFORMED;
+    }
+
+    struct cbor_decoder_result decode_result =
+        cbor_stream_decode(payload + offset, payload_size - offset,
+                           &VALIDATOR_CALLBACKS, &state);
+
+    if (state.result != CBOR_VALIDATION_OK) {
+      return state.result;
+    }
+
+    if (decode_result.status != CBOR_DECODER_FINISHED) {
+      return CBOR_VALIDATION_MALFORMED;
+    }
+
+    offset += decode_result.read;
+  }
+
+  *item_size = offset;
+  return CBOR_VALIDATION_OK;
+}
+
+cbor_validation_result
+cbor_validate_indefinite_map(const uint8_t *payload, size_t payload_size,
+                             const cbor_validator_limits *limits) {
+  if (limits == NULL) {
+    limits = &CBOR_VALIDATOR_DEFAULT_LIMITS;
+  }
+
+  if (payload == NULL || payload_size == 0) {
+    return CBOR_VALIDATION_MALFORMED;
+  }
+
+  if (limits->max_payload_size != 0 &&
+      payload_size > limits->max_payload_size) {
+    return CBOR_VALIDATION_TOO_LARGE;
+  }
+
+  if (payload[0] != CBOR_INDEFINITE_MAP_START) {
+    return CBOR_VALIDATION_NOT_INDEFINITE_MAP;
+  }
+
+  size_t item_size = 0;
+  cbor_validation_result result =
+      walk_item(payload, payload_size, limits, &item_size);
+  if (result != CBOR_VALIDATION_OK) {
+    return result;
+  }
+
+  if (item_size != payload_size) {
+    return CBOR_VALIDATION_TRAILING_DATA;
+  }
+
+  return CBOR_VALIDATION_OK;
+}
+
+cbor_validation_result cbor_validate_item(const uint8_t *data,
+                                          size_t data_size,
+                                          const cbor_validator_limits *limits,
+                                          size_t *item_size) {
+  if (limits == NULL) {
+    limits = &CBOR_VALIDATOR_DEFAULT_LIMITS;
+  }
+
+  if (data == NULL || data_size == 0) {
+    return CBOR_VALIDATION_MALFORMED;
+  }
+
+  cbor_validation_result result =
+      walk_item(data, data_size, limits, item_size);
+  if (result == CBOR_VALIDATION_OK && limits->max_payload_size != 0 &&
+      *item_size > limits->max_payload_size) {
+    return CBOR_VALIDATION_TOO_LARGE;
+  }
+  return result;
+}
+
+const char *cbor_validation_result_to_string(cbor_validation_result result) {
+  switch (result) {
+  case CBOR_VALIDATION_OK:
+    return "valid";
+  case CBOR_VALIDATION_MALFORMED:
+    return "malformed CBOR data";
+  case CBOR_VALIDATION_NOT_INDEFINITE_MAP:
+    return "CBOR item is not an indefinite map";
+  case CBOR_VALIDATION_TOO_DEEP:
+    return "CBOR item nesting is too deep";
+  case CBOR_VALIDATION_TOO_LARGE:
+    return "CBOR payload is too large";
+  case CBOR_VALIDATION_TOO_MANY_ITEMS:
+    return "CBOR payload has too many items";
+  case CBOR_VALIDATION_TRAILING_DATA:
+    return "trailing data after CBOR item";
+  default:
+    return "unknown";
+  }
+}
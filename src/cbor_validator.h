@@ -0,0 +1,80 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+/** Maximum nesting depth the validator is able to track */
+#define CBOR_VALIDATOR_MAX_DEPTH 64
+
+/**
+ * Limits enforced on validated payloads
+ */
+typedef struct {
+  /** Maximum size of the payload in bytes, 0 for no limit */
+  size_t max_payload_size;
+
+  /** Maximum nesting depth, capped to CBOR_VALIDATOR_MAX_DEPTH */
+  size_t max_depth;
+
+  /** Maximum number of data items in the payload, 0 for no limit */
+  size_t max_items;
+} cbor_validator_limits;
+
+/** Limits used when none are configured */
+extern const cbor_validator_limits CBOR_VALIDATOR_DEFAULT_LIMITS;
+
+/**
+ * Outcome of the validation of a CBOR payload
+ */
+typedef enum {
+  CBOR_VALIDATION_OK = 0,
+  /** The payload is empty, truncated or not well-formed CBOR */
+  CBOR_VALIDATION_MALFORMED,
+  /** The top level item is not an indefinite length map */
+  CBOR_VALIDATION_NOT_INDEFINITE_MAP,
+  /** Nested items exceed the maximum depth */
+  CBOR_VALIDATION_TOO_DEEP,
+  /** The payload is bigger than the maximum size */
+  CBOR_VALIDATION_TOO_LARGE,
+  /** The payload contains more data items than the maximum */
+  CBOR_VALIDATION_TOO_MANY_ITEMS,
+  /** Bytes are left after the end of the top level item */
+  CBOR_VALIDATION_TRAILING_DATA
+} cbor_validation_result;
+
+/**
+ * Checks that the payload contains exactly one well-formed CBOR item and that
+ * this item is an indefinite length map within the given limits. The payload
+ * is walked with the libcbor streaming decoder, so no memory is allocated and
+ * the walk stops as soon as a limit is exceeded.
+ *
+ * \param payload encoded CBOR data
+ * \param payload_size size of the payload in bytes
+ * \param limits limits to enforce, NULL to use CBOR_VALIDATOR_DEFAULT_LIMITS
+ * \returns CBOR_VALIDATION_OK if the payload is valid, the reason otherwise
+ */
+cbor_validation_result
+cbor_validate_indefinite_map(const uint8_t *payload, size_t payload_size,
+                             const cbor_validator_limits *limits);
+
+/**
+ * Checks that the data starts with a well-formed CBOR item of any type within
+ * the given limits, and returns its size. Used to split CBOR sequences.
+ *
+ * \param data encoded CBOR data, possibly followed by more items
+ * \param data_size size of the data in bytes
+ * \param limits limits to enforce, NULL to use CBOR_VALIDATOR_DEFAULT_LIMITS
+ * \param item_size out size of the first item, set when it is valid
+ * \returns CBOR_VALIDATION_OK if the first item is valid, the reason otherwise
+ */
+cbor_validation_result cbor_validate_item(const uint8_t *data,
+                                          size_t data_size,
+                                          const cbor_validator_limits *limits,
+                                          size_t *item_size);
+
+/**
+ * Returns a human readable description of a validation result
+ *
+ * \param result validation result
+ * \returns static string describing the result
+ */
+const char *cbor_validation_result_to_string(cbor_validation_result result);
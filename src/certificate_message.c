@@ -0,0 +1,199 @@
+#include "certificate_message.h"
+#include "cbor_splice.h"
+#include <sodium.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define CBOR_UINT_MAJOR_TYPE 0
+#define CBOR_BYTES_MAJOR_TYPE 2
+#define CBOR_TEXT_MAJOR_TYPE 3
+#define CBOR_INDEFINITE_MAP_START 0xbf
+#define CBOR_BREAK 0xff
+
+/** Longest algorithm name accepted when decoding */
+#define MAX_ALGORITHM_NAME_LENGTH 31
+
+static const char *ENTITY_KEY = "entity";
+static const char *CREATE_TIME_KEY = "create_time";
+static const char *PUBLIC_KEY_KEY = "public_key";
+static const char *KEY_ID_KEY = "key_id";
+static const char *ALGORITHM_KEY = "algorithm";
+
+static const char *algorithm_name(const certificate *cert) {
+  return cert->algorithm != NULL
+             ? cert->algorithm
+             : signing_algorithm_name(SIGNING_ALGORITHM_ED25519);
+}
+
+size_t certificate_message_size(const certificate *cert) {
+  return 2 + cbor_splice_string_size(ENTITY_KEY) +
+         cbor_splice_string_size(cert->entity) +
+         cbor_splice_string_size(CREATE_TIME_KEY) + CBOR_SPLICE_UINT64_SIZE +
+         cbor_splice_string_size(PUBLIC_KEY_KEY) +
+         cbor_splice_bytes_size(SIGNING_KEY_PUBLIC_BYTES) +
+         cbor_splice_string_size(KEY_ID_KEY) +
+         cbor_splice_bytes_size(SIGNING_KEY_ID_BYTES) +
+         cbor_splice_string_size(ALGORITHM_KEY) +
+         cbor_splice_string_size(algorithm_name(cert));
+}
+
+error_code certificate_message_encode(const certificate *cert, uint8_t *out,
+                                      size_t capacity) {
+  static const uint8_t EMPTY_MAP[] = {CBOR_INDEFINITE_MAP_START, CBOR_BREAK};
+
+  signing_algorithm algorithm = SIGNING_ALGORITHM_ED25519;
+  if (!signing_algorithm_parse(algorithm_name(cert), &algorithm)) {
+    return ERROR_INVALID_ARGUMENT;
+  }
+
+  uint8_t public_key[SIGNING_KEY_PUBLIC_BYTES];
+  size_t public_key_size = 0;
+  if (sodium_hex2bin(public_key, sizeof(public_key), cert->public_key,
+                     strlen(cert->public_key), NULL, &public_key_size,
+                     NULL) != 0 ||
+      public_key_size != sizeof(public_key)) {
+    return ERROR_INVALID_ARGUMENT;
+  }
+  uint8_t key_id[SIGNING_KEY_ID_BYTES];
+  signing_key_compute_id(public_key, key_id);
+
+  cbor_splice splice;
+  cbor_splice_init(&splice, out, capacity, EMPTY_MAP, sizeof(EMPTY_MAP));
+  cbor_splice_put_string(&splice, ENTITY_KEY);
+  cbor_splice_put_string(&splice, cert->entity);
+  cbor_splice_put_string(&splice, CREATE_TIME_KEY);
+  cbor_splice_put_uint64(&splice, cert->create_time_unix);
+  cbor_splice_put_string(&splice, PUBLIC_KEY_KEY);
+  cbor_splice_put_bytes(&splice, public_key, sizeof(public_key));
+  cbor_splice_put_string(&splice, KEY_ID_KEY);
+  cbor_splice_put_bytes(&splice, key_id, sizeof(key_id));
+  cbor_splice_put_string(&splice, ALGORITHM_KEY);
+  cbor_splice_put_string(&splice, algorithm_name(cert));
+
+  return cbor_splice_finish(&splice) != 0 ? SUCCESS : ERROR_NO_MEMORY;
+}
+
+/**
+ * Reads the head of an item of a major type and moves past it
+ *
+ * \returns false if the data at position is not a complete head of the type
+ */
+static bool read_head(const uint8_t *data, size_t size, size_t *position,
+                      uint8_t major, uint64_t *value) {
+  size_t at = *position;
+  if (at >= size || data[at] >> 5 != major) {
+    return false;
+  }
+
+  uint8_t info = data[at++] & 0x1f;
+  *value = info;
+  if (info >= 24) {
+    if (info > 27) {
+      return false;
+    }
+    size_t length_size = (size_t)1 << (info - 24);
+    if (size - at < length_size) {
+      return false;
+    }
+    *value = 0;
+    for (size_t i = 0; i < length_size; i++) {
+      *value = (*value << 8) | data[at++];
+    }
+  }
+  *position = at;
+  return true;
+}
+
+/**
+ * Reads a text or byte string and moves past it
+ */
+static bool read_string(const uint8_t *data, size_t size, size_t *position,
+                        uint8_t major, const uint8_t **content,
+                        size_t *length) {
+  uint64_t string_length = 0;
+  if (!read_head(data, size, position, major, &string_length) ||
+      size - *position < string_length) {
+    return false;
+  }
+  *content = data + *position;
+  *length = (size_t)string_length;
+  *position += (size_t)string_length;
+  return true;
+}
+
+static bool read_key(const uint8_t *data, size_t size, size_t *position,
+                     const char *key) {
+  const uint8_t *text = NULL;
+  size_t length = 0;
+  return read_string(data, size, position, CBOR_TEXT_MAJOR_TYPE, &text,
+                     &length) &&
+         length == strlen(key) && memcmp(text, key, length) == 0;
+}
+
+static bool read_fixed_bytes(const uint8_t *data, size_t size,
+                             size_t *position, uint8_t *out,
+                             size_t expected_length) {
+  const uint8_t *bytes = NULL;
+  size_t length = 0;
+  if (!read_string(data, size, position, CBOR_BYTES_MAJOR_TYPE, &bytes,
+                   &length) ||
+      length != expected_length) {
+    return false;
+  }
+  memcpy(out, bytes, length);
+  return true;
+}
+
+static bool read_algorithm(const uint8_t *data, size_t size, size_t *position,
+                           signing_algorithm *algorithm) {
+  const uint8_t *text = NULL;
+  size_t length = 0;
+  if (!read_string(data, size, position, CBOR_TEXT_MAJOR_TYPE, &text,
+                   &length) ||
+      length > MAX_ALGORITHM_NAME_LENGTH) {
+    return false;
+  }
+
+  char name[MAX_ALGORITHM_NAME_LENGTH + 1];
+  memcpy(name, text, length);
+  name[length] = '\0';
+  return signing_algorithm_parse(name, algorithm);
+}
+
+error_code certificate_message_decode(const uint8_t *data, size_t size,
+                                      certificate_message *message) {
+  size_t position = 0;
+  if (size == 0 || data[position++] != CBOR_INDEFINITE_MAP_START) {
+    return ERROR_INVALID_ARGUMENT;
+  }
+
+  const uint8_t *entity = NULL;
+  if (!read_key(data, size, &position, ENTITY_KEY) ||
+      !read_string(data, size, &position, CBOR_TEXT_MAJOR_TYPE, &entity,
+                   &message->entity_length) ||
+      !read_key(data, size, &position, CREATE_TIME_KEY) ||
+      !read_head(data, size, &position, CBOR_UINT_MAJOR_TYPE,
+                 &message->create_time_unix) ||
+      !read_key(data, size, &position, PUBLIC_KEY_KEY) ||
+      !read_fixed_bytes(data, size, &position, message->public_key,
+                        SIGNING_KEY_PUBLIC_BYTES) ||
+      !read_key(data, size, &position, KEY_ID_KEY) ||
+      !read_fixed_bytes(data, size, &position, message->key_id,
+                        SIGNING_KEY_ID_BYTES) ||
+      !read_key(data, size, &position, ALGORITHM_KEY) ||
+      !read_algorithm(data, size, &position, &message->algorithm)) {
+    return ERROR_INVALID_ARGUMENT;
+  }
+  if (position != size - 1 || data[position] != CBOR_BREAK) {
+    return ERROR_INVALID_ARGUMENT;
+  }
+  message->entity = (const char *)entity;
+
+  // A key id that does not name the public key would hide another key
+  uint8_t key_id[SIGNING_KEY_ID_BYTES];
+  signing_key_compute_id(message->public_key, key_id);
+  if (memcmp(key_id, message->key_id, sizeof(key_id)) != 0) {
+    return ERROR_INVALID_ARGUMENT;
+  }
+  return SUCCESS;
+}
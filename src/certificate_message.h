@@ -0,0 +1,63 @@
+#pragma once
+#include "certificate_repository.h"
+#include "error.h"
+#include "signing_context.h"
+#include "signing_key.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Certificate published as a retained MQTT message, so that verifiers can
+ * learn the public keys from the broker instead of the database. The payload
+ * is an indefinite length CBOR map whose pairs are, in this order:
+ *
+ * - "entity": text, who generated the certificate
+ * - "create_time": unsigned integer on 64 bits, Unix seconds
+ * - "public_key": byte string of SIGNING_KEY_PUBLIC_BYTES bytes
+ * - "key_id": byte string of SIGNING_KEY_ID_BYTES bytes
+ * - "algorithm": text, see signing_algorithm_name
+ */
+typedef struct {
+  /** Entity, not null terminated, pointing into the decoded message */
+  const char *entity;
+  size_t entity_length;
+
+  uint64_t create_time_unix;
+  uint8_t public_key[SIGNING_KEY_PUBLIC_BYTES];
+  uint8_t key_id[SIGNING_KEY_ID_BYTES];
+  signing_algorithm algorithm;
+} certificate_message;
+
+/**
+ * Size of the encoded message of a certificate
+ *
+ * \param cert certificate
+ * \returns the size in bytes of the message
+ */
+size_t certificate_message_size(const certificate *cert);
+
+/**
+ * Encodes the message of a certificate
+ *
+ * \param cert certificate, with a hex encoded public key
+ * \param out output buffer of certificate_message_size bytes
+ * \param capacity size of the output buffer
+ * \returns ERROR_INVALID_ARGUMENT if the public key is not hex encoded or the
+ * algorithm is unknown, ERROR_NO_MEMORY if the buffer is too small, success
+ * otherwise
+ */
+error_code certificate_message_encode(const certificate *cert, uint8_t *out,
+                                      size_t capacity);
+
+/**
+ * Decodes a message written by certificate_message_encode
+ *
+ * \param data encoded message
+ * \param size size of the message
+ * \param message out decoded certificate, pointing into the data
+ * \returns ERROR_INVALID_ARGUMENT if the message is malformed, an algorithm
+ * is unknown or the key id is not the one of the public key, success
+ * otherwise
+ */
+error_code certificate_message_decode(const uint8_t *data, size_t size,
+                                      certificate_message *message);
@@ -1,98 +1,913 @@
 #include "certificate_repository.h"
 #include "mosquitto.h"
 #include "mosquitto_broker.h"
-#include "utils.h"
+#include "signing_context.h"
+#include "signing_key.h"
 #include <assert.h>
+#include <endian.h>
+#include <poll.h>
 #include <postgresql/libpq-fe.h>
+#include <sodium.h>
+#include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
-static const char *QUERY_CREATE_TABLE =
-    "CREATE TABLE IF NOT EXISTS \"entity_certificates\" ( \
-                entity      text                                    not null, \
-                create_time timestamp with time zone                not null, \
-                public_key  text                                    not null  \
-            );";
+// Creates the table or migrates it to the current schema in a single
+// statement. The catalog is checked first, so that a table already up to date
+// is neither altered nor updated on every connection:
+// - tables created before key ids get the column, filled by the database, the
+//   key id being the start of the SHA-256 hash of the public key (see
+//   signing_key_compute_id), which is also done for the certificates stored
+//   without key id by older brokers
+// - certificates stored before the algorithm was recorded are ED25519 keys
+// - the unique index makes the inserts idempotent, certificates of the outbox
+//   may be sent again after a crash
+static const char *QUERY_MIGRATE =
+    "DO $$ BEGIN "
+    "IF to_regclass('entity_certificates') IS NULL THEN "
+    "  CREATE TABLE IF NOT EXISTS \"entity_certificates\" ("
+    "    entity      text                     not null,"
+    "    create_time timestamp with time zone not null,"
+    "    public_key  text                     not null,"
+    "    key_id      bytea,"
+    "    algorithm   text not null default 'ed25519'"
+    "  ); "
+    "END IF; "
+    "IF NOT EXISTS (SELECT FROM pg_attribute "
+    "    WHERE attrelid = 'entity_certificates'::regclass "
+    "    AND attname = 'key_id' AND NOT attisdropped) THEN "
+    "  ALTER TABLE \"entity_certificates\" "
+    "  ADD COLUMN IF NOT EXISTS key_id bytea; "
+    "END IF; "
+    "IF NOT EXISTS (SELECT FROM pg_attribute "
+    "    WHERE attrelid = 'entity_certificates'::regclass "
+    "    AND attname = 'algorithm' AND NOT attisdropped) THEN "
+    "  ALTER TABLE \"entity_certificates\" ADD COLUMN IF NOT EXISTS "
+    "  algorithm text NOT NULL DEFAULT 'ed25519'; "
+    "END IF; "
+    "IF to_regclass('entity_certificates_public_key') IS NULL THEN "
+    "  CREATE UNIQUE INDEX IF NOT EXISTS \"entity_certificates_public_key\" "
+    "  ON \"entity_certificates\" (public_key); "
+    "END IF; "
+    "IF to_regclass('entity_certificates_key_id') IS NULL THEN "
+    "  CREATE INDEX IF NOT EXISTS \"entity_certificates_key_id\" "
+    "  ON \"entity_certificates\" (key_id); "
+    "END IF; "
+    // Looked up with the key id index
+    "IF EXISTS (SELECT FROM \"entity_certificates\" "
+    "    WHERE key_id IS NULL AND public_key ~ '^[0-9a-fA-F]{64}$') THEN "
+    "  UPDATE \"entity_certificates\" "
+    "  SET key_id = substring(sha256(decode(public_key, 'hex')) FROM 1 FOR 8) "
+    "  WHERE key_id IS NULL AND public_key ~ '^[0-9a-fA-F]{64}$'; "
+    "END IF; "
+    "END $$";
 
 static const char *QUERY_INSERT_CERTIFICATE =
-    "INSERT INTO \"entity_certificates\" (entity, create_time, public_key) "
-    "VALUES ($1, $2, $3)";
+    "INSERT INTO \"entity_certificates\" "
+    "(entity, create_time, public_key, key_id, algorithm) "
+    "VALUES ($1, $2, $3, $4, $5) ON CONFLICT DO NOTHING";
+
+static const char *STATEMENT_INSERT_CERTIFICATE = "insert_certificate";
+
+static const char *QUERY_SELECT_CERTIFICATES =
+    "SELECT entity, extract(epoch FROM create_time)::bigint, public_key, "
+    "algorithm FROM \"entity_certificates\" "
+    "WHERE $1::text IS NULL OR entity = $1 "
+    "ORDER BY create_time";
+
+static const char *QUERY_SELECT_CERTIFICATES_BY_KEY_ID =
+    "SELECT entity, extract(epoch FROM create_time)::bigint, public_key, "
+    "algorithm FROM \"entity_certificates\" WHERE key_id = $1";
+
+static const char *STATEMENT_SELECT_BY_KEY_ID = "select_by_key_id";
+
+/** Type OIDs of the insert parameters, from pg_type */
+#define BYTEAOID 17
+#define TEXTOID 25
+#define TIMESTAMPTZOID 1184
+
+/** Seconds between the Unix epoch and the PostgreSQL epoch (2000-01-01) */
+#define POSTGRES_EPOCH_UNIX 946684800
+
+/** Maximum number of inserts sent in a single pipeline batch */
+#define MAX_BATCH_SIZE 64
+
+typedef struct {
+  char *entity;
+  uint64_t create_time_unix;
+  char *public_key;
+  uint8_t key_id[SIGNING_KEY_ID_BYTES];
+  signing_algorithm algorithm;
+
+  /** Number of batches in which the insert of the certificate failed, the
+   * certificate being retried alone from the first failure */
+  unsigned attempts;
+  uint64_t retry_at_ms;
+  uint64_t retry_delay_ms;
+} queued_certificate;
+
+typedef enum {
+  REPOSITORY_DISCONNECTED,
+  REPOSITORY_CONNECTING,
+  REPOSITORY_CONNECTED
+} repository_state;
 
 struct certificate_repository {
+  certificate_repository_options options;
+
   PGconn *connection;
+  repository_state state;
+
+  /** Last value returned by PQconnectPoll while connecting */
+  PostgresPollingStatusType polling;
+
+  uint64_t retry_at_ms;
+  uint64_t retry_delay_ms;
+
+  /** Time at which the connection attempt or the batch in flight fails */
+  uint64_t deadline_ms;
+
+  /** Set once the schema and the insert statement are prepared on the
+   * current connection */
+  bool prepared;
+
+  /** A batch has been sent and its sync result was not received yet */
+  bool batch_in_flight;
+
+  /** The results of the schema and statement preparation, synced apart from
+   * the inserts of the batch, were not all received yet */
+  bool batch_preparing;
+
+  /** Indexes in the queue of the certificates of the batch, in queue
+   * order */
+  size_t batch_indexes[MAX_BATCH_SIZE];
+  size_t batch_size;
+  bool batch_failed;
+
+  /** Number of insert results received for the batch */
+  size_t batch_results;
+
+  /** Index in the batch of the insert that made it fail, batch_size when no
+   * insert failed by itself */
+  size_t batch_failed_index;
+
+  /** Certificates not stored yet, oldest first */
+  queued_certificate *queue;
+  size_t queue_count;
+  size_t queue_capacity;
+
+  /** Number of queued certificates whose insert failed */
+  size_t failed_count;
+
+  /** Append-only file holding the queued certificates */
+  FILE *outbox;
 };
 
-certificate_repository *certificate_repository_new(const char *connection) {
-  assert(connection != NULL);
+static void free_queued_certificate(queued_certificate *queued) {
+  free(queued->entity);
+  free(queued->public_key);
+}
 
-  certificate_repository *repo =
-      (certificate_repository *)calloc(1, sizeof(certificate_repository));
+static error_code enqueue(certificate_repository *repo,
+                          const certificate *cert) {
+  signing_algorithm algorithm = SIGNING_ALGORITHM_ED25519;
+  if (cert->algorithm != NULL &&
+      !signing_algorithm_parse(cert->algorithm, &algorithm)) {
+    return ERROR_INVALID_ARGUMENT;
+  }
 
-  repo->connection = PQconnectdb(connection);
-  if (repo->connection == NULL) {
-    mosquitto_log_printf(MOSQ_LOG_ERR, "Failed to create new connnection");
-    free(repo);
-    return NULL;
+  const char *public_key = cert->public_key;
+  uint8_t public_key_bytes[SIGNING_KEY_PUBLIC_BYTES];
+  size_t public_key_size = 0;
+  if (sodium_hex2bin(public_key_bytes, sizeof(public_key_bytes), public_key,
+                     strlen(public_key), NULL, &public_key_size, NULL) != 0 ||
+      public_key_size != sizeof(public_key_bytes)) {
+    return ERROR_INVALID_ARGUMENT;
+  }
+
+  if (repo->queue_count == repo->queue_capacity) {
+    size_t capacity = repo->queue_capacity == 0 ? 4 : repo->queue_capacity * 2;
+    queued_certificate *queue = (queued_certificate *)realloc(
+        repo->queue, capacity * sizeof(queued_certificate));
+    if (queue == NULL) {
+      return ERROR_NO_MEMORY;
+    }
+    repo->queue = queue;
+    repo->queue_capacity = capacity;
+  }
+
+  queued_certificate queued = {
+      .entity = strdup(cert->entity),
+      .create_time_unix = cert->create_time_unix,
+      .public_key = strdup(public_key),
+      .algorithm = algorithm,
+  };
+  if (queued.entity == NULL || queued.public_key == NULL) {
+    free_queued_certificate(&queued);
+    return ERROR_NO_MEMORY;
+  }
+  signing_key_compute_id(public_key_bytes, queued.key_id);
+
+  repo->queue[repo->queue_count++] = queued;
+  return SUCCESS;
+}
+
+/**
+ * Parses a line of an outbox or key dump file, without its newline: the
+ * entity, the creation time, the public key and the algorithm separated by
+ * tabs, lines written before algorithms were recorded having no algorithm.
+ * The line is modified and the certificate points into it.
+ */
+static bool parse_certificate_line(char *line, certificate *cert) {
+  char *create_time = strchr(line, '\t');
+  char *public_key =
+      create_time != NULL ? strchr(create_time + 1, '\t') : NULL;
+  if (public_key == NULL) {
+    return false;
+  }
+  *create_time++ = '\0';
+  *public_key++ = '\0';
+
+  char *algorithm = strchr(public_key, '\t');
+  if (algorithm != NULL) {
+    *algorithm++ = '\0';
   }
 
-  if (PQstatus(repo->connection) != CONNECTION_OK) {
+  cert->entity = line;
+  cert->create_time_unix = strtoull(create_time, NULL, 10);
+  cert->public_key = public_key;
+  cert->algorithm = algorithm;
+  return true;
+}
+
+/**
+ * Reads the certificates of a file, a last line without newline was not
+ * completely written and is ignored
+ *
+ * \returns the number of malformed lines
+ */
+static size_t read_certificates(FILE *file, certificate_callback callback,
+                                void *userdata) {
+  char *line = NULL;
+  size_t line_capacity = 0;
+  ssize_t length = 0;
+  size_t malformed = 0;
+
+  while ((length = getline(&line, &line_capacity, file)) > 0) {
+    if (line[length - 1] != '\n') {
+      break;
+    }
+    line[length - 1] = '\0';
+
+    certificate cert;
+    if (!parse_certificate_line(line, &cert)) {
+      malformed++;
+      continue;
+    }
+    callback(&cert, userdata);
+  }
+  free(line);
+
+  return malformed;
+}
+
+static void enqueue_loaded(const certificate *cert, void *userdata) {
+  certificate_repository *repo = (certificate_repository *)userdata;
+  if (enqueue(repo, cert) != SUCCESS) {
     mosquitto_log_printf(MOSQ_LOG_ERR,
-                         "Failed to enstablish new connection, reason: %s",
-                         PQerrorMessage(repo->connection));
-    certificate_repository_destroy(repo);
-    return NULL;
+                         "Failed to load certificate outbox entry");
+  }
+}
+
+/**
+ * Loads the certificates left in the outbox by a previous run
+ */
+static void load_outbox(certificate_repository *repo) {
+  rewind(repo->outbox);
+
+  if (read_certificates(repo->outbox, enqueue_loaded, repo) > 0) {
+    mosquitto_log_printf(MOSQ_LOG_WARNING,
+                         "Ignoring malformed certificate outbox entries");
   }
 
-  PGresult *query_create_table_result =
-      PQexec(repo->connection, QUERY_CREATE_TABLE);
+  if (repo->queue_count > 0) {
+    mosquitto_log_printf(MOSQ_LOG_INFO,
+                         "Loaded %zu certificates from the outbox",
+                         repo->queue_count);
+  }
+}
+
+static bool write_outbox_line(certificate_repository *repo,
+                              const certificate *cert) {
+  const char *algorithm = cert->algorithm != NULL
+                              ? cert->algorithm
+                              : signing_algorithm_name(SIGNING_ALGORITHM_ED25519);
+  return fprintf(repo->outbox, "%s\t%llu\t%s\t%s\n", cert->entity,
+                 (unsigned long long)cert->create_time_unix, cert->public_key,
+                 algorithm) >= 0;
+}
+
+/**
+ * Appends certificates to the outbox, synced to disk once for all of them
+ */
+static void append_outbox(certificate_repository *repo,
+                          const certificate *certs, size_t count) {
+  if (repo->outbox == NULL) {
+    return;
+  }
+
+  bool written = true;
+  for (size_t i = 0; i < count && written; i++) {
+    written = write_outbox_line(repo, &certs[i]);
+  }
+  if (!written || fflush(repo->outbox) != 0 ||
+      fsync(fileno(repo->outbox)) != 0) {
+    mosquitto_log_printf(MOSQ_LOG_WARNING,
+                         "Failed to append certificates to the outbox %s",
+                         repo->options.outbox_path);
+  }
+}
+
+static void truncate_outbox(certificate_repository *repo) {
+  if (repo->outbox != NULL && ftruncate(fileno(repo->outbox), 0) != 0) {
+    mosquitto_log_printf(MOSQ_LOG_WARNING,
+                         "Failed to truncate the outbox %s",
+                         repo->options.outbox_path);
+  }
+}
 
-  ExecStatusType status = PQresultStatus(query_create_table_result);
+certificate_repository *
+certificate_repository_new(const certificate_repository_options *options) {
+  assert(options != NULL);
+  assert(options->connection != NULL);
 
-  if (status != PGRES_COMMAND_OK) {
-    mosquitto_log_printf(MOSQ_LOG_ERR, "Failed to create tables, reason: %s",
-                         PQerrorMessage(repo->connection));
-    PQclear(query_create_table_result);
-    certificate_repository_destroy(repo);
+  certificate_repository *repo =
+      (certificate_repository *)calloc(1, sizeof(certificate_repository));
+  if (repo == NULL) {
     return NULL;
   }
 
+  repo->options = *options;
+  repo->state = REPOSITORY_DISCONNECTED;
+  repo->retry_delay_ms = options->retry_initial_ms;
+
+  if (options->outbox_path != NULL) {
+    repo->outbox = fopen(options->outbox_path, "a+");
+    if (repo->outbox == NULL) {
+      mosquitto_log_printf(MOSQ_LOG_ERR,
+                           "Failed to open the certificate outbox %s",
+                           options->outbox_path);
+      free(repo);
+      return NULL;
+    }
+    load_outbox(repo);
+  }
+
   return repo;
 }
 
+/** Tabs and newlines would break the outbox format */
+static bool is_outbox_safe(const certificate *cert) {
+  return strpbrk(cert->entity, "\t\n") == NULL &&
+         strpbrk(cert->public_key, "\t\n") == NULL;
+}
+
 error_code certificate_repository_add(certificate_repository *repo,
-                                      certificate *cert) {
+                                      const certificate *cert) {
+  return certificate_repository_add_batch(repo, cert, 1);
+}
 
+error_code certificate_repository_add_batch(certificate_repository *repo,
+                                            const certificate *certs,
+                                            size_t count) {
   assert(repo != NULL);
-  assert(cert != NULL);
+  assert(certs != NULL || count == 0);
 
-  char isotime[64] = {0};
-  utils_timestamp_to_iso8601(cert->create_time_unix, isotime, sizeof(isotime));
+  for (size_t i = 0; i < count; i++) {
+    if (!is_outbox_safe(&certs[i])) {
+      return ERROR_INVALID_ARGUMENT;
+    }
+  }
 
-  const char *values[] = {cert->entity, isotime, cert->public_key};
+  size_t queue_count = repo->queue_count;
+  for (size_t i = 0; i < count; i++) {
+    error_code error = enqueue(repo, &certs[i]);
+    if (error != SUCCESS) {
+      // Leave the queue as it was
+      while (repo->queue_count > queue_count) {
+        free_queued_certificate(&repo->queue[--repo->queue_count]);
+      }
+      return error;
+    }
+  }
 
-  PGresult *result =
-      PQexecParams(repo->connection, QUERY_INSERT_CERTIFICATE,
-                   3,      // Number of parameters
-                   NULL,   // Parameter types (NULL means automatic inference)
-                   values, // Parameter values
-                   NULL,   // Parameter lengths (NULL means strings)
-                   NULL,   // Parameter formats (NULL means text)
-                   0       // Result format (0 means text)
-      );
+  append_outbox(repo, certs, count);
+  return SUCCESS;
+}
+
+size_t certificate_repository_pending(const certificate_repository *repo) {
+  return repo->queue_count;
+}
+
+/**
+ * Delays the next insertion, the delay growing after every failure
+ */
+static void schedule_retry(certificate_repository *repo, uint64_t now_ms) {
+  mosquitto_log_printf(MOSQ_LOG_WARNING,
+                       "Retrying certificate insertion in %llu ms",
+                       (unsigned long long)repo->retry_delay_ms);
+  repo->retry_at_ms = now_ms + repo->retry_delay_ms;
+
+  // Exponential backoff
+  repo->retry_delay_ms *= 2;
+  if (repo->retry_delay_ms > repo->options.retry_max_ms) {
+    repo->retry_delay_ms = repo->options.retry_max_ms;
+  }
+}
+
+static void fail_connection(certificate_repository *repo, uint64_t now_ms,
+                            const char *action) {
+  mosquitto_log_printf(MOSQ_LOG_ERR, "Failed to %s, reason: %s", action,
+                       repo->connection != NULL
+                           ? PQerrorMessage(repo->connection)
+                           : "out of memory");
+
+  if (repo->connection != NULL) {
+    PQfinish(repo->connection);
+    repo->connection = NULL;
+  }
+  repo->state = REPOSITORY_DISCONNECTED;
+  repo->prepared = false;
+  repo->batch_in_flight = false;
+  repo->batch_preparing = false;
+
+  schedule_retry(repo, now_ms);
+}
+
+static void start_connection(certificate_repository *repo, uint64_t now_ms) {
+  repo->connection = PQconnectStart(repo->options.connection);
+  if (repo->connection == NULL || PQstatus(repo->connection) == CONNECTION_BAD) {
+    fail_connection(repo, now_ms, "create new connnection");
+    return;
+  }
+
+  // Behave as if PQconnectPoll had returned PGRES_POLLING_WRITING
+  repo->state = REPOSITORY_CONNECTING;
+  repo->polling = PGRES_POLLING_WRITING;
+  repo->deadline_ms = now_ms + repo->options.timeout_ms;
+}
+
+/**
+ * Checks without waiting if the connection socket is ready for the events
+ */
+static bool is_socket_ready(PGconn *connection, short events) {
+  struct pollfd fd = {.fd = PQsocket(connection), .events = events};
+  if (fd.fd < 0) {
+    // Let libpq report the error
+    return true;
+  }
+  return poll(&fd, 1, 0) != 0;
+}
+
+static void poll_batches(certificate_repository *repo, uint64_t now_ms);
+
+static void poll_connection(certificate_repository *repo, uint64_t now_ms) {
+  short events = repo->polling == PGRES_POLLING_READING ? POLLIN : POLLOUT;
+  if (!is_socket_ready(repo->connection, events)) {
+    return;
+  }
+
+  repo->polling = PQconnectPoll(repo->connection);
+
+  if (repo->polling == PGRES_POLLING_FAILED) {
+    fail_connection(repo, now_ms, "enstablish new connection");
+  } else if (repo->polling == PGRES_POLLING_OK) {
+    if (PQsetnonblocking(repo->connection, 1) != 0 ||
+        !PQenterPipelineMode(repo->connection)) {
+      fail_connection(repo, now_ms, "enter pipeline mode");
+      return;
+    }
+    repo->state = REPOSITORY_CONNECTED;
+    repo->retry_delay_ms = repo->options.retry_initial_ms;
+    poll_batches(repo, now_ms);
+  }
+}
+
+static bool send_prepare(certificate_repository *repo) {
+  static const Oid PARAM_TYPES[] = {TEXTOID, TIMESTAMPTZOID, TEXTOID,
+                                    BYTEAOID, TEXTOID};
+  if (!PQsendQueryParams(repo->connection, QUERY_MIGRATE, 0, NULL, NULL, NULL,
+                         NULL, 0)) {
+    return false;
+  }
+
+  return PQsendPrepare(repo->connection, STATEMENT_INSERT_CERTIFICATE,
+                       QUERY_INSERT_CERTIFICATE, 5, PARAM_TYPES);
+}
+
+static bool send_insert(certificate_repository *repo,
+                        const queued_certificate *queued) {
+  // Binary timestamps are big endian microseconds since the PostgreSQL epoch
+  int64_t microseconds =
+      ((int64_t)queued->create_time_unix - POSTGRES_EPOCH_UNIX) * 1000000;
+  uint64_t timestamp = htobe64((uint64_t)microseconds);
+
+  const char *algorithm = signing_algorithm_name(queued->algorithm);
+
+  const char *values[] = {queued->entity, (const char *)&timestamp,
+                          queued->public_key, (const char *)queued->key_id,
+                          algorithm};
+  const int lengths[] = {(int)strlen(queued->entity), sizeof(timestamp),
+                         (int)strlen(queued->public_key),
+                         sizeof(queued->key_id), (int)strlen(algorithm)};
+  const int formats[] = {1, 1, 1, 1, 1};
+
+  return PQsendQueryPrepared(repo->connection, STATEMENT_INSERT_CERTIFICATE, 5,
+                             values, lengths, formats, 0);
+}
+
+/**
+ * Selects the certificates of the next batch: a certificate whose insert
+ * failed is sent alone once its retry delay is over, so that it can not make
+ * the others fail again, the others are sent together in queue order
+ *
+ * \returns the number of certificates selected, 0 when none can be sent yet
+ */
+static size_t select_batch(certificate_repository *repo, uint64_t now_ms) {
+  for (size_t i = 0; repo->failed_count > 0 && i < repo->queue_count; i++) {
+    if (repo->queue[i].attempts > 0 && now_ms >= repo->queue[i].retry_at_ms) {
+      repo->batch_indexes[0] = i;
+      return 1;
+    }
+  }
+
+  size_t batch_size = 0;
+  for (size_t i = 0; i < repo->queue_count && batch_size < MAX_BATCH_SIZE;
+       i++) {
+    if (repo->queue[i].attempts == 0) {
+      repo->batch_indexes[batch_size++] = i;
+    }
+  }
+  return batch_size;
+}
+
+/**
+ * Sends the oldest queued certificates in a single batch ended by a sync,
+ * preceded on a new connection by the schema creation and the statement
+ * preparation, ended by their own sync so that a failed insert does not roll
+ * them back
+ */
+static void send_batch(certificate_repository *repo, uint64_t now_ms) {
+  size_t batch_size = select_batch(repo, now_ms);
+  if (batch_size == 0) {
+    return;
+  }
+
+  if (!repo->prepared) {
+    if (!send_prepare(repo) || !PQpipelineSync(repo->connection)) {
+      fail_connection(repo, now_ms, "prepare certificate insertion");
+      return;
+    }
+    repo->batch_preparing = true;
+  }
+
+  for (size_t i = 0; i < batch_size; i++) {
+    if (!send_insert(repo, &repo->queue[repo->batch_indexes[i]])) {
+      fail_connection(repo, now_ms, "insert certificate");
+      return;
+    }
+  }
+
+  if (!PQpipelineSync(repo->connection)) {
+    fail_connection(repo, now_ms, "insert certificate");
+    return;
+  }
+
+  repo->batch_in_flight = true;
+  repo->deadline_ms = now_ms + repo->options.timeout_ms;
+  repo->batch_size = batch_size;
+  repo->batch_failed = false;
+  repo->batch_results = 0;
+  repo->batch_failed_index = batch_size;
+}
+
+/**
+ * Schedules the next attempt of a certificate whose insert failed, the delay
+ * of each certificate growing after every failure. The certificate is never
+ * dropped, so that a key is never used without its certificate stored.
+ */
+static void fail_insert(certificate_repository *repo, uint64_t now_ms,
+                        queued_certificate *queued) {
+  if (queued->attempts++ == 0) {
+    repo->failed_count++;
+    queued->retry_delay_ms = repo->options.retry_initial_ms;
+  }
+
+  mosquitto_log_printf(MOSQ_LOG_WARNING,
+                       "Retrying the certificate %s of %s in %llu ms, after "
+                       "%u failed insertions",
+                       queued->public_key, queued->entity,
+                       (unsigned long long)queued->retry_delay_ms,
+                       queued->attempts);
+  queued->retry_at_ms = now_ms + queued->retry_delay_ms;
 
+  // Exponential backoff
+  queued->retry_delay_ms *= 2;
+  if (queued->retry_delay_ms > repo->options.retry_max_ms) {
+    queued->retry_delay_ms = repo->options.retry_max_ms;
+  }
+}
+
+/**
+ * Removes the certificates of a stored batch from the queue, reporting them
+ * to the stored callback
+ */
+static void remove_batch(certificate_repository *repo) {
+  size_t kept = repo->batch_indexes[0];
+  size_t next = 0;
+  for (size_t i = kept; i < repo->queue_count; i++) {
+    queued_certificate *queued = &repo->queue[i];
+    if (next == repo->batch_size || repo->batch_indexes[next] != i) {
+      repo->queue[kept++] = *queued;
+      continue;
+    }
+    next++;
+
+    if (queued->attempts > 0) {
+      repo->failed_count--;
+    }
+    if (repo->options.stored_callback != NULL) {
+      certificate cert = {
+          .entity = queued->entity,
+          .create_time_unix = queued->create_time_unix,
+          .public_key = queued->public_key,
+          .algorithm = signing_algorithm_name(queued->algorithm),
+      };
+      repo->options.stored_callback(&cert, repo->options.userdata);
+    }
+    free_queued_certificate(queued);
+  }
+  repo->queue_count = kept;
+}
+
+static void finish_batch(certificate_repository *repo, uint64_t now_ms) {
+  if (repo->batch_preparing) {
+    repo->batch_preparing = false;
+    if (repo->batch_failed) {
+      fail_connection(repo, now_ms, "prepare certificate insertion");
+      return;
+    }
+    repo->prepared = true;
+    return;
+  }
+
+  repo->batch_in_flight = false;
+
+  if (!repo->batch_failed) {
+    remove_batch(repo);
+    if (repo->queue_count == 0) {
+      truncate_outbox(repo);
+    }
+    return;
+  }
+
+  if (repo->batch_failed_index == repo->batch_size) {
+    // No insert failed by itself
+    fail_connection(repo, now_ms, "insert certificates");
+    return;
+  }
+
+  // The statements of a batch run in a single implicit transaction, nothing
+  // was stored: the batch is sent again without the failed insert, which is
+  // retried alone
+  fail_insert(repo, now_ms,
+              &repo->queue[repo->batch_indexes[repo->batch_failed_index]]);
+}
+
+static void read_result(certificate_repository *repo, PGresult *result) {
   ExecStatusType status = PQresultStatus(result);
+  size_t index = repo->batch_results;
+  if (!repo->batch_preparing) {
+    repo->batch_results++;
+  }
 
-  if (status != PGRES_COMMAND_OK) {
-    mosquitto_log_printf(MOSQ_LOG_ERR, "Failed to insert certificate: %s",
-                         PQerrorMessage(repo->connection));
+  if (status == PGRES_COMMAND_OK) {
+    return;
+  }
+
+  if (!repo->batch_failed && status != PGRES_PIPELINE_ABORTED) {
+    if (repo->batch_preparing) {
+      mosquitto_log_printf(MOSQ_LOG_ERR,
+                           "Failed to prepare certificate insertion: %s",
+                           PQresultErrorMessage(result));
+    } else if (index < repo->batch_size) {
+      const queued_certificate *queued =
+          &repo->queue[repo->batch_indexes[index]];
+      mosquitto_log_printf(MOSQ_LOG_ERR,
+                           "Failed to insert the certificate %s of %s: %s",
+                           queued->public_key, queued->entity,
+                           PQresultErrorMessage(result));
+      repo->batch_failed_index = index;
+    }
+  }
+  repo->batch_failed = true;
+}
+
+static void read_batch_results(certificate_repository *repo,
+                               uint64_t now_ms) {
+  if (!PQconsumeInput(repo->connection)) {
+    fail_connection(repo, now_ms, "read certificate insertion results");
+    return;
+  }
+
+  while (repo->batch_in_flight && !PQisBusy(repo->connection)) {
+    PGresult *result = PQgetResult(repo->connection);
+    if (result == NULL) {
+      // End of the results of a statement
+      continue;
+    }
+
+    if (PQresultStatus(result) == PGRES_PIPELINE_SYNC) {
+      finish_batch(repo, now_ms);
+    } else {
+      read_result(repo, result);
+    }
     PQclear(result);
-    return ERROR_UNKNOWN;
   }
+}
 
-  return SUCCESS;
+static void poll_batches(certificate_repository *repo, uint64_t now_ms) {
+  if (repo->batch_in_flight) {
+    read_batch_results(repo, now_ms);
+  }
+
+  if (repo->state == REPOSITORY_CONNECTED && !repo->batch_in_flight &&
+      repo->queue_count > 0 && now_ms >= repo->retry_at_ms) {
+    send_batch(repo, now_ms);
+  }
+
+  if (repo->state == REPOSITORY_CONNECTED && PQflush(repo->connection) < 0) {
+    fail_connection(repo, now_ms, "send certificates");
+  }
+}
+
+void certificate_repository_poll(certificate_repository *repo,
+                                 uint64_t now_ms) {
+  assert(repo != NULL);
+
+  switch (repo->state) {
+  case REPOSITORY_DISCONNECTED:
+    // Connect only when there is something to write
+    if (repo->queue_count > 0 && now_ms >= repo->retry_at_ms) {
+      start_connection(repo, now_ms);
+    }
+    break;
+  case REPOSITORY_CONNECTING:
+    poll_connection(repo, now_ms);
+    break;
+  case REPOSITORY_CONNECTED:
+    poll_batches(repo, now_ms);
+    break;
+  }
+
+  if (repo->options.timeout_ms == 0 || now_ms < repo->deadline_ms) {
+    return;
+  }
+  if (repo->state == REPOSITORY_CONNECTING) {
+    fail_connection(repo, now_ms, "connect before the timeout");
+  } else if (repo->state == REPOSITORY_CONNECTED && repo->batch_in_flight) {
+    fail_connection(repo, now_ms, "insert certificates before the timeout");
+  }
 }
 
 void certificate_repository_destroy(certificate_repository *repo) {
   assert(repo != NULL);
-  PQfinish(repo->connection);
+  if (repo->connection != NULL) {
+    PQfinish(repo->connection);
+  }
+  for (size_t i = 0; i < repo->queue_count; i++) {
+    free_queued_certificate(&repo->queue[i]);
+  }
+  free(repo->queue);
+  if (repo->outbox != NULL) {
+    fclose(repo->outbox);
+  }
   free(repo);
 }
+
+/**
+ * Calls the callback for every row of a certificate query result
+ */
+static void report_certificates(PGresult *result,
+                                certificate_callback callback,
+                                void *userdata) {
+  for (int row = 0; row < PQntuples(result); row++) {
+    certificate cert = {
+        .entity = PQgetvalue(result, row, 0),
+        .create_time_unix = strtoull(PQgetvalue(result, row, 1), NULL, 10),
+        .public_key = PQgetvalue(result, row, 2),
+        .algorithm = PQgetvalue(result, row, 3),
+    };
+    callback(&cert, userdata);
+  }
+}
+
+error_code certificate_repository_fetch(const char *connection,
+                                        const char *entity,
+                                        certificate_callback callback,
+                                        void *userdata) {
+  PGconn *conn = PQconnectdb(connection);
+  if (PQstatus(conn) != CONNECTION_OK) {
+    mosquitto_log_printf(MOSQ_LOG_ERR, "Failed to connect, reason: %s",
+                         PQerrorMessage(conn));
+    PQfinish(conn);
+    return ERROR_UNKNOWN;
+  }
+
+  PGresult *result = PQexecParams(conn, QUERY_SELECT_CERTIFICATES, 1, NULL,
+                                  &entity, NULL, NULL, 0);
+  if (PQresultStatus(result) != PGRES_TUPLES_OK) {
+    mosquitto_log_printf(MOSQ_LOG_ERR, "Failed to read certificates: %s",
+                         PQerrorMessage(conn));
+    PQclear(result);
+    PQfinish(conn);
+    return ERROR_UNKNOWN;
+  }
+
+  report_certificates(result, callback, userdata);
+
+  PQclear(result);
+  PQfinish(conn);
+  return SUCCESS;
+}
+
+error_code certificate_repository_find(const char *connection,
+                                       const uint8_t *key_ids,
+                                       size_t key_id_count,
+                                       certificate_callback callback,
+                                       void *userdata) {
+  static const Oid PARAM_TYPES[] = {BYTEAOID};
+  static const int LENGTHS[] = {SIGNING_KEY_ID_BYTES};
+  static const int FORMATS[] = {1};
+
+  PGconn *conn = PQconnectdb(connection);
+  if (PQstatus(conn) != CONNECTION_OK) {
+    mosquitto_log_printf(MOSQ_LOG_ERR, "Failed to connect, reason: %s",
+                         PQerrorMessage(conn));
+    PQfinish(conn);
+    return ERROR_UNKNOWN;
+  }
+
+  PGresult *result =
+      PQprepare(conn, STATEMENT_SELECT_BY_KEY_ID,
+                QUERY_SELECT_CERTIFICATES_BY_KEY_ID, 1, PARAM_TYPES);
+  error_code error = SUCCESS;
+  if (PQresultStatus(result) != PGRES_COMMAND_OK) {
+    error = ERROR_UNKNOWN;
+  }
+  PQclear(result);
+
+  // One index lookup per key id
+  for (size_t i = 0; error == SUCCESS && i < key_id_count; i++) {
+    const char *values[] = {
+        (const char *)key_ids + i * SIGNING_KEY_ID_BYTES};
+    result = PQexecPrepared(conn, STATEMENT_SELECT_BY_KEY_ID, 1, values,
+                            LENGTHS, FORMATS, 0);
+    if (PQresultStatus(result) == PGRES_TUPLES_OK) {
+      report_certificates(result, callback, userdata);
+    } else {
+      error = ERROR_UNKNOWN;
+    }
+    PQclear(result);
+  }
+
+  if (error != SUCCESS) {
+    mosquitto_log_printf(MOSQ_LOG_ERR, "Failed to find certificates: %s",
+                         PQerrorMessage(conn));
+  }
+  PQfinish(conn);
+  return error;
+}
+
+error_code certificate_repository_read_file(const char *path,
+                                            certificate_callback callback,
+                                            void *userdata) {
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    mosquitto_log_printf(MOSQ_LOG_ERR, "Failed to open certificate file %s",
+                         path);
+    return ERROR_INVALID_ARGUMENT;
+  }
+
+  size_t malformed = read_certificates(file, callback, userdata);
+  fclose(file);
+
+  if (malformed > 0) {
+    mosquitto_log_printf(MOSQ_LOG_WARNING,
+                         "Ignored %zu malformed lines of certificate file %s",
+                         malformed, path);
+  }
+  return SUCCESS;
+}
@@ -3,9 +3,19 @@
 #include <stddef.h>
 #include <stdint.h>
 
+/** Entity of the certificates when none is configured */
+#define CERTIFICATE_DEFAULT_ENTITY "MOSQUITTO_MQTT_BROKER"
+
 /**
  * Opaque struct representing a certificate repository
- * to manage insertion of new certificates
+ * to manage insertion of new certificates.
+ *
+ * The repository keeps a single long-lived connection, opened and used with
+ * the non-blocking libpq API so that the caller is never blocked on the
+ * database. Certificates are queued by certificate_repository_add and written
+ * in batches by certificate_repository_poll, with a prepared statement in
+ * pipeline mode. Queued certificates can be buffered in an append-only outbox
+ * file, so that they survive a restart while the database is unreachable.
  */
 typedef struct certificate_repository certificate_repository;
 
@@ -21,29 +31,172 @@ typedef struct {
 
   /** Public key */
   const char *public_key;
+
+  /** Name of the signature algorithm of the key (see signing_algorithm_name),
+   * ED25519 when null */
+  const char *algorithm;
 } certificate;
 
 /**
- * Creates a new repository for insertion of certificates
+ * Called for every certificate read by certificate_repository_fetch and
+ * certificate_repository_read_file, the certificate is only valid during the
+ * call
  *
- * \param connection connection string
+ * \param cert certificate read
+ * \param userdata data given to the reading function
+ */
+typedef void (*certificate_callback)(const certificate *cert, void *userdata);
+
+/**
+ * Options of a certificate repository
+ */
+typedef struct {
+  /** Connection string */
+  const char *connection;
+
+  /** Path of the outbox file, null to keep queued certificates in memory
+   * only */
+  const char *outbox_path;
+
+  /** Delay in milliseconds before reconnecting after a failure, doubled
+   * after every failure up to retry_max_ms */
+  uint64_t retry_initial_ms;
+  uint64_t retry_max_ms;
+
+  /** Time in milliseconds a connection attempt or a batch can take before
+   * the connection is closed and retried, 0 to wait indefinitely */
+  uint64_t timeout_ms;
+
+  /** Called by certificate_repository_poll for every certificate once it is
+   * stored, may be null */
+  certificate_callback stored_callback;
+
+  /** Data given to stored_callback */
+  void *userdata;
+} certificate_repository_options;
+
+/**
+ * Creates a new repository for insertion of certificates, loading the
+ * certificates left in the outbox. The connection is started by the first
+ * call to certificate_repository_poll, which creates the table or migrates it
+ * to the current schema before the first insert: the key id column is added,
+ * filled for the existing certificates and indexed, and the algorithm column
+ * is added with ED25519 for the existing certificates. Only the missing parts
+ * of the schema, found in the catalog, are created.
+ *
+ * \param options repository options, strings must outlive the repository
  * \returns handle to the created repository on success, null otherwise
  */
-certificate_repository *certificate_repository_new(const char *connection);
+certificate_repository *
+certificate_repository_new(const certificate_repository_options *options);
 
 /**
- * Adds a certificate to the repository
+ * Queues a certificate to be added to the repository with the key id of its
+ * public key, and appends it to the outbox
  *
  * \param repo handle to certificate repository
- * \param cert cert DTO to add
- * \returns success on insertion, error otherwise
+ * \param cert cert DTO to add, copied by the repository
+ * \returns ERROR_INVALID_ARGUMENT if the public key is not a hex encoded
+ * ED25519 key or the algorithm is unknown, success when the certificate is
+ * queued, error otherwise
  */
 error_code certificate_repository_add(certificate_repository *repo,
-                                      certificate *cert);
+                                      const certificate *cert);
+
+/**
+ * Queues several certificates at once, in order, and appends them to the
+ * outbox with a single sync to disk. Either every certificate is queued or
+ * none is.
+ *
+ * \param repo handle to certificate repository
+ * \param certs cert DTOs to add, copied by the repository
+ * \param count number of certificates
+ * \returns ERROR_INVALID_ARGUMENT if any certificate is invalid, success when
+ * every certificate is queued, error otherwise
+ */
+error_code certificate_repository_add_batch(certificate_repository *repo,
+                                            const certificate *certs,
+                                            size_t count);
 
 /**
- * Destroys the repository freeing memory
+ * Advances the connection and the writes of queued certificates as far as
+ * possible without blocking. Must be called periodically.
+ *
+ * A certificate whose insert fails is retried alone, with a backoff delay of
+ * its own, until it is stored, while the others are still written: it is
+ * never dropped, so that the key of a certificate is never used without it.
+ * Only the failure of the connection or of a whole batch makes the
+ * repository reconnect and send the batch again. Every stored certificate is
+ * reported to the stored callback of the options.
+ *
+ * \param repo handle to certificate repository
+ * \param now_ms current monotonic time in milliseconds
+ */
+void certificate_repository_poll(certificate_repository *repo,
+                                 uint64_t now_ms);
+
+/**
+ * Returns the number of queued certificates not stored yet. Certificates are
+ * stored in the order they are added, except those retried after a failed
+ * insert.
+ *
+ * \param repo handle to certificate repository
+ */
+size_t certificate_repository_pending(const certificate_repository *repo);
+
+/**
+ * Destroys the repository freeing memory. Certificates not stored yet are
+ * kept in the outbox.
  *
  * \param repo handle to certificate repository
  */
 void certificate_repository_destroy(certificate_repository *repo);
+
+/**
+ * Reads the stored certificates, oldest first, with a blocking connection.
+ * Meant for offline tools, never called by the plugin.
+ *
+ * \param connection connection string
+ * \param entity entity whose certificates are read, null for every entity
+ * \param callback function called for every certificate
+ * \param userdata data given to the callback
+ * \returns success when every certificate was read, error otherwise
+ */
+error_code certificate_repository_fetch(const char *connection,
+                                        const char *entity,
+                                        certificate_callback callback,
+                                        void *userdata);
+
+/**
+ * Reads the stored certificates having the given key ids, with one indexed
+ * lookup per key id on a blocking connection. Meant for offline tools, never
+ * called by the plugin.
+ *
+ * \param connection connection string
+ * \param key_ids key ids of SIGNING_KEY_ID_BYTES bytes each, one after the
+ * other
+ * \param key_id_count number of key ids
+ * \param callback function called for every certificate
+ * \param userdata data given to the callback
+ * \returns success when every lookup was made, error otherwise
+ */
+error_code certificate_repository_find(const char *connection,
+                                       const uint8_t *key_ids,
+                                       size_t key_id_count,
+                                       certificate_callback callback,
+                                       void *userdata);
+
+/**
+ * Reads the certificates of a file in the outbox format: one certificate per
+ * line, the entity, the creation time in Unix seconds, the hex encoded
+ * public key and the algorithm separated by tabs, the algorithm being ED25519
+ * when missing. Malformed lines are skipped.
+ *
+ * \param path path of the file
+ * \param callback function called for every certificate
+ * \param userdata data given to the callback
+ * \returns success when the file was read, error otherwise
+ */
+error_code certificate_repository_read_file(const char *path,
+                                            certificate_callback callback,
+                                            void *userdata);
@@ -0,0 +1,203 @@
+#include "detached_signature.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <sodium.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CBOR_ARRAY_FOUR_ITEMS 0x84
+#define CBOR_ARRAY_FIVE_ITEMS 0x85
+#define CBOR_UINT64_HEAD 0x1b
+#define CBOR_BYTES_MAJOR_TYPE 2
+#define CBOR_TEXT_MAJOR_TYPE 3
+
+#define PRESENT_TIME 1u
+#define PRESENT_KEY_ID 2u
+#define PRESENT_TOKEN 4u
+#define PRESENT_ALL (PRESENT_TIME | PRESENT_KEY_ID | PRESENT_TOKEN)
+
+#define TOKEN_VARIANT sodium_base64_VARIANT_ORIGINAL
+
+_Static_assert(DETACHED_SIGNATURE_TOKEN_TEXT_SIZE ==
+                   sodium_base64_ENCODED_LEN(SIGNING_CONTEXT_SIGNATURE_BYTES,
+                                             TOKEN_VARIANT),
+               "The token text must fit a base64 signature");
+
+/** First items of the signed arrays, separating detached signatures and
+ * countersignatures from the other signed structures */
+static const char CONTEXT[] = "message-sign detached";
+static const char COUNTERSIGN_CONTEXT[] = "message-sign countersigned";
+
+static const uint8_t BREAK[] = {0xff};
+
+static size_t put_head(uint8_t *out, uint8_t major, uint64_t value) {
+  uint8_t type = (uint8_t)(major << 5);
+  if (value < 24) {
+    out[0] = type | (uint8_t)value;
+    return 1;
+  }
+
+  size_t length_size = value <= UINT8_MAX    ? 1
+                       : value <= UINT16_MAX ? 2
+                       : value <= UINT32_MAX ? 4
+                                             : 8;
+  out[0] = type | (uint8_t)(length_size == 1   ? 24
+                            : length_size == 2 ? 25
+                            : length_size == 4 ? 26
+                                               : 27);
+  for (size_t i = 0; i < length_size; i++) {
+    out[length_size - i] = (uint8_t)(value >> (8 * i));
+  }
+  return 1 + length_size;
+}
+
+/**
+ * Writes the head of the signed array and its context
+ */
+static size_t put_context(uint8_t *out, uint8_t array_head,
+                          const char *context, size_t context_size) {
+  size_t size = 0;
+  out[size++] = array_head;
+  size += put_head(out + size, CBOR_TEXT_MAJOR_TYPE, context_size);
+  memcpy(out + size, context, context_size);
+  return size + context_size;
+}
+
+/**
+ * Writes the ingestion time, the key id and the head of the signed byte
+ * string that follows them
+ */
+static size_t put_middle(uint8_t *out, const detached_signature *signature,
+                         size_t bytes_size) {
+  size_t size = 0;
+  out[size++] = CBOR_UINT64_HEAD;
+  for (int i = 7; i >= 0; i--) {
+    out[size++] = (uint8_t)(signature->ingestion_time >> (8 * i));
+  }
+  size += put_head(out + size, CBOR_BYTES_MAJOR_TYPE, SIGNING_KEY_ID_BYTES);
+  memcpy(out + size, signature->key_id, SIGNING_KEY_ID_BYTES);
+  size += SIGNING_KEY_ID_BYTES;
+  return size + put_head(out + size, CBOR_BYTES_MAJOR_TYPE, bytes_size);
+}
+
+void detached_signature_input_init(detached_signature_input *input,
+                                   const char *topic,
+                                   const detached_signature *signature,
+                                   const void *payload, size_t payload_size) {
+  size_t topic_size = strlen(topic);
+
+  size_t head_size = put_context(input->head, CBOR_ARRAY_FIVE_ITEMS, CONTEXT,
+                                 sizeof(CONTEXT) - 1);
+  head_size += put_head(input->head + head_size, CBOR_TEXT_MAJOR_TYPE,
+                        topic_size);
+  size_t middle_size = put_middle(input->middle, signature, payload_size);
+
+  input->parts[0] = (signing_part){input->head, head_size};
+  input->parts[1] = (signing_part){(const uint8_t *)topic, topic_size};
+  input->parts[2] = (signing_part){input->middle, middle_size};
+  input->parts[3] = (signing_part){(const uint8_t *)payload, payload_size};
+}
+
+void detached_signature_countersign_input_init(
+    detached_signature_input *input, const detached_signature *signature,
+    const uint8_t *map, size_t open_size) {
+  size_t head_size =
+      put_context(input->head, CBOR_ARRAY_FOUR_ITEMS, COUNTERSIGN_CONTEXT,
+                  sizeof(COUNTERSIGN_CONTEXT) - 1);
+  size_t middle_size = put_middle(input->middle, signature, open_size + 1);
+
+  input->parts[0] = (signing_part){input->head, head_size};
+  input->parts[1] = (signing_part){input->middle, middle_size};
+  input->parts[2] = (signing_part){map, open_size};
+  input->parts[3] = (signing_part){BREAK, sizeof(BREAK)};
+}
+
+void detached_signature_format(const detached_signature *signature,
+                               char *time, char *key_id, char *token) {
+  snprintf(time, DETACHED_SIGNATURE_TIME_TEXT_SIZE, "%" PRIu64,
+           signature->ingestion_time);
+  sodium_bin2hex(key_id, DETACHED_SIGNATURE_KEY_ID_TEXT_SIZE,
+                 signature->key_id, SIGNING_KEY_ID_BYTES);
+  sodium_bin2base64(token, DETACHED_SIGNATURE_TOKEN_TEXT_SIZE,
+                    signature->signature, SIGNING_CONTEXT_SIGNATURE_BYTES,
+                    TOKEN_VARIANT);
+}
+
+static bool parse_time(const char *value, uint64_t *time) {
+  if (*value < '0' || *value > '9') {
+    return false;
+  }
+  char *end = NULL;
+  errno = 0;
+  unsigned long long parsed = strtoull(value, &end, 10);
+  if (*end != '\0' || errno == ERANGE) {
+    return false;
+  }
+  *time = (uint64_t)parsed;
+  return true;
+}
+
+static bool decode(const char *value, uint8_t *out, size_t size,
+                   bool base64) {
+  size_t decoded = 0;
+  int result =
+      base64 ? sodium_base642bin(out, size, value, strlen(value), NULL,
+                                 &decoded, NULL, TOKEN_VARIANT)
+             : sodium_hex2bin(out, size, value, strlen(value), NULL, &decoded,
+                              NULL);
+  return result == 0 && decoded == size;
+}
+
+bool detached_signature_read_property(detached_signature *signature,
+                                      const char *name, const char *value) {
+  if (strcmp(name, DETACHED_SIGNATURE_TIME_PROPERTY) == 0) {
+    if (!parse_time(value, &signature->ingestion_time)) {
+      return false;
+    }
+    signature->present |= PRESENT_TIME;
+  } else if (strcmp(name, DETACHED_SIGNATURE_KEY_ID_PROPERTY) == 0) {
+    if (!decode(value, signature->key_id, SIGNING_KEY_ID_BYTES, false)) {
+      return false;
+    }
+    signature->present |= PRESENT_KEY_ID;
+  } else if (strcmp(name, DETACHED_SIGNATURE_TOKEN_PROPERTY) == 0) {
+    if (!decode(value, signature->signature, SIGNING_CONTEXT_SIGNATURE_BYTES,
+                true)) {
+      return false;
+    }
+    signature->present |= PRESENT_TOKEN;
+  }
+  return true;
+}
+
+bool detached_signature_is_complete(const detached_signature *signature) {
+  return (signature->present & PRESENT_ALL) == PRESENT_ALL;
+}
+
+void detached_signature_pack(const detached_signature *signature,
+                             uint8_t *out) {
+  for (int i = 0; i < 8; i++) {
+    out[i] = (uint8_t)(signature->ingestion_time >> (8 * (7 - i)));
+  }
+  memcpy(out + 8, signature->key_id, SIGNING_KEY_ID_BYTES);
+  memcpy(out + 8 + SIGNING_KEY_ID_BYTES, signature->signature,
+         SIGNING_CONTEXT_SIGNATURE_BYTES);
+}
+
+bool detached_signature_unpack(detached_signature *signature,
+                               const uint8_t *data, size_t size) {
+  if (size != DETACHED_SIGNATURE_PACKED_BYTES) {
+    return false;
+  }
+
+  signature->ingestion_time = 0;
+  for (int i = 0; i < 8; i++) {
+    signature->ingestion_time = (signature->ingestion_time << 8) | data[i];
+  }
+  memcpy(signature->key_id, data + 8, SIGNING_KEY_ID_BYTES);
+  memcpy(signature->signature, data + 8 + SIGNING_KEY_ID_BYTES,
+         SIGNING_CONTEXT_SIGNATURE_BYTES);
+  signature->present = PRESENT_ALL;
+  return true;
+}
@@ -0,0 +1,132 @@
+#pragma once
+#include "signing_context.h"
+#include "signing_key.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** Names of the MQTT v5 user properties carrying a detached signature */
+#define DETACHED_SIGNATURE_TIME_PROPERTY "INGESTION_TIME"
+#define DETACHED_SIGNATURE_KEY_ID_PROPERTY "KEY_ID"
+#define DETACHED_SIGNATURE_TOKEN_PROPERTY "VERIFICATION_TOKEN"
+
+/** Sizes of the property values, with their terminating null: a decimal
+ * 64 bits integer, the hex key id and the padded base64 signature */
+#define DETACHED_SIGNATURE_TIME_TEXT_SIZE 21
+#define DETACHED_SIGNATURE_KEY_ID_TEXT_SIZE (2 * SIGNING_KEY_ID_BYTES + 1)
+#define DETACHED_SIGNATURE_TOKEN_TEXT_SIZE 89
+
+/** Size of a signature packed by detached_signature_pack */
+#define DETACHED_SIGNATURE_PACKED_BYTES                                        \
+  (8 + SIGNING_KEY_ID_BYTES + SIGNING_CONTEXT_SIGNATURE_BYTES)
+
+/** Number of parts of the signed bytes */
+#define DETACHED_SIGNATURE_PARTS 4
+
+/**
+ * Signature of a message whose payload is left untouched, carried by user
+ * properties next to the payload
+ */
+typedef struct {
+  /** Ingestion time in the time precision unit since the Unix epoch */
+  uint64_t ingestion_time;
+  uint8_t key_id[SIGNING_KEY_ID_BYTES];
+  uint8_t signature[SIGNING_CONTEXT_SIGNATURE_BYTES];
+
+  /** Properties read by detached_signature_read_property, as a bit set */
+  unsigned present;
+} detached_signature;
+
+/**
+ * Bytes covered by a detached signature, the encoded CBOR array
+ * ["message-sign detached", topic, ingestion time, key id, payload] where the
+ * ingestion time is an unsigned integer always encoded on 64 bits. Only the
+ * heads of the array items are written, the topic and the payload are
+ * referenced in place.
+ */
+typedef struct {
+  uint8_t head[32];
+  uint8_t middle[32];
+  signing_part parts[DETACHED_SIGNATURE_PARTS];
+} detached_signature_input;
+
+/**
+ * Describes the bytes covered by the signature of a message
+ *
+ * \param input input to initialize, referencing the topic and the payload
+ * \param topic topic of the message
+ * \param signature ingestion time and key id of the signature
+ * \param payload payload of the message, may be null when empty
+ * \param payload_size size of the payload in bytes
+ */
+void detached_signature_input_init(detached_signature_input *input,
+                                   const char *topic,
+                                   const detached_signature *signature,
+                                   const void *payload, size_t payload_size);
+
+/**
+ * Describes the bytes covered by a countersignature, the encoded CBOR array
+ * ["message-sign countersigned", ingestion time, key id, message] where the
+ * message is a byte string holding a map signed by another broker, as it was
+ * received. The map is referenced in place up to its closing break, which is
+ * a part of its own, so that a verifier can countersign the map found at the
+ * start of a countersigned message.
+ *
+ * \param input input to initialize, referencing the map
+ * \param signature ingestion time and key id of the countersignature
+ * \param map signed map
+ * \param open_size size of the map without its closing break
+ */
+void detached_signature_countersign_input_init(
+    detached_signature_input *input, const detached_signature *signature,
+    const uint8_t *map, size_t open_size);
+
+/**
+ * Writes the values of the user properties of a signature
+ *
+ * \param signature signature
+ * \param time out DETACHED_SIGNATURE_TIME_TEXT_SIZE bytes
+ * \param key_id out DETACHED_SIGNATURE_KEY_ID_TEXT_SIZE bytes
+ * \param token out DETACHED_SIGNATURE_TOKEN_TEXT_SIZE bytes
+ */
+void detached_signature_format(const detached_signature *signature,
+                               char *time, char *key_id, char *token);
+
+/**
+ * Reads a user property of a message into a signature, the other properties
+ * are ignored
+ *
+ * \param signature signature, zeroed before the first property
+ * \param name name of the property
+ * \param value value of the property
+ * \returns false if the property is a signature property with an invalid
+ * value
+ */
+bool detached_signature_read_property(detached_signature *signature,
+                                      const char *name, const char *value);
+
+/**
+ * Returns whether every signature property has been read
+ */
+bool detached_signature_is_complete(const detached_signature *signature);
+
+/**
+ * Packs a signature into bytes, as kept by the audit log: the ingestion time
+ * as a big endian 64 bits integer, the key id and the signature
+ *
+ * \param signature signature
+ * \param out out DETACHED_SIGNATURE_PACKED_BYTES bytes
+ */
+void detached_signature_pack(const detached_signature *signature,
+                             uint8_t *out);
+
+/**
+ * Unpacks a signature packed by detached_signature_pack
+ *
+ * \param signature out signature, complete on success
+ * \param data packed signature
+ * \param size size of the packed signature
+ * \returns false if the size is not DETACHED_SIGNATURE_PACKED_BYTES
+ */
+bool detached_signature_unpack(detached_signature *signature,
+                               const uint8_t *data, size_t size);
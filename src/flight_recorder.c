@@ -0,0 +1,141 @@
+#include "flight_recorder.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325u
+#define FNV_PRIME 0x100000001b3u
+
+struct flight_recorder {
+  flight_recorder_header *header;
+  flight_recorder_slot *slots;
+  size_t mapped_size;
+
+  /** Copy of the header write count, only this writer updates it */
+  uint64_t write_count;
+};
+
+flight_recorder *flight_recorder_open(const char *path, size_t capacity) {
+  if (capacity == 0) {
+    return NULL;
+  }
+
+  flight_recorder *recorder =
+      (flight_recorder *)calloc(1, sizeof(flight_recorder));
+  if (recorder == NULL) {
+    return NULL;
+  }
+
+  recorder->mapped_size = sizeof(flight_recorder_header) +
+                          capacity * sizeof(flight_recorder_slot);
+
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    free(recorder);
+    return NULL;
+  }
+
+  // Allocate the blocks now, so that writes never fault on a full disk
+  if (posix_fallocate(fd, 0, (off_t)recorder->mapped_size) != 0) {
+    close(fd);
+    free(recorder);
+    return NULL;
+  }
+
+  void *data = mmap(NULL, recorder->mapped_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    free(recorder);
+    return NULL;
+  }
+
+  recorder->header = (flight_recorder_header *)data;
+  recorder->slots =
+      (flight_recorder_slot *)((uint8_t *)data + sizeof(flight_recorder_header));
+
+  recorder->header->version = FLIGHT_RECORDER_VERSION;
+  recorder->header->slot_size = sizeof(flight_recorder_slot);
+  recorder->header->stage_count = METRICS_STAGE_COUNT;
+  recorder->header->capacity = capacity;
+  atomic_store_explicit(&recorder->header->write_count, 0,
+                        memory_order_relaxed);
+
+  // Written last, so that readers ignore a file being initialized
+  atomic_thread_fence(memory_order_release);
+  recorder->header->magic = FLIGHT_RECORDER_MAGIC;
+
+  return recorder;
+}
+
+void flight_recorder_write(flight_recorder *recorder,
+                           const flight_record *record) {
+  uint64_t index = recorder->write_count++;
+  flight_recorder_slot *slot =
+      &recorder->slots[index % recorder->header->capacity];
+
+  // Seqlock: odd while writing, then even and unique to this index
+  atomic_store_explicit(&slot->sequence, 2 * index + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  slot->record = *record;
+  atomic_store_explicit(&slot->sequence, 2 * index + 2, memory_order_release);
+
+  atomic_store_explicit(&recorder->header->write_count, recorder->write_count,
+                        memory_order_release);
+}
+
+void flight_recorder_close(flight_recorder *recorder) {
+  if (recorder == NULL) {
+    return;
+  }
+  munmap(recorder->header, recorder->mapped_size);
+  free(recorder);
+}
+
+bool flight_recorder_check(const void *data, size_t size) {
+  const flight_recorder_header *header = (const flight_recorder_header *)data;
+
+  if (size < sizeof(flight_recorder_header) ||
+      header->magic != FLIGHT_RECORDER_MAGIC ||
+      header->version != FLIGHT_RECORDER_VERSION ||
+      header->slot_size != sizeof(flight_recorder_slot) ||
+      header->stage_count != METRICS_STAGE_COUNT || header->capacity == 0) {
+    return false;
+  }
+
+  return (size - sizeof(flight_recorder_header)) / sizeof(flight_recorder_slot) >=
+         header->capacity;
+}
+
+bool flight_recorder_read(const void *data, uint64_t index,
+                          flight_record *record) {
+  const flight_recorder_header *header = (const flight_recorder_header *)data;
+  const flight_recorder_slot *slots =
+      (const flight_recorder_slot *)((const uint8_t *)data +
+                                     sizeof(flight_recorder_header));
+  const flight_recorder_slot *slot = &slots[index % header->capacity];
+
+  uint64_t expected = 2 * index + 2;
+  if (atomic_load_explicit(&slot->sequence, memory_order_acquire) !=
+      expected) {
+    return false;
+  }
+
+  *record = slot->record;
+
+  atomic_thread_fence(memory_order_acquire);
+  return atomic_load_explicit(&slot->sequence, memory_order_relaxed) ==
+         expected;
+}
+
+uint64_t flight_recorder_topic_hash(const char *topic) {
+  uint64_t hash = FNV_OFFSET_BASIS;
+  for (const unsigned char *c = (const unsigned char *)topic; *c != '\0';
+       c++) {
+    hash ^= *c;
+    hash *= FNV_PRIME;
+  }
+  return hash;
+}
@@ -0,0 +1,125 @@
+#pragma once
+#include "metrics.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define FLIGHT_RECORDER_MAGIC 0x5246534du /* "MSFR" */
+#define FLIGHT_RECORDER_VERSION 1
+
+/** Outcome of a recorded message that was signed, other outcomes are the
+ * metrics_rejection reason plus one */
+#define FLIGHT_RECORD_SIGNED 0
+
+/** Outcome of a recorded message already signed by another broker and
+ * delivered unchanged */
+#define FLIGHT_RECORD_PASSED UINT32_MAX
+
+/**
+ * Header at the start of a flight recorder file
+ */
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t slot_size;
+  uint32_t stage_count;
+  uint64_t capacity;
+
+  /** Number of records written since the file was created, the last
+   * capacity records are kept */
+  _Atomic uint64_t write_count;
+
+  uint8_t reserved[32];
+} flight_recorder_header;
+
+/**
+ * Message recorded by the flight recorder
+ */
+typedef struct {
+  /** Ingestion time in nanoseconds since the Unix epoch */
+  uint64_t timestamp_ns;
+
+  /** FNV-1a hash of the topic */
+  uint64_t topic_hash;
+
+  uint32_t payload_size;
+
+  /** FLIGHT_RECORD_SIGNED, FLIGHT_RECORD_PASSED or metrics_rejection + 1 */
+  uint32_t outcome;
+
+  /** Time spent in every metrics_stage, in nanoseconds */
+  uint64_t stage_ns[METRICS_STAGE_COUNT];
+} flight_record;
+
+/**
+ * Slot of the ring buffer, the sequence makes torn reads from another process
+ * detectable: it is odd while the record is being written
+ */
+typedef struct {
+  _Atomic uint64_t sequence;
+  flight_record record;
+} flight_recorder_slot;
+
+/**
+ * Opaque struct representing a flight recorder writing to a memory mapped
+ * ring buffer file. Writes are lock-free and never block, the file can be
+ * decoded while the broker is running or after a crash.
+ */
+typedef struct flight_recorder flight_recorder;
+
+/**
+ * Creates or replaces a flight recorder file and maps it in memory
+ *
+ * \param path path of the file
+ * \param capacity number of records kept
+ * \returns handle to the flight recorder on success, null otherwise
+ */
+flight_recorder *flight_recorder_open(const char *path, size_t capacity);
+
+/**
+ * Writes a record, overwriting the oldest one when the ring buffer is full.
+ * Must be called from a single thread.
+ *
+ * \param recorder handle to the flight recorder
+ * \param record record to write
+ */
+void flight_recorder_write(flight_recorder *recorder,
+                           const flight_record *record);
+
+/**
+ * Unmaps and closes the flight recorder file, the file is kept
+ *
+ * \param recorder handle to the flight recorder
+ */
+void flight_recorder_close(flight_recorder *recorder);
+
+/**
+ * Checks the header of a mapped flight recorder file
+ *
+ * \param data mapped file
+ * \param size size of the mapped file
+ * \returns true if the file is a flight recorder file of this version
+ */
+bool flight_recorder_check(const void *data, size_t size);
+
+/**
+ * Reads a record of a mapped flight recorder file
+ *
+ * \param data mapped file, checked with flight_recorder_check
+ * \param index index of the record, from write_count - capacity (or 0) to
+ * write_count - 1
+ * \param record out record
+ * \returns true if the record was read, false if it was overwritten or
+ * being written
+ */
+bool flight_recorder_read(const void *data, uint64_t index,
+                          flight_record *record);
+
+/**
+ * Hashes a topic for a record
+ *
+ * \param topic topic
+ * \returns FNV-1a 64 bit hash of the topic
+ */
+uint64_t flight_recorder_topic_hash(const char *topic);
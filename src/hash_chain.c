@@ -0,0 +1,39 @@
+#include "hash_chain.h"
+#include <sodium.h>
+
+void hash_chain_init(hash_chain *chain, const uint8_t *public_key,
+                     size_t public_key_size) {
+  crypto_generichash(chain->head, HASH_CHAIN_LINK_BYTES, public_key,
+                     public_key_size, NULL, 0);
+  chain->sequence = 0;
+  chain->checkpoint_sequence = 0;
+}
+
+uint64_t hash_chain_next_sequence(const hash_chain *chain) {
+  return chain->sequence + 1;
+}
+
+error_code hash_chain_append(hash_chain *chain, const uint8_t *message,
+                             size_t message_size) {
+  crypto_generichash_state state;
+
+  if (crypto_generichash_init(&state, NULL, 0, HASH_CHAIN_LINK_BYTES) != 0 ||
+      crypto_generichash_update(&state, chain->head, HASH_CHAIN_LINK_BYTES) !=
+          0 ||
+      crypto_generichash_update(&state, message, message_size) != 0 ||
+      crypto_generichash_final(&state, chain->head, HASH_CHAIN_LINK_BYTES) !=
+          0) {
+    return ERROR_UNKNOWN;
+  }
+
+  chain->sequence++;
+  return SUCCESS;
+}
+
+uint64_t hash_chain_pending(const hash_chain *chain) {
+  return chain->sequence - chain->checkpoint_sequence;
+}
+
+void hash_chain_mark_checkpoint(hash_chain *chain) {
+  chain->checkpoint_sequence = chain->sequence;
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include "error.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/** Size in bytes of a link of the chain (BLAKE2b-256) */
+#define HASH_CHAIN_LINK_BYTES 32
+
+/**
+ * Hash chain over signed messages. Each link is the BLAKE2b hash of the
+ * previous link followed by the message bytes, so that signing the head of
+ * the chain authenticates every message before it.
+ */
+typedef struct {
+  /** Last link of the chain */
+  uint8_t head[HASH_CHAIN_LINK_BYTES];
+
+  /** Sequence number of the last link, 0 for the genesis link */
+  uint64_t sequence;
+
+  /** Sequence number of the last link covered by a checkpoint */
+  uint64_t checkpoint_sequence;
+} hash_chain;
+
+/**
+ * Initializes a chain. The genesis link is the hash of the public key that
+ * signs the checkpoints, which binds the chain to the key.
+ *
+ * \param chain chain to initialize
+ * \param public_key ED25519 public key
+ * \param public_key_size size of the public key
+ */
+void hash_chain_init(hash_chain *chain, const uint8_t *public_key,
+                     size_t public_key_size);
+
+/**
+ * Returns the sequence number that the next message will have
+ */
+uint64_t hash_chain_next_sequence(const hash_chain *chain);
+
+/**
+ * Appends a message to the chain, updating the head and the sequence number
+ *
+ * \param chain chain
+ * \param message bytes of the message
+ * \param message_size size of the message
+ * \returns a error code
+ */
+error_code hash_chain_append(hash_chain *chain, const uint8_t *message,
+                             size_t message_size);
+
+/**
+ * Returns the number of messages not covered by a checkpoint yet
+ */
+uint64_t hash_chain_pending(const hash_chain *chain);
+
+/**
+ * Marks every message appended so far as covered by a checkpoint
+ */
+void hash_chain_mark_checkpoint(hash_chain *chain);
@@ -0,0 +1,170 @@
+#include "ingestion_clock.h"
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define HAS_TSC 1
+#else
+#define HAS_TSC 0
+#endif
+
+#define CALIBRATION_NS 10000000u
+#define NS_PER_S 1000000000u
+
+#define CBOR_UINT64_HEAD 0x1b
+#define CBOR_TAG_EPOCH_TIME 0xc1
+#define CBOR_FLOAT64_HEAD 0xfb
+
+static uint64_t read_clock(clockid_t id) {
+  struct timespec ts;
+  clock_gettime(id, &ts);
+  return (uint64_t)ts.tv_sec * NS_PER_S + (uint64_t)ts.tv_nsec;
+}
+
+#if HAS_TSC
+/**
+ * Checks the invariant TSC flag: the counter runs at a constant rate in every
+ * power state and is synchronized between cores
+ */
+static int tsc_is_invariant(void) {
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx)) {
+    return 0;
+  }
+  return (edx >> 8) & 1u;
+}
+
+/**
+ * Reads the realtime clock and the TSC together, the TSC value is the middle
+ * of the realtime clock read
+ */
+static void read_anchor(uint64_t *ns, uint64_t *tsc) {
+  uint64_t before = __rdtsc();
+  *ns = read_clock(CLOCK_REALTIME);
+  uint64_t after = __rdtsc();
+  *tsc = before + (after - before) / 2;
+}
+#endif
+
+error_code ingestion_clock_init(ingestion_clock *clock, clock_source source,
+                                time_precision precision,
+                                time_encoding encoding) {
+  memset(clock, 0, sizeof(ingestion_clock));
+  clock->source = source;
+  clock->precision = precision;
+  clock->encoding = encoding;
+
+  if (source != CLOCK_SOURCE_TSC) {
+    return SUCCESS;
+  }
+
+#if HAS_TSC
+  if (!tsc_is_invariant()) {
+    return ERROR_INVALID_ARGUMENT;
+  }
+
+  read_anchor(&clock->anchor_ns, &clock->anchor_tsc);
+
+  struct timespec pause = {.tv_sec = 0, .tv_nsec = CALIBRATION_NS};
+  nanosleep(&pause, NULL);
+
+  // The first calibration is the same as a correction of a clock counting
+  // one nanosecond per tick
+  clock->ns_per_tick = UINT64_C(1) << 32;
+  ingestion_clock_recalibrate(clock);
+  return clock->ns_per_tick != 0 ? SUCCESS : ERROR_UNKNOWN;
+#else
+  return ERROR_INVALID_ARGUMENT;
+#endif
+}
+
+uint64_t ingestion_clock_now_ns(const ingestion_clock *clock) {
+  switch (clock->source) {
+  case CLOCK_SOURCE_REALTIME_COARSE:
+    return read_clock(CLOCK_REALTIME_COARSE);
+#if HAS_TSC
+  case CLOCK_SOURCE_TSC: {
+    uint64_t tsc = __rdtsc();
+    if (tsc <= clock->anchor_tsc) {
+      return clock->anchor_ns;
+    }
+    unsigned __int128 elapsed =
+        (unsigned __int128)(tsc - clock->anchor_tsc) * clock->ns_per_tick;
+    return clock->anchor_ns + (uint64_t)(elapsed >> 32);
+  }
+#endif
+  default:
+    return read_clock(CLOCK_REALTIME);
+  }
+}
+
+void ingestion_clock_recalibrate(ingestion_clock *clock) {
+#if HAS_TSC
+  if (clock->source != CLOCK_SOURCE_TSC) {
+    return;
+  }
+
+  uint64_t ns = 0;
+  uint64_t tsc = 0;
+  read_anchor(&ns, &tsc);
+
+  // A realtime clock stepped back keeps the previous rate
+  if (tsc > clock->anchor_tsc && ns > clock->anchor_ns) {
+    clock->ns_per_tick =
+        (uint64_t)(((unsigned __int128)(ns - clock->anchor_ns) << 32) /
+                   (tsc - clock->anchor_tsc));
+  }
+  clock->anchor_ns = ns;
+  clock->anchor_tsc = tsc;
+#else
+  (void)clock;
+#endif
+}
+
+size_t ingestion_clock_encoded_size(const ingestion_clock *clock) {
+  return clock->encoding == TIME_ENCODING_TAG ? 10 : 9;
+}
+
+static void put_uint64_be(uint8_t *out, uint64_t value) {
+  for (int i = 7; i >= 0; i--) {
+    out[i] = (uint8_t)value;
+    value >>= 8;
+  }
+}
+
+static uint64_t unit_ns(const ingestion_clock *clock) {
+  switch (clock->precision) {
+  case TIME_PRECISION_MS:
+    return 1000000u;
+  case TIME_PRECISION_US:
+    return 1000u;
+  default:
+    return 1;
+  }
+}
+
+uint64_t ingestion_clock_units(const ingestion_clock *clock, uint64_t time_ns) {
+  return time_ns / unit_ns(clock);
+}
+
+size_t ingestion_clock_encode(const ingestion_clock *clock, uint64_t time_ns,
+                              uint8_t *out) {
+  uint64_t units = ingestion_clock_units(clock, time_ns);
+
+  if (clock->encoding == TIME_ENCODING_TAG) {
+    double seconds = (double)units / (double)(NS_PER_S / unit_ns(clock));
+    uint64_t bits;
+    memcpy(&bits, &seconds, sizeof(bits));
+
+    out[0] = CBOR_TAG_EPOCH_TIME;
+    out[1] = CBOR_FLOAT64_HEAD;
+    put_uint64_be(out + 2, bits);
+    return 10;
+  }
+
+  out[0] = CBOR_UINT64_HEAD;
+  put_uint64_be(out + 1, units);
+  return 9;
+}
@@ -0,0 +1,119 @@
+#pragma once
+#include "error.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/** Maximum encoded size of an ingestion time: tag 1 followed by a float64 */
+#define INGESTION_CLOCK_MAX_ENCODED_SIZE 10
+
+/**
+ * Source of the ingestion time
+ */
+typedef enum {
+  /** clock_gettime(CLOCK_REALTIME) */
+  CLOCK_SOURCE_REALTIME = 0,
+
+  /** clock_gettime(CLOCK_REALTIME_COARSE), resolution of a kernel tick */
+  CLOCK_SOURCE_REALTIME_COARSE,
+
+  /** Time stamp counter calibrated against, and anchored to, the realtime
+   * clock. Needs an invariant TSC. */
+  CLOCK_SOURCE_TSC
+} clock_source;
+
+/**
+ * Unit of the encoded ingestion time
+ */
+typedef enum {
+  TIME_PRECISION_MS = 0,
+  TIME_PRECISION_US,
+  TIME_PRECISION_NS
+} time_precision;
+
+/**
+ * Encoding of the ingestion time
+ */
+typedef enum {
+  /** Unsigned integer in the precision unit since the Unix epoch, always
+   * encoded on 64 bits */
+  TIME_ENCODING_UINT = 0,
+
+  /** Epoch-based date/time (tag 1) of a float64 number of seconds, rounded
+   * to the precision first */
+  TIME_ENCODING_TAG
+} time_encoding;
+
+/**
+ * Clock giving the ingestion time of messages
+ */
+typedef struct {
+  clock_source source;
+  time_precision precision;
+  time_encoding encoding;
+
+  /** Realtime and TSC values read together, origin of the TSC clock */
+  uint64_t anchor_ns;
+  uint64_t anchor_tsc;
+
+  /** Nanoseconds per TSC tick, as a 32.32 fixed point number */
+  uint64_t ns_per_tick;
+} ingestion_clock;
+
+/**
+ * Initializes a clock. The TSC source is calibrated for a few milliseconds.
+ *
+ * \param clock clock to initialize
+ * \param source source of the time
+ * \param precision unit of the encoded time
+ * \param encoding encoding of the time
+ * \returns ERROR_INVALID_ARGUMENT if the TSC is requested but is not invariant
+ * or not available on this architecture, SUCCESS otherwise
+ */
+error_code ingestion_clock_init(ingestion_clock *clock, clock_source source,
+                                time_precision precision,
+                                time_encoding encoding);
+
+/**
+ * Reads the clock
+ *
+ * \param clock clock
+ * \returns nanoseconds since the Unix epoch
+ */
+uint64_t ingestion_clock_now_ns(const ingestion_clock *clock);
+
+/**
+ * Corrects the TSC calibration with the ticks counted since the last anchor,
+ * and anchors the clock again to the realtime clock. Does nothing for the
+ * other sources.
+ *
+ * \param clock clock
+ */
+void ingestion_clock_recalibrate(ingestion_clock *clock);
+
+/**
+ * Encoded size of the times of a clock, the same for every time
+ *
+ * \param clock clock
+ * \returns size in bytes of an encoded time
+ */
+size_t ingestion_clock_encoded_size(const ingestion_clock *clock);
+
+/**
+ * Converts a time read from the clock to its precision
+ *
+ * \param clock clock
+ * \param time_ns nanoseconds since the Unix epoch
+ * \returns time in the precision unit since the Unix epoch
+ */
+uint64_t ingestion_clock_units(const ingestion_clock *clock, uint64_t time_ns);
+
+/**
+ * Encodes a time read from the clock with its precision and encoding
+ *
+ * \param clock clock
+ * \param time_ns nanoseconds since the Unix epoch
+ * \param out output buffer of at least INGESTION_CLOCK_MAX_ENCODED_SIZE bytes
+ * \returns size in bytes of the encoded time
+ */
+size_t ingestion_clock_encode(const ingestion_clock *clock, uint64_t time_ns,
+                              uint8_t *out);
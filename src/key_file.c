@@ -0,0 +1,170 @@
+#include "key_file.h"
+#include <ctype.h>
+#include <fcntl.h>
+#include <sodium.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static const uint8_t KEY_FILE_MAGIC[8] = {'M', 'S', 'K', 'E', 'Y', 0, 0, 2};
+
+/** Magic of the key files written before the algorithm was sealed */
+static const uint8_t KEY_FILE_MAGIC_V1[8] = {'M', 'S', 'K', 'E', 'Y',
+                                             0,   0,   1};
+
+#define NONCE_OFFSET sizeof(KEY_FILE_MAGIC)
+#define BOX_OFFSET (NONCE_OFFSET + crypto_secretbox_NONCEBYTES)
+
+/** Sealed content: the creation time in big endian, the algorithm, then the
+ * seed */
+#define PLAIN_BYTES (8 + 1 + SIGNING_KEY_SEED_BYTES)
+
+/** Sealed content of the files written before the algorithm was sealed,
+ * without the algorithm */
+#define PLAIN_BYTES_V1 (8 + SIGNING_KEY_SEED_BYTES)
+#define KEY_FILE_SIZE_V1 (KEY_FILE_SIZE - 1)
+
+_Static_assert(BOX_OFFSET + crypto_secretbox_MACBYTES + PLAIN_BYTES ==
+                   KEY_FILE_SIZE,
+               "Unexpected key file layout");
+_Static_assert(BOX_OFFSET + crypto_secretbox_MACBYTES + PLAIN_BYTES_V1 ==
+                   KEY_FILE_SIZE_V1,
+               "Unexpected key file layout");
+_Static_assert(KEY_FILE_SECRET_BYTES == crypto_secretbox_KEYBYTES,
+               "Unexpected secret size");
+
+/**
+ * Decodes a hex encoded secret, ignoring surrounding whitespace
+ */
+static error_code parse_secret(const char *hex, size_t size,
+                               uint8_t *secret) {
+  while (size > 0 && isspace((unsigned char)*hex)) {
+    hex++;
+    size--;
+  }
+  while (size > 0 && isspace((unsigned char)hex[size - 1])) {
+    size--;
+  }
+
+  size_t secret_size = 0;
+  if (size != 2 * KEY_FILE_SECRET_BYTES ||
+      sodium_hex2bin(secret, KEY_FILE_SECRET_BYTES, hex, size, NULL,
+                     &secret_size, NULL) != 0 ||
+      secret_size != KEY_FILE_SECRET_BYTES) {
+    return ERROR_INVALID_ARGUMENT;
+  }
+  return SUCCESS;
+}
+
+error_code key_file_load_secret(const char *path, uint8_t *secret) {
+  if (path == NULL) {
+    const char *hex = getenv(KEY_FILE_SECRET_ENV);
+    return hex != NULL ? parse_secret(hex, strlen(hex), secret)
+                       : ERROR_INVALID_ARGUMENT;
+  }
+
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    return ERROR_INVALID_ARGUMENT;
+  }
+
+  // Room for the hex digits, a line ending and one more byte to detect
+  // longer files
+  char hex[2 * KEY_FILE_SECRET_BYTES + 4];
+  size_t size = fread(hex, 1, sizeof(hex), file);
+  fclose(file);
+
+  error_code error = size < sizeof(hex) ? parse_secret(hex, size, secret)
+                                        : ERROR_INVALID_ARGUMENT;
+  sodium_memzero(hex, sizeof(hex));
+  return error;
+}
+
+error_code key_file_write(const char *path, const signing_key *key,
+                          const uint8_t *secret) {
+  uint8_t plain[PLAIN_BYTES];
+  for (int i = 0; i < 8; i++) {
+    plain[i] = (uint8_t)(key->create_time_unix >> (56 - 8 * i));
+  }
+  plain[8] = (uint8_t)key->context.algorithm;
+  crypto_sign_ed25519_sk_to_seed(plain + 9, key->private_key);
+
+  uint8_t data[KEY_FILE_SIZE];
+  memcpy(data, KEY_FILE_MAGIC, sizeof(KEY_FILE_MAGIC));
+  randombytes_buf(data + NONCE_OFFSET, crypto_secretbox_NONCEBYTES);
+  crypto_secretbox_easy(data + BOX_OFFSET, plain, sizeof(plain),
+                        data + NONCE_OFFSET, secret);
+  sodium_memzero(plain, sizeof(plain));
+
+  int fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0600);
+  if (fd < 0) {
+    return ERROR_UNKNOWN;
+  }
+
+  bool written = write(fd, data, sizeof(data)) == (ssize_t)sizeof(data) &&
+                 fsync(fd) == 0;
+  if (close(fd) != 0 || !written) {
+    unlink(path);
+    return ERROR_UNKNOWN;
+  }
+  return SUCCESS;
+}
+
+error_code key_file_read(const char *path, const uint8_t *secret,
+                         signing_key **key, bool *algorithm_sealed) {
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    return ERROR_UNKNOWN;
+  }
+
+  uint8_t data[KEY_FILE_SIZE + 1];
+  size_t size = fread(data, 1, sizeof(data), file);
+  bool read_error = ferror(file) != 0;
+  fclose(file);
+  if (read_error) {
+    return ERROR_UNKNOWN;
+  }
+
+  bool sealed = size == KEY_FILE_SIZE &&
+                memcmp(data, KEY_FILE_MAGIC, sizeof(KEY_FILE_MAGIC)) == 0;
+  bool v1 = size == KEY_FILE_SIZE_V1 &&
+            memcmp(data, KEY_FILE_MAGIC_V1, sizeof(KEY_FILE_MAGIC_V1)) == 0;
+
+  // Files without algorithm are unsealed one byte further, so that their
+  // seed lands at the same offset
+  uint8_t plain[PLAIN_BYTES] = {0};
+  uint8_t *box = sealed ? plain : plain + 1;
+  if ((!sealed && !v1) ||
+      crypto_secretbox_open_easy(box, data + BOX_OFFSET, size - BOX_OFFSET,
+                                 data + NONCE_OFFSET, secret) != 0) {
+    return ERROR_INVALID_ARGUMENT;
+  }
+  if (v1) {
+    memmove(plain, plain + 1, 8);
+    plain[8] = SIGNING_ALGORITHM_ED25519;
+  }
+
+  uint64_t create_time_unix = 0;
+  for (int i = 0; i < 8; i++) {
+    create_time_unix = create_time_unix << 8 | plain[i];
+  }
+  signing_algorithm algorithm = (signing_algorithm)plain[8];
+  if (plain[8] >= SIGNING_ALGORITHM_COUNT) {
+    sodium_memzero(plain, sizeof(plain));
+    return ERROR_INVALID_ARGUMENT;
+  }
+
+  *key = signing_key_from_seed(plain + 9, create_time_unix);
+  sodium_memzero(plain, sizeof(plain));
+  if (*key == NULL) {
+    return ERROR_NO_MEMORY;
+  }
+
+  signing_key_set_algorithm(*key, algorithm);
+  if (algorithm_sealed != NULL) {
+    *algorithm_sealed = sealed;
+  }
+  return SUCCESS;
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include "error.h"
+#include "signing_key.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Size of the secret key sealing a key file */
+#define KEY_FILE_SECRET_BYTES 32
+
+/** Environment variable holding the hex encoded secret when no secret file
+ * is given */
+#define KEY_FILE_SECRET_ENV "MESSAGE_SIGN_KEY_SECRET"
+
+/** Size of a key file: magic, nonce, then the creation time, the signing
+ * algorithm and the seed sealed with libsodium secretbox */
+#define KEY_FILE_SIZE (8 + 24 + 16 + 8 + 1 + SIGNING_KEY_SEED_BYTES)
+
+/**
+ * Reads the hex encoded secret sealing key files, from a file or from the
+ * KEY_FILE_SECRET_ENV environment variable. Surrounding whitespace is
+ * ignored.
+ *
+ * \param path path of the file holding the secret, null to read the
+ * environment variable
+ * \param secret out secret of KEY_FILE_SECRET_BYTES bytes
+ * \returns ERROR_INVALID_ARGUMENT if the secret is missing or is not
+ * KEY_FILE_SECRET_BYTES hex encoded bytes, success otherwise
+ */
+error_code key_file_load_secret(const char *path, uint8_t *secret);
+
+/**
+ * Seals a keypair and its signing algorithm with a secret and writes it to a
+ * new file, readable by its owner only. An existing file is never replaced.
+ *
+ * \param path path of the key file
+ * \param key keypair to store, with the algorithm it is prepared for
+ * \param secret secret of KEY_FILE_SECRET_BYTES bytes
+ * \returns success when the file is written and synced, ERROR_UNKNOWN
+ * otherwise
+ */
+error_code key_file_write(const char *path, const signing_key *key,
+                          const uint8_t *secret);
+
+/**
+ * Reads and unseals a keypair written by key_file_write, prepared for its
+ * sealed algorithm. Key files written before the algorithm was sealed are
+ * still read, their keypair being prepared for ED25519.
+ *
+ * \param path path of the key file
+ * \param secret secret of KEY_FILE_SECRET_BYTES bytes
+ * \param key out keypair, to destroy with signing_key_destroy
+ * \param algorithm_sealed out whether the file holds the algorithm, may be
+ * null
+ * \returns ERROR_INVALID_ARGUMENT if the file is not a key file or was sealed
+ * with another secret, ERROR_UNKNOWN if it cannot be read, ERROR_NO_MEMORY
+ * on allocation failure, success otherwise
+ */
+error_code key_file_read(const char *path, const uint8_t *secret,
+                         signing_key **key, bool *algorithm_sealed);
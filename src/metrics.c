@@ -0,0 +1,230 @@
+#include "metrics.h"
+#include <string.h>
+
+/** Percentiles reported for every stage, and their names */
+static const double PERCENTILES[] = {50.0, 90.0, 99.0, 99.9};
+static const char *PERCENTILE_NAMES[] = {"p50", "p90", "p99", "p999"};
+static const char *PERCENTILE_QUANTILES[] = {"0.5", "0.9", "0.99", "0.999"};
+
+#define PERCENTILE_COUNT (sizeof(PERCENTILES) / sizeof(PERCENTILES[0]))
+
+static size_t bucket_index(uint64_t value) {
+  if (value < 2 * METRICS_HISTOGRAM_SUB_BUCKETS) {
+    return (size_t)value;
+  }
+
+  // Position of the highest set bit, at least PRECISION_BITS + 1
+  unsigned msb = 63u - (unsigned)__builtin_clzll(value);
+  unsigned shift = msb - METRICS_HISTOGRAM_PRECISION_BITS;
+  size_t sub_bucket =
+      (size_t)(value >> shift) - METRICS_HISTOGRAM_SUB_BUCKETS;
+
+  return 2 * METRICS_HISTOGRAM_SUB_BUCKETS +
+         (size_t)(msb - METRICS_HISTOGRAM_PRECISION_BITS - 1) *
+             METRICS_HISTOGRAM_SUB_BUCKETS +
+         sub_bucket;
+}
+
+/**
+ * Returns the highest value recorded in a bucket
+ */
+static uint64_t bucket_highest_value(size_t index) {
+  if (index < 2 * METRICS_HISTOGRAM_SUB_BUCKETS) {
+    return index;
+  }
+
+  size_t offset = index - 2 * METRICS_HISTOGRAM_SUB_BUCKETS;
+  unsigned shift =
+      (unsigned)(offset / METRICS_HISTOGRAM_SUB_BUCKETS) + 1u;
+  uint64_t sub_bucket = METRICS_HISTOGRAM_SUB_BUCKETS +
+                        offset % METRICS_HISTOGRAM_SUB_BUCKETS;
+
+  return (sub_bucket << shift) + ((UINT64_C(1) << shift) - 1);
+}
+
+void latency_histogram_record(latency_histogram *histogram, uint64_t value) {
+  histogram->buckets[bucket_index(value)]++;
+  histogram->interval_count++;
+  if (value > histogram->interval_max) {
+    histogram->interval_max = value;
+  }
+  histogram->total_count++;
+  histogram->total_sum += value;
+}
+
+uint64_t latency_histogram_percentile(const latency_histogram *histogram,
+                                      double percentile) {
+  if (histogram->interval_count == 0) {
+    return 0;
+  }
+
+  // Rank of the value at the percentile, from 1 to interval_count
+  uint64_t rank =
+      (uint64_t)(percentile / 100.0 * (double)histogram->interval_count + 0.5);
+  if (rank == 0) {
+    rank = 1;
+  } else if (rank > histogram->interval_count) {
+    rank = histogram->interval_count;
+  }
+
+  uint64_t seen = 0;
+  for (size_t i = 0; i < METRICS_HISTOGRAM_BUCKETS; i++) {
+    seen += histogram->buckets[i];
+    if (seen >= rank) {
+      uint64_t value = bucket_highest_value(i);
+      return value < histogram->interval_max ? value : histogram->interval_max;
+    }
+  }
+  return histogram->interval_max;
+}
+
+void latency_histogram_reset_interval(latency_histogram *histogram) {
+  memset(histogram->buckets, 0, sizeof(histogram->buckets));
+  histogram->interval_count = 0;
+  histogram->interval_max = 0;
+}
+
+void metrics_record_latency(plugin_metrics *metrics, metrics_stage stage,
+                            uint64_t nanoseconds) {
+  latency_histogram_record(&metrics->latency[stage], nanoseconds);
+}
+
+void metrics_count_rejection(plugin_metrics *metrics,
+                             metrics_rejection reason) {
+  metrics->messages_rejected[reason]++;
+}
+
+const char *metrics_stage_name(metrics_stage stage) {
+  switch (stage) {
+  case METRICS_STAGE_VALIDATE:
+    return "validate";
+  case METRICS_STAGE_DECODE:
+    return "decode";
+  case METRICS_STAGE_SIGN:
+    return "sign";
+  case METRICS_STAGE_TOTAL:
+    return "total";
+  default:
+    return "unknown";
+  }
+}
+
+const char *metrics_rejection_name(metrics_rejection reason) {
+  switch (reason) {
+  case METRICS_REJECTED_NO_KEY:
+    return "no_key";
+  case METRICS_REJECTED_INVALID_PAYLOAD:
+    return "invalid_payload";
+  case METRICS_REJECTED_DECODE:
+    return "decode";
+  case METRICS_REJECTED_SERIALIZE:
+    return "serialize";
+  case METRICS_REJECTED_ALLOCATION:
+    return "allocation";
+  case METRICS_REJECTED_SIGN:
+    return "sign";
+  default:
+    return "unknown";
+  }
+}
+
+void metrics_for_each(const plugin_metrics *metrics,
+                      metrics_value_callback callback, void *userdata) {
+  char name[64];
+
+  callback("messages/signed", metrics->messages_signed, userdata);
+  callback("messages/skipped", metrics->messages_skipped, userdata);
+  callback("messages/unsigned", metrics->messages_unsigned, userdata);
+  callback("messages/presigned", metrics->messages_presigned, userdata);
+  callback("messages/countersigned", metrics->messages_countersigned,
+           userdata);
+  for (int i = 0; i < METRICS_REJECTED_COUNT; i++) {
+    snprintf(name, sizeof(name), "messages/rejected/%s",
+             metrics_rejection_name((metrics_rejection)i));
+    callback(name, metrics->messages_rejected[i], userdata);
+  }
+  callback("bytes/in", metrics->bytes_in, userdata);
+  callback("bytes/out", metrics->bytes_out, userdata);
+
+  for (int stage = 0; stage < METRICS_STAGE_COUNT; stage++) {
+    const latency_histogram *histogram = &metrics->latency[stage];
+    const char *stage_name = metrics_stage_name((metrics_stage)stage);
+
+    snprintf(name, sizeof(name), "latency/%s/count", stage_name);
+    callback(name, histogram->interval_count, userdata);
+    for (size_t i = 0; i < PERCENTILE_COUNT; i++) {
+      snprintf(name, sizeof(name), "latency/%s/%s", stage_name,
+               PERCENTILE_NAMES[i]);
+      callback(name, latency_histogram_percentile(histogram, PERCENTILES[i]),
+               userdata);
+    }
+    snprintf(name, sizeof(name), "latency/%s/max", stage_name);
+    callback(name, histogram->interval_max, userdata);
+  }
+}
+
+int metrics_write_prometheus(const plugin_metrics *metrics, FILE *out) {
+  fprintf(out, "# HELP message_sign_messages_total Messages processed by the "
+               "plugin, by outcome\n"
+               "# TYPE message_sign_messages_total counter\n");
+  fprintf(out, "message_sign_messages_total{outcome=\"signed\"} %llu\n",
+          (unsigned long long)metrics->messages_signed);
+  fprintf(out, "message_sign_messages_total{outcome=\"skipped\"} %llu\n",
+          (unsigned long long)metrics->messages_skipped);
+  fprintf(out, "message_sign_messages_total{outcome=\"unsigned\"} %llu\n",
+          (unsigned long long)metrics->messages_unsigned);
+  fprintf(out, "message_sign_messages_total{outcome=\"presigned\"} %llu\n",
+          (unsigned long long)metrics->messages_presigned);
+  fprintf(out,
+          "message_sign_messages_total{outcome=\"countersigned\"} %llu\n",
+          (unsigned long long)metrics->messages_countersigned);
+
+  fprintf(out, "# HELP message_sign_rejected_total Messages rejected by the "
+               "plugin, by reason\n"
+               "# TYPE message_sign_rejected_total counter\n");
+  for (int i = 0; i < METRICS_REJECTED_COUNT; i++) {
+    fprintf(out, "message_sign_rejected_total{reason=\"%s\"} %llu\n",
+            metrics_rejection_name((metrics_rejection)i),
+            (unsigned long long)metrics->messages_rejected[i]);
+  }
+
+  fprintf(out, "# HELP message_sign_bytes_total Payload bytes of the signed "
+               "messages, before and after signing\n"
+               "# TYPE message_sign_bytes_total counter\n");
+  fprintf(out, "message_sign_bytes_total{direction=\"in\"} %llu\n",
+          (unsigned long long)metrics->bytes_in);
+  fprintf(out, "message_sign_bytes_total{direction=\"out\"} %llu\n",
+          (unsigned long long)metrics->bytes_out);
+
+  fprintf(out, "# HELP message_sign_stage_latency_seconds Latency of the "
+               "processing stages of a message, quantiles over the last "
+               "interval\n"
+               "# TYPE message_sign_stage_latency_seconds summary\n");
+  for (int stage = 0; stage < METRICS_STAGE_COUNT; stage++) {
+    const latency_histogram *histogram = &metrics->latency[stage];
+    const char *stage_name = metrics_stage_name((metrics_stage)stage);
+
+    for (size_t i = 0; i < PERCENTILE_COUNT; i++) {
+      fprintf(out,
+              "message_sign_stage_latency_seconds{stage=\"%s\","
+              "quantile=\"%s\"} %.9f\n",
+              stage_name, PERCENTILE_QUANTILES[i],
+              (double)latency_histogram_percentile(histogram,
+                                                   PERCENTILES[i]) /
+                  1e9);
+    }
+    fprintf(out, "message_sign_stage_latency_seconds_sum{stage=\"%s\"} %.9f\n",
+            stage_name, (double)histogram->total_sum / 1e9);
+    fprintf(out,
+            "message_sign_stage_latency_seconds_count{stage=\"%s\"} %llu\n",
+            stage_name, (unsigned long long)histogram->total_count);
+  }
+
+  return ferror(out) ? -1 : 0;
+}
+
+void metrics_reset_interval(plugin_metrics *metrics) {
+  for (int stage = 0; stage < METRICS_STAGE_COUNT; stage++) {
+    latency_histogram_reset_interval(&metrics->latency[stage]);
+  }
+}
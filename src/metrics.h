@@ -0,0 +1,194 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+
+/** Sub-buckets per power of two are 2^METRICS_HISTOGRAM_PRECISION_BITS, so
+ * recorded values are rounded by at most 1/16 (6.25%) */
+#define METRICS_HISTOGRAM_PRECISION_BITS 4
+#define METRICS_HISTOGRAM_SUB_BUCKETS (1u << METRICS_HISTOGRAM_PRECISION_BITS)
+
+/** Values below twice the sub-bucket count get a bucket each, then every
+ * power of two up to 2^63 is split in sub-buckets */
+#define METRICS_HISTOGRAM_BUCKETS                                              \
+  (2 * METRICS_HISTOGRAM_SUB_BUCKETS +                                         \
+   (63 - METRICS_HISTOGRAM_PRECISION_BITS) * METRICS_HISTOGRAM_SUB_BUCKETS)
+
+/**
+ * Stages of the processing of a message whose latency is measured
+ */
+typedef enum {
+  /** Validation of the encoded payload */
+  METRICS_STAGE_VALIDATE = 0,
+
+  /** Decoding and serialization through a libcbor tree, in tree payload mode
+   */
+  METRICS_STAGE_DECODE,
+
+  /** Splice of the new pairs and signature or hash chain link */
+  METRICS_STAGE_SIGN,
+
+  /** Whole processing of a selected message */
+  METRICS_STAGE_TOTAL,
+
+  METRICS_STAGE_COUNT
+} metrics_stage;
+
+/**
+ * Reasons why a message was rejected, one per error path of the message
+ * callback
+ */
+typedef enum {
+  /** No key installed yet, waiting for the certificate of the first key */
+  METRICS_REJECTED_NO_KEY = 0,
+
+  /** Payload refused by the validator */
+  METRICS_REJECTED_INVALID_PAYLOAD,
+
+  /** libcbor failed to load the payload */
+  METRICS_REJECTED_DECODE,
+
+  /** libcbor failed to serialize the payload */
+  METRICS_REJECTED_SERIALIZE,
+
+  /** The output buffer could not be allocated */
+  METRICS_REJECTED_ALLOCATION,
+
+  /** The signed payload could not be made */
+  METRICS_REJECTED_SIGN,
+
+  METRICS_REJECTED_COUNT
+} metrics_rejection;
+
+/**
+ * Log-linear latency histogram in the style of HDR histograms: constant
+ * relative precision over the whole range of 64 bit values, constant time
+ * recording
+ */
+typedef struct {
+  /** Values recorded since the last interval reset, per bucket */
+  uint64_t buckets[METRICS_HISTOGRAM_BUCKETS];
+  uint64_t interval_count;
+  uint64_t interval_max;
+
+  /** Count and sum of all values recorded since start */
+  uint64_t total_count;
+  uint64_t total_sum;
+} latency_histogram;
+
+/**
+ * Counters and latency histograms of the plugin
+ */
+typedef struct {
+  uint64_t messages_signed;
+  uint64_t messages_skipped;
+
+  /** Messages that could not be signed and were delivered unsigned by the
+   * failure policy, also counted in messages_rejected */
+  uint64_t messages_unsigned;
+
+  /** Messages already signed by another broker and delivered unchanged */
+  uint64_t messages_presigned;
+
+  /** Messages already signed by another broker and countersigned, also
+   * counted in messages_signed */
+  uint64_t messages_countersigned;
+  uint64_t messages_rejected[METRICS_REJECTED_COUNT];
+  uint64_t bytes_in;
+  uint64_t bytes_out;
+  latency_histogram latency[METRICS_STAGE_COUNT];
+} plugin_metrics;
+
+/**
+ * Called for every value reported by metrics_for_each
+ *
+ * \param name name of the value, a topic level path such as
+ * "latency/sign/p99"
+ * \param value value
+ * \param userdata data given to metrics_for_each
+ */
+typedef void (*metrics_value_callback)(const char *name, uint64_t value,
+                                       void *userdata);
+
+/**
+ * Records a value in a histogram
+ *
+ * \param histogram histogram
+ * \param value value to record
+ */
+void latency_histogram_record(latency_histogram *histogram, uint64_t value);
+
+/**
+ * Returns the value at a percentile of the values recorded since the last
+ * interval reset, rounded up to the highest value of its bucket
+ *
+ * \param histogram histogram
+ * \param percentile percentile from 0 to 100
+ * \returns the value at the percentile, 0 if no value was recorded
+ */
+uint64_t latency_histogram_percentile(const latency_histogram *histogram,
+                                      double percentile);
+
+/**
+ * Forgets the values recorded since the last interval reset, the total count
+ * and sum are kept
+ *
+ * \param histogram histogram
+ */
+void latency_histogram_reset_interval(latency_histogram *histogram);
+
+/**
+ * Records the latency of a stage
+ *
+ * \param metrics metrics
+ * \param stage stage
+ * \param nanoseconds duration of the stage in nanoseconds
+ */
+void metrics_record_latency(plugin_metrics *metrics, metrics_stage stage,
+                            uint64_t nanoseconds);
+
+/**
+ * Counts a rejected message
+ *
+ * \param metrics metrics
+ * \param reason reason of the rejection
+ */
+void metrics_count_rejection(plugin_metrics *metrics,
+                             metrics_rejection reason);
+
+/**
+ * Returns the name of a stage
+ */
+const char *metrics_stage_name(metrics_stage stage);
+
+/**
+ * Returns the name of a rejection reason
+ */
+const char *metrics_rejection_name(metrics_rejection reason);
+
+/**
+ * Reports every counter, and the count, maximum and percentiles in
+ * nanoseconds of every stage latency over the current interval
+ *
+ * \param metrics metrics
+ * \param callback function called for every value
+ * \param userdata data given to the callback
+ */
+void metrics_for_each(const plugin_metrics *metrics,
+                      metrics_value_callback callback, void *userdata);
+
+/**
+ * Writes the metrics in the Prometheus text exposition format, the latencies
+ * as summaries in seconds
+ *
+ * \param metrics metrics
+ * \param out output stream
+ * \returns 0 on success, a negative value on write error
+ */
+int metrics_write_prometheus(const plugin_metrics *metrics, FILE *out);
+
+/**
+ * Starts a new interval for the latency percentiles
+ *
+ * \param metrics metrics
+ */
+void metrics_reset_interval(plugin_metrics *metrics);
@@ -3,185 +3,1804 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "arena.h"
+#include "audit_log.h"
+#include "cbor_splice.h"
+#include "cbor_validator.h"
+#include "certificate_message.h"
 #include "certificate_repository.h"
+#include "flight_recorder.h"
+#include "hash_chain.h"
+#include "ingestion_clock.h"
+#include "key_file.h"
 #include "mosquitto.h"
 #include "mosquitto_broker.h"
 #include "mosquitto_plugin.h"
 #include "mqtt_protocol.h"
+#include "tenant_keys.h"
+#include "topic_trie.h"
 #include "utils.h"
+#include "verifier.h"
 #include <cbor.h>
+#include <errno.h>
 #include <sodium.h>
-#include <sys/time.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
 
 #define UNUSED(A) (void)(A)
 
-static const char *ENTITY = "MOSQUITTO_MQTT_BROKER";
+static const char *INGESTION_TIME_KEY = "INGESTION_TIME";
+static const char *SIGNATURE_KEY = "VERIFICATION_TOKEN";
+static const char *SEQUENCE_KEY = "CHAIN_SEQUENCE";
+static const char *CHAIN_LINK_KEY = "CHAIN_LINK";
+static const char *KEY_ID_KEY = "KEY_ID";
+static const char *COUNTERSIGNATURE_KEY = "COUNTERSIGNATURE";
+
+/** Keys of the integer key format */
+#define INGESTION_TIME_INT_KEY -1
+#define SIGNATURE_INT_KEY -2
+#define SEQUENCE_INT_KEY -3
+#define CHAIN_LINK_INT_KEY -4
+#define KEY_ID_INT_KEY -5
+#define COUNTERSIGNATURE_INT_KEY -6
+static const char *KEY_ROTATION_TOPIC = "$CONTROL/message-sign/rotate-key";
+
+#define ARENA_INITIAL_SIZE (64 * 1024)
+#define ARENA_DEFAULT_MAX_RETAINED_SIZE (4 * 1024 * 1024)
+
+#define DEFAULT_CHECKPOINT_TOPIC "$SYS/plugins/message-sign/checkpoint"
+#define DEFAULT_CHECKPOINT_INTERVAL_MESSAGES 1000
+#define DEFAULT_CHECKPOINT_INTERVAL_MS 1000
+
+#define DEFAULT_CERTIFICATE_RETRY_INITIAL_MS 500
+#define DEFAULT_CERTIFICATE_RETRY_MAX_MS 60000
+#define DEFAULT_CERTIFICATE_TIMEOUT_MS 10000
+
+#define DEFAULT_KEY_ROTATION_GRACE_MS 1000
+
+#define METRICS_TOPIC_PREFIX "$SYS/plugins/message-sign/"
+#define DEFAULT_METRICS_INTERVAL_MS 10000
+
+#define DEFAULT_FLIGHT_RECORDER_SIZE 65536
+#define DEFAULT_FLIGHT_RECORDER_THRESHOLD_US 1000
+
+#define CLOCK_CALIBRATION_INTERVAL_MS 1000
+
+#define DEFAULT_AUDIT_SEGMENT_DURATION_MS 3600000
+#define DEFAULT_AUDIT_FLUSH_INTERVAL_MS 1000
+
+#define DEFAULT_REJECT_LOG_RATE 10
+#define DEFAULT_REJECT_LOG_BURST 20
+#define DEFAULT_REJECT_LOG_PREFIX_LEVELS 1
+#define DEFAULT_REJECT_LOG_INTERVAL_MS 60000
+
+/** Name of the user property marking messages delivered unsigned */
+static const char *UNSIGNED_PROPERTY = "UNSIGNED";
+
+static const char *FAILURE_POLICY_NAMES[FAILURE_POLICY_COUNT] = {
+    "drop", "pass", "mark"};
+
+static const char *SIGNED_POLICY_NAMES[SIGNED_POLICY_COUNT] = {
+    "resign", "pass", "countersign"};
 
 static mosquitto_plugin_id_t *mosq_pid = NULL;
 
-static int error_code_to_mosquitto_error(error_code error) {
-  switch (error) {
-  case SUCCESS:
-    return MOSQ_ERR_SUCCESS;
-  case ERROR_INVALID_ARGUMENT:
-    return MOSQ_ERR_INVAL;
-  case ERROR_NO_MEMORY:
+static int error_code_to_mosquitto_error(error_code error) {
+  switch (error) {
+  case SUCCESS:
+    return MOSQ_ERR_SUCCESS;
+  case ERROR_INVALID_ARGUMENT:
+    return MOSQ_ERR_INVAL;
+  case ERROR_NO_MEMORY:
+    return MOSQ_ERR_NOMEM;
+  default:
+    return MOSQ_ERR_UNKNOWN;
+  }
+}
+
+static uint64_t monotonic_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u;
+}
+
+/**
+ * Timing and outcome of the processing of a message, reported to the metrics
+ * and to the flight recorder when it is finished
+ */
+typedef struct {
+  /** Ingestion time in nanoseconds since the Unix epoch */
+  uint64_t ingestion_ns;
+
+  uint64_t start_ns;
+  uint64_t stage_start_ns;
+  uint64_t stage_ns[METRICS_STAGE_COUNT];
+
+  /** Bit mask of the stages that ran */
+  unsigned stages;
+
+  /** FLIGHT_RECORD_SIGNED, FLIGHT_RECORD_PASSED or metrics_rejection + 1 */
+  uint32_t outcome;
+
+  /** Cause of the rejection, logged unless rate limited */
+  const char *detail;
+} message_trace;
+
+/**
+ * Reads the clock to time a stage, only when metrics or the flight recorder
+ * are enabled
+ */
+static uint64_t trace_clock(const plugin_config *config) {
+  if (!config->timing_enabled) {
+    return 0;
+  }
+
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void trace_start(const plugin_config *config, message_trace *trace,
+                        uint64_t ingestion_ns) {
+  memset(trace, 0, sizeof(message_trace));
+  trace->ingestion_ns = ingestion_ns;
+  trace->start_ns = trace_clock(config);
+  trace->stage_start_ns = trace->start_ns;
+}
+
+/**
+ * Ends a stage, the next one starts at the same time
+ */
+static void trace_stage(const plugin_config *config, message_trace *trace,
+                        metrics_stage stage) {
+  uint64_t now = trace_clock(config);
+  trace->stage_ns[stage] = now - trace->stage_start_ns;
+  trace->stage_start_ns = now;
+  trace->stages |= 1u << stage;
+}
+
+static void trace_reject(message_trace *trace, metrics_rejection reason,
+                         const char *detail) {
+  trace->outcome = (uint32_t)reason + 1;
+  trace->detail = detail;
+}
+
+/**
+ * Counts a processed message, records the latencies of its stages, and writes
+ * it to the flight recorder when it was rejected or slower than the threshold
+ */
+static void trace_finish(plugin_config *config, message_trace *trace,
+                         const struct mosquitto_evt_message *ed,
+                         uint32_t payload_size) {
+  bool rejected = trace->outcome != FLIGHT_RECORD_SIGNED &&
+                  trace->outcome != FLIGHT_RECORD_PASSED;
+  if (!rejected) {
+    if (trace->outcome == FLIGHT_RECORD_SIGNED) {
+      config->metrics.messages_signed++;
+    } else {
+      config->metrics.messages_presigned++;
+    }
+    config->metrics.bytes_in += payload_size;
+    config->metrics.bytes_out += ed->payloadlen;
+  } else {
+    metrics_rejection reason = (metrics_rejection)(trace->outcome - 1);
+    metrics_count_rejection(&config->metrics, reason);
+
+    // Misbehaving publishers must not flood the broker log
+    if (reject_log_count(&config->reject_log, monotonic_ms(), ed->topic,
+                         reason)) {
+      mosquitto_log_printf(MOSQ_LOG_ERR, "Rejected message on %s: %s (%s)",
+                           ed->topic, metrics_rejection_name(reason),
+                           trace->detail);
+    }
+  }
+
+  if (!config->timing_enabled) {
+    return;
+  }
+
+  trace->stage_ns[METRICS_STAGE_TOTAL] = trace_clock(config) - trace->start_ns;
+  trace->stages |= 1u << METRICS_STAGE_TOTAL;
+
+  if (config->metrics_interval_ms > 0) {
+    for (int stage = 0; stage < METRICS_STAGE_COUNT; stage++) {
+      if (trace->stages & (1u << stage)) {
+        metrics_record_latency(&config->metrics, (metrics_stage)stage,
+                               trace->stage_ns[stage]);
+      }
+    }
+  }
+
+  if (config->flight_recorder != NULL &&
+      (rejected ||
+       trace->stage_ns[METRICS_STAGE_TOTAL] >=
+           config->flight_recorder_threshold_us * 1000u)) {
+    flight_record record = {
+        .timestamp_ns = trace->ingestion_ns,
+        .topic_hash = flight_recorder_topic_hash(ed->topic),
+        .payload_size = payload_size,
+        .outcome = trace->outcome,
+    };
+    memcpy(record.stage_ns, trace->stage_ns, sizeof(record.stage_ns));
+    flight_recorder_write(config->flight_recorder, &record);
+  }
+}
+
+/**
+ * Publishes a certificate as a retained message on a topic of its own below
+ * certificate_topic, named by its key id, so that subscribers receive every
+ * certificate and the newest ones as they are added
+ */
+static void publish_certificate(const plugin_config *config,
+                                const certificate *cert,
+                                const uint8_t *key_id) {
+  if (config->certificate_topic == NULL) {
+    return;
+  }
+
+  char key_id_hex[2 * SIGNING_KEY_ID_BYTES + 1];
+  sodium_bin2hex(key_id_hex, sizeof(key_id_hex), key_id, SIGNING_KEY_ID_BYTES);
+  size_t topic_size =
+      strlen(config->certificate_topic) + 1 + sizeof(key_id_hex);
+  char *topic = (char *)malloc(topic_size);
+  size_t message_size = certificate_message_size(cert);
+  uint8_t *message = (uint8_t *)mosquitto_malloc(message_size);
+  if (topic == NULL || message == NULL) {
+    mosquitto_log_printf(MOSQ_LOG_ERR,
+                         "Failed to allocate certificate message");
+    free(topic);
+    mosquitto_free(message);
+    return;
+  }
+  snprintf(topic, topic_size, "%s/%s", config->certificate_topic, key_id_hex);
+
+  error_code error = certificate_message_encode(cert, message, message_size);
+  if (error != SUCCESS) {
+    mosquitto_log_printf(MOSQ_LOG_ERR, "Failed to encode certificate: %d",
+                         error);
+    free(topic);
+    mosquitto_free(message);
+    return;
+  }
+
+  // The broker takes ownership of the message buffer and copies the topic
+  int result = mosquitto_broker_publish(NULL, topic, (int)message_size,
+                                        message, 1, true, NULL);
+  if (result != MOSQ_ERR_SUCCESS) {
+    mosquitto_log_printf(MOSQ_LOG_ERR, "Failed to publish certificate: %d",
+                         result);
+  }
+  free(topic);
+}
+
+/**
+ * Makes the unpublished key the one used to sign messages
+ */
+static void install_unpublished_key(plugin_config *config) {
+  error_code error =
+      signing_keyring_install(&config->keys, config->unpublished_key,
+                              monotonic_ms(), config->key_rotation_grace_ms);
+  if (error != SUCCESS) {
+    mosquitto_log_printf(MOSQ_LOG_ERR, "Failed to install signing key: %d",
+                         error);
+    return;
+  }
+  config->unpublished_key_installed = true;
+}
+
+/**
+ * Called by the repository for every stored certificate, which makes its key
+ * usable when waiting for certificates
+ */
+static void certificate_stored(const certificate *cert, void *userdata) {
+  plugin_config *config = (plugin_config *)userdata;
+  if (config->unpublished_key != NULL &&
+      strcmp(cert->public_key, config->unpublished_key->public_key_hex) == 0) {
+    config->unpublished_key_stored = true;
+  } else if (config->tenant_keys != NULL &&
+             tenant_keys_set_stored(config->tenant_keys, cert->entity,
+                                    cert->public_key) &&
+             config->tenant_registry != NULL) {
+    fprintf(config->tenant_registry, "%s %s\n", cert->public_key,
+            cert->entity);
+  }
+}
+
+/**
+ * Advances the writes of the certificate repository. Once the certificate of
+ * the unpublished key is stored the key is installed, and the next key can be
+ * generated. A certificate that cannot be stored is retried by the repository
+ * until it is, its key is never installed before.
+ */
+static void poll_certificate_repository(plugin_config *config) {
+  if (config->certificate_repository == NULL) {
+    return;
+  }
+  certificate_repository_poll(config->certificate_repository, monotonic_ms());
+  if (config->tenant_registry != NULL) {
+    fflush(config->tenant_registry);
+  }
+
+  if (config->unpublished_key == NULL || !config->unpublished_key_stored) {
+    return;
+  }
+
+  mosquitto_log_printf(MOSQ_LOG_INFO, "Certificate of entity %s published",
+                       config->entity);
+  if (!config->unpublished_key_installed) {
+    install_unpublished_key(config);
+  }
+  if (config->unpublished_key_installed) {
+    config->unpublished_key = NULL;
+    config->unpublished_key_installed = false;
+    config->unpublished_key_stored = false;
+  }
+}
+
+/**
+ * Generates a new keypair to sign messages, and starts publishing its public
+ * key to public storage for verification. The key replaces the current one
+ * once its certificate is stored, or right away for the first key when
+ * signing may start before the certificate is stored.
+ */
+static int rotate_signing_key(plugin_config *config) {
+  if (config->key_file != NULL) {
+    mosquitto_log_printf(MOSQ_LOG_WARNING,
+                         "The key is shared through %s, ignoring rotation "
+                         "request",
+                         config->key_file);
+    return MOSQ_ERR_SUCCESS;
+  }
+
+  if (config->unpublished_key != NULL) {
+    mosquitto_log_printf(MOSQ_LOG_WARNING,
+                         "Key rotation already in progress, ignoring request");
+    return MOSQ_ERR_SUCCESS;
+  }
+
+  // Every rotation retires at most one key, so the installation of the new
+  // key cannot fail once it has started
+  if (config->keys.retired_count == SIGNING_KEYRING_MAX_RETIRED) {
+    mosquitto_log_printf(MOSQ_LOG_WARNING,
+                         "Too many retired keys, ignoring rotation request");
+    return MOSQ_ERR_SUCCESS;
+  }
+
+  signing_key *key = signing_key_generate();
+  if (key == NULL) {
+    mosquitto_log_printf(MOSQ_LOG_ERR, "Failed to generate crypto sign keypair");
+    return MOSQ_ERR_UNKNOWN;
+  }
+
+  signing_key_set_algorithm(key, config->algorithm);
+  mosquitto_log_printf(MOSQ_LOG_DEBUG, "Generated keypair for entity %s at %lu",
+                       config->entity, key->create_time_unix);
+
+  certificate cert = {
+      .entity = config->entity,
+      .create_time_unix = key->create_time_unix,
+      .public_key = key->public_key_hex,
+      .algorithm = signing_algorithm_name(config->algorithm),
+  };
+
+  error_code error =
+      certificate_repository_add(config->certificate_repository, &cert);
+  if (error != SUCCESS) {
+    mosquitto_log_printf(MOSQ_LOG_ERR,
+                         "Failed to add new certificate to repository: %d",
+                         error);
+    signing_key_destroy(key);
+    return error_code_to_mosquitto_error(error);
+  }
+  publish_certificate(config, &cert, key->key_id);
+
+  config->unpublished_key = key;
+  config->unpublished_key_installed = false;
+  config->unpublished_key_stored = false;
+  if (!config->wait_for_certificate &&
+      signing_keyring_current(&config->keys) == NULL) {
+    install_unpublished_key(config);
+  }
+
+  if (config->key_rotation_interval > 0) {
+    config->next_rotation_ms =
+        monotonic_ms() + (uint64_t)config->key_rotation_interval * 1000u;
+  }
+
+  poll_certificate_repository(config);
+  return MOSQ_ERR_SUCCESS;
+}
+
+/**
+ * Loads the keypair shared by the brokers of a cluster from its sealed key
+ * file. Its certificate was stored once when the file was created, so nothing
+ * is written to the database.
+ */
+static int load_shared_key(plugin_config *config) {
+  uint8_t secret[KEY_FILE_SECRET_BYTES];
+  if (key_file_load_secret(config->key_secret_file, secret) != SUCCESS) {
+    mosquitto_log_printf(MOSQ_LOG_ERR, "Missing or invalid key secret in %s",
+                         config->key_secret_file != NULL
+                             ? config->key_secret_file
+                             : KEY_FILE_SECRET_ENV);
+    return MOSQ_ERR_INVAL;
+  }
+
+  signing_key *key = NULL;
+  bool algorithm_sealed = false;
+  error_code error =
+      key_file_read(config->key_file, secret, &key, &algorithm_sealed);
+  sodium_memzero(secret, sizeof(secret));
+  if (error != SUCCESS) {
+    mosquitto_log_printf(MOSQ_LOG_ERR, "Failed to read key file %s: %d",
+                         config->key_file, error);
+    return error_code_to_mosquitto_error(error);
+  }
+
+  // Its certificate was stored with the sealed algorithm, the key files
+  // written before the algorithm was sealed use the configured one
+  if (!algorithm_sealed) {
+    signing_key_set_algorithm(key, config->algorithm);
+  } else if (key->context.algorithm != config->algorithm) {
+    mosquitto_log_printf(MOSQ_LOG_ERR,
+                         "Key file %s is sealed for the %s algorithm, "
+                         "not the configured %s",
+                         config->key_file,
+                         signing_algorithm_name(key->context.algorithm),
+                         signing_algorithm_name(config->algorithm));
+    signing_key_destroy(key);
+    return MOSQ_ERR_INVAL;
+  }
+
+  // The keyring is empty, the installation cannot fail
+  signing_keyring_install(&config->keys, key, monotonic_ms(), 0);
+
+  certificate cert = {
+      .entity = config->entity,
+      .create_time_unix = key->create_time_unix,
+      .public_key = key->public_key_hex,
+      .algorithm = signing_algorithm_name(config->algorithm),
+  };
+  publish_certificate(config, &cert, key->key_id);
+  mosquitto_log_printf(MOSQ_LOG_INFO, "Loaded %s key of entity %s from %s",
+                       signing_algorithm_name(config->algorithm),
+                       config->entity, config->key_file);
+  return MOSQ_ERR_SUCCESS;
+}
+
+/**
+ * Reads the next tenant name of a tenants file, skipping blank lines and
+ * comments
+ *
+ * \returns the name, stripped of its line ending, null at the end of the
+ * file
+ */
+static char *read_tenant_name(FILE *file, char **line, size_t *capacity) {
+  ssize_t length = 0;
+  while ((length = getline(line, capacity, file)) > 0) {
+    char *name = *line;
+    while (length > 0 &&
+           (name[length - 1] == '\n' || name[length - 1] == '\r')) {
+      name[--length] = '\0';
+    }
+    if (length > 0 && name[0] != '#') {
+      return name;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Checks that a tenant name can be matched and stored in a certificate
+ */
+static bool is_tenant_name_valid(const plugin_config *config,
+                                 const char *name) {
+  if (strchr(name, '\t') != NULL) {
+    return false;
+  }
+  // A topic level never contains a separator or a wildcard
+  return config->tenant_selector != TENANT_SELECTOR_TOPIC ||
+         strpbrk(name, "/+#") == NULL;
+}
+
+/**
+ * Reads the master key the tenant keys are derived from, sealing a new one in
+ * the tenant key file on the first start
+ *
+ * \param master out master key, to destroy with signing_key_destroy
+ */
+static int load_tenant_master_key(plugin_config *config,
+                                  signing_key **master) {
+  uint8_t secret[KEY_FILE_SECRET_BYTES];
+  if (key_file_load_secret(config->key_secret_file, secret) != SUCCESS) {
+    mosquitto_log_printf(MOSQ_LOG_ERR, "Missing or invalid key secret in %s",
+                         config->key_secret_file != NULL
+                             ? config->key_secret_file
+                             : KEY_FILE_SECRET_ENV);
+    return MOSQ_ERR_INVAL;
+  }
+
+  error_code error = SUCCESS;
+  if (access(config->tenant_key_file, F_OK) == 0) {
+    error = key_file_read(config->tenant_key_file, secret, master, NULL);
+  } else {
+    *master = signing_key_generate();
+    error = *master != NULL
+                ? key_file_write(config->tenant_key_file, *master, secret)
+                : ERROR_NO_MEMORY;
+    if (error == SUCCESS) {
+      mosquitto_log_printf(MOSQ_LOG_INFO, "Sealed a new tenant key in %s",
+                           config->tenant_key_file);
+    }
+  }
+  sodium_memzero(secret, sizeof(secret));
+
+  if (error != SUCCESS) {
+    mosquitto_log_printf(MOSQ_LOG_ERR, "Failed to load tenant key file %s: %d",
+                         config->tenant_key_file, error);
+    signing_key_destroy(*master);
+    *master = NULL;
+    return error_code_to_mosquitto_error(error);
+  }
+  return MOSQ_ERR_SUCCESS;
+}
+
+/**
+ * Derives the key of every tenant of the tenants file from the tenant key
+ * file, so that tenants keep their keys across restarts. Only the
+ * certificates missing from the tenant registry are queued, with a single
+ * repository call. When waiting for certificates, the key of a tenant signs
+ * once its own certificate is stored.
+ */
+static int load_tenants(plugin_config *config) {
+  FILE *file = fopen(config->tenants_file, "r");
+  if (file == NULL) {
+    mosquitto_log_printf(MOSQ_LOG_ERR, "Failed to open tenants file %s",
+                         config->tenants_file);
+    return MOSQ_ERR_INVAL;
+  }
+
+  char *line = NULL;
+  size_t line_capacity = 0;
+  size_t count = 0;
+  while (read_tenant_name(file, &line, &line_capacity) != NULL) {
+    count++;
+  }
+  if (count == 0) {
+    mosquitto_log_printf(MOSQ_LOG_WARNING, "No tenant in %s",
+                         config->tenants_file);
+    free(line);
+    fclose(file);
+    return MOSQ_ERR_SUCCESS;
+  }
+
+  config->tenant_keys = tenant_keys_new(count);
+  if (config->tenant_keys == NULL) {
+    mosquitto_log_printf(MOSQ_LOG_ERR, "Failed to allocate %zu tenant keys",
+                         count);
+    free(line);
+    fclose(file);
+    return MOSQ_ERR_NOMEM;
+  }
+
+  signing_key *master = NULL;
+  int result = load_tenant_master_key(config, &master);
+
+  rewind(file);
+  const char *name = NULL;
+  while (result == MOSQ_ERR_SUCCESS &&
+         (name = read_tenant_name(file, &line, &line_capacity)) != NULL) {
+    if (!is_tenant_name_valid(config, name)) {
+      mosquitto_log_printf(MOSQ_LOG_WARNING,
+                           "Invalid tenant name (%s), ignoring it", name);
+      continue;
+    }
+
+    signing_key *key = tenant_keys_derive_key(master, name);
+    if (key == NULL) {
+      mosquitto_log_printf(MOSQ_LOG_ERR,
+                           "Failed to derive the key of tenant %s", name);
+      result = MOSQ_ERR_UNKNOWN;
+      break;
+    }
+    signing_key_set_algorithm(key, config->algorithm);
+
+    error_code error = tenant_keys_add(config->tenant_keys, name, key);
+    if (error == ERROR_INVALID_ARGUMENT) {
+      mosquitto_log_printf(MOSQ_LOG_WARNING,
+                           "Duplicate tenant (%s), ignoring it", name);
+      signing_key_destroy(key);
+    } else if (error != SUCCESS) {
+      signing_key_destroy(key);
+      result = error_code_to_mosquitto_error(error);
+    }
+  }
+  signing_key_destroy(master);
+  free(line);
+  fclose(file);
+  if (result != MOSQ_ERR_SUCCESS) {
+    return result;
+  }
+
+  size_t registered_count = 0;
+  error_code error = tenant_keys_load_registered(
+      config->tenant_keys, config->tenant_registry_file, &registered_count);
+  config->tenant_registry = fopen(config->tenant_registry_file, "a");
+  if (error != SUCCESS || config->tenant_registry == NULL) {
+    mosquitto_log_printf(MOSQ_LOG_ERR, "Failed to open tenant registry %s",
+                         config->tenant_registry_file);
+    return MOSQ_ERR_UNKNOWN;
+  }
+
+  // Names are only stable once every tenant is added
+  size_t tenant_count = tenant_keys_count(config->tenant_keys);
+  certificate *certs = (certificate *)calloc(tenant_count, sizeof(certificate));
+  if (certs == NULL) {
+    return MOSQ_ERR_NOMEM;
+  }
+  for (size_t i = 0; i < tenant_count; i++) {
+    const signing_key *key = tenant_keys_key(config->tenant_keys, i);
+    certs[i] = (certificate){
+        .entity = tenant_keys_name(config->tenant_keys, i),
+        .create_time_unix = key->create_time_unix,
+        .public_key = key->public_key_hex,
+        .algorithm = signing_algorithm_name(config->algorithm),
+    };
+    publish_certificate(config, &certs[i], key->key_id);
+  }
+
+  // The certificates of registered tenants are stored already, only the new
+  // ones are queued
+  size_t new_count = 0;
+  for (size_t i = 0; i < tenant_count; i++) {
+    if (!tenant_keys_stored(config->tenant_keys, i)) {
+      certs[new_count++] = certs[i];
+    }
+  }
+
+  error = new_count > 0
+              ? certificate_repository_add_batch(
+                    config->certificate_repository, certs, new_count)
+              : SUCCESS;
+  free(certs);
+  if (error != SUCCESS) {
+    mosquitto_log_printf(MOSQ_LOG_ERR,
+                         "Failed to add tenant certificates to repository: %d",
+                         error);
+    return error_code_to_mosquitto_error(error);
+  }
+
+  mosquitto_log_printf(MOSQ_LOG_INFO,
+                       "Loaded keys of %zu tenants from %s, %zu registered "
+                       "before",
+                       tenant_count, config->tenants_file, registered_count);
+  return MOSQ_ERR_SUCCESS;
+}
+
+/**
+ * Parses a non negative integer configuration value
+ *
+ * \returns true on success, false if the value is not a valid number
+ */
+static bool parse_size(const char *value, size_t *out) {
+  char *end = NULL;
+  errno = 0;
+  unsigned long long parsed = strtoull(value, &end, 10);
+
+  if (errno != 0 || end == value || *end != '\0' || value[0] == '-' ||
+      parsed > SIZE_MAX) {
+    return false;
+  }
+
+  *out = (size_t)parsed;
+  return true;
+}
+
+static void load_size_option(const char *key, const char *value,
+                             size_t *out) {
+  if (!parse_size(value, out)) {
+    mosquitto_log_printf(MOSQ_LOG_WARNING,
+                         "Invalid value (%s) for configuration key %s, "
+                         "ignoring it",
+                         value, key);
+  }
+}
+
+static void load_bool_option(const char *key, const char *value, bool *out) {
+  if (strcmp(value, "true") == 0) {
+    *out = true;
+  } else if (strcmp(value, "false") == 0) {
+    *out = false;
+  } else {
+    mosquitto_log_printf(MOSQ_LOG_WARNING,
+                         "Invalid value (%s) for configuration key %s, "
+                         "expected true or false, ignoring it",
+                         value, key);
+  }
+}
+
+/**
+ * Adds a whitespace separated list of topic filters to a trie, created on
+ * first use
+ *
+ * \returns MOSQ_ERR_INVAL if a filter is not valid
+ */
+static int load_topic_filters(const char *key, const char *value,
+                              topic_trie **trie) {
+  if (*trie == NULL) {
+    *trie = topic_trie_new();
+    if (*trie == NULL) {
+      mosquitto_log_printf(MOSQ_LOG_ERR,
+                           "Failed to allocate topic filters for %s", key);
+      return MOSQ_ERR_NOMEM;
+    }
+  }
+
+  error_code error = topic_trie_add_list(*trie, value);
+  if (error == ERROR_INVALID_ARGUMENT) {
+    mosquitto_log_printf(MOSQ_LOG_ERR, "Invalid topic filter in %s (%s)", key,
+                         value);
+    return MOSQ_ERR_INVAL;
+  }
+  if (error != SUCCESS) {
+    mosquitto_log_printf(MOSQ_LOG_ERR, "Failed to add topic filters of %s",
+                         key);
+    return error_code_to_mosquitto_error(error);
+  }
+  return MOSQ_ERR_SUCCESS;
+}
+
+static bool parse_failure_policy(const char *name, failure_policy *policy) {
+  for (int i = 0; i < FAILURE_POLICY_COUNT; i++) {
+    if (strcmp(name, FAILURE_POLICY_NAMES[i]) == 0) {
+      *policy = (failure_policy)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+static void load_failure_policy(const char *key, const char *value,
+                                failure_policy *out) {
+  if (!parse_failure_policy(value, out)) {
+    mosquitto_log_printf(MOSQ_LOG_WARNING,
+                         "Unexpected value (%s) for configuration key %s, "
+                         "expected drop, pass or mark, ignoring it",
+                         value, key);
+  }
+}
+
+static bool parse_signed_policy(const char *name, signed_policy *policy) {
+  for (int i = 0; i < SIGNED_POLICY_COUNT; i++) {
+    if (strcmp(name, SIGNED_POLICY_NAMES[i]) == 0) {
+      *policy = (signed_policy)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+static void load_signed_policy(const char *key, const char *value,
+                               signed_policy *out) {
+  if (!parse_signed_policy(value, out)) {
+    mosquitto_log_printf(MOSQ_LOG_WARNING,
+                         "Unexpected value (%s) for configuration key %s, "
+                         "expected resign, pass or countersign, ignoring it",
+                         value, key);
+  }
+}
+
+/**
+ * Loads the plugin options, invalid values of most options being ignored
+ *
+ * \returns MOSQ_ERR_INVAL if a topic filter is not valid
+ */
+static int load_configuration(plugin_config *config,
+                              struct mosquitto_opt *opts, int opt_count) {
+  config->entity = CERTIFICATE_DEFAULT_ENTITY;
+  config->validator_limits = CBOR_VALIDATOR_DEFAULT_LIMITS;
+  config->arena_max_retained_size = ARENA_DEFAULT_MAX_RETAINED_SIZE;
+  config->checkpoint_topic = DEFAULT_CHECKPOINT_TOPIC;
+  config->certificate_retry_initial_ms = DEFAULT_CERTIFICATE_RETRY_INITIAL_MS;
+  config->certificate_retry_max_ms = DEFAULT_CERTIFICATE_RETRY_MAX_MS;
+  config->certificate_timeout_ms = DEFAULT_CERTIFICATE_TIMEOUT_MS;
+  config->key_rotation_grace_ms = DEFAULT_KEY_ROTATION_GRACE_MS;
+  config->control_topic_enabled = true;
+  config->metrics_interval_ms = DEFAULT_METRICS_INTERVAL_MS;
+  config->flight_recorder_size = DEFAULT_FLIGHT_RECORDER_SIZE;
+  config->flight_recorder_threshold_us = DEFAULT_FLIGHT_RECORDER_THRESHOLD_US;
+  config->audit_segment_size = AUDIT_LOG_DEFAULT_SEGMENT_SIZE;
+  config->audit_segment_duration_ms = DEFAULT_AUDIT_SEGMENT_DURATION_MS;
+  config->audit_flush_interval_ms = DEFAULT_AUDIT_FLUSH_INTERVAL_MS;
+  config->checkpoint_interval_messages = DEFAULT_CHECKPOINT_INTERVAL_MESSAGES;
+  config->checkpoint_interval_ms = DEFAULT_CHECKPOINT_INTERVAL_MS;
+  config->reject_log_rate = DEFAULT_REJECT_LOG_RATE;
+  config->reject_log_burst = DEFAULT_REJECT_LOG_BURST;
+  config->reject_log_prefix_levels = DEFAULT_REJECT_LOG_PREFIX_LEVELS;
+  config->reject_log_interval_ms = DEFAULT_REJECT_LOG_INTERVAL_MS;
+
+  int result = MOSQ_ERR_SUCCESS;
+  for (size_t i = 0; i < opt_count; i++) {
+    char *key = opts[i].key;
+    char *value = opts[i].value;
+
+    if (strcmp(key, "db_connection_string") == 0) {
+      config->db_connection_string = value;
+    } else if (strcmp(key, "entity") == 0) {
+      config->entity = value;
+    } else if (strcmp(key, "key_file") == 0) {
+      config->key_file = value;
+    } else if (strcmp(key, "key_secret_file") == 0) {
+      config->key_secret_file = value;
+    } else if (strcmp(key, "wait_for_certificate") == 0) {
+      load_bool_option(key, value, &config->wait_for_certificate);
+    } else if (strcmp(key, "certificate_outbox") == 0) {
+      config->certificate_outbox = value;
+    } else if (strcmp(key, "certificate_topic") == 0) {
+      config->certificate_topic = value;
+    } else if (strcmp(key, "certificate_retry_initial_ms") == 0) {
+      load_size_option(key, value, &config->certificate_retry_initial_ms);
+    } else if (strcmp(key, "certificate_retry_max_ms") == 0) {
+      load_size_option(key, value, &config->certificate_retry_max_ms);
+    } else if (strcmp(key, "certificate_timeout_ms") == 0) {
+      load_size_option(key, value, &config->certificate_timeout_ms);
+    } else if (strcmp(key, "key_rotation_interval") == 0) {
+      load_size_option(key, value, &config->key_rotation_interval);
+    } else if (strcmp(key, "key_rotation_grace_ms") == 0) {
+      load_size_option(key, value, &config->key_rotation_grace_ms);
+    } else if (strcmp(key, "control_topic_enabled") == 0) {
+      load_bool_option(key, value, &config->control_topic_enabled);
+    } else if (strcmp(key, "tenants_file") == 0) {
+      config->tenants_file = value;
+    } else if (strcmp(key, "tenant_key_file") == 0) {
+      config->tenant_key_file = value;
+    } else if (strcmp(key, "tenant_registry_file") == 0) {
+      config->tenant_registry_file = value;
+    } else if (strcmp(key, "tenant_selector") == 0) {
+      if (strcmp(value, "topic") == 0) {
+        config->tenant_selector = TENANT_SELECTOR_TOPIC;
+      } else if (strcmp(value, "username") == 0) {
+        config->tenant_selector = TENANT_SELECTOR_USERNAME;
+      } else if (strcmp(value, "client_id") == 0) {
+        config->tenant_selector = TENANT_SELECTOR_CLIENT_ID;
+      } else {
+        mosquitto_log_printf(MOSQ_LOG_WARNING,
+                             "Unexpected tenant selector (%s), ignoring it",
+                             value);
+      }
+    } else if (strcmp(key, "tenant_topic_level") == 0) {
+      load_size_option(key, value, &config->tenant_topic_level);
+    } else if (strcmp(key, "payload_mode") == 0) {
+      if (strcmp(value, "tree") == 0) {
+        config->payload_mode = PAYLOAD_MODE_TREE;
+      } else if (strcmp(value, "splice") == 0) {
+        config->payload_mode = PAYLOAD_MODE_SPLICE;
+      } else {
+        mosquitto_log_printf(MOSQ_LOG_WARNING,
+                             "Unexpected payload mode (%s), ignoring it",
+                             value);
+      }
+    } else if (strcmp(key, "sign_mode") == 0) {
+      if (strcmp(value, "message") == 0) {
+        config->sign_mode = SIGN_MODE_MESSAGE;
+      } else if (strcmp(value, "chain") == 0) {
+        config->sign_mode = SIGN_MODE_CHAIN;
+      } else {
+        mosquitto_log_printf(MOSQ_LOG_WARNING,
+                             "Unexpected sign mode (%s), ignoring it", value);
+      }
+    } else if (strcmp(key, "key_format") == 0) {
+      if (strcmp(value, "text") == 0) {
+        config->key_format = KEY_FORMAT_TEXT;
+      } else if (strcmp(value, "integer") == 0) {
+        config->key_format = KEY_FORMAT_INTEGER;
+      } else {
+        mosquitto_log_printf(MOSQ_LOG_WARNING,
+                             "Unexpected key format (%s), ignoring it", value);
+      }
+    } else if (strcmp(key, "envelope") == 0) {
+      if (strcmp(value, "map") == 0) {
+        config->envelope = ENVELOPE_MAP;
+      } else if (strcmp(value, "cose") == 0) {
+        config->envelope = ENVELOPE_COSE;
+      } else if (strcmp(value, "properties") == 0) {
+        config->envelope = ENVELOPE_PROPERTIES;
+      } else {
+        mosquitto_log_printf(MOSQ_LOG_WARNING,
+                             "Unexpected envelope (%s), ignoring it", value);
+      }
+    } else if (strcmp(key, "algorithm") == 0) {
+      if (!signing_algorithm_parse(value, &config->algorithm)) {
+        mosquitto_log_printf(MOSQ_LOG_WARNING,
+                             "Unexpected algorithm (%s), ignoring it", value);
+      }
+    } else if (strcmp(key, "clock_source") == 0) {
+      if (strcmp(value, "realtime") == 0) {
+        config->clock_source = CLOCK_SOURCE_REALTIME;
+      } else if (strcmp(value, "realtime_coarse") == 0) {
+        config->clock_source = CLOCK_SOURCE_REALTIME_COARSE;
+      } else if (strcmp(value, "tsc") == 0) {
+        config->clock_source = CLOCK_SOURCE_TSC;
+      } else {
+        mosquitto_log_printf(MOSQ_LOG_WARNING,
+                             "Unexpected clock source (%s), ignoring it",
+                             value);
+      }
+    } else if (strcmp(key, "time_precision") == 0) {
+      if (strcmp(value, "ms") == 0) {
+        config->time_precision = TIME_PRECISION_MS;
+      } else if (strcmp(value, "us") == 0) {
+        config->time_precision = TIME_PRECISION_US;
+      } else if (strcmp(value, "ns") == 0) {
+        config->time_precision = TIME_PRECISION_NS;
+      } else {
+        mosquitto_log_printf(MOSQ_LOG_WARNING,
+                             "Unexpected time precision (%s), ignoring it",
+                             value);
+      }
+    } else if (strcmp(key, "time_encoding") == 0) {
+      if (strcmp(value, "uint") == 0) {
+        config->time_encoding = TIME_ENCODING_UINT;
+      } else if (strcmp(value, "tag") == 0) {
+        config->time_encoding = TIME_ENCODING_TAG;
+      } else {
+        mosquitto_log_printf(MOSQ_LOG_WARNING,
+                             "Unexpected time encoding (%s), ignoring it",
+                             value);
+      }
+    } else if (strcmp(key, "checkpoint_topic") == 0) {
+      config->checkpoint_topic = value;
+    } else if (strcmp(key, "checkpoint_interval_messages") == 0) {
+      load_size_option(key, value, &config->checkpoint_interval_messages);
+    } else if (strcmp(key, "checkpoint_interval_ms") == 0) {
+      load_size_option(key, value, &config->checkpoint_interval_ms);
+    } else if (strcmp(key, "sign_topics") == 0) {
+      result = load_topic_filters(key, value, &config->sign_topics);
+    } else if (strcmp(key, "skip_topics") == 0) {
+      result = load_topic_filters(key, value, &config->skip_topics);
+    } else if (strcmp(key, "failure_policy") == 0) {
+      load_failure_policy(key, value, &config->failure_policy);
+    } else if (strncmp(key, "failure_policy_", 15) == 0) {
+      failure_policy policy = FAILURE_POLICY_DROP;
+      if (parse_failure_policy(key + 15, &policy)) {
+        result = load_topic_filters(key, value,
+                                    &config->failure_policy_topics[policy]);
+      } else {
+        mosquitto_log_printf(MOSQ_LOG_WARNING,
+                             "Unexpected configuration key %s, ignoring it",
+                             key);
+      }
+    } else if (strcmp(key, "signed_policy") == 0) {
+      load_signed_policy(key, value, &config->signed_policy);
+    } else if (strncmp(key, "signed_policy_", 14) == 0) {
+      signed_policy policy = SIGNED_POLICY_RESIGN;
+      if (parse_signed_policy(key + 14, &policy)) {
+        result = load_topic_filters(key, value,
+                                    &config->signed_policy_topics[policy]);
+      } else {
+        mosquitto_log_printf(MOSQ_LOG_WARNING,
+                             "Unexpected configuration key %s, ignoring it",
+                             key);
+      }
+    } else if (strcmp(key, "reject_log_rate") == 0) {
+      load_size_option(key, value, &config->reject_log_rate);
+    } else if (strcmp(key, "reject_log_burst") == 0) {
+      load_size_option(key, value, &config->reject_log_burst);
+    } else if (strcmp(key, "reject_log_prefix_levels") == 0) {
+      load_size_option(key, value, &config->reject_log_prefix_levels);
+    } else if (strcmp(key, "reject_log_interval_ms") == 0) {
+      load_size_option(key, value, &config->reject_log_interval_ms);
+    } else if (strcmp(key, "max_payload_size") == 0) {
+      load_size_option(key, value, &config->validator_limits.max_payload_size);
+    } else if (strcmp(key, "max_nesting_depth") == 0) {
+      load_size_option(key, value, &config->validator_limits.max_depth);
+    } else if (strcmp(key, "max_item_count") == 0) {
+      load_size_option(key, value, &config->validator_limits.max_items);
+    } else if (strcmp(key, "arena_max_retained_size") == 0) {
+      load_size_option(key, value, &config->arena_max_retained_size);
+    } else if (strcmp(key, "metrics_interval_ms") == 0) {
+      load_size_option(key, value, &config->metrics_interval_ms);
+    } else if (strcmp(key, "metrics_prometheus_file") == 0) {
+      config->metrics_prometheus_file = value;
+    } else if (strcmp(key, "flight_recorder_file") == 0) {
+      config->flight_recorder_file = value;
+    } else if (strcmp(key, "flight_recorder_size") == 0) {
+      load_size_option(key, value, &config->flight_recorder_size);
+    } else if (strcmp(key, "flight_recorder_threshold_us") == 0) {
+      load_size_option(key, value, &config->flight_recorder_threshold_us);
+    } else if (strcmp(key, "audit_log_dir") == 0) {
+      config->audit_log_dir = value;
+    } else if (strcmp(key, "audit_segment_size") == 0) {
+      load_size_option(key, value, &config->audit_segment_size);
+    } else if (strcmp(key, "audit_segment_duration_ms") == 0) {
+      load_size_option(key, value, &config->audit_segment_duration_ms);
+    } else if (strcmp(key, "audit_flush_interval_ms") == 0) {
+      load_size_option(key, value, &config->audit_flush_interval_ms);
+    } else {
+      mosquitto_log_printf(MOSQ_LOG_WARNING,
+                           "Unexpected configuration key (%s), ignoring it",
+                           key);
+    }
+    if (result != MOSQ_ERR_SUCCESS) {
+      return result;
+    }
+  }
+
+  if (config->validator_limits.max_depth == 0 ||
+      config->validator_limits.max_depth > CBOR_VALIDATOR_MAX_DEPTH) {
+    mosquitto_log_printf(MOSQ_LOG_WARNING,
+                         "Maximum nesting depth must be between 1 and %d, "
+                         "using %d",
+                         CBOR_VALIDATOR_MAX_DEPTH, CBOR_VALIDATOR_MAX_DEPTH);
+    config->validator_limits.max_depth = CBOR_VALIDATOR_MAX_DEPTH;
+  }
+
+  if (config->checkpoint_interval_messages == 0) {
+    mosquitto_log_printf(MOSQ_LOG_WARNING,
+                         "Checkpoint interval must be at least 1 message, "
+                         "using %d",
+                         DEFAULT_CHECKPOINT_INTERVAL_MESSAGES);
+    config->checkpoint_interval_messages =
+        DEFAULT_CHECKPOINT_INTERVAL_MESSAGES;
+  }
+
+  if (config->envelope != ENVELOPE_MAP &&
+      config->sign_mode == SIGN_MODE_CHAIN) {
+    mosquitto_log_printf(MOSQ_LOG_WARNING,
+                         "The %s envelope needs the message sign mode, "
+                         "using the map envelope",
+                         config->envelope == ENVELOPE_COSE ? "cose"
+                                                           : "properties");
+    config->envelope = ENVELOPE_MAP;
+  }
+
+  // The COSE header only declares EdDSA, which has no prehashed variant
+  if (config->envelope == ENVELOPE_COSE &&
+      config->algorithm != SIGNING_ALGORITHM_ED25519) {
+    mosquitto_log_printf(MOSQ_LOG_WARNING,
+                         "The cose envelope needs the ed25519 algorithm, "
+                         "using the map envelope");
+    config->envelope = ENVELOPE_MAP;
+  }
+
+  if (config->tenants_file != NULL &&
+      config->tenant_selector == TENANT_SELECTOR_NONE) {
+    mosquitto_log_printf(MOSQ_LOG_WARNING,
+                         "Missing tenant_selector, selecting tenants by "
+                         "topic");
+    config->tenant_selector = TENANT_SELECTOR_TOPIC;
+  }
+
+  if (config->tenants_file != NULL && config->sign_mode == SIGN_MODE_CHAIN) {
+    mosquitto_log_printf(MOSQ_LOG_WARNING,
+                         "Tenant keys are ignored in chain sign mode, the "
+                         "chain is signed by the broker key");
+    config->tenants_file = NULL;
+  }
+
+  if (config->certificate_topic != NULL &&
+      strpbrk(config->certificate_topic, "+#") != NULL) {
+    mosquitto_log_printf(MOSQ_LOG_WARNING,
+                         "Certificate topic (%s) cannot contain wildcards, "
+                         "certificates are not published",
+                         config->certificate_topic);
+    config->certificate_topic = NULL;
+  }
+
+  if (config->audit_flush_interval_ms == 0) {
+    config->audit_flush_interval_ms = 1;
+  }
+
+  if (config->certificate_retry_initial_ms == 0) {
+    config->certificate_retry_initial_ms = 1;
+  }
+  if (config->certificate_retry_max_ms < config->certificate_retry_initial_ms) {
+    config->certificate_retry_max_ms = config->certificate_retry_initial_ms;
+  }
+  return MOSQ_ERR_SUCCESS;
+}
+
+/**
+ * Encodes the keys appended to messages once, for the configured key format
+ */
+static void encode_message_keys(plugin_config *config) {
+  if (config->key_format == KEY_FORMAT_INTEGER) {
+    cbor_splice_key_int(&config->ingestion_time_key, INGESTION_TIME_INT_KEY);
+    cbor_splice_key_int(&config->signature_key, SIGNATURE_INT_KEY);
+    cbor_splice_key_int(&config->sequence_key, SEQUENCE_INT_KEY);
+    cbor_splice_key_int(&config->chain_link_key, CHAIN_LINK_INT_KEY);
+    cbor_splice_key_int(&config->key_id_key, KEY_ID_INT_KEY);
+    cbor_splice_key_int(&config->countersignature_key,
+                        COUNTERSIGNATURE_INT_KEY);
+  } else {
+    cbor_splice_key_text(&config->ingestion_time_key, INGESTION_TIME_KEY);
+    cbor_splice_key_text(&config->signature_key, SIGNATURE_KEY);
+    cbor_splice_key_text(&config->sequence_key, SEQUENCE_KEY);
+    cbor_splice_key_text(&config->chain_link_key, CHAIN_LINK_KEY);
+    cbor_splice_key_text(&config->key_id_key, KEY_ID_KEY);
+    cbor_splice_key_text(&config->countersignature_key, COUNTERSIGNATURE_KEY);
+  }
+}
+
+/**
+ * Publishes a checkpoint signing the head of the hash chain. The checkpoint is
+ * a map with the same layout as chained messages, signed like messages are in
+ * message sign mode.
+ */
+static void publish_checkpoint(plugin_config *config) {
+  static const uint8_t EMPTY_MAP[] = {0xbf, 0xff};
+  const signing_key *key = signing_keyring_current(&config->keys);
+  if (key == NULL) {
+    return;
+  }
+
+  uint8_t base[128];
+  cbor_splice splice;
+
+  cbor_splice_init(&splice, base, sizeof(base), EMPTY_MAP, sizeof(EMPTY_MAP));
+  cbor_splice_put_key(&splice, &config->sequence_key);
+  cbor_splice_put_uint64(&splice, config->chain.sequence);
+  cbor_splice_put_key(&splice, &config->chain_link_key);
+  cbor_splice_put_bytes(&splice, config->chain.head, HASH_CHAIN_LINK_BYTES);
+
+  size_t base_size = cbor_splice_finish(&splice);
+  if (base_size == 0) {
+    mosquitto_log_printf(MOSQ_LOG_ERR, "Failed to encode checkpoint");
+    return;
+  }
+
+  uint8_t ingestion_time[INGESTION_CLOCK_MAX_ENCODED_SIZE];
+  size_t ingestion_time_size = ingestion_clock_encode(
+      &config->clock, ingestion_clock_now_ns(&config->clock), ingestion_time);
+
+  size_t checkpoint_size = utils_splice_signed_cbor_message_size(
+      base_size, &config->ingestion_time_key, ingestion_time_size,
+      &config->key_id_key, SIGNING_KEY_ID_BYTES, &config->signature_key);
+  uint8_t *checkpoint = (uint8_t *)mosquitto_malloc(checkpoint_size);
+  if (checkpoint == NULL) {
+    mosquitto_log_printf(MOSQ_LOG_ERR, "Failed to allocate checkpoint");
+    return;
+  }
+
+  error_code error = utils_splice_signed_cbor_message(
+      base, base_size, &config->ingestion_time_key, ingestion_time,
+      ingestion_time_size, &config->key_id_key, key->key_id,
+      SIGNING_KEY_ID_BYTES, &key->context, &config->signature_key,
+      checkpoint, checkpoint_size);
+  if (error != SUCCESS) {
+    mosquitto_log_printf(MOSQ_LOG_ERR, "Failed to sign checkpoint %d", error);
+    mosquitto_free(checkpoint);
+    return;
+  }
+
+  // The broker takes ownership of the checkpoint buffer
+  int result =
+      mosquitto_broker_publish(NULL, config->checkpoint_topic,
+                               (int)checkpoint_size, checkpoint, 1, false, NULL);
+  if (result != MOSQ_ERR_SUCCESS) {
+    mosquitto_log_printf(MOSQ_LOG_ERR, "Failed to publish checkpoint: %d",
+                         result);
+    return;
+  }
+
+  hash_chain_mark_checkpoint(&config->chain);
+  config->last_checkpoint_ms = monotonic_ms();
+}
+
+/**
+ * Re-encodes the payload through a libcbor tree. The encoded map is allocated
+ * from the message arena, which must be active.
+ * The payload must have been validated with cbor_validate_indefinite_map.
+ */
+static int reencode_tree(plugin_config *config, message_trace *trace,
+                         struct mosquitto_evt_message *ed,
+                         const uint8_t **map, size_t *map_size) {
+  struct cbor_load_result load_result;
+  cbor_item_t *cbor_map = cbor_load(ed->payload, ed->payloadlen, &load_result);
+
+  if (load_result.error.code != CBOR_ERR_NONE) {
+    trace_reject(trace, METRICS_REJECTED_DECODE, "Error loading CBOR data");
+    return -1;
+  }
+
+  size_t size = cbor_serialized_size(cbor_map);
+  uint8_t *buffer = size > 0 ? arena_alloc(config->message_arena, size) : NULL;
+
+  if (buffer == NULL || cbor_serialize(cbor_map, buffer, size) != size) {
+    trace_reject(trace, METRICS_REJECTED_SERIALIZE,
+                 "Failed to serialize CBOR map");
+    cbor_decref(&cbor_map);
+    return -1;
+  }
+
+  cbor_decref(&cbor_map);
+  *map = buffer;
+  *map_size = size;
+  return MOSQ_ERR_SUCCESS;
+}
+
+/**
+ * Appends the ingestion time and the authentication pairs of the configured
+ * sign mode to an encoded indefinite map, without decoding it, and replaces
+ * the payload of the message with the result
+ */
+static int sign_encoded_map(plugin_config *config, message_trace *trace,
+                            const signing_key *key,
+                            struct mosquitto_evt_message *ed,
+                            const uint8_t *map, size_t map_size) {
+  uint8_t ingestion_time[INGESTION_CLOCK_MAX_ENCODED_SIZE];
+  size_t ingestion_time_size = ingestion_clock_encode(
+      &config->clock, trace->ingestion_ns, ingestion_time);
+
+  size_t final_size = 0;
+  if (config->sign_mode == SIGN_MODE_CHAIN) {
+    final_size = utils_splice_chained_cbor_message_size(
+        map_size, &config->ingestion_time_key, ingestion_time_size,
+        &config->sequence_key, &config->chain_link_key);
+  } else if (config->envelope == ENVELOPE_COSE) {
+    final_size = utils_splice_cose_sign1_message_size(
+        map_size, &config->ingestion_time_key, ingestion_time_size,
+        SIGNING_KEY_ID_BYTES);
+  } else {
+    final_size = utils_splice_signed_cbor_message_size(
+        map_size, &config->ingestion_time_key, ingestion_time_size,
+        &config->key_id_key, SIGNING_KEY_ID_BYTES, &config->signature_key);
+  }
+
+  // The output buffer must be allocated with mosquitto_malloc since the
+  // broker will free it
+  uint8_t *new_payload = (uint8_t *)mosquitto_malloc(final_size);
+  if (new_payload == NULL) {
+    trace_reject(trace, METRICS_REJECTED_ALLOCATION,
+                 "Failed to allocate output buffer");
     return MOSQ_ERR_NOMEM;
-  default:
-    return MOSQ_ERR_UNKNOWN;
   }
+
+  error_code error = SUCCESS;
+  if (config->sign_mode == SIGN_MODE_CHAIN) {
+    error = utils_splice_chained_cbor_message(
+        map, map_size, &config->ingestion_time_key, ingestion_time,
+        ingestion_time_size, &config->chain, &config->sequence_key,
+        &config->chain_link_key, new_payload, final_size);
+  } else if (config->envelope == ENVELOPE_COSE) {
+    error = utils_splice_cose_sign1_message(
+        map, map_size, &config->ingestion_time_key, ingestion_time,
+        ingestion_time_size, &key->context, key->key_id,
+        SIGNING_KEY_ID_BYTES, new_payload, final_size);
+  } else {
+    error = utils_splice_signed_cbor_message(
+        map, map_size, &config->ingestion_time_key, ingestion_time,
+        ingestion_time_size, &config->key_id_key, key->key_id,
+        SIGNING_KEY_ID_BYTES, &key->context, &config->signature_key,
+        new_payload, final_size);
+  }
+
+  if (error != SUCCESS) {
+    trace_reject(trace, METRICS_REJECTED_SIGN,
+                 "Failed to make CBOR signed message");
+    mosquitto_free(new_payload);
+    return error_code_to_mosquitto_error(error);
+  }
+
+  /* Assign the new payload and payloadlen to the event data structure. You
+   * must *not* free the original payload, it will be handled by the
+   * broker. */
+  ed->payload = new_payload;
+  ed->payloadlen = final_size;
+  return MOSQ_ERR_SUCCESS;
 }
 
 /**
- * Initialize keypair in memory to sign messages,
- * and publish the public key to public storage for verification
+ * Appends a countersignature to a map already signed by another broker,
+ * without decoding it nor adding a second ingestion time, and replaces the
+ * payload of the message with the result
  */
-static int init_signing_keypair(plugin_config *config) {
-  int error =
-      crypto_sign_keypair(config->ca_public_key, config->ca_private_key);
+static int countersign_map(plugin_config *config, message_trace *trace,
+                           const signing_key *key,
+                           struct mosquitto_evt_message *ed) {
+  detached_signature countersignature;
+  countersignature.ingestion_time =
+      ingestion_clock_units(&config->clock, trace->ingestion_ns);
+  memcpy(countersignature.key_id, key->key_id, SIGNING_KEY_ID_BYTES);
 
-  if (error) {
-    mosquitto_log_printf(MOSQ_LOG_ERR,
-                         "Failed to generate crypto sign keypair: %d", error);
-    return error;
+  size_t final_size = utils_splice_countersigned_cbor_message_size(
+      ed->payloadlen, &config->countersignature_key);
+
+  // Freed by the broker, like the payloads of signed maps
+  uint8_t *new_payload = (uint8_t *)mosquitto_malloc(final_size);
+  if (new_payload == NULL) {
+    trace_reject(trace, METRICS_REJECTED_ALLOCATION,
+                 "Failed to allocate output buffer");
+    return MOSQ_ERR_NOMEM;
   }
 
-  certificate_repository *cert_repo =
-      certificate_repository_new(config->db_connection_string);
-  if (cert_repo == NULL) {
-    mosquitto_log_printf(MOSQ_LOG_ERR,
-                         "Failed to create certificate repository");
-    return -1;
+  error_code error = utils_splice_countersigned_cbor_message(
+      ed->payload, ed->payloadlen, &countersignature, &key->context,
+      &config->countersignature_key, new_payload, final_size);
+  if (error != SUCCESS) {
+    trace_reject(trace, METRICS_REJECTED_SIGN,
+                 "Failed to make CBOR countersigned message");
+    mosquitto_free(new_payload);
+    return error_code_to_mosquitto_error(error);
+  }
+
+  ed->payload = new_payload;
+  ed->payloadlen = final_size;
+  config->metrics.messages_countersigned++;
+  return MOSQ_ERR_SUCCESS;
+}
+
+/**
+ * Signs the topic, the ingestion time and the payload of a message, and
+ * attaches the signature as user properties. The payload is neither parsed
+ * nor copied.
+ *
+ * \param signature out signature of the message
+ */
+static int sign_properties(plugin_config *config, message_trace *trace,
+                           const signing_key *key,
+                           struct mosquitto_evt_message *ed,
+                           detached_signature *signature) {
+  signature->ingestion_time =
+      ingestion_clock_units(&config->clock, trace->ingestion_ns);
+  memcpy(signature->key_id, key->key_id, SIGNING_KEY_ID_BYTES);
+
+  detached_signature_input input;
+  detached_signature_input_init(&input, ed->topic, signature, ed->payload,
+                                ed->payloadlen);
+  if (signing_context_sign_parts(&key->context, input.parts,
+                                 DETACHED_SIGNATURE_PARTS,
+                                 signature->signature) != SUCCESS) {
+    trace_reject(trace, METRICS_REJECTED_SIGN, "Failed to sign payload");
+    return MOSQ_ERR_UNKNOWN;
   }
 
-  char pk_hex_string[crypto_sign_PUBLICKEYBYTES * 2 + 1] = {0};
-  sodium_bin2hex(pk_hex_string, sizeof(pk_hex_string), config->ca_public_key,
-                 crypto_sign_PUBLICKEYBYTES);
+  char time[DETACHED_SIGNATURE_TIME_TEXT_SIZE];
+  char key_id[DETACHED_SIGNATURE_KEY_ID_TEXT_SIZE];
+  char token[DETACHED_SIGNATURE_TOKEN_TEXT_SIZE];
+  detached_signature_format(signature, time, key_id, token);
 
-  struct timeval tv;
-  gettimeofday(&tv, NULL);
+  // Built on a copy of the message properties and swapped in only once
+  // complete, so that a failure never leaves a partial signature attached
+  mosquitto_property *properties = NULL;
+  if (mosquitto_property_copy_all(&properties, ed->properties) !=
+          MOSQ_ERR_SUCCESS ||
+      mosquitto_property_add_string_pair(&properties, MQTT_PROP_USER_PROPERTY,
+                                         DETACHED_SIGNATURE_TIME_PROPERTY,
+                                         time) != MOSQ_ERR_SUCCESS ||
+      mosquitto_property_add_string_pair(&properties, MQTT_PROP_USER_PROPERTY,
+                                         DETACHED_SIGNATURE_KEY_ID_PROPERTY,
+                                         key_id) != MOSQ_ERR_SUCCESS ||
+      mosquitto_property_add_string_pair(&properties, MQTT_PROP_USER_PROPERTY,
+                                         DETACHED_SIGNATURE_TOKEN_PROPERTY,
+                                         token) != MOSQ_ERR_SUCCESS) {
+    mosquitto_property_free_all(&properties);
+    trace_reject(trace, METRICS_REJECTED_ALLOCATION,
+                 "Failed to add signature properties");
+    return MOSQ_ERR_NOMEM;
+  }
 
-  certificate cert = {
-      .entity = ENTITY,
-      .create_time_unix = (uint64_t)tv.tv_sec,
-      .public_key = pk_hex_string,
-  };
+  // The broker owns the property list and frees it with the message
+  mosquitto_property_free_all(&ed->properties);
+  ed->properties = properties;
+  return MOSQ_ERR_SUCCESS;
+}
 
-  mosquitto_log_printf(MOSQ_LOG_DEBUG, "Generated keypair for entity %s at %lu",
-                       ENTITY, cert.create_time_unix);
+/**
+ * Returns the key of the tenant publishing a message, the broker key when the
+ * tenant is unknown, null when waiting for the certificate of the tenant key
+ */
+static const signing_key *select_tenant_key(const plugin_config *config,
+                                            struct mosquitto_evt_message *ed,
+                                            const signing_key *key) {
+  const char *name = NULL;
+  size_t length = 0;
+  switch (config->tenant_selector) {
+  case TENANT_SELECTOR_TOPIC:
+    name = tenant_keys_topic_level(ed->topic, config->tenant_topic_level,
+                                   &length);
+    break;
+  case TENANT_SELECTOR_USERNAME:
+    name = mosquitto_client_username(ed->client);
+    break;
+  case TENANT_SELECTOR_CLIENT_ID:
+    name = mosquitto_client_id(ed->client);
+    break;
+  default:
+    break;
+  }
+  if (name == NULL) {
+    return key;
+  }
+  if (config->tenant_selector != TENANT_SELECTOR_TOPIC) {
+    length = strlen(name);
+  }
 
-  error = certificate_repository_add(cert_repo, &cert);
+  bool stored = false;
+  const signing_key *tenant_key =
+      tenant_keys_find(config->tenant_keys, name, length, &stored);
+  if (tenant_key == NULL) {
+    return key;
+  }
+  return stored || !config->wait_for_certificate ? tenant_key : NULL;
+}
 
-  if (error) {
-    mosquitto_log_printf(
-        MOSQ_LOG_ERR, "Failed to add new certificate to repository: %d", error);
+/**
+ * Keeps a signed message in the audit log as it is delivered, with its
+ * signature when it is carried by properties. Only copies the message into
+ * the mapped segment, messages that cannot be kept are counted by the log.
+ */
+static void audit_message(plugin_config *config, const message_trace *trace,
+                          const struct mosquitto_evt_message *ed,
+                          const detached_signature *signature) {
+  uint8_t packed[DETACHED_SIGNATURE_PACKED_BYTES];
+  audit_record record = {
+      .time_ns = trace->ingestion_ns,
+      .topic = ed->topic,
+      .topic_length = strlen(ed->topic),
+      .payload = (const uint8_t *)ed->payload,
+      .payload_size = ed->payloadlen,
+  };
+  if (signature != NULL) {
+    detached_signature_pack(signature, packed);
+    record.signature = packed;
+    record.signature_size = sizeof(packed);
   }
+  audit_log_append(config->audit_log, &record);
+}
 
-  certificate_repository_destroy(cert_repo);
-  return error;
+/**
+ * Checks if the messages published on a topic must be signed: the topic must
+ * match sign_topics when configured, and must not match skip_topics
+ */
+static bool is_topic_selected(const plugin_config *config, const char *topic) {
+  if (config->sign_topics != NULL && !topic_trie_is_empty(config->sign_topics) &&
+      !topic_trie_matches(config->sign_topics, topic)) {
+    return false;
+  }
+  return config->skip_topics == NULL ||
+         !topic_trie_matches(config->skip_topics, topic);
 }
 
-static void load_configuration(plugin_config *config,
-                               struct mosquitto_opt *opts, int opt_count) {
-  for (size_t i = 0; i < opt_count; i++) {
-    char *key = opts[i].key;
-    char *value = opts[i].value;
+/**
+ * Returns the failure policy of a topic, the policy lists being checked from
+ * the most to the least restrictive
+ */
+static failure_policy topic_failure_policy(const plugin_config *config,
+                                           const char *topic) {
+  static const failure_policy PRECEDENCE[] = {
+      FAILURE_POLICY_DROP, FAILURE_POLICY_MARK, FAILURE_POLICY_PASS};
 
-    if (strcmp(key, "db_connection_string") == 0) {
-      config->db_connection_string = value;
-    } else {
-      mosquitto_log_printf(MOSQ_LOG_WARNING,
-                           "Unexpected configuration key (%s), ignoring it",
-                           key);
+  for (size_t i = 0; i < sizeof(PRECEDENCE) / sizeof(PRECEDENCE[0]); i++) {
+    const topic_trie *trie = config->failure_policy_topics[PRECEDENCE[i]];
+    if (trie != NULL && topic_trie_matches(trie, topic)) {
+      return PRECEDENCE[i];
+    }
+  }
+  return config->failure_policy;
+}
+
+/**
+ * Returns the policy of a topic for maps already signed by another broker,
+ * the policy lists being checked from the one adding the most signatures to
+ * the least
+ */
+static signed_policy topic_signed_policy(const plugin_config *config,
+                                         const char *topic) {
+  static const signed_policy PRECEDENCE[] = {SIGNED_POLICY_COUNTERSIGN,
+                                             SIGNED_POLICY_RESIGN,
+                                             SIGNED_POLICY_PASS};
+
+  for (size_t i = 0; i < sizeof(PRECEDENCE) / sizeof(PRECEDENCE[0]); i++) {
+    const topic_trie *trie = config->signed_policy_topics[PRECEDENCE[i]];
+    if (trie != NULL && topic_trie_matches(trie, topic)) {
+      return PRECEDENCE[i];
     }
   }
+  return config->signed_policy;
+}
+
+/**
+ * Decides the fate of a message that could not be signed. Its payload is
+ * still the original one.
+ *
+ * \param result error returned when the message is dropped
+ * \returns the result of the message callback
+ */
+static int apply_failure_policy(plugin_config *config,
+                                const message_trace *trace,
+                                struct mosquitto_evt_message *ed, int result) {
+  failure_policy policy = topic_failure_policy(config, ed->topic);
+  if (policy == FAILURE_POLICY_DROP) {
+    return result;
+  }
+
+  if (policy == FAILURE_POLICY_MARK) {
+    const char *reason =
+        metrics_rejection_name((metrics_rejection)(trace->outcome - 1));
+    // Delivered unmarked rather than dropped when the property cannot be
+    // allocated
+    mosquitto_property_add_string_pair(&ed->properties,
+                                       MQTT_PROP_USER_PROPERTY,
+                                       UNSIGNED_PROPERTY, reason);
+  }
+  config->metrics.messages_unsigned++;
+  return MOSQ_ERR_SUCCESS;
 }
 
 static int callback_message(int event, void *event_data, void *userdata) {
   UNUSED(event);
-  struct timeval tv;
-  gettimeofday(&tv, NULL);
 
   plugin_config *config = (plugin_config *)userdata;
   struct mosquitto_evt_message *ed = (struct mosquitto_evt_message *)event_data;
 
-  struct cbor_load_result load_result;
-  cbor_item_t *cbor_map = cbor_load(ed->payload, ed->payloadlen, &load_result);
+  // Let messages on other topics through untouched
+  if (!is_topic_selected(config, ed->topic)) {
+    config->metrics.messages_skipped++;
+    return MOSQ_ERR_SUCCESS;
+  }
 
-  if (load_result.error.code != CBOR_ERR_NONE) {
-    mosquitto_log_printf(MOSQ_LOG_ERR, "Error loading CBOR data: %d",
-                         load_result.error.code);
-    return -1;
+  // The only read of the ingestion clock for this message
+  message_trace trace;
+  trace_start(config, &trace, ingestion_clock_now_ns(&config->clock));
+  uint32_t payload_size = ed->payloadlen;
+
+  // The key is loaded once, a rotation during this message keeps it alive
+  // for the grace period
+  const signing_key *key = signing_keyring_current(&config->keys);
+  if (key != NULL && config->tenant_keys != NULL) {
+    key = select_tenant_key(config, ed, key);
+  }
+  if (key == NULL) {
+    // Only happens when waiting for the certificate of the first key or of
+    // the tenant key
+    trace_reject(&trace, METRICS_REJECTED_NO_KEY,
+                 "Certificate not stored yet");
+    trace_finish(config, &trace, ed, payload_size);
+    return apply_failure_policy(config, &trace, ed, -1);
   }
 
-  if (!cbor_isa_map(cbor_map)) {
-    mosquitto_log_printf(MOSQ_LOG_ERR, "CBOR item is not a map");
-    cbor_decref(&cbor_map);
-    return -1;
+  if (config->envelope == ENVELOPE_PROPERTIES) {
+    int result = MOSQ_ERR_SUCCESS;
+    size_t max_payload_size = config->validator_limits.max_payload_size;
+    if (max_payload_size > 0 && payload_size > max_payload_size) {
+      trace_reject(&trace, METRICS_REJECTED_INVALID_PAYLOAD,
+                   cbor_validation_result_to_string(
+                       CBOR_VALIDATION_TOO_LARGE));
+      result = -1;
+    } else {
+      detached_signature signature;
+      result = sign_properties(config, &trace, key, ed, &signature);
+      trace_stage(config, &trace, METRICS_STAGE_SIGN);
+      if (config->audit_log != NULL &&
+          trace.outcome == FLIGHT_RECORD_SIGNED) {
+        audit_message(config, &trace, ed, &signature);
+      }
+    }
+
+    trace_finish(config, &trace, ed, payload_size);
+    if (trace.outcome != FLIGHT_RECORD_SIGNED) {
+      return apply_failure_policy(config, &trace, ed, result);
+    }
+    return result;
   }
 
-  if (!cbor_map_is_indefinite(cbor_map)) {
-    mosquitto_log_printf(MOSQ_LOG_ERR, "CBOR map is not indefinite");
-    cbor_decref(&cbor_map);
-    return -1;
+  // Reject invalid payloads before any allocation
+  cbor_validation_result validation = cbor_validate_indefinite_map(
+      ed->payload, ed->payloadlen, &config->validator_limits);
+  trace_stage(config, &trace, METRICS_STAGE_VALIDATE);
+
+  if (validation != CBOR_VALIDATION_OK) {
+    trace_reject(&trace, METRICS_REJECTED_INVALID_PAYLOAD,
+                 cbor_validation_result_to_string(validation));
+    trace_finish(config, &trace, ed, payload_size);
+    return apply_failure_policy(config, &trace, ed, -1);
   }
 
-  cbor_item_t *ingestion_time_key = cbor_build_string("INGESTION_TIME");
-  cbor_item_t *ingestion_time_value = cbor_build_uint64(tv.tv_usec / 1000u);
-  struct cbor_pair ingestion_time_pair = {.key = ingestion_time_key,
-                                          .value = ingestion_time_value};
+  const uint8_t *map = ed->payload;
+  size_t map_size = ed->payloadlen;
+  int result = MOSQ_ERR_SUCCESS;
 
-  if (!cbor_map_add(cbor_map, ingestion_time_pair)) {
-    mosquitto_log_printf(MOSQ_LOG_ERR, "Failed to add INGESTION TIME");
-    cbor_decref(&cbor_map);
-    cbor_decref(&ingestion_time_key);
-    cbor_decref(&ingestion_time_value);
-    return -1;
+  // Maps signed by another broker are recognized by their last pair, before
+  // any decoding
+  signed_policy policy = SIGNED_POLICY_RESIGN;
+  if (verifier_is_signed_map(map, map_size)) {
+    policy = topic_signed_policy(config, ed->topic);
+  }
+  if (policy == SIGNED_POLICY_PASS) {
+    // Kept in the audit log like the maps signed here, the log holding every
+    // signed message delivered
+    trace.outcome = FLIGHT_RECORD_PASSED;
+    if (config->audit_log != NULL) {
+      audit_message(config, &trace, ed, NULL);
+    }
+    trace_finish(config, &trace, ed, payload_size);
+    return MOSQ_ERR_SUCCESS;
   }
 
-  error_code error = utils_make_signed_cbor_message(
-      cbor_map, config->ca_private_key, "VERIFICATION_TOKEN");
+  if (policy == SIGNED_POLICY_COUNTERSIGN) {
+    result = countersign_map(config, &trace, key, ed);
+    trace_stage(config, &trace, METRICS_STAGE_SIGN);
+  } else {
+    if (config->payload_mode == PAYLOAD_MODE_TREE) {
+      // Every libcbor allocation made for this message comes from the arena,
+      // which is released at once when the message has been signed
+      arena_activate(config->message_arena);
+      result = reencode_tree(config, &trace, ed, &map, &map_size);
+      arena_activate(NULL);
+      trace_stage(config, &trace, METRICS_STAGE_DECODE);
+    }
 
-  if (error != SUCCESS) {
-    mosquitto_log_printf(MOSQ_LOG_ERR, "Failed to make CBOR signed message %d",
-                         error);
-    cbor_decref(&cbor_map);
-    return error_code_to_mosquitto_error(error);
+    if (result == MOSQ_ERR_SUCCESS) {
+      result = sign_encoded_map(config, &trace, key, ed, map, map_size);
+      trace_stage(config, &trace, METRICS_STAGE_SIGN);
+    }
+
+    if (config->payload_mode == PAYLOAD_MODE_TREE) {
+      arena_reset(config->message_arena);
+    }
   }
 
-  // Serialize the updated CBOR map
-  unsigned char *final_buffer = NULL;
-  size_t final_size = 0;
-  final_size = cbor_serialize_alloc(cbor_map, &final_buffer, &final_size);
-  if (final_buffer == NULL) {
-    mosquitto_log_printf(MOSQ_LOG_ERR, "Failed to serialize updated CBOR map");
-    cbor_decref(&cbor_map);
-    return -1;
+  if (config->sign_mode == SIGN_MODE_CHAIN &&
+      hash_chain_pending(&config->chain) >=
+          config->checkpoint_interval_messages) {
+    publish_checkpoint(config);
   }
 
-  // Allocate output buffer using mosquitto_calloc
-  uint8_t *new_payload = (uint8_t *)mosquitto_calloc(1, final_size);
-  if (new_payload == NULL) {
-    mosquitto_log_printf(MOSQ_LOG_ERR, "Failed to allocate output buffer");
-    cbor_decref(&cbor_map);
-    free(final_buffer);
-    return MOSQ_ERR_NOMEM;
+  if (config->audit_log != NULL && trace.outcome == FLIGHT_RECORD_SIGNED) {
+    audit_message(config, &trace, ed, NULL);
   }
+  trace_finish(config, &trace, ed, payload_size);
 
-  // Copy the final serialized data to the output buffer
-  memcpy(new_payload, final_buffer, final_size);
+  if (trace.outcome != FLIGHT_RECORD_SIGNED) {
+    return apply_failure_policy(config, &trace, ed, result);
+  }
+  return result;
+}
 
-  /* Assign the new payload and payloadlen to the event data structure. You
-   * must *not* free the original payload, it will be handled by the
-   * broker. */
-  ed->payload = new_payload;
-  ed->payloadlen = final_size;
+static void publish_metric(const char *name, uint64_t value, void *userdata) {
+  UNUSED(userdata);
+
+  char topic[128];
+  char payload[24];
+  snprintf(topic, sizeof(topic), METRICS_TOPIC_PREFIX "%s", name);
+  int length = snprintf(payload, sizeof(payload), "%llu",
+                        (unsigned long long)value);
+
+  // Retained like the other $SYS topics
+  mosquitto_broker_publish_copy(NULL, topic, length, payload, 0, true, NULL);
+}
+
+/**
+ * Writes the metrics to the Prometheus file, through a temporary file renamed
+ * over it so that readers never see a partial file
+ */
+static void write_prometheus_file(plugin_config *config) {
+  char path[4096];
+  snprintf(path, sizeof(path), "%s.tmp", config->metrics_prometheus_file);
+
+  FILE *out = fopen(path, "w");
+  if (out == NULL) {
+    mosquitto_log_printf(MOSQ_LOG_WARNING, "Failed to open %s", path);
+    return;
+  }
+
+  int error = metrics_write_prometheus(&config->metrics, out);
+  if (fclose(out) != 0 || error != 0 ||
+      rename(path, config->metrics_prometheus_file) != 0) {
+    mosquitto_log_printf(MOSQ_LOG_WARNING, "Failed to write metrics to %s",
+                         config->metrics_prometheus_file);
+    remove(path);
+  }
+}
+
+static void publish_metrics(plugin_config *config) {
+  metrics_for_each(&config->metrics, publish_metric, config);
+  if (config->metrics_prometheus_file != NULL) {
+    write_prometheus_file(config);
+  }
+  metrics_reset_interval(&config->metrics);
+}
+
+static void log_rejected_prefix(const char *prefix, const uint64_t *counts,
+                                void *userdata) {
+  UNUSED(userdata);
+
+  char line[256];
+  size_t length = 0;
+  for (int i = 0; i < METRICS_REJECTED_COUNT && length < sizeof(line); i++) {
+    if (counts[i] > 0) {
+      length += (size_t)snprintf(
+          line + length, sizeof(line) - length, " %s=%llu",
+          metrics_rejection_name((metrics_rejection)i),
+          (unsigned long long)counts[i]);
+    }
+  }
+  mosquitto_log_printf(MOSQ_LOG_WARNING, "Rejected on %s:%s",
+                       prefix != NULL ? prefix : "other topics", line);
+}
+
+/**
+ * Logs the rejections of the last summary interval per topic prefix and
+ * reason
+ */
+static void log_rejection_summary(plugin_config *config) {
+  reject_log *log = &config->reject_log;
+  uint64_t now_ms = monotonic_ms();
+  if (!reject_log_summary_due(log, now_ms)) {
+    return;
+  }
+
+  if (log->interval_rejected > 0) {
+    mosquitto_log_printf(MOSQ_LOG_WARNING,
+                         "Rejected %llu messages in the last %llu ms, %llu "
+                         "not logged",
+                         (unsigned long long)log->interval_rejected,
+                         (unsigned long long)(now_ms - log->interval_start_ms),
+                         (unsigned long long)log->interval_suppressed);
+  }
+  reject_log_summarize(log, now_ms, log_rejected_prefix, NULL);
+}
+
+static int callback_tick(int event, void *event_data, void *userdata) {
+  UNUSED(event);
+  UNUSED(event_data);
+
+  plugin_config *config = (plugin_config *)userdata;
+
+  poll_certificate_repository(config);
+  signing_keyring_reclaim(&config->keys, monotonic_ms());
+  log_rejection_summary(config);
+
+  if (config->audit_log != NULL) {
+    uint64_t dropped = audit_log_dropped(config->audit_log);
+    if (dropped > config->audit_dropped_logged) {
+      mosquitto_log_printf(MOSQ_LOG_ERR,
+                           "%llu signed messages could not be written to the "
+                           "audit log",
+                           (unsigned long long)(dropped -
+                                                config->audit_dropped_logged));
+      config->audit_dropped_logged = dropped;
+    }
+  }
+
+  if (monotonic_ms() >= config->next_clock_calibration_ms) {
+    ingestion_clock_recalibrate(&config->clock);
+    config->next_clock_calibration_ms =
+        monotonic_ms() + CLOCK_CALIBRATION_INTERVAL_MS;
+  }
+
+  if (config->metrics_interval_ms > 0 &&
+      monotonic_ms() >= config->next_metrics_ms) {
+    publish_metrics(config);
+    config->next_metrics_ms = monotonic_ms() + config->metrics_interval_ms;
+  }
+
+  if (config->key_rotation_interval > 0 && config->unpublished_key == NULL &&
+      monotonic_ms() >= config->next_rotation_ms) {
+    rotate_signing_key(config);
+  }
+
+  if (config->sign_mode == SIGN_MODE_CHAIN &&
+      hash_chain_pending(&config->chain) > 0 &&
+      monotonic_ms() - config->last_checkpoint_ms >=
+          config->checkpoint_interval_ms) {
+    publish_checkpoint(config);
+  }
 
-  cbor_decref(&cbor_map);
-  free(final_buffer);
   return MOSQ_ERR_SUCCESS;
 }
 
+static int callback_control(int event, void *event_data, void *userdata) {
+  UNUSED(event);
+  UNUSED(event_data);
+
+  plugin_config *config = (plugin_config *)userdata;
+  mosquitto_log_printf(MOSQ_LOG_INFO, "Key rotation requested");
+  return rotate_signing_key(config);
+}
+
 int mosquitto_plugin_version(int supported_version_count,
                              const int *supported_versions) {
   int i;
@@ -205,7 +1824,7 @@ int mosquitto_plugin_init(mosquitto_plugin_id_t *identifier, void **user_data,
   }
 
   /* Init session data */
-  *user_data = mosquitto_malloc(sizeof(plugin_config));
+  *user_data = mosquitto_calloc(1, sizeof(plugin_config));
   if (*user_data == NULL) {
     mosquitto_log_printf(MOSQ_LOG_ERR,
                          "Failed to allocate memory for plugin config");
@@ -213,10 +1832,185 @@ int mosquitto_plugin_init(mosquitto_plugin_id_t *identifier, void **user_data,
   }
 
   plugin_config *config = (plugin_config *)*user_data;
-  load_configuration(config, opts, opt_count);
-  int error = init_signing_keypair(config);
-  if (error) {
-    return -1;
+  int result = load_configuration(config, opts, opt_count);
+  if (result != MOSQ_ERR_SUCCESS) {
+    return result;
+  }
+  encode_message_keys(config);
+
+  if (ingestion_clock_init(&config->clock, config->clock_source,
+                           config->time_precision,
+                           config->time_encoding) != SUCCESS) {
+    mosquitto_log_printf(MOSQ_LOG_WARNING,
+                         "No invariant TSC available, using the realtime "
+                         "clock");
+    ingestion_clock_init(&config->clock, CLOCK_SOURCE_REALTIME,
+                         config->time_precision, config->time_encoding);
+  }
+  config->next_clock_calibration_ms =
+      monotonic_ms() + CLOCK_CALIBRATION_INTERVAL_MS;
+
+  if (config->key_file != NULL && config->key_rotation_interval > 0) {
+    mosquitto_log_printf(MOSQ_LOG_WARNING,
+                         "Scheduled key rotation is disabled with key_file");
+    config->key_rotation_interval = 0;
+  }
+
+  if (config->db_connection_string == NULL && config->key_file == NULL) {
+    mosquitto_log_printf(MOSQ_LOG_ERR,
+                         "Missing db_connection_string or key_file "
+                         "configuration");
+    return MOSQ_ERR_INVAL;
+  }
+
+  // Tenant certificates are written to the database, which key files avoid
+  if (config->tenants_file != NULL && config->key_file != NULL) {
+    mosquitto_log_printf(MOSQ_LOG_ERR,
+                         "tenants_file needs db_connection_string and cannot "
+                         "be used with key_file");
+    return MOSQ_ERR_INVAL;
+  }
+
+  // Without them every start would register new keys for every tenant
+  if (config->tenants_file != NULL &&
+      (config->tenant_key_file == NULL ||
+       config->tenant_registry_file == NULL)) {
+    mosquitto_log_printf(MOSQ_LOG_ERR,
+                         "tenants_file needs tenant_key_file and "
+                         "tenant_registry_file");
+    return MOSQ_ERR_INVAL;
+  }
+
+  // Verifiers derive the MAC key from the seed, which only key files share
+  if (config->algorithm == SIGNING_ALGORITHM_BLAKE2B_MAC &&
+      config->key_file == NULL) {
+    mosquitto_log_printf(MOSQ_LOG_ERR,
+                         "The blake2b-mac algorithm needs a key_file");
+    return MOSQ_ERR_INVAL;
+  }
+
+  if (config->sign_topics != NULL) {
+    topic_trie_compile(config->sign_topics);
+  }
+  if (config->skip_topics != NULL) {
+    topic_trie_compile(config->skip_topics);
+  }
+  for (int i = 0; i < FAILURE_POLICY_COUNT; i++) {
+    if (config->failure_policy_topics[i] != NULL) {
+      topic_trie_compile(config->failure_policy_topics[i]);
+    }
+  }
+  for (int i = 0; i < SIGNED_POLICY_COUNT; i++) {
+    if (config->signed_policy_topics[i] != NULL) {
+      topic_trie_compile(config->signed_policy_topics[i]);
+    }
+  }
+  reject_log_init(&config->reject_log, config->reject_log_rate,
+                  config->reject_log_burst, config->reject_log_prefix_levels,
+                  config->reject_log_interval_ms, monotonic_ms());
+
+  arena_register_cbor_allocator();
+  config->message_arena =
+      arena_new(ARENA_INITIAL_SIZE, config->arena_max_retained_size);
+  if (config->message_arena == NULL) {
+    mosquitto_log_printf(MOSQ_LOG_ERR, "Failed to allocate message arena");
+    return MOSQ_ERR_NOMEM;
+  }
+
+  signing_keyring_init(&config->keys);
+  int error = MOSQ_ERR_SUCCESS;
+  if (config->key_file != NULL) {
+    error = load_shared_key(config);
+    if (error != MOSQ_ERR_SUCCESS) {
+      return error;
+    }
+  } else {
+    certificate_repository_options repository_options = {
+        .connection = config->db_connection_string,
+        .outbox_path = config->certificate_outbox,
+        .retry_initial_ms = config->certificate_retry_initial_ms,
+        .retry_max_ms = config->certificate_retry_max_ms,
+        .timeout_ms = config->certificate_timeout_ms,
+        .stored_callback = certificate_stored,
+        .userdata = config,
+    };
+    config->certificate_repository =
+        certificate_repository_new(&repository_options);
+    if (config->certificate_repository == NULL) {
+      mosquitto_log_printf(MOSQ_LOG_ERR,
+                           "Failed to create certificate repository");
+      return MOSQ_ERR_UNKNOWN;
+    }
+
+    if (config->tenants_file != NULL) {
+      error = load_tenants(config);
+      if (error != MOSQ_ERR_SUCCESS) {
+        return error;
+      }
+    }
+
+    error = rotate_signing_key(config);
+    if (error != MOSQ_ERR_SUCCESS) {
+      return -1;
+    }
+  }
+
+  if (config->sign_mode == SIGN_MODE_CHAIN) {
+    const signing_key *first_key = config->unpublished_key != NULL
+                                       ? config->unpublished_key
+                                       : signing_keyring_current(&config->keys);
+    hash_chain_init(&config->chain, first_key->public_key,
+                    sizeof(first_key->public_key));
+    config->last_checkpoint_ms = monotonic_ms();
+  }
+
+  config->next_metrics_ms = monotonic_ms() + config->metrics_interval_ms;
+
+  if (config->flight_recorder_file != NULL) {
+    config->flight_recorder = flight_recorder_open(
+        config->flight_recorder_file, config->flight_recorder_size);
+    if (config->flight_recorder == NULL) {
+      mosquitto_log_printf(MOSQ_LOG_ERR,
+                           "Failed to open flight recorder file %s",
+                           config->flight_recorder_file);
+      return MOSQ_ERR_UNKNOWN;
+    }
+  }
+
+  if (config->audit_log_dir != NULL) {
+    audit_log_options audit_options = {
+        .directory = config->audit_log_dir,
+        .segment_size = config->audit_segment_size,
+        .segment_duration_ms = config->audit_segment_duration_ms,
+        .flush_interval_ms = config->audit_flush_interval_ms,
+    };
+    config->audit_log = audit_log_open(&audit_options);
+    if (config->audit_log == NULL) {
+      mosquitto_log_printf(MOSQ_LOG_ERR,
+                           "Failed to open audit log segment in %s",
+                           config->audit_log_dir);
+      return MOSQ_ERR_UNKNOWN;
+    }
+  }
+  config->timing_enabled =
+      config->metrics_interval_ms > 0 || config->flight_recorder != NULL;
+
+  // The tick drives the certificate publication, the checkpoints and the
+  // metrics
+  error = mosquitto_callback_register(mosq_pid, MOSQ_EVT_TICK, callback_tick,
+                                      NULL, config);
+  if (error != MOSQ_ERR_SUCCESS) {
+    return error;
+  }
+
+  // Any client allowed to publish on the control topic can rotate the key
+  if (config->control_topic_enabled) {
+    error = mosquitto_callback_register(mosq_pid, MOSQ_EVT_CONTROL,
+                                        callback_control, KEY_ROTATION_TOPIC,
+                                        config);
+    if (error != MOSQ_ERR_SUCCESS) {
+      return error;
+    }
   }
 
   return mosquitto_callback_register(mosq_pid, MOSQ_EVT_MESSAGE,
@@ -229,6 +2023,37 @@ int mosquitto_plugin_cleanup(void *user_data, struct mosquitto_opt *opts,
   UNUSED(opt_count);
 
   if (user_data != NULL) {
+    plugin_config *config = (plugin_config *)user_data;
+    mosquitto_callback_unregister(mosq_pid, MOSQ_EVT_TICK, callback_tick,
+                                  NULL);
+    if (config->control_topic_enabled) {
+      mosquitto_callback_unregister(mosq_pid, MOSQ_EVT_CONTROL,
+                                    callback_control, KEY_ROTATION_TOPIC);
+    }
+    if (config->certificate_repository != NULL) {
+      certificate_repository_destroy(config->certificate_repository);
+    }
+    if (!config->unpublished_key_installed) {
+      signing_key_destroy(config->unpublished_key);
+    }
+    signing_keyring_destroy(&config->keys);
+    tenant_keys_destroy(config->tenant_keys);
+    if (config->tenant_registry != NULL) {
+      fclose(config->tenant_registry);
+    }
+    if (config->message_arena != NULL) {
+      arena_destroy(config->message_arena);
+    }
+    topic_trie_destroy(config->sign_topics);
+    topic_trie_destroy(config->skip_topics);
+    for (int i = 0; i < FAILURE_POLICY_COUNT; i++) {
+      topic_trie_destroy(config->failure_policy_topics[i]);
+    }
+    for (int i = 0; i < SIGNED_POLICY_COUNT; i++) {
+      topic_trie_destroy(config->signed_policy_topics[i]);
+    }
+    flight_recorder_close(config->flight_recorder);
+    audit_log_close(config->audit_log);
     mosquitto_free(user_data);
   }
 
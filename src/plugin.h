@@ -1,8 +1,217 @@
 #pragma once
+#include "arena.h"
+#include "audit_log.h"
+#include "cbor_splice.h"
+#include "cbor_validator.h"
+#include "certificate_repository.h"
+#include "detached_signature.h"
+#include "flight_recorder.h"
+#include "hash_chain.h"
+#include "ingestion_clock.h"
+#include "metrics.h"
+#include "reject_log.h"
+#include "signing_key.h"
+#include "tenant_keys.h"
+#include "topic_trie.h"
+#include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
+
+/**
+ * Strategy used to append the ingestion time and the signature to a payload
+ */
+typedef enum {
+  /** Decode the payload into a libcbor tree, then serialize it again */
+  PAYLOAD_MODE_TREE = 0,
+
+  /** Validate the encoded payload and splice the new pairs into a copy */
+  PAYLOAD_MODE_SPLICE
+} payload_mode;
+
+/**
+ * How messages are authenticated
+ */
+typedef enum {
+  /** Every message carries its own ED25519 signature */
+  SIGN_MODE_MESSAGE = 0,
+
+  /** Every message carries a hash chain link, the chain head is signed by
+     checkpoints published periodically */
+  SIGN_MODE_CHAIN
+} sign_mode;
+
+/**
+ * Keys of the pairs appended to messages
+ */
+typedef enum {
+  /** Text keys such as "INGESTION_TIME" */
+  KEY_FORMAT_TEXT = 0,
+
+  /** Negative integer keys, one or two bytes on the wire */
+  KEY_FORMAT_INTEGER
+} key_format;
+
+/**
+ * How the signature is attached to a message in message sign mode
+ */
+typedef enum {
+  /** Pair appended to the payload map */
+  ENVELOPE_MAP = 0,
+
+  /** COSE_Sign1 message (RFC 9052) whose payload is the map with the
+     ingestion time */
+  ENVELOPE_COSE,
+
+  /** MQTT v5 user properties signing the topic, the ingestion time and the
+     untouched payload, which can be of any format */
+  ENVELOPE_PROPERTIES
+} envelope;
+
+/**
+ * What happens to a message that cannot be signed
+ */
+typedef enum {
+  /** The message is rejected and not delivered */
+  FAILURE_POLICY_DROP = 0,
+
+  /** The message is delivered unchanged */
+  FAILURE_POLICY_PASS,
+
+  /** The message is delivered unchanged with an UNSIGNED user property
+     naming the rejection reason */
+  FAILURE_POLICY_MARK,
+
+  FAILURE_POLICY_COUNT
+} failure_policy;
+
+/**
+ * What happens to a map already signed by another broker, such as the edge
+ * broker of a bridge
+ */
+typedef enum {
+  /** The map is signed again like any other one, which repeats the keys of
+     the appended pairs */
+  SIGNED_POLICY_RESIGN = 0,
+
+  /** The map is delivered unchanged */
+  SIGNED_POLICY_PASS,
+
+  /** A countersignature of the map as received is appended to it */
+  SIGNED_POLICY_COUNTERSIGN,
+
+  SIGNED_POLICY_COUNT
+} signed_policy;
+
+/**
+ * What selects the key of the tenant signing a message
+ */
+typedef enum {
+  /** Every message is signed with the key of the broker */
+  TENANT_SELECTOR_NONE = 0,
+
+  /** A level of the topic names the tenant */
+  TENANT_SELECTOR_TOPIC,
+
+  /** The username of the publishing client names the tenant */
+  TENANT_SELECTOR_USERNAME,
+
+  /** The client id of the publishing client names the tenant */
+  TENANT_SELECTOR_CLIENT_ID
+} tenant_selector;
 
 typedef struct {
   const char *db_connection_string;
-  uint8_t ca_public_key[32];
-  uint8_t ca_private_key[64];
-} plugin_config;
\ No newline at end of file
+  const char *entity;
+  const char *key_file;
+  const char *key_secret_file;
+  bool wait_for_certificate;
+  const char *certificate_outbox;
+  const char *certificate_topic;
+  size_t certificate_retry_initial_ms;
+  size_t certificate_retry_max_ms;
+  size_t certificate_timeout_ms;
+  size_t key_rotation_interval;
+  size_t key_rotation_grace_ms;
+  bool control_topic_enabled;
+  const char *tenants_file;
+  const char *tenant_key_file;
+  const char *tenant_registry_file;
+  tenant_selector tenant_selector;
+  size_t tenant_topic_level;
+  payload_mode payload_mode;
+  sign_mode sign_mode;
+  key_format key_format;
+  envelope envelope;
+  signing_algorithm algorithm;
+  clock_source clock_source;
+  time_precision time_precision;
+  time_encoding time_encoding;
+  const char *checkpoint_topic;
+  size_t checkpoint_interval_messages;
+  size_t checkpoint_interval_ms;
+  topic_trie *sign_topics;
+  topic_trie *skip_topics;
+  failure_policy failure_policy;
+  topic_trie *failure_policy_topics[FAILURE_POLICY_COUNT];
+  signed_policy signed_policy;
+  topic_trie *signed_policy_topics[SIGNED_POLICY_COUNT];
+  size_t reject_log_rate;
+  size_t reject_log_burst;
+  size_t reject_log_prefix_levels;
+  size_t reject_log_interval_ms;
+  cbor_validator_limits validator_limits;
+  size_t arena_max_retained_size;
+  size_t metrics_interval_ms;
+  const char *metrics_prometheus_file;
+  const char *flight_recorder_file;
+  size_t flight_recorder_size;
+  size_t flight_recorder_threshold_us;
+  const char *audit_log_dir;
+  size_t audit_segment_size;
+  size_t audit_segment_duration_ms;
+  size_t audit_flush_interval_ms;
+  arena *message_arena;
+
+  /** Keys appended to messages, encoded once for the key format */
+  cbor_splice_key ingestion_time_key;
+  cbor_splice_key signature_key;
+  cbor_splice_key sequence_key;
+  cbor_splice_key chain_link_key;
+  cbor_splice_key key_id_key;
+  cbor_splice_key countersignature_key;
+  signing_keyring keys;
+
+  /** Keys of the tenants, derived from the tenant key file at startup and
+     never rotated, null without tenants_file */
+  tenant_keys *tenant_keys;
+
+  /** Registry the stored tenant certificates are appended to, null without
+     tenants_file */
+  FILE *tenant_registry;
+
+  /** Key whose certificate is being published, owned by the keyring once
+     installed */
+  signing_key *unpublished_key;
+  bool unpublished_key_installed;
+
+  /** Set by the repository once the certificate of the unpublished key is
+     stored */
+  bool unpublished_key_stored;
+  certificate_repository *certificate_repository;
+  uint64_t next_rotation_ms;
+  hash_chain chain;
+  uint64_t last_checkpoint_ms;
+  plugin_metrics metrics;
+  uint64_t next_metrics_ms;
+  reject_log reject_log;
+  flight_recorder *flight_recorder;
+  audit_log *audit_log;
+
+  /** Messages not written to the audit log, as last logged */
+  uint64_t audit_dropped_logged;
+  ingestion_clock clock;
+  uint64_t next_clock_calibration_ms;
+
+  /** Stages are timed when metrics or the flight recorder are enabled */
+  bool timing_enabled;
+} plugin_config;
@@ -0,0 +1,127 @@
+#include "reject_log.h"
+#include <string.h>
+
+#define MILLI_TOKENS_PER_LINE 1000u
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ull
+#define FNV_PRIME 0x100000001b3ull
+
+void reject_log_init(reject_log *log, size_t rate_per_s, size_t burst,
+                     size_t prefix_levels, size_t summary_interval_ms,
+                     uint64_t now_ms) {
+  memset(log, 0, sizeof(reject_log));
+  log->rate_per_s = rate_per_s;
+  log->capacity = (uint64_t)burst * MILLI_TOKENS_PER_LINE;
+  log->tokens = log->capacity;
+  log->last_refill_ms = now_ms;
+  log->prefix_levels = prefix_levels;
+  log->summary_interval_ms = summary_interval_ms;
+  log->interval_start_ms = now_ms;
+}
+
+/**
+ * Returns the length of the first prefix_levels levels of a topic, without
+ * the separator that follows them
+ */
+static size_t prefix_length(const char *topic, size_t prefix_levels) {
+  size_t length = 0;
+  size_t levels = 0;
+  while (topic[length] != '\0') {
+    if (topic[length] == '/' && ++levels == prefix_levels) {
+      break;
+    }
+    length++;
+  }
+  return length < REJECT_LOG_MAX_PREFIX_LENGTH - 1
+             ? length
+             : REJECT_LOG_MAX_PREFIX_LENGTH - 1;
+}
+
+static uint64_t hash_prefix(const char *prefix, size_t length) {
+  uint64_t hash = FNV_OFFSET_BASIS;
+  for (size_t i = 0; i < length; i++) {
+    hash = (hash ^ (uint8_t)prefix[i]) * FNV_PRIME;
+  }
+  // 0 marks the free slots
+  return hash != 0 ? hash : 1;
+}
+
+static uint64_t *find_counts(reject_log *log, const char *topic) {
+  size_t length = prefix_length(topic, log->prefix_levels);
+  uint64_t hash = hash_prefix(topic, length);
+
+  size_t slot = (size_t)hash % REJECT_LOG_MAX_PREFIXES;
+  for (size_t probe = 0; probe < REJECT_LOG_MAX_PREFIXES; probe++) {
+    reject_log_entry *entry = &log->entries[slot];
+    if (entry->hash == 0) {
+      // Keep a free slot so that probes of missing prefixes terminate early
+      if (log->entry_count == REJECT_LOG_MAX_PREFIXES - 1) {
+        break;
+      }
+      entry->hash = hash;
+      memcpy(entry->prefix, topic, length);
+      entry->prefix[length] = '\0';
+      log->entry_count++;
+      return entry->counts;
+    }
+    if (entry->hash == hash && strncmp(entry->prefix, topic, length) == 0 &&
+        entry->prefix[length] == '\0') {
+      return entry->counts;
+    }
+    slot = (slot + 1) % REJECT_LOG_MAX_PREFIXES;
+  }
+  return log->other;
+}
+
+bool reject_log_count(reject_log *log, uint64_t now_ms, const char *topic,
+                      metrics_rejection reason) {
+  find_counts(log, topic)[reason]++;
+  log->interval_rejected++;
+
+  if (now_ms > log->last_refill_ms) {
+    uint64_t refill = (now_ms - log->last_refill_ms) * log->rate_per_s;
+    log->tokens = log->capacity - log->tokens > refill
+                      ? log->tokens + refill
+                      : log->capacity;
+    log->last_refill_ms = now_ms;
+  }
+
+  if (log->tokens < MILLI_TOKENS_PER_LINE) {
+    log->interval_suppressed++;
+    return false;
+  }
+  log->tokens -= MILLI_TOKENS_PER_LINE;
+  return true;
+}
+
+bool reject_log_summary_due(const reject_log *log, uint64_t now_ms) {
+  return now_ms - log->interval_start_ms >= log->summary_interval_ms;
+}
+
+static bool has_counts(const uint64_t *counts) {
+  for (int i = 0; i < METRICS_REJECTED_COUNT; i++) {
+    if (counts[i] > 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void reject_log_summarize(reject_log *log, uint64_t now_ms,
+                          reject_log_callback callback, void *userdata) {
+  for (size_t i = 0; i < REJECT_LOG_MAX_PREFIXES; i++) {
+    if (log->entries[i].hash != 0) {
+      callback(log->entries[i].prefix, log->entries[i].counts, userdata);
+    }
+  }
+  if (has_counts(log->other)) {
+    callback(NULL, log->other, userdata);
+  }
+
+  memset(log->entries, 0, sizeof(log->entries));
+  memset(log->other, 0, sizeof(log->other));
+  log->entry_count = 0;
+  log->interval_rejected = 0;
+  log->interval_suppressed = 0;
+  log->interval_start_ms = now_ms;
+}
@@ -0,0 +1,110 @@
+#pragma once
+#include "metrics.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** Topic prefixes counted separately in a summary interval, the rejections
+ * on other prefixes are counted together */
+#define REJECT_LOG_MAX_PREFIXES 64
+
+/** Longer topic prefixes are truncated */
+#define REJECT_LOG_MAX_PREFIX_LENGTH 64
+
+/**
+ * Rejections counted for a topic prefix
+ */
+typedef struct {
+  /** FNV-1a hash of the prefix, 0 for a free slot */
+  uint64_t hash;
+  char prefix[REJECT_LOG_MAX_PREFIX_LENGTH];
+  uint64_t counts[METRICS_REJECTED_COUNT];
+} reject_log_entry;
+
+/**
+ * Rate limiter and aggregator of the logs of rejected messages. A token
+ * bucket decides which rejections are logged on their own line, and every
+ * rejection is counted per topic prefix and reason for the periodic summary.
+ * Counting a rejection costs a hash of the prefix and a probe in a fixed
+ * table, without allocation.
+ */
+typedef struct {
+  /** Tokens of the bucket in thousandths of a line */
+  uint64_t tokens;
+  uint64_t capacity;
+  uint64_t rate_per_s;
+  uint64_t last_refill_ms;
+
+  /** Topic levels of the prefixes, 0 for the whole topic */
+  size_t prefix_levels;
+
+  uint64_t summary_interval_ms;
+  uint64_t interval_start_ms;
+
+  /** Rejections of the current interval, and those not logged on their own
+   * line */
+  uint64_t interval_rejected;
+  uint64_t interval_suppressed;
+
+  /** Open addressing table of the prefixes of the current interval */
+  reject_log_entry entries[REJECT_LOG_MAX_PREFIXES];
+  size_t entry_count;
+
+  /** Rejections on prefixes that did not fit in the table */
+  uint64_t other[METRICS_REJECTED_COUNT];
+} reject_log;
+
+/**
+ * Called by reject_log_summarize for every prefix with rejections
+ *
+ * \param prefix topic prefix, null for the prefixes that did not fit in the
+ * table
+ * \param counts rejections per reason, METRICS_REJECTED_COUNT values
+ * \param userdata data given to reject_log_summarize
+ */
+typedef void (*reject_log_callback)(const char *prefix, const uint64_t *counts,
+                                    void *userdata);
+
+/**
+ * Initializes a rejection log with a full bucket
+ *
+ * \param log log to initialize
+ * \param rate_per_s lines logged per second in the long run, 0 to only log
+ * summaries
+ * \param burst lines that can be logged at once
+ * \param prefix_levels topic levels of the prefixes, 0 for whole topics
+ * \param summary_interval_ms interval between two summaries
+ * \param now_ms current monotonic time in milliseconds
+ */
+void reject_log_init(reject_log *log, size_t rate_per_s, size_t burst,
+                     size_t prefix_levels, size_t summary_interval_ms,
+                     uint64_t now_ms);
+
+/**
+ * Counts a rejected message and takes a token from the bucket
+ *
+ * \param log rejection log
+ * \param now_ms current monotonic time in milliseconds
+ * \param topic topic of the message
+ * \param reason reason of the rejection
+ * \returns true if the rejection should be logged on its own line
+ */
+bool reject_log_count(reject_log *log, uint64_t now_ms, const char *topic,
+                      metrics_rejection reason);
+
+/**
+ * Returns whether the summary interval is over
+ */
+bool reject_log_summary_due(const reject_log *log, uint64_t now_ms);
+
+/**
+ * Reports the rejections of the current interval per prefix, then starts a
+ * new interval
+ *
+ * \param log rejection log
+ * \param now_ms current monotonic time in milliseconds
+ * \param callback function called for every prefix with rejections
+ * \param userdata data given to the callback
+ */
+void reject_log_summarize(reject_log *log, uint64_t now_ms,
+                          reject_log_callback callback, void *userdata);
@@ -0,0 +1,135 @@
+#include "signing_context.h"
+#include <sodium.h>
+#include <stdlib.h>
+#include <string.h>
+
+_Static_assert(SIGNING_CONTEXT_SIGNATURE_BYTES == crypto_sign_BYTES,
+               "Every algorithm must fit the ED25519 signature slot");
+_Static_assert(SIGNING_CONTEXT_SIGNATURE_BYTES <= crypto_generichash_BYTES_MAX,
+               "The MAC must fit the signature slot");
+_Static_assert(sizeof(((signing_context *)0)->secret_key) ==
+                   crypto_sign_SECRETKEYBYTES,
+               "The context holds a libsodium secret key");
+
+static const char *ALGORITHM_NAMES[SIGNING_ALGORITHM_COUNT] = {
+    "ed25519", "ed25519ph", "blake2b-mac"};
+
+/** Personalizes the derivation of the MAC key from the seed */
+static const uint8_t MAC_KEY_LABEL[] = "message-sign blake2b-mac key";
+
+/** Size under which the parts of an ED25519 message are assembled on the
+ * stack */
+#define ASSEMBLED_STACK_BYTES 1024
+
+static void mac_parts(const uint8_t *mac_key, const signing_part *parts,
+                      size_t part_count, uint8_t *mac) {
+  crypto_generichash_state state;
+  crypto_generichash_init(&state, mac_key, SIGNING_CONTEXT_MAC_KEY_BYTES,
+                          SIGNING_CONTEXT_SIGNATURE_BYTES);
+  for (size_t i = 0; i < part_count; i++) {
+    crypto_generichash_update(&state, parts[i].data, parts[i].size);
+  }
+  crypto_generichash_final(&state, mac, SIGNING_CONTEXT_SIGNATURE_BYTES);
+  sodium_memzero(&state, sizeof(state));
+}
+
+static error_code sign_ed25519(const signing_context *context,
+                               const signing_part *parts, size_t part_count,
+                               uint8_t *signature) {
+  if (part_count == 1) {
+    crypto_sign_detached(signature, NULL, parts[0].data, parts[0].size,
+                         context->secret_key);
+    return SUCCESS;
+  }
+
+  // crypto_sign_detached hashes the message twice, the parts are assembled
+  // once
+  size_t size = 0;
+  for (size_t i = 0; i < part_count; i++) {
+    size += parts[i].size;
+  }
+  uint8_t stack[ASSEMBLED_STACK_BYTES];
+  uint8_t *message = size <= sizeof(stack) ? stack : (uint8_t *)malloc(size);
+  if (message == NULL) {
+    return ERROR_NO_MEMORY;
+  }
+
+  size_t position = 0;
+  for (size_t i = 0; i < part_count; i++) {
+    if (parts[i].size > 0) {
+      memcpy(message + position, parts[i].data, parts[i].size);
+    }
+    position += parts[i].size;
+  }
+
+  crypto_sign_detached(signature, NULL, message, size, context->secret_key);
+  if (message != stack) {
+    free(message);
+  }
+  return SUCCESS;
+}
+
+static error_code sign_ed25519ph(const signing_context *context,
+                                 const signing_part *parts, size_t part_count,
+                                 uint8_t *signature) {
+  crypto_sign_state state;
+  crypto_sign_init(&state);
+  for (size_t i = 0; i < part_count; i++) {
+    crypto_sign_update(&state, parts[i].data, parts[i].size);
+  }
+  int result =
+      crypto_sign_final_create(&state, signature, NULL, context->secret_key);
+  sodium_memzero(&state, sizeof(state));
+  return result == 0 ? SUCCESS : ERROR_UNKNOWN;
+}
+
+static error_code sign_blake2b_mac(const signing_context *context,
+                                   const signing_part *parts,
+                                   size_t part_count, uint8_t *signature) {
+  mac_parts(context->mac_key, parts, part_count, signature);
+  return SUCCESS;
+}
+
+static const signing_function BACKENDS[SIGNING_ALGORITHM_COUNT] = {
+    sign_ed25519, sign_ed25519ph, sign_blake2b_mac};
+
+void signing_context_init(signing_context *context, const uint8_t *private_key,
+                          signing_algorithm algorithm) {
+  memset(context, 0, sizeof(*context));
+  context->algorithm = algorithm;
+  context->sign = BACKENDS[algorithm];
+
+  if (algorithm == SIGNING_ALGORITHM_BLAKE2B_MAC) {
+    crypto_generichash(context->mac_key, sizeof(context->mac_key),
+                       MAC_KEY_LABEL, sizeof(MAC_KEY_LABEL) - 1, private_key,
+                       crypto_sign_SEEDBYTES);
+    return;
+  }
+
+  memcpy(context->secret_key, private_key, sizeof(context->secret_key));
+}
+
+void signing_context_mac(const uint8_t *mac_key, const uint8_t *message,
+                         size_t size, uint8_t *mac) {
+  signing_part part = {message, size};
+  mac_parts(mac_key, &part, 1, mac);
+}
+
+void signing_context_wipe(signing_context *context) {
+  sodium_memzero(context, sizeof(*context));
+}
+
+const char *signing_algorithm_name(signing_algorithm algorithm) {
+  return algorithm < SIGNING_ALGORITHM_COUNT ? ALGORITHM_NAMES[algorithm]
+                                             : "unknown";
+}
+
+bool signing_algorithm_parse(const char *name, signing_algorithm *algorithm) {
+  for (int i = 0; i < SIGNING_ALGORITHM_COUNT; i++) {
+    if (strcmp(name, ALGORITHM_NAMES[i]) == 0) {
+      *algorithm = (signing_algorithm)i;
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,140 @@
+#pragma once
+#include "error.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** Size of the signatures of every algorithm */
+#define SIGNING_CONTEXT_SIGNATURE_BYTES 64
+
+/** Size of the key of the MAC algorithm */
+#define SIGNING_CONTEXT_MAC_KEY_BYTES 32
+
+/**
+ * Algorithm signing messages
+ */
+typedef enum {
+  /** ED25519 over the signed bytes */
+  SIGNING_ALGORITHM_ED25519 = 0,
+
+  /** ED25519ph (RFC 8032): ED25519 over the SHA-512 hash of the signed
+     bytes, which are hashed once instead of twice */
+  SIGNING_ALGORITHM_ED25519PH,
+
+  /** Keyed BLAKE2b-512 MAC, for verifiers trusted with the secret key */
+  SIGNING_ALGORITHM_BLAKE2B_MAC,
+
+  SIGNING_ALGORITHM_COUNT
+} signing_algorithm;
+
+typedef struct signing_context signing_context;
+
+/**
+ * Contiguous part of a message signed in several parts
+ */
+typedef struct {
+  const uint8_t *data;
+  size_t size;
+} signing_part;
+
+/**
+ * Backend signing a message, see signing_context_sign_parts
+ */
+typedef error_code (*signing_function)(const signing_context *context,
+                                       const signing_part *parts,
+                                       size_t part_count, uint8_t *signature);
+
+/**
+ * Secret key prepared once for an algorithm. The backend of the algorithm is
+ * resolved when the context is initialized, signing does not branch on the
+ * algorithm. ED25519 and ED25519ph sign with crypto_sign_detached and
+ * crypto_sign_final_create, the MAC key is derived from the seed once.
+ */
+struct signing_context {
+  signing_function sign;
+  signing_algorithm algorithm;
+
+  /** ED25519 secret key, seed then public key, unused by the MAC */
+  uint8_t secret_key[64];
+
+  /** Key of the MAC algorithm, derived from the seed */
+  uint8_t mac_key[SIGNING_CONTEXT_MAC_KEY_BYTES];
+};
+
+/**
+ * Prepares a secret key for an algorithm
+ *
+ * \param context context to initialize
+ * \param private_key ED25519 secret key of 64 bytes, seed then public key
+ * \param algorithm algorithm of the signatures
+ */
+void signing_context_init(signing_context *context, const uint8_t *private_key,
+                          signing_algorithm algorithm);
+
+/**
+ * Signs a message with the algorithm of the context
+ *
+ * \param context prepared key
+ * \param message message to sign
+ * \param size size of the message
+ * \param signature out signature of SIGNING_CONTEXT_SIGNATURE_BYTES bytes
+ * \returns success, or ERROR_UNKNOWN if signing fails
+ */
+static inline error_code signing_context_sign(const signing_context *context,
+                                              const uint8_t *message,
+                                              size_t size,
+                                              uint8_t *signature) {
+  signing_part part = {message, size};
+  return context->sign(context, &part, 1, signature);
+}
+
+/**
+ * Signs the concatenation of several parts without copying them, the
+ * signature is the one of signing_context_sign over the concatenated bytes
+ *
+ * \param context prepared key
+ * \param parts parts of the message, in order
+ * \param part_count number of parts
+ * \param signature out signature of SIGNING_CONTEXT_SIGNATURE_BYTES bytes
+ * \returns success, or ERROR_NO_MEMORY if the parts of an ED25519 message
+ *          cannot be assembled
+ */
+static inline error_code
+signing_context_sign_parts(const signing_context *context,
+                           const signing_part *parts, size_t part_count,
+                           uint8_t *signature) {
+  return context->sign(context, parts, part_count, signature);
+}
+
+/**
+ * Computes the BLAKE2b-512 MAC of a message, as signed with
+ * SIGNING_ALGORITHM_BLAKE2B_MAC
+ *
+ * \param mac_key MAC key of a context, of SIGNING_CONTEXT_MAC_KEY_BYTES bytes
+ * \param message message
+ * \param size size of the message
+ * \param mac out MAC of SIGNING_CONTEXT_SIGNATURE_BYTES bytes
+ */
+void signing_context_mac(const uint8_t *mac_key, const uint8_t *message,
+                         size_t size, uint8_t *mac);
+
+/**
+ * Wipes the secret parts of a prepared key
+ *
+ * \param context context to wipe
+ */
+void signing_context_wipe(signing_context *context);
+
+/**
+ * Returns the name of an algorithm, as stored with certificates
+ */
+const char *signing_algorithm_name(signing_algorithm algorithm);
+
+/**
+ * Parses the name of an algorithm
+ *
+ * \param name name of the algorithm
+ * \param algorithm out algorithm
+ * \returns false if the name is not known
+ */
+bool signing_algorithm_parse(const char *name, signing_algorithm *algorithm);
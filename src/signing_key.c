@@ -0,0 +1,118 @@
+#include "signing_key.h"
+#include <sodium.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+/**
+ * Fills the fields derived from the keypair and sets the creation time
+ */
+static void complete_key(signing_key *key, uint64_t create_time_unix) {
+  sodium_bin2hex(key->public_key_hex, sizeof(key->public_key_hex),
+                 key->public_key, sizeof(key->public_key));
+
+  signing_context_init(&key->context, key->private_key,
+                       SIGNING_ALGORITHM_ED25519);
+  signing_key_compute_id(key->public_key, key->key_id);
+  key->create_time_unix = create_time_unix;
+}
+
+signing_key *signing_key_generate(void) {
+  signing_key *key = (signing_key *)calloc(1, sizeof(signing_key));
+  if (key == NULL) {
+    return NULL;
+  }
+
+  if (crypto_sign_keypair(key->public_key, key->private_key) != 0) {
+    signing_key_destroy(key);
+    return NULL;
+  }
+
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  complete_key(key, (uint64_t)tv.tv_sec);
+
+  return key;
+}
+
+signing_key *signing_key_from_seed(const uint8_t *seed,
+                                   uint64_t create_time_unix) {
+  signing_key *key = (signing_key *)calloc(1, sizeof(signing_key));
+  if (key == NULL) {
+    return NULL;
+  }
+
+  if (crypto_sign_seed_keypair(key->public_key, key->private_key, seed) !=
+      0) {
+    signing_key_destroy(key);
+    return NULL;
+  }
+
+  complete_key(key, create_time_unix);
+  return key;
+}
+
+void signing_key_set_algorithm(signing_key *key,
+                               signing_algorithm algorithm) {
+  signing_context_wipe(&key->context);
+  signing_context_init(&key->context, key->private_key, algorithm);
+}
+
+void signing_key_compute_id(const uint8_t *public_key, uint8_t *key_id) {
+  uint8_t hash[crypto_hash_sha256_BYTES];
+  crypto_hash_sha256(hash, public_key, SIGNING_KEY_PUBLIC_BYTES);
+  memcpy(key_id, hash, SIGNING_KEY_ID_BYTES);
+}
+
+void signing_key_destroy(signing_key *key) {
+  if (key == NULL) {
+    return;
+  }
+  sodium_memzero(key->private_key, sizeof(key->private_key));
+  signing_context_wipe(&key->context);
+  free(key);
+}
+
+void signing_keyring_init(signing_keyring *keyring) {
+  atomic_init(&keyring->current, NULL);
+  keyring->retired_count = 0;
+}
+
+const signing_key *signing_keyring_current(signing_keyring *keyring) {
+  return atomic_load_explicit(&keyring->current, memory_order_acquire);
+}
+
+error_code signing_keyring_install(signing_keyring *keyring, signing_key *key,
+                                   uint64_t now_ms, uint64_t grace_ms) {
+  if (keyring->retired_count == SIGNING_KEYRING_MAX_RETIRED) {
+    return ERROR_NO_MEMORY;
+  }
+
+  signing_key *previous =
+      atomic_exchange_explicit(&keyring->current, key, memory_order_acq_rel);
+
+  if (previous != NULL) {
+    keyring->retired[keyring->retired_count++] = (retired_signing_key){
+        .key = previous, .reclaim_at_ms = now_ms + grace_ms};
+  }
+  return SUCCESS;
+}
+
+void signing_keyring_reclaim(signing_keyring *keyring, uint64_t now_ms) {
+  size_t kept = 0;
+
+  for (size_t i = 0; i < keyring->retired_count; i++) {
+    if (keyring->retired[i].reclaim_at_ms <= now_ms) {
+      signing_key_destroy(keyring->retired[i].key);
+    } else {
+      keyring->retired[kept++] = keyring->retired[i];
+    }
+  }
+  keyring->retired_count = kept;
+}
+
+void signing_keyring_destroy(signing_keyring *keyring) {
+  signing_keyring_reclaim(keyring, UINT64_MAX);
+  signing_key_destroy(
+      atomic_exchange_explicit(&keyring->current, NULL, memory_order_acq_rel));
+}
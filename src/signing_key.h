@@ -0,0 +1,146 @@
+#pragma once
+#include "error.h"
+#include "signing_context.h"
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** Size of an ED25519 public key */
+#define SIGNING_KEY_PUBLIC_BYTES 32
+
+/** Size of the key id: the first bytes of the SHA-256 hash of the public key,
+ * which the database can compute too */
+#define SIGNING_KEY_ID_BYTES 8
+
+/** Size of the seed a keypair is derived from */
+#define SIGNING_KEY_SEED_BYTES 32
+
+/** Maximum number of retired keys waiting for reclamation */
+#define SIGNING_KEYRING_MAX_RETIRED 8
+
+/**
+ * ED25519 keypair used to sign messages
+ */
+typedef struct {
+  uint8_t public_key[SIGNING_KEY_PUBLIC_BYTES];
+  uint8_t private_key[64];
+
+  /** Private key prepared once for the signing algorithm, ED25519 unless
+   * changed with signing_key_set_algorithm */
+  signing_context context;
+
+  /** Hex encoded public key, null terminated */
+  char public_key_hex[65];
+
+  /** Short identifier of the key carried by messages */
+  uint8_t key_id[SIGNING_KEY_ID_BYTES];
+
+  /** Creation time of the keypair in Unix seconds */
+  uint64_t create_time_unix;
+} signing_key;
+
+/**
+ * Key replaced by a newer one, kept until its grace period is over
+ */
+typedef struct {
+  signing_key *key;
+  uint64_t reclaim_at_ms;
+} retired_signing_key;
+
+/**
+ * Holds the key currently used to sign messages. Signers load the current key
+ * with a single atomic read, rotation swaps the pointer and keeps the old key
+ * alive for a grace period so that signers still using it are never left with
+ * a dangling pointer.
+ */
+typedef struct {
+  _Atomic(signing_key *) current;
+
+  retired_signing_key retired[SIGNING_KEYRING_MAX_RETIRED];
+  size_t retired_count;
+} signing_keyring;
+
+/**
+ * Generates a new keypair
+ *
+ * \returns the new key on success, null otherwise
+ */
+signing_key *signing_key_generate(void);
+
+/**
+ * Derives a keypair from a seed, as stored in a key file
+ *
+ * \param seed seed of SIGNING_KEY_SEED_BYTES bytes
+ * \param create_time_unix creation time of the keypair in Unix seconds
+ * \returns the key on success, null otherwise
+ */
+signing_key *signing_key_from_seed(const uint8_t *seed,
+                                   uint64_t create_time_unix);
+
+/**
+ * Expands the private key again for another signing algorithm
+ *
+ * \param key key, not used to sign yet
+ * \param algorithm algorithm of the signatures
+ */
+void signing_key_set_algorithm(signing_key *key, signing_algorithm algorithm);
+
+/**
+ * Computes the key id of a public key
+ *
+ * \param public_key ED25519 public key of SIGNING_KEY_PUBLIC_BYTES bytes
+ * \param key_id out key id of SIGNING_KEY_ID_BYTES bytes
+ */
+void signing_key_compute_id(const uint8_t *public_key, uint8_t *key_id);
+
+/**
+ * Wipes the private key and frees memory
+ *
+ * \param key key to destroy, may be null
+ */
+void signing_key_destroy(signing_key *key);
+
+/**
+ * Initializes an empty keyring
+ *
+ * \param keyring keyring to initialize
+ */
+void signing_keyring_init(signing_keyring *keyring);
+
+/**
+ * Returns the key to sign with. The key stays valid for the grace period
+ * given when it is replaced.
+ *
+ * \param keyring keyring
+ * \returns the current key, null if no key has been installed yet
+ */
+const signing_key *signing_keyring_current(signing_keyring *keyring);
+
+/**
+ * Makes a key the current one, the keyring takes ownership of it. The
+ * previous key is retired until now_ms + grace_ms.
+ *
+ * \param keyring keyring
+ * \param key key to install
+ * \param now_ms current monotonic time in milliseconds
+ * \param grace_ms time in milliseconds the previous key stays valid
+ * \returns success on installation, ERROR_NO_MEMORY if too many keys are
+ * already retired, in which case the keyring is unchanged
+ */
+error_code signing_keyring_install(signing_keyring *keyring, signing_key *key,
+                                   uint64_t now_ms, uint64_t grace_ms);
+
+/**
+ * Frees the retired keys whose grace period is over
+ *
+ * \param keyring keyring
+ * \param now_ms current monotonic time in milliseconds
+ */
+void signing_keyring_reclaim(signing_keyring *keyring, uint64_t now_ms);
+
+/**
+ * Frees every key of the keyring
+ *
+ * \param keyring keyring
+ */
+void signing_keyring_destroy(signing_keyring *keyring);
@@ -0,0 +1,292 @@
+#include "tenant_keys.h"
+#include <errno.h>
+#include <sodium.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Personalizes the derivation of tenant seeds from the master seed */
+static const uint8_t TENANT_SEED_LABEL[] = "message-sign tenant key";
+
+/** Index of the free slots */
+#define FREE_SLOT UINT32_MAX
+
+typedef struct {
+  uint64_t hash;
+
+  /** Index of the entry, FREE_SLOT for a free slot */
+  uint32_t entry;
+  uint32_t unused;
+} tenant_slot;
+
+typedef struct {
+  uint32_t name_offset;
+  uint32_t name_length;
+  signing_key *key;
+  bool stored;
+} tenant_entry;
+
+struct tenant_keys {
+  uint8_t hash_key[crypto_shorthash_KEYBYTES];
+
+  /** Power of two number of slots, at least twice the capacity */
+  tenant_slot *slots;
+  size_t slot_mask;
+
+  /** Entries in insertion order */
+  tenant_entry *entries;
+  size_t count;
+  size_t capacity;
+
+  /** Null terminated names, one after the other */
+  char *names;
+  size_t names_size;
+  size_t names_capacity;
+};
+
+tenant_keys *tenant_keys_new(size_t capacity) {
+  if (capacity == 0 || capacity >= FREE_SLOT / 2) {
+    return NULL;
+  }
+
+  size_t slot_count = 1;
+  while (slot_count < 2 * capacity) {
+    slot_count *= 2;
+  }
+
+  tenant_keys *tenants = (tenant_keys *)calloc(1, sizeof(tenant_keys));
+  if (tenants == NULL) {
+    return NULL;
+  }
+  tenants->slots = (tenant_slot *)malloc(slot_count * sizeof(tenant_slot));
+  tenants->entries = (tenant_entry *)calloc(capacity, sizeof(tenant_entry));
+  if (tenants->slots == NULL || tenants->entries == NULL) {
+    tenant_keys_destroy(tenants);
+    return NULL;
+  }
+
+  for (size_t i = 0; i < slot_count; i++) {
+    tenants->slots[i].entry = FREE_SLOT;
+  }
+  tenants->slot_mask = slot_count - 1;
+  tenants->capacity = capacity;
+  crypto_shorthash_keygen(tenants->hash_key);
+  return tenants;
+}
+
+static uint64_t hash_name(const tenant_keys *tenants, const char *name,
+                          size_t length) {
+  uint8_t out[crypto_shorthash_BYTES];
+  crypto_shorthash(out, (const unsigned char *)name, length,
+                   tenants->hash_key);
+
+  uint64_t hash;
+  memcpy(&hash, out, sizeof(hash));
+  return hash;
+}
+
+/**
+ * Returns the slot of a name, or the free slot where it would be inserted
+ */
+static tenant_slot *find_slot(const tenant_keys *tenants, const char *name,
+                              size_t length, uint64_t hash) {
+  size_t index = (size_t)hash & tenants->slot_mask;
+  for (;;) {
+    tenant_slot *slot = &tenants->slots[index];
+    if (slot->entry == FREE_SLOT) {
+      return slot;
+    }
+
+    const tenant_entry *entry = &tenants->entries[slot->entry];
+    if (slot->hash == hash && entry->name_length == length &&
+        memcmp(tenants->names + entry->name_offset, name, length) == 0) {
+      return slot;
+    }
+    index = (index + 1) & tenants->slot_mask;
+  }
+}
+
+static error_code append_name(tenant_keys *tenants, const char *name,
+                              size_t length) {
+  if (tenants->names_capacity - tenants->names_size < length + 1) {
+    size_t capacity =
+        tenants->names_capacity == 0 ? 4096 : 2 * tenants->names_capacity;
+    while (capacity - tenants->names_size < length + 1) {
+      capacity *= 2;
+    }
+    if (capacity > UINT32_MAX) {
+      return ERROR_NO_MEMORY;
+    }
+
+    char *names = (char *)realloc(tenants->names, capacity);
+    if (names == NULL) {
+      return ERROR_NO_MEMORY;
+    }
+    tenants->names = names;
+    tenants->names_capacity = capacity;
+  }
+
+  memcpy(tenants->names + tenants->names_size, name, length);
+  tenants->names[tenants->names_size + length] = '\0';
+  tenants->names_size += length + 1;
+  return SUCCESS;
+}
+
+error_code tenant_keys_add(tenant_keys *tenants, const char *name,
+                           signing_key *key) {
+  size_t length = strlen(name);
+  if (length == 0 || key == NULL || tenants->count == tenants->capacity) {
+    return ERROR_INVALID_ARGUMENT;
+  }
+
+  uint64_t hash = hash_name(tenants, name, length);
+  tenant_slot *slot = find_slot(tenants, name, length, hash);
+  if (slot->entry != FREE_SLOT) {
+    return ERROR_INVALID_ARGUMENT;
+  }
+
+  size_t name_offset = tenants->names_size;
+  error_code error = append_name(tenants, name, length);
+  if (error != SUCCESS) {
+    return error;
+  }
+
+  tenants->entries[tenants->count] = (tenant_entry){
+      .name_offset = (uint32_t)name_offset,
+      .name_length = (uint32_t)length,
+      .key = key,
+  };
+  slot->hash = hash;
+  slot->entry = (uint32_t)tenants->count;
+  tenants->count++;
+  return SUCCESS;
+}
+
+const signing_key *tenant_keys_find(const tenant_keys *tenants,
+                                    const char *name, size_t length,
+                                    bool *stored) {
+  uint64_t hash = hash_name(tenants, name, length);
+  const tenant_slot *slot = find_slot(tenants, name, length, hash);
+  if (slot->entry == FREE_SLOT) {
+    return NULL;
+  }
+
+  const tenant_entry *entry = &tenants->entries[slot->entry];
+  if (stored != NULL) {
+    *stored = entry->stored;
+  }
+  return entry->key;
+}
+
+bool tenant_keys_set_stored(tenant_keys *tenants, const char *name,
+                            const char *public_key) {
+  size_t length = strlen(name);
+  uint64_t hash = hash_name(tenants, name, length);
+  const tenant_slot *slot = find_slot(tenants, name, length, hash);
+  if (slot->entry == FREE_SLOT) {
+    return false;
+  }
+
+  tenant_entry *entry = &tenants->entries[slot->entry];
+  if (strcmp(entry->key->public_key_hex, public_key) != 0) {
+    return false;
+  }
+  entry->stored = true;
+  return true;
+}
+
+error_code tenant_keys_load_registered(tenant_keys *tenants, const char *path,
+                                       size_t *count) {
+  *count = 0;
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    return errno == ENOENT ? SUCCESS : ERROR_UNKNOWN;
+  }
+
+  char *line = NULL;
+  size_t line_capacity = 0;
+  ssize_t length = 0;
+  while ((length = getline(&line, &line_capacity, file)) > 0) {
+    if (line[length - 1] == '\n') {
+      line[length - 1] = '\0';
+    }
+
+    // The public key, then the name up to the end of the line
+    char *separator = strchr(line, ' ');
+    if (separator == NULL) {
+      continue;
+    }
+    *separator = '\0';
+    if (tenant_keys_set_stored(tenants, separator + 1, line)) {
+      (*count)++;
+    }
+  }
+
+  bool failed = ferror(file) != 0;
+  free(line);
+  fclose(file);
+  return failed ? ERROR_UNKNOWN : SUCCESS;
+}
+
+size_t tenant_keys_count(const tenant_keys *tenants) { return tenants->count; }
+
+bool tenant_keys_stored(const tenant_keys *tenants, size_t index) {
+  return tenants->entries[index].stored;
+}
+
+const char *tenant_keys_name(const tenant_keys *tenants, size_t index) {
+  return tenants->names + tenants->entries[index].name_offset;
+}
+
+const signing_key *tenant_keys_key(const tenant_keys *tenants, size_t index) {
+  return tenants->entries[index].key;
+}
+
+void tenant_keys_destroy(tenant_keys *tenants) {
+  if (tenants == NULL) {
+    return;
+  }
+
+  for (size_t i = 0; i < tenants->count; i++) {
+    signing_key_destroy(tenants->entries[i].key);
+  }
+  free(tenants->entries);
+  free(tenants->slots);
+  free(tenants->names);
+  sodium_memzero(tenants, sizeof(*tenants));
+  free(tenants);
+}
+
+signing_key *tenant_keys_derive_key(const signing_key *master,
+                                    const char *name) {
+  uint8_t seed[SIGNING_KEY_SEED_BYTES];
+  crypto_generichash_state state;
+  crypto_generichash_init(&state, master->private_key, SIGNING_KEY_SEED_BYTES,
+                          sizeof(seed));
+  crypto_generichash_update(&state, TENANT_SEED_LABEL,
+                            sizeof(TENANT_SEED_LABEL));
+  crypto_generichash_update(&state, (const uint8_t *)name, strlen(name));
+  crypto_generichash_final(&state, seed, sizeof(seed));
+
+  signing_key *key = signing_key_from_seed(seed, master->create_time_unix);
+  sodium_memzero(seed, sizeof(seed));
+  sodium_memzero(&state, sizeof(state));
+  return key;
+}
+
+const char *tenant_keys_topic_level(const char *topic, size_t level,
+                                    size_t *length) {
+  const char *start = topic;
+  for (size_t i = 0; i < level; i++) {
+    start = strchr(start, '/');
+    if (start == NULL) {
+      return NULL;
+    }
+    start++;
+  }
+
+  const char *end = strchr(start, '/');
+  *length = end != NULL ? (size_t)(end - start) : strlen(start);
+  return start;
+}
@@ -0,0 +1,137 @@
+#pragma once
+#include "error.h"
+#include "signing_key.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Opaque struct holding the signing keys of tenants, looked up by tenant
+ * name. Names are hashed with a randomly keyed SipHash into an open
+ * addressing table of 16 bytes slots, kept at most half full, so that a
+ * lookup costs a hash and a few probes whatever the number of tenants, even
+ * for crafted names. The slots point into a compact array of entries and a
+ * single pool of names. Lookups never allocate.
+ */
+typedef struct tenant_keys tenant_keys;
+
+/**
+ * Creates an empty table
+ *
+ * \param capacity maximum number of tenants
+ * \returns handle to the created table on success, null otherwise
+ */
+tenant_keys *tenant_keys_new(size_t capacity);
+
+/**
+ * Adds the key of a tenant, the table takes ownership of the key on success
+ *
+ * \param tenants handle to the table
+ * \param name name of the tenant, copied
+ * \param key signing key of the tenant
+ * \returns ERROR_INVALID_ARGUMENT if the name is empty or already known or
+ * the table is full, ERROR_NO_MEMORY if the name cannot be copied, success
+ * otherwise
+ */
+error_code tenant_keys_add(tenant_keys *tenants, const char *name,
+                           signing_key *key);
+
+/**
+ * Finds the key of a tenant
+ *
+ * \param tenants handle to the table
+ * \param name name of the tenant, not necessarily null terminated
+ * \param length length of the name
+ * \param stored out whether the certificate of the key is stored (see
+ * tenant_keys_set_stored), may be null
+ * \returns the key, null if the tenant is not known
+ */
+const signing_key *tenant_keys_find(const tenant_keys *tenants,
+                                    const char *name, size_t length,
+                                    bool *stored);
+
+/**
+ * Records that the certificate of the key of a tenant is stored
+ *
+ * \param tenants handle to the table
+ * \param name name of the tenant
+ * \param public_key hex encoded public key of the stored certificate
+ * \returns false if the tenant is not known or has another key
+ */
+bool tenant_keys_set_stored(tenant_keys *tenants, const char *name,
+                            const char *public_key);
+
+/**
+ * Marks the tenants whose certificates were registered before, as listed in
+ * a registry file with one line per stored certificate: the hex encoded
+ * public key, a space and the tenant name. Lines of unknown tenants or of
+ * other keys are skipped.
+ *
+ * \param tenants handle to the table
+ * \param path path of the registry file
+ * \param count out number of tenants marked as stored
+ * \returns success, also when the file does not exist yet, ERROR_UNKNOWN if
+ * it cannot be read
+ */
+error_code tenant_keys_load_registered(tenant_keys *tenants, const char *path,
+                                       size_t *count);
+
+/**
+ * Returns the number of tenants
+ */
+size_t tenant_keys_count(const tenant_keys *tenants);
+
+/**
+ * Returns the name of the tenant added at an index
+ *
+ * \param tenants handle to the table
+ * \param index index of the tenant, less than tenant_keys_count
+ */
+const char *tenant_keys_name(const tenant_keys *tenants, size_t index);
+
+/**
+ * Returns whether the certificate of the tenant added at an index is stored
+ *
+ * \param tenants handle to the table
+ * \param index index of the tenant, less than tenant_keys_count
+ */
+bool tenant_keys_stored(const tenant_keys *tenants, size_t index);
+
+/**
+ * Returns the key of the tenant added at an index
+ *
+ * \param tenants handle to the table
+ * \param index index of the tenant, less than tenant_keys_count
+ */
+const signing_key *tenant_keys_key(const tenant_keys *tenants, size_t index);
+
+/**
+ * Destroys the table, wiping and freeing the keys
+ *
+ * \param tenants handle to the table, may be null
+ */
+void tenant_keys_destroy(tenant_keys *tenants);
+
+/**
+ * Derives the key of a tenant from a master key, so that a tenant gets the
+ * same key at every start. The seed is the BLAKE2b hash of the tenant name
+ * keyed with the master seed, and the key is created with the master key.
+ *
+ * \param master master key, as read from its sealed key file
+ * \param name name of the tenant
+ * \returns the key on success, null otherwise
+ */
+signing_key *tenant_keys_derive_key(const signing_key *master,
+                                    const char *name);
+
+/**
+ * Finds a level of a topic, which names the tenant when tenants are
+ * selected by topic
+ *
+ * \param topic topic name
+ * \param level index of the level, 0 for the first one
+ * \param length out length of the level
+ * \returns the start of the level in the topic, null if the topic has fewer
+ * levels
+ */
+const char *tenant_keys_topic_level(const char *topic, size_t level,
+                                    size_t *length);
@@ -0,0 +1,289 @@
+#include "topic_trie.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct trie_node {
+  /** Topic level leading to this node, not null terminated */
+  char *level;
+  size_t level_length;
+
+  /** Children by exact level, sorted by topic_trie_compile */
+  struct trie_node **children;
+  size_t child_count;
+  size_t child_capacity;
+
+  /** Child for the + wildcard */
+  struct trie_node *plus;
+
+  /** A filter ends with # after this node */
+  bool hash;
+
+  /** A filter ends at this node */
+  bool terminal;
+} trie_node;
+
+struct topic_trie {
+  trie_node root;
+  size_t filter_count;
+};
+
+static void node_free(trie_node *node) {
+  for (size_t i = 0; i < node->child_count; i++) {
+    node_free(node->children[i]);
+    free(node->children[i]);
+  }
+  if (node->plus != NULL) {
+    node_free(node->plus);
+    free(node->plus);
+  }
+  free(node->children);
+  free(node->level);
+}
+
+static int compare_level(const char *a, size_t a_length, const char *b,
+                         size_t b_length) {
+  int result = memcmp(a, b, a_length < b_length ? a_length : b_length);
+  if (result != 0) {
+    return result;
+  }
+  return (a_length > b_length) - (a_length < b_length);
+}
+
+static int compare_nodes(const void *a, const void *b) {
+  const trie_node *na = *(const trie_node *const *)a;
+  const trie_node *nb = *(const trie_node *const *)b;
+  return compare_level(na->level, na->level_length, nb->level,
+                       nb->level_length);
+}
+
+/**
+ * Finds an exact child with binary search, children must be sorted
+ */
+static const trie_node *find_child(const trie_node *node, const char *level,
+                                   size_t length) {
+  size_t low = 0;
+  size_t high = node->child_count;
+
+  while (low < high) {
+    size_t middle = low + (high - low) / 2;
+    const trie_node *child = node->children[middle];
+    int result =
+        compare_level(level, length, child->level, child->level_length);
+
+    if (result == 0) {
+      return child;
+    } else if (result < 0) {
+      high = middle;
+    } else {
+      low = middle + 1;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Finds or creates an exact child with a linear scan, used while building
+ */
+static trie_node *get_or_add_child(trie_node *node, const char *level,
+                                   size_t length) {
+  for (size_t i = 0; i < node->child_count; i++) {
+    trie_node *child = node->children[i];
+    if (compare_level(level, length, child->level, child->level_length) == 0) {
+      return child;
+    }
+  }
+
+  if (node->child_count == node->child_capacity) {
+    size_t capacity = node->child_capacity == 0 ? 4 : node->child_capacity * 2;
+    trie_node **children =
+        (trie_node **)realloc(node->children, capacity * sizeof(trie_node *));
+    if (children == NULL) {
+      return NULL;
+    }
+    node->children = children;
+    node->child_capacity = capacity;
+  }
+
+  trie_node *child = (trie_node *)calloc(1, sizeof(trie_node));
+  if (child == NULL) {
+    return NULL;
+  }
+
+  child->level = (char *)malloc(length > 0 ? length : 1);
+  if (child->level == NULL) {
+    free(child);
+    return NULL;
+  }
+  memcpy(child->level, level, length);
+  child->level_length = length;
+
+  node->children[node->child_count++] = child;
+  return child;
+}
+
+static void node_compile(trie_node *node) {
+  if (node->child_count > 1) {
+    qsort(node->children, node->child_count, sizeof(trie_node *),
+          compare_nodes);
+  }
+  for (size_t i = 0; i < node->child_count; i++) {
+    node_compile(node->children[i]);
+  }
+  if (node->plus != NULL) {
+    node_compile(node->plus);
+  }
+}
+
+/**
+ * Checks that wildcards occupy whole levels and that # is the last level
+ */
+static bool is_valid_filter(const char *filter, size_t length) {
+  if (length == 0) {
+    return false;
+  }
+
+  for (size_t i = 0; i < length; i++) {
+    if (filter[i] == '\0') {
+      return false;
+    }
+    if (filter[i] == '+' || filter[i] == '#') {
+      bool level_start = i == 0 || filter[i - 1] == '/';
+      bool level_end = i + 1 == length || filter[i + 1] == '/';
+      if (!level_start || !level_end) {
+        return false;
+      }
+      if (filter[i] == '#' && i + 1 != length) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+topic_trie *topic_trie_new(void) {
+  return (topic_trie *)calloc(1, sizeof(topic_trie));
+}
+
+error_code topic_trie_add(topic_trie *trie, const char *filter,
+                          size_t length) {
+  if (trie == NULL || filter == NULL || !is_valid_filter(filter, length)) {
+    return ERROR_INVALID_ARGUMENT;
+  }
+
+  trie_node *node = &trie->root;
+  const char *level = filter;
+  const char *end = filter + length;
+
+  while (true) {
+    const char *separator = memchr(level, '/', end - level);
+    size_t level_length = (separator != NULL ? separator : end) - level;
+
+    if (level_length == 1 && level[0] == '#') {
+      node->hash = true;
+      break;
+    }
+
+    if (level_length == 1 && level[0] == '+') {
+      if (node->plus == NULL) {
+        node->plus = (trie_node *)calloc(1, sizeof(trie_node));
+        if (node->plus == NULL) {
+          return ERROR_NO_MEMORY;
+        }
+      }
+      node = node->plus;
+    } else {
+      node = get_or_add_child(node, level, level_length);
+      if (node == NULL) {
+        return ERROR_NO_MEMORY;
+      }
+    }
+
+    if (separator == NULL) {
+      node->terminal = true;
+      break;
+    }
+    level = separator + 1;
+  }
+
+  trie->filter_count++;
+  return SUCCESS;
+}
+
+error_code topic_trie_add_list(topic_trie *trie, const char *filters) {
+  const char *cursor = filters;
+
+  while (*cursor != '\0') {
+    while (isspace((unsigned char)*cursor)) {
+      cursor++;
+    }
+
+    const char *start = cursor;
+    while (*cursor != '\0' && !isspace((unsigned char)*cursor)) {
+      cursor++;
+    }
+
+    if (cursor > start) {
+      error_code error = topic_trie_add(trie, start, cursor - start);
+      if (error != SUCCESS) {
+        return error;
+      }
+    }
+  }
+  return SUCCESS;
+}
+
+void topic_trie_compile(topic_trie *trie) { node_compile(&trie->root); }
+
+bool topic_trie_is_empty(const topic_trie *trie) {
+  return trie->filter_count == 0;
+}
+
+static bool node_matches(const trie_node *node, const char *level,
+                         bool allow_wildcards) {
+  if (node->hash && allow_wildcards) {
+    return true;
+  }
+
+  const char *separator = strchr(level, '/');
+  size_t level_length =
+      separator != NULL ? (size_t)(separator - level) : strlen(level);
+
+  const trie_node *child = find_child(node, level, level_length);
+  const trie_node *candidates[] = {child,
+                                   allow_wildcards ? node->plus : NULL};
+
+  for (size_t i = 0; i < 2; i++) {
+    const trie_node *next = candidates[i];
+    if (next == NULL) {
+      continue;
+    }
+
+    if (separator == NULL) {
+      // Last level: a/# also matches a
+      if (next->terminal || next->hash) {
+        return true;
+      }
+    } else if (node_matches(next, separator + 1, true)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool topic_trie_matches(const topic_trie *trie, const char *topic) {
+  if (trie->filter_count == 0 || topic == NULL) {
+    return false;
+  }
+
+  // Filters starting with a wildcard do not match topics starting with $
+  return node_matches(&trie->root, topic, topic[0] != '$');
+}
+
+void topic_trie_destroy(topic_trie *trie) {
+  if (trie == NULL) {
+    return;
+  }
+  node_free(&trie->root);
+  free(trie);
+}
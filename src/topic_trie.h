@@ -0,0 +1,69 @@
+#pragma once
+#include "error.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Opaque struct representing a set of MQTT topic filters compiled into a
+ * trie, indexed by topic level. Matching a topic costs O(topic levels)
+ * whatever the number of filters.
+ */
+typedef struct topic_trie topic_trie;
+
+/**
+ * Creates a new empty trie
+ *
+ * \returns handle to the created trie on success, null otherwise
+ */
+topic_trie *topic_trie_new(void);
+
+/**
+ * Adds a topic filter to the trie
+ *
+ * \param trie handle to the trie
+ * \param filter topic filter, may contain the + and # wildcards
+ * \param length length of the filter
+ * \returns success on insertion, ERROR_INVALID_ARGUMENT if the filter is not
+ * valid, error otherwise
+ */
+error_code topic_trie_add(topic_trie *trie, const char *filter, size_t length);
+
+/**
+ * Adds every topic filter of a whitespace separated list to the trie
+ *
+ * \param trie handle to the trie
+ * \param filters whitespace separated list of topic filters
+ * \returns success if every filter was inserted, error otherwise
+ */
+error_code topic_trie_add_list(topic_trie *trie, const char *filters);
+
+/**
+ * Prepares the trie for matching. Must be called after the last filter is
+ * added and before the first match.
+ *
+ * \param trie handle to the trie
+ */
+void topic_trie_compile(topic_trie *trie);
+
+/**
+ * Returns whether the trie contains no filter
+ */
+bool topic_trie_is_empty(const topic_trie *trie);
+
+/**
+ * Checks if a topic matches any filter of the trie, following the MQTT rules
+ * (topics starting with $ are not matched by filters starting with a
+ * wildcard)
+ *
+ * \param trie handle to the trie
+ * \param topic topic name
+ * \returns true if at least one filter matches the topic
+ */
+bool topic_trie_matches(const topic_trie *trie, const char *topic);
+
+/**
+ * Destroys the trie freeing memory
+ *
+ * \param trie handle to the trie
+ */
+void topic_trie_destroy(topic_trie *trie);
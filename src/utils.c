@@ -1,4 +1,6 @@
 #include "utils.h"
+#include "arena.h"
+#include "cbor_splice.h"
 #include <cbor.h>
 #include <sodium.h>
 #include <string.h>
@@ -6,8 +8,33 @@
 
 #define IS_NULL(x) ((x) == NULL)
 
+#define CBOR_INDEFINITE_MAP_START 0xbf
+#define CBOR_BREAK 0xff
+#define CBOR_MAP_ONE_PAIR 0xa1
+#define CBOR_ARRAY_FOUR_ITEMS 0x84
+
+/** Tag 18 of COSE_Sign1 messages */
+#define COSE_SIGN1_TAG 0xd2
+
+/** Label of the key id header parameter */
+#define COSE_HEADER_KID 0x04
+
+/** The Sig_structure prefix must fit in front of the payload, in place of the
+ * message prefix */
+#define COSE_MIN_KEY_ID_SIZE 8
+#define COSE_MAX_KEY_ID_SIZE 23
+
+/** Protected header {1: -8} (alg: EdDSA), as a byte string */
+static const uint8_t COSE_PROTECTED_HEADER[] = {0x43, 0xa1, 0x01, 0x27};
+
+/** Start of the Sig_structure array: its head, the "Signature1" context, the
+ * protected header and an empty external_aad */
+static const uint8_t COSE_SIG_STRUCTURE_PREFIX[] = {
+    0x84, 0x6a, 'S',  'i',  'g',  'n',  'a',  't', 'u',
+    'r',  'e',  '1',  0x43, 0xa1, 0x01, 0x27, 0x40};
+
 error_code utils_make_signed_cbor_message(cbor_item_t *cbor_map,
-                                          const uint8_t *private_key,
+                                          const signing_context *signer,
                                           const char *appended_signature_key) {
 
   unsigned char *serialized_map = NULL;
@@ -16,7 +43,7 @@ error_code utils_make_signed_cbor_message(cbor_item_t *cbor_map,
   cbor_item_t *signature_item = NULL;
   struct cbor_pair new_pair;
 
-  if (IS_NULL(cbor_map) || IS_NULL(private_key) ||
+  if (IS_NULL(cbor_map) || IS_NULL(signer) ||
       IS_NULL(appended_signature_key)) {
     return ERROR_INVALID_ARGUMENT;
   }
@@ -32,17 +59,19 @@ error_code utils_make_signed_cbor_message(cbor_item_t *cbor_map,
     return ERROR_NO_MEMORY;
   }
 
-  if (crypto_sign_detached(signature, NULL, serialized_map, serialized_size,
-                           private_key)) {
-    free(serialized_map);
+  if (signing_context_sign(signer, serialized_map, serialized_size,
+                           signature) != SUCCESS) {
+    arena_cbor_free(serialized_map);
     return ERROR_UNKNOWN;
   }
 
+  // The buffer comes from the libcbor allocator, which may be an arena
+  arena_cbor_free(serialized_map);
+
   // Create a CBOR byte string for the signature
   signature_item = cbor_build_bytestring(signature, crypto_sign_BYTES);
 
   if (signature_item == NULL) {
-    free(serialized_map);
     return ERROR_NO_MEMORY;
   }
 
@@ -50,11 +79,307 @@ error_code utils_make_signed_cbor_message(cbor_item_t *cbor_map,
   new_pair.key = cbor_build_string(appended_signature_key);
   new_pair.value = signature_item;
 
-  if (!cbor_map_add(cbor_map, new_pair)) {
+  if (IS_NULL(new_pair.key)) {
     cbor_decref(&signature_item);
-    free(serialized_map);
+    return ERROR_NO_MEMORY;
+  }
+
+  bool added = cbor_map_add(cbor_map, new_pair);
+
+  // The map holds its own references to the pair
+  cbor_decref(&new_pair.key);
+  cbor_decref(&signature_item);
+
+  if (!added) {
+    return ERROR_UNKNOWN;
+  }
+
+  return SUCCESS;
+}
+
+size_t utils_splice_signed_cbor_message_size(
+    size_t payload_size, const cbor_splice_key *ingestion_time_key,
+    size_t ingestion_time_size, const cbor_splice_key *key_id_key,
+    size_t key_id_size, const cbor_splice_key *appended_signature_key) {
+  return payload_size + ingestion_time_key->size + ingestion_time_size +
+         key_id_key->size + cbor_splice_bytes_size(key_id_size) +
+         appended_signature_key->size +
+         cbor_splice_bytes_size(crypto_sign_BYTES);
+}
+
+error_code utils_splice_signed_cbor_message(
+    const uint8_t *payload, size_t payload_size,
+    const cbor_splice_key *ingestion_time_key, const uint8_t *ingestion_time,
+    size_t ingestion_time_size, const cbor_splice_key *key_id_key,
+    const uint8_t *key_id, size_t key_id_size, const signing_context *signer,
+    const cbor_splice_key *appended_signature_key, uint8_t *out,
+    size_t out_size) {
+
+  cbor_splice splice;
+  unsigned char signature[crypto_sign_BYTES];
+  const uint8_t *signed_data = NULL;
+  size_t signed_size = 0;
+
+  if (IS_NULL(payload) || IS_NULL(ingestion_time_key) ||
+      IS_NULL(ingestion_time) || IS_NULL(key_id_key) || IS_NULL(key_id) ||
+      IS_NULL(signer) || IS_NULL(appended_signature_key) ||
+      IS_NULL(out)) {
+    return ERROR_INVALID_ARGUMENT;
+  }
+
+  if (payload_size < 2 || payload[0] != CBOR_INDEFINITE_MAP_START ||
+      payload[payload_size - 1] != CBOR_BREAK) {
+    return ERROR_INVALID_ARGUMENT;
+  }
+
+  if (out_size < utils_splice_signed_cbor_message_size(
+                     payload_size, ingestion_time_key, ingestion_time_size,
+                     key_id_key, key_id_size, appended_signature_key)) {
+    return ERROR_INVALID_ARGUMENT;
+  }
+
+  cbor_splice_init(&splice, out, out_size, payload, payload_size);
+  cbor_splice_put_key(&splice, ingestion_time_key);
+  cbor_splice_put_raw(&splice, ingestion_time, ingestion_time_size);
+  cbor_splice_put_key(&splice, key_id_key);
+  cbor_splice_put_bytes(&splice, key_id, key_id_size);
+
+  // Sign the same bytes that the serialization of the map with the ingestion
+  // time and the key id would produce
+  signed_data = cbor_splice_closed_view(&splice, &signed_size);
+  if (IS_NULL(signed_data)) {
+    return ERROR_UNKNOWN;
+  }
+
+  if (signing_context_sign(signer, signed_data, signed_size, signature) !=
+      SUCCESS) {
+    return ERROR_UNKNOWN;
+  }
+
+  cbor_splice_put_key(&splice, appended_signature_key);
+  cbor_splice_put_bytes(&splice, signature, crypto_sign_BYTES);
+
+  if (cbor_splice_finish(&splice) == 0) {
+    return ERROR_UNKNOWN;
+  }
+
+  return SUCCESS;
+}
+
+size_t utils_splice_countersigned_cbor_message_size(
+    size_t payload_size, const cbor_splice_key *countersignature_key) {
+  return payload_size + countersignature_key->size +
+         cbor_splice_bytes_size(DETACHED_SIGNATURE_PACKED_BYTES);
+}
+
+error_code utils_splice_countersigned_cbor_message(
+    const uint8_t *payload, size_t payload_size,
+    detached_signature *countersignature, const signing_context *signer,
+    const cbor_splice_key *countersignature_key, uint8_t *out,
+    size_t out_size) {
+
+  cbor_splice splice;
+  detached_signature_input input;
+  uint8_t packed[DETACHED_SIGNATURE_PACKED_BYTES];
+
+  if (IS_NULL(payload) || IS_NULL(countersignature) || IS_NULL(signer) ||
+      IS_NULL(countersignature_key) || IS_NULL(out)) {
+    return ERROR_INVALID_ARGUMENT;
+  }
+
+  if (payload_size < 2 || payload[0] != CBOR_INDEFINITE_MAP_START ||
+      payload[payload_size - 1] != CBOR_BREAK) {
+    return ERROR_INVALID_ARGUMENT;
+  }
+
+  if (out_size < utils_splice_countersigned_cbor_message_size(
+                     payload_size, countersignature_key)) {
+    return ERROR_INVALID_ARGUMENT;
+  }
+
+  // The received map is signed in place, it is copied once into the output
+  detached_signature_countersign_input_init(&input, countersignature,
+                                            payload, payload_size - 1);
+  if (signing_context_sign_parts(signer, input.parts,
+                                 DETACHED_SIGNATURE_PARTS,
+                                 countersignature->signature) != SUCCESS) {
     return ERROR_UNKNOWN;
   }
+  detached_signature_pack(countersignature, packed);
+
+  cbor_splice_init(&splice, out, out_size, payload, payload_size);
+  cbor_splice_put_key(&splice, countersignature_key);
+  cbor_splice_put_bytes(&splice, packed, sizeof(packed));
+
+  if (cbor_splice_finish(&splice) == 0) {
+    return ERROR_UNKNOWN;
+  }
+
+  return SUCCESS;
+}
+
+size_t utils_splice_chained_cbor_message_size(
+    size_t payload_size, const cbor_splice_key *ingestion_time_key,
+    size_t ingestion_time_size, const cbor_splice_key *sequence_key,
+    const cbor_splice_key *link_key) {
+  return payload_size + ingestion_time_key->size + ingestion_time_size +
+         sequence_key->size + CBOR_SPLICE_UINT64_SIZE + link_key->size +
+         cbor_splice_bytes_size(HASH_CHAIN_LINK_BYTES);
+}
+
+error_code utils_splice_chained_cbor_message(
+    const uint8_t *payload, size_t payload_size,
+    const cbor_splice_key *ingestion_time_key, const uint8_t *ingestion_time,
+    size_t ingestion_time_size, hash_chain *chain,
+    const cbor_splice_key *sequence_key, const cbor_splice_key *link_key,
+    uint8_t *out, size_t out_size) {
+
+  cbor_splice splice;
+  const uint8_t *chained_data = NULL;
+  size_t chained_size = 0;
+
+  if (IS_NULL(payload) || IS_NULL(ingestion_time_key) ||
+      IS_NULL(ingestion_time) || IS_NULL(chain) || IS_NULL(sequence_key) ||
+      IS_NULL(link_key) || IS_NULL(out)) {
+    return ERROR_INVALID_ARGUMENT;
+  }
+
+  if (payload_size < 2 || payload[0] != CBOR_INDEFINITE_MAP_START ||
+      payload[payload_size - 1] != CBOR_BREAK) {
+    return ERROR_INVALID_ARGUMENT;
+  }
+
+  if (out_size < utils_splice_chained_cbor_message_size(
+                     payload_size, ingestion_time_key, ingestion_time_size,
+                     sequence_key, link_key)) {
+    return ERROR_INVALID_ARGUMENT;
+  }
+
+  cbor_splice_init(&splice, out, out_size, payload, payload_size);
+  cbor_splice_put_key(&splice, ingestion_time_key);
+  cbor_splice_put_raw(&splice, ingestion_time, ingestion_time_size);
+  cbor_splice_put_key(&splice, sequence_key);
+  cbor_splice_put_uint64(&splice, hash_chain_next_sequence(chain));
+
+  chained_data = cbor_splice_closed_view(&splice, &chained_size);
+  if (IS_NULL(chained_data)) {
+    return ERROR_UNKNOWN;
+  }
+
+  error_code error = hash_chain_append(chain, chained_data, chained_size);
+  if (error != SUCCESS) {
+    return error;
+  }
+
+  cbor_splice_put_key(&splice, link_key);
+  cbor_splice_put_bytes(&splice, chain->head, HASH_CHAIN_LINK_BYTES);
+
+  if (cbor_splice_finish(&splice) == 0) {
+    return ERROR_UNKNOWN;
+  }
+
+  return SUCCESS;
+}
+
+/**
+ * Encodes the unprotected header of a COSE_Sign1 message: a map with the key
+ * id label
+ */
+static size_t encode_cose_unprotected_header(const uint8_t *key_id,
+                                             size_t key_id_size,
+                                             uint8_t *out) {
+  out[0] = CBOR_MAP_ONE_PAIR;
+  out[1] = COSE_HEADER_KID;
+  size_t head = cbor_encode_bytestring_start(key_id_size, out + 2,
+                                             COSE_MAX_KEY_ID_SIZE + 1);
+  memcpy(out + 2 + head, key_id, key_id_size);
+  return 2 + head + key_id_size;
+}
+
+size_t utils_splice_cose_sign1_message_size(
+    size_t payload_size, const cbor_splice_key *ingestion_time_key,
+    size_t ingestion_time_size, size_t key_id_size) {
+  size_t map_size = payload_size + ingestion_time_key->size +
+                    ingestion_time_size;
+  return 2 + sizeof(COSE_PROTECTED_HEADER) + 2 +
+         cbor_splice_bytes_size(key_id_size) +
+         cbor_splice_bytes_size(map_size) +
+         cbor_splice_bytes_size(crypto_sign_BYTES);
+}
+
+error_code utils_splice_cose_sign1_message(
+    const uint8_t *payload, size_t payload_size,
+    const cbor_splice_key *ingestion_time_key, const uint8_t *ingestion_time,
+    size_t ingestion_time_size, const signing_context *signer,
+    const uint8_t *key_id, size_t key_id_size, uint8_t *out, size_t out_size) {
+
+  cbor_splice splice;
+  unsigned char signature[crypto_sign_BYTES];
+  uint8_t unprotected[2 + 1 + COSE_MAX_KEY_ID_SIZE];
+
+  if (IS_NULL(payload) || IS_NULL(ingestion_time_key) ||
+      IS_NULL(ingestion_time) || IS_NULL(signer) || IS_NULL(key_id) ||
+      IS_NULL(out)) {
+    return ERROR_INVALID_ARGUMENT;
+  }
+
+  if (payload_size < 2 || payload[0] != CBOR_INDEFINITE_MAP_START ||
+      payload[payload_size - 1] != CBOR_BREAK) {
+    return ERROR_INVALID_ARGUMENT;
+  }
+
+  if (key_id_size < COSE_MIN_KEY_ID_SIZE ||
+      key_id_size > COSE_MAX_KEY_ID_SIZE ||
+      out_size < utils_splice_cose_sign1_message_size(
+                     payload_size, ingestion_time_key, ingestion_time_size,
+                     key_id_size)) {
+    return ERROR_INVALID_ARGUMENT;
+  }
+
+  // Layout of the output: tag, array head, protected header, unprotected
+  // header, payload byte string, signature byte string
+  size_t unprotected_size =
+      encode_cose_unprotected_header(key_id, key_id_size, unprotected);
+  size_t prefix_size = 2 + sizeof(COSE_PROTECTED_HEADER) + unprotected_size;
+  size_t map_size =
+      payload_size + ingestion_time_key->size + ingestion_time_size;
+  size_t payload_head = cbor_encode_bytestring_start(
+      map_size, out + prefix_size, out_size - prefix_size);
+
+  cbor_splice_init(&splice, out + prefix_size + payload_head, map_size,
+                   payload, payload_size);
+  cbor_splice_put_key(&splice, ingestion_time_key);
+  cbor_splice_put_raw(&splice, ingestion_time, ingestion_time_size);
+  if (payload_head == 0 || cbor_splice_finish(&splice) != map_size) {
+    return ERROR_UNKNOWN;
+  }
+
+  // The Sig_structure is ["Signature1", protected, external_aad, payload],
+  // its prefix is written in front of the payload byte string and replaced by
+  // the message prefix once signed
+  uint8_t *sig_structure =
+      out + prefix_size - sizeof(COSE_SIG_STRUCTURE_PREFIX);
+  memcpy(sig_structure, COSE_SIG_STRUCTURE_PREFIX,
+         sizeof(COSE_SIG_STRUCTURE_PREFIX));
+
+  if (signing_context_sign(signer, sig_structure,
+                           sizeof(COSE_SIG_STRUCTURE_PREFIX) + payload_head +
+                               map_size,
+                           signature) != SUCCESS) {
+    return ERROR_UNKNOWN;
+  }
+
+  out[0] = COSE_SIGN1_TAG;
+  out[1] = CBOR_ARRAY_FOUR_ITEMS;
+  memcpy(out + 2, COSE_PROTECTED_HEADER, sizeof(COSE_PROTECTED_HEADER));
+  memcpy(out + 2 + sizeof(COSE_PROTECTED_HEADER), unprotected,
+         unprotected_size);
+
+  uint8_t *signature_item = out + prefix_size + payload_head + map_size;
+  size_t signature_head = cbor_encode_bytestring_start(
+      crypto_sign_BYTES, signature_item,
+      out_size - (size_t)(signature_item - out));
+  memcpy(signature_item + signature_head, signature, crypto_sign_BYTES);
 
   return SUCCESS;
 }
@@ -1,5 +1,9 @@
 #pragma once
+#include "cbor_splice.h"
+#include "detached_signature.h"
 #include "error.h"
+#include "hash_chain.h"
+#include "signing_context.h"
 #include <cbor.h>
 #include <stddef.h>
 
@@ -9,15 +13,199 @@
  * This method expects that the passed cbor_buffer contains a map type value.
  *
  * \param map CBOR item on which the signature will be calculated and appended
- * \param private_key key used to sign the payload with ED25519 algorithm
+ * \param signer prepared key used to sign the payload with ED25519 algorithm
  * \param appended_signature_key key value for the signature that will be
  * appended
  * \returns a error code
  */
 error_code utils_make_signed_cbor_message(cbor_item_t *map,
-                                          const uint8_t *private_key,
+                                          const signing_context *signer,
                                           const char *appended_signature_key);
 
+/**
+ * Computes the size of the message produced by
+ * utils_splice_signed_cbor_message for the given arguments
+ *
+ * \param payload_size size of the encoded indefinite map
+ * \param ingestion_time_key encoded key for the ingestion time that will be
+ * appended
+ * \param ingestion_time_size size of the encoded ingestion time
+ * \param key_id_key encoded key for the key id that will be appended
+ * \param key_id_size size of the key id
+ * \param appended_signature_key encoded key for the signature that will be
+ * appended
+ * \returns size in bytes of the signed message
+ */
+size_t utils_splice_signed_cbor_message_size(
+    size_t payload_size, const cbor_splice_key *ingestion_time_key,
+    size_t ingestion_time_size, const cbor_splice_key *key_id_key,
+    size_t key_id_size, const cbor_splice_key *appended_signature_key);
+
+/**
+ * Makes a serialized CBOR message appending the ingestion time, the key id
+ * and the ED25519 signature to an already encoded indefinite map, without
+ * decoding it. The payload is copied once into the output buffer, the new
+ * pairs are encoded in place before its closing break and the signature is
+ * calculated on the resulting bytes up to the signature pair, closed by a
+ * break. The payload must have been validated with
+ * cbor_validate_indefinite_map.
+ *
+ * \param payload encoded indefinite CBOR map
+ * \param payload_size size of the payload in bytes
+ * \param ingestion_time_key encoded key for the ingestion time that will be
+ * appended
+ * \param ingestion_time encoded CBOR item of the ingestion time that will be
+ * appended, see ingestion_clock_encode
+ * \param ingestion_time_size size of the encoded ingestion time
+ * \param key_id_key encoded key for the key id that will be appended
+ * \param key_id key id of the signing key, appended as a byte string
+ * \param key_id_size size of the key id
+ * \param signer prepared key used to sign the payload with ED25519 algorithm
+ * \param appended_signature_key encoded key for the signature that will be
+ * appended
+ * \param out output buffer, of at least
+ * utils_splice_signed_cbor_message_size bytes
+ * \param out_size size of the output buffer
+ * \returns a error code
+ */
+error_code utils_splice_signed_cbor_message(
+    const uint8_t *payload, size_t payload_size,
+    const cbor_splice_key *ingestion_time_key, const uint8_t *ingestion_time,
+    size_t ingestion_time_size, const cbor_splice_key *key_id_key,
+    const uint8_t *key_id, size_t key_id_size, const signing_context *signer,
+    const cbor_splice_key *appended_signature_key, uint8_t *out,
+    size_t out_size);
+
+/**
+ * Computes the size of the message produced by
+ * utils_splice_chained_cbor_message for the given arguments
+ *
+ * \param payload_size size of the encoded indefinite map
+ * \param ingestion_time_key encoded key for the ingestion time that will be
+ * appended
+ * \param ingestion_time_size size of the encoded ingestion time
+ * \param sequence_key encoded key for the sequence number that will be
+ * appended
+ * \param link_key encoded key for the chain link that will be appended
+ * \returns size in bytes of the chained message
+ */
+size_t utils_splice_chained_cbor_message_size(
+    size_t payload_size, const cbor_splice_key *ingestion_time_key,
+    size_t ingestion_time_size, const cbor_splice_key *sequence_key,
+    const cbor_splice_key *link_key);
+
+/**
+ * Makes a serialized CBOR message appending the ingestion time, the sequence
+ * number in the hash chain and the new link of the chain to an already encoded
+ * indefinite map. The link is the hash of the previous link and of the map
+ * with the ingestion time and the sequence number, closed by its break.
+ * The payload must have been validated with cbor_validate_indefinite_map.
+ *
+ * \param payload encoded indefinite CBOR map
+ * \param payload_size size of the payload in bytes
+ * \param ingestion_time_key encoded key for the ingestion time that will be
+ * appended
+ * \param ingestion_time encoded CBOR item of the ingestion time that will be
+ * appended
+ * \param ingestion_time_size size of the encoded ingestion time
+ * \param chain hash chain the message is appended to
+ * \param sequence_key encoded key for the sequence number that will be
+ * appended
+ * \param link_key encoded key for the chain link that will be appended
+ * \param out output buffer, of at least
+ * utils_splice_chained_cbor_message_size bytes
+ * \param out_size size of the output buffer
+ * \returns a error code
+ */
+error_code utils_splice_chained_cbor_message(
+    const uint8_t *payload, size_t payload_size,
+    const cbor_splice_key *ingestion_time_key, const uint8_t *ingestion_time,
+    size_t ingestion_time_size, hash_chain *chain,
+    const cbor_splice_key *sequence_key, const cbor_splice_key *link_key,
+    uint8_t *out, size_t out_size);
+
+/**
+ * Computes the size of the message produced by
+ * utils_splice_cose_sign1_message for the given arguments
+ *
+ * \param payload_size size of the encoded indefinite map
+ * \param ingestion_time_key encoded key for the ingestion time that will be
+ * appended
+ * \param ingestion_time_size size of the encoded ingestion time
+ * \param key_id_size size of the key id
+ * \returns size in bytes of the COSE_Sign1 message
+ */
+size_t utils_splice_cose_sign1_message_size(
+    size_t payload_size, const cbor_splice_key *ingestion_time_key,
+    size_t ingestion_time_size, size_t key_id_size);
+
+/**
+ * Makes a tagged COSE_Sign1 message (RFC 9052) with the EdDSA algorithm in
+ * its protected header and the key id in its unprotected header. Its payload
+ * is the encoded indefinite map with the ingestion time appended.
+ * The payload is copied once into the output buffer, and the Sig_structure is
+ * written in front of it in the same buffer, which requires a key id of at
+ * least 8 bytes.
+ * The payload must have been validated with cbor_validate_indefinite_map.
+ *
+ * \param payload encoded indefinite CBOR map
+ * \param payload_size size of the payload in bytes
+ * \param ingestion_time_key encoded key for the ingestion time that will be
+ * appended
+ * \param ingestion_time encoded CBOR item of the ingestion time
+ * \param ingestion_time_size size of the encoded ingestion time
+ * \param signer prepared key used to sign the payload with ED25519 algorithm
+ * \param key_id key id of the signing key
+ * \param key_id_size size of the key id, from 8 to 23 bytes
+ * \param out output buffer, of at least
+ * utils_splice_cose_sign1_message_size bytes
+ * \param out_size size of the output buffer
+ * \returns a error code
+ */
+error_code utils_splice_cose_sign1_message(
+    const uint8_t *payload, size_t payload_size,
+    const cbor_splice_key *ingestion_time_key, const uint8_t *ingestion_time,
+    size_t ingestion_time_size, const signing_context *signer,
+    const uint8_t *key_id, size_t key_id_size, uint8_t *out, size_t out_size);
+
+/**
+ * Computes the size of the message produced by
+ * utils_splice_countersigned_cbor_message for the given arguments
+ *
+ * \param payload_size size of the encoded signed map
+ * \param countersignature_key encoded key for the countersignature that will
+ * be appended
+ * \returns size in bytes of the countersigned message
+ */
+size_t utils_splice_countersigned_cbor_message_size(
+    size_t payload_size, const cbor_splice_key *countersignature_key);
+
+/**
+ * Makes a serialized CBOR message appending a countersignature to a map
+ * already signed by another broker, without decoding it nor adding a second
+ * ingestion time. The countersignature signs the map as received, see
+ * detached_signature_countersign_input_init, and is appended as a byte string
+ * packed by detached_signature_pack. The payload must have been validated
+ * with cbor_validate_indefinite_map.
+ *
+ * \param payload encoded signed indefinite CBOR map
+ * \param payload_size size of the payload in bytes
+ * \param countersignature ingestion time and key id of the
+ * countersignature, its signature is written on success
+ * \param signer prepared key used to sign the payload
+ * \param countersignature_key encoded key for the countersignature that will
+ * be appended
+ * \param out output buffer, of at least
+ * utils_splice_countersigned_cbor_message_size bytes
+ * \param out_size size of the output buffer
+ * \returns a error code
+ */
+error_code utils_splice_countersigned_cbor_message(
+    const uint8_t *payload, size_t payload_size,
+    detached_signature *countersignature, const signing_context *signer,
+    const cbor_splice_key *countersignature_key, uint8_t *out,
+    size_t out_size);
+
 /**
  * Converts unix timestamp (in seconds) into ISO8601 string
  *
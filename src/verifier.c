@@ -0,0 +1,829 @@
+#include "verifier.h"
+#include <pthread.h>
+#include <sodium.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CBOR_INDEFINITE_MAP_START 0xbf
+#define CBOR_BREAK 0xff
+#define CBOR_MAP_ONE_PAIR 0xa1
+#define CBOR_ARRAY_FOUR_ITEMS 0x84
+#define CBOR_BYTES_MAJOR_TYPE 0x40
+
+/** Head of the byte strings of 24 to 255 bytes closing signed maps, followed
+ * by their length */
+#define CBOR_BYTES_UINT8_LENGTH 0x58
+#define CLOSING_BYTES_HEAD_SIZE 2
+
+/** Encoded signature keys of the plugin: -2 and "VERIFICATION_TOKEN" */
+static const uint8_t SIGNATURE_INT_KEY[] = {0x21};
+static const uint8_t SIGNATURE_TEXT_KEY[] = {
+    0x72, 'V', 'E', 'R', 'I', 'F', 'I', 'C', 'A', 'T',
+    'I',  'O', 'N', '_', 'T', 'O', 'K', 'E', 'N'};
+
+/** Encoded countersignature keys of the plugin: -6 and "COUNTERSIGNATURE" */
+static const uint8_t COUNTERSIGNATURE_INT_KEY[] = {0x25};
+static const uint8_t COUNTERSIGNATURE_TEXT_KEY[] = {
+    0x70, 'C', 'O', 'U', 'N', 'T', 'E', 'R', 'S',
+    'I',  'G', 'N', 'A', 'T', 'U', 'R', 'E'};
+
+/** Encoded key id keys of the plugin: -5 and "KEY_ID", and the head of the
+ * key id byte string */
+static const uint8_t KEY_ID_INT_KEY[] = {0x24};
+static const uint8_t KEY_ID_TEXT_KEY[] = {0x66, 'K', 'E', 'Y', '_', 'I', 'D'};
+static const uint8_t KEY_ID_HEAD[] = {0x40 + SIGNING_KEY_ID_BYTES};
+
+/** Tag 18 of COSE_Sign1 messages */
+#define COSE_SIGN1_TAG 0xd2
+
+/** Label of the key id header parameter */
+#define COSE_HEADER_KID 0x04
+
+/** Protected header {1: -8} (alg: EdDSA), as a byte string */
+static const uint8_t COSE_PROTECTED_HEADER[] = {0x43, 0xa1, 0x01, 0x27};
+
+/** Start of the Sig_structure array, as written by
+ * utils_splice_cose_sign1_message */
+static const uint8_t COSE_SIG_STRUCTURE_PREFIX[] = {
+    0x84, 0x6a, 'S',  'i',  'g',  'n',  'a',  't', 'u',
+    'r',  'e',  '1',  0x43, 0xa1, 0x01, 0x27, 0x40};
+
+/** Messages taken at once by a worker from its own range */
+#define WORK_CHUNK_SIZE 64
+
+void verifier_key_cache_init(verifier_key_cache *cache) {
+  memset(cache, 0, sizeof(verifier_key_cache));
+}
+
+static error_code append_key(verifier_key_cache *cache,
+                             const verifier_key *key) {
+  if (cache->count == cache->capacity) {
+    size_t capacity = cache->capacity == 0 ? 16 : 2 * cache->capacity;
+    verifier_key *keys = (verifier_key *)realloc(
+        cache->keys, capacity * sizeof(verifier_key));
+    if (keys == NULL) {
+      return ERROR_NO_MEMORY;
+    }
+    cache->keys = keys;
+    cache->capacity = capacity;
+  }
+
+  cache->keys[cache->count++] = *key;
+  return SUCCESS;
+}
+
+error_code verifier_key_cache_add(verifier_key_cache *cache,
+                                  const char *public_key_hex,
+                                  uint64_t create_time_unix,
+                                  signing_algorithm algorithm) {
+  verifier_key key = {0};
+  size_t key_size = 0;
+
+  if (algorithm >= SIGNING_ALGORITHM_COUNT ||
+      algorithm == SIGNING_ALGORITHM_BLAKE2B_MAC) {
+    return ERROR_INVALID_ARGUMENT;
+  }
+  if (sodium_hex2bin(key.public_key, sizeof(key.public_key), public_key_hex,
+                     strlen(public_key_hex), NULL, &key_size, NULL) != 0 ||
+      key_size != sizeof(key.public_key)) {
+    return ERROR_INVALID_ARGUMENT;
+  }
+  signing_key_compute_id(key.public_key, key.key_id);
+  key.create_time_unix = create_time_unix;
+  key.algorithm = algorithm;
+
+  return append_key(cache, &key);
+}
+
+error_code verifier_key_cache_add_signing_key(verifier_key_cache *cache,
+                                              const signing_key *key) {
+  verifier_key entry = {0};
+  crypto_sign_ed25519_sk_to_pk(entry.public_key, key->private_key);
+  memcpy(entry.key_id, key->key_id, sizeof(entry.key_id));
+  entry.create_time_unix = key->create_time_unix;
+  entry.algorithm = key->context.algorithm;
+  if (entry.algorithm == SIGNING_ALGORITHM_BLAKE2B_MAC) {
+    memcpy(entry.mac_key, key->context.mac_key, sizeof(entry.mac_key));
+  }
+
+  error_code error = append_key(cache, &entry);
+  sodium_memzero(&entry, sizeof(entry));
+  return error;
+}
+
+static int compare_keys(const void *a, const void *b) {
+  const verifier_key *key_a = (const verifier_key *)a;
+  const verifier_key *key_b = (const verifier_key *)b;
+  int order = memcmp(key_a->key_id, key_b->key_id, SIGNING_KEY_ID_BYTES);
+  if (order != 0) {
+    return order;
+  }
+  order = memcmp(key_a->public_key, key_b->public_key,
+                 SIGNING_KEY_PUBLIC_BYTES);
+  if (order != 0) {
+    return order;
+  }
+  return (int)key_a->algorithm - (int)key_b->algorithm;
+}
+
+void verifier_key_cache_seal(verifier_key_cache *cache) {
+  if (cache->count == 0) {
+    return;
+  }
+
+  qsort(cache->keys, cache->count, sizeof(verifier_key), compare_keys);
+
+  // The same certificate can be loaded from several sources
+  size_t unique = 1;
+  for (size_t i = 1; i < cache->count; i++) {
+    if (compare_keys(&cache->keys[unique - 1], &cache->keys[i]) != 0) {
+      cache->keys[unique++] = cache->keys[i];
+    }
+  }
+  cache->count = unique;
+}
+
+const verifier_key *verifier_key_cache_find(const verifier_key_cache *cache,
+                                            const uint8_t *key_id) {
+  size_t low = 0;
+  size_t high = cache->count;
+  while (low < high) {
+    size_t middle = low + (high - low) / 2;
+    int order =
+        memcmp(cache->keys[middle].key_id, key_id, SIGNING_KEY_ID_BYTES);
+    if (order == 0) {
+      return &cache->keys[middle];
+    }
+    if (order < 0) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return NULL;
+}
+
+void verifier_key_cache_destroy(verifier_key_cache *cache) {
+  if (cache->keys != NULL) {
+    sodium_memzero(cache->keys, cache->capacity * sizeof(verifier_key));
+  }
+  free(cache->keys);
+  memset(cache, 0, sizeof(verifier_key_cache));
+}
+
+void verifier_init(verifier *verifier, const verifier_key_cache *cache) {
+  memset(verifier, 0, sizeof(*verifier));
+  verifier->cache = cache;
+}
+
+void verifier_destroy(verifier *verifier) {
+  free(verifier->scratch);
+  memset(verifier, 0, sizeof(*verifier));
+}
+
+/**
+ * Makes room for the signed bytes in the scratch buffer
+ */
+static uint8_t *reserve_scratch(verifier *verifier, size_t size) {
+  if (size > verifier->scratch_capacity) {
+    uint8_t *scratch = (uint8_t *)realloc(verifier->scratch, size);
+    if (scratch == NULL) {
+      return NULL;
+    }
+    verifier->scratch = scratch;
+    verifier->scratch_capacity = size;
+  }
+  return verifier->scratch;
+}
+
+/**
+ * Reads a definite length byte string
+ *
+ * \param data encoded data
+ * \param size size of the data
+ * \param position in: start of the byte string, out: first byte after it
+ * \param content out start of the content of the byte string
+ * \param content_size out size of the content
+ * \returns false if the data at position is not a complete byte string
+ */
+static bool read_bytes(const uint8_t *data, size_t size, size_t *position,
+                       const uint8_t **content, size_t *content_size) {
+  size_t at = *position;
+  if (at >= size || (data[at] & 0xe0) != CBOR_BYTES_MAJOR_TYPE) {
+    return false;
+  }
+
+  uint8_t info = data[at++] & 0x1f;
+  uint64_t length = info;
+  if (info >= 24) {
+    if (info > 27) {
+      return false;
+    }
+    size_t length_size = (size_t)1 << (info - 24);
+    if (size - at < length_size) {
+      return false;
+    }
+    length = 0;
+    for (size_t i = 0; i < length_size; i++) {
+      length = (length << 8) | data[at++];
+    }
+  }
+
+  if (size - at < length) {
+    return false;
+  }
+  *content = data + at;
+  *content_size = (size_t)length;
+  *position = at + (size_t)length;
+  return true;
+}
+
+static bool check_signature(const uint8_t *signature,
+                            const uint8_t *signed_data, size_t signed_size,
+                            const verifier_key *key) {
+  switch (key->algorithm) {
+  case SIGNING_ALGORITHM_ED25519:
+    return crypto_sign_verify_detached(signature, signed_data, signed_size,
+                                       key->public_key) == 0;
+  case SIGNING_ALGORITHM_ED25519PH: {
+    crypto_sign_state state;
+    crypto_sign_init(&state);
+    crypto_sign_update(&state, signed_data, signed_size);
+    return crypto_sign_final_verify(&state, signature, key->public_key) == 0;
+  }
+  case SIGNING_ALGORITHM_BLAKE2B_MAC: {
+    uint8_t mac[SIGNING_CONTEXT_SIGNATURE_BYTES];
+    signing_context_mac(key->mac_key, signed_data, signed_size, mac);
+    return sodium_memcmp(mac, signature, sizeof(mac)) == 0;
+  }
+  default:
+    return false;
+  }
+}
+
+/**
+ * Locates the break closing an indefinite map
+ *
+ * \param end out offset of the break
+ * \returns false if the message is not an indefinite map
+ */
+static bool find_map_end(const uint8_t *message, size_t size, size_t *end) {
+  if (size < 2 || message[0] != CBOR_INDEFINITE_MAP_START ||
+      message[size - 1] != CBOR_BREAK) {
+    return false;
+  }
+  *end = size - 1;
+  return true;
+}
+
+/**
+ * Locates the last pair of a map when its key is one of the keys of the
+ * plugin and its value a byte string of a given size
+ *
+ * \param end offset of the break closing the map
+ * \param int_key encoded integer key
+ * \param text_key encoded text key
+ * \param text_key_size size of the encoded text key
+ * \param value_size size of the byte string, from 24 to 255 bytes
+ * \param prefix_size out size of the map before the key
+ * \param value out start of the content of the byte string
+ * \returns false if the map does not end with such a pair
+ */
+static bool find_closing_pair(const uint8_t *message, size_t end,
+                              uint8_t int_key, const uint8_t *text_key,
+                              size_t text_key_size, uint8_t value_size,
+                              size_t *prefix_size, const uint8_t **value) {
+  size_t trailer_size = CLOSING_BYTES_HEAD_SIZE + value_size;
+  if (end < 2 + trailer_size) {
+    return false;
+  }
+
+  size_t key_end = end - trailer_size;
+  if (message[key_end] != CBOR_BYTES_UINT8_LENGTH ||
+      message[key_end + 1] != value_size) {
+    return false;
+  }
+
+  if (message[key_end - 1] == int_key) {
+    *prefix_size = key_end - 1;
+  } else if (key_end >= 1 + text_key_size &&
+             memcmp(message + key_end - text_key_size, text_key,
+                    text_key_size) == 0) {
+    *prefix_size = key_end - text_key_size;
+  } else {
+    return false;
+  }
+
+  *value = message + key_end + CLOSING_BYTES_HEAD_SIZE;
+  return true;
+}
+
+/**
+ * Locates the signature pair closing a signed map
+ *
+ * \param end offset of the break closing the map
+ * \param prefix_size out size of the map before the signature key
+ * \param signature out start of the signature
+ * \returns false if the map does not end with a signature pair
+ */
+static bool find_map_signature(const uint8_t *message, size_t end,
+                               size_t *prefix_size,
+                               const uint8_t **signature) {
+  return find_closing_pair(message, end, SIGNATURE_INT_KEY[0],
+                           SIGNATURE_TEXT_KEY, sizeof(SIGNATURE_TEXT_KEY),
+                           crypto_sign_BYTES, prefix_size, signature);
+}
+
+/**
+ * Locates the countersignature pair closing a countersigned map
+ *
+ * \param end offset of the break closing the map
+ * \param prefix_size out size of the map before the countersignature key,
+ * which is the countersigned map without its break
+ * \param countersignature out start of the packed countersignature
+ * \returns false if the map does not end with a countersignature pair
+ */
+static bool find_map_countersignature(const uint8_t *message, size_t end,
+                                      size_t *prefix_size,
+                                      const uint8_t **countersignature) {
+  return find_closing_pair(
+      message, end, COUNTERSIGNATURE_INT_KEY[0], COUNTERSIGNATURE_TEXT_KEY,
+      sizeof(COUNTERSIGNATURE_TEXT_KEY), DETACHED_SIGNATURE_PACKED_BYTES,
+      prefix_size, countersignature);
+}
+
+bool verifier_is_signed_map(const uint8_t *message, size_t size) {
+  size_t end = 0;
+  size_t prefix_size = 0;
+  const uint8_t *value = NULL;
+  return message != NULL && find_map_end(message, size, &end) &&
+         (find_map_signature(message, end, &prefix_size, &value) ||
+          find_map_countersignature(message, end, &prefix_size, &value));
+}
+
+/**
+ * Locates the key id pair right before the signature pair of a map. Maps
+ * signed before key ids were added have none.
+ *
+ * \param prefix_size size of the map before the signature key
+ * \returns the key id, null if the map has none
+ */
+static const uint8_t *find_map_key_id(const uint8_t *message,
+                                      size_t prefix_size) {
+  size_t value_size = sizeof(KEY_ID_HEAD) + SIGNING_KEY_ID_BYTES;
+  if (prefix_size < 1 + sizeof(KEY_ID_INT_KEY) + value_size) {
+    return NULL;
+  }
+
+  size_t value_start = prefix_size - value_size;
+  if (memcmp(message + value_start, KEY_ID_HEAD, sizeof(KEY_ID_HEAD)) != 0) {
+    return NULL;
+  }
+
+  if (message[value_start - 1] == KEY_ID_INT_KEY[0] ||
+      (value_start >= 1 + sizeof(KEY_ID_TEXT_KEY) &&
+       memcmp(message + value_start - sizeof(KEY_ID_TEXT_KEY),
+              KEY_ID_TEXT_KEY, sizeof(KEY_ID_TEXT_KEY)) == 0)) {
+    return message + value_start + sizeof(KEY_ID_HEAD);
+  }
+  return NULL;
+}
+
+/**
+ * Parsed COSE_Sign1 message written by the plugin
+ */
+typedef struct {
+  const uint8_t *key_id;
+  size_t key_id_size;
+
+  /** Payload byte string, with its head */
+  const uint8_t *payload_item;
+  size_t payload_item_size;
+
+  const uint8_t *signature;
+} cose_sign1;
+
+static bool parse_cose_sign1(const uint8_t *message, size_t size,
+                             cose_sign1 *cose) {
+  const uint8_t *payload = NULL;
+  size_t payload_size = 0;
+  size_t signature_size = 0;
+
+  size_t position = 2 + sizeof(COSE_PROTECTED_HEADER);
+  if (size < position + 2 || message[0] != COSE_SIGN1_TAG ||
+      message[1] != CBOR_ARRAY_FOUR_ITEMS ||
+      memcmp(message + 2, COSE_PROTECTED_HEADER,
+             sizeof(COSE_PROTECTED_HEADER)) != 0 ||
+      message[position] != CBOR_MAP_ONE_PAIR ||
+      message[position + 1] != COSE_HEADER_KID) {
+    return false;
+  }
+  position += 2;
+
+  if (!read_bytes(message, size, &position, &cose->key_id,
+                  &cose->key_id_size)) {
+    return false;
+  }
+
+  size_t payload_start = position;
+  if (!read_bytes(message, size, &position, &payload, &payload_size)) {
+    return false;
+  }
+  cose->payload_item = message + payload_start;
+  cose->payload_item_size = position - payload_start;
+
+  return read_bytes(message, size, &position, &cose->signature,
+                    &signature_size) &&
+         signature_size == crypto_sign_BYTES && position == size;
+}
+
+bool verifier_message_key_id(const uint8_t *message, size_t size,
+                             uint8_t *key_id) {
+  const uint8_t *found = NULL;
+  size_t prefix_size = 0;
+  const uint8_t *signature = NULL;
+  cose_sign1 cose;
+
+  size_t end = 0;
+  if (find_map_end(message, size, &end) &&
+      find_map_signature(message, end, &prefix_size, &signature)) {
+    found = find_map_key_id(message, prefix_size);
+  } else if (parse_cose_sign1(message, size, &cose) &&
+             cose.key_id_size == SIGNING_KEY_ID_BYTES) {
+    found = cose.key_id;
+  }
+
+  if (found == NULL) {
+    return false;
+  }
+  memcpy(key_id, found, SIGNING_KEY_ID_BYTES);
+  return true;
+}
+
+/**
+ * Checks a signature with the keys having the given key id
+ */
+static verify_result verify_with_key_id(const verifier *verifier,
+                                        const uint8_t *key_id,
+                                        const uint8_t *signature,
+                                        const uint8_t *signed_data,
+                                        size_t signed_size) {
+  const verifier_key_cache *cache = verifier->cache;
+  const verifier_key *key = verifier_key_cache_find(cache, key_id);
+  if (key == NULL) {
+    return VERIFY_UNKNOWN_KEY;
+  }
+
+  // Several certificates can share a key id, they are next to each other
+  while (key > cache->keys &&
+         memcmp(key[-1].key_id, key_id, SIGNING_KEY_ID_BYTES) == 0) {
+    key--;
+  }
+  for (; key < cache->keys + cache->count &&
+         memcmp(key->key_id, key_id, SIGNING_KEY_ID_BYTES) == 0;
+       key++) {
+    if (check_signature(signature, signed_data, signed_size, key)) {
+      return VERIFY_OK;
+    }
+  }
+  return VERIFY_BAD_SIGNATURE;
+}
+
+/**
+ * Checks a detached signature or a countersignature against the bytes it
+ * covers, assembled in the scratch buffer
+ */
+static verify_result verify_input(verifier *verifier,
+                                  const detached_signature_input *input,
+                                  const detached_signature *signature) {
+  size_t signed_size = 0;
+  for (size_t i = 0; i < DETACHED_SIGNATURE_PARTS; i++) {
+    signed_size += input->parts[i].size;
+  }
+  uint8_t *signed_data = reserve_scratch(verifier, signed_size);
+  if (signed_data == NULL) {
+    return VERIFY_NO_MEMORY;
+  }
+
+  // ED25519 verification hashes the signed bytes twice, they are assembled
+  // once
+  size_t position = 0;
+  for (size_t i = 0; i < DETACHED_SIGNATURE_PARTS; i++) {
+    if (input->parts[i].size > 0) {
+      memcpy(signed_data + position, input->parts[i].data,
+             input->parts[i].size);
+    }
+    position += input->parts[i].size;
+  }
+
+  return verify_with_key_id(verifier, signature->key_id,
+                            signature->signature, signed_data, signed_size);
+}
+
+/**
+ * Verifies a map closed by the signature pair, or by a countersignature pair
+ * in which case both the countersignature and the countersigned map are
+ * verified. The signed bytes are the map up to the signature key, closed by a
+ * break.
+ *
+ * \param end offset of the break closing the map, which is only implied for
+ * a countersigned map
+ */
+static verify_result verify_map(verifier *verifier, const uint8_t *message,
+                                size_t end) {
+  size_t prefix_size = 0;
+  const uint8_t *countersignature = NULL;
+  if (find_map_countersignature(message, end, &prefix_size,
+                                &countersignature)) {
+    detached_signature signature;
+    detached_signature_unpack(&signature, countersignature,
+                              DETACHED_SIGNATURE_PACKED_BYTES);
+    detached_signature_input input;
+    detached_signature_countersign_input_init(&input, &signature, message,
+                                              prefix_size);
+    verify_result result = verify_input(verifier, &input, &signature);
+    return result == VERIFY_OK ? verify_map(verifier, message, prefix_size)
+                               : result;
+  }
+
+  const uint8_t *signature = NULL;
+  if (!find_map_signature(message, end, &prefix_size, &signature)) {
+    return VERIFY_MALFORMED;
+  }
+
+  uint8_t *signed_data = reserve_scratch(verifier, prefix_size + 1);
+  if (signed_data == NULL) {
+    return VERIFY_NO_MEMORY;
+  }
+  memcpy(signed_data, message, prefix_size);
+  signed_data[prefix_size] = CBOR_BREAK;
+
+  const uint8_t *key_id = find_map_key_id(message, prefix_size);
+  if (key_id != NULL) {
+    return verify_with_key_id(verifier, key_id, signature, signed_data,
+                              prefix_size + 1);
+  }
+
+  // Without key id, start with the key of the previous message
+  const verifier_key_cache *cache = verifier->cache;
+  if (verifier->last_key < cache->count &&
+      check_signature(signature, signed_data, prefix_size + 1,
+                      &cache->keys[verifier->last_key])) {
+    return VERIFY_OK;
+  }
+  for (size_t i = 0; i < cache->count; i++) {
+    if (i != verifier->last_key &&
+        check_signature(signature, signed_data, prefix_size + 1,
+                        &cache->keys[i])) {
+      verifier->last_key = i;
+      return VERIFY_OK;
+    }
+  }
+  return VERIFY_BAD_SIGNATURE;
+}
+
+/**
+ * Verifies a COSE_Sign1 message with the key named by its key id
+ */
+static verify_result verify_cose_sign1(verifier *verifier,
+                                       const uint8_t *message, size_t size) {
+  cose_sign1 cose;
+  if (!parse_cose_sign1(message, size, &cose)) {
+    return VERIFY_MALFORMED;
+  }
+
+  if (cose.key_id_size != SIGNING_KEY_ID_BYTES) {
+    return VERIFY_UNKNOWN_KEY;
+  }
+
+  // Sig_structure: ["Signature1", protected, external_aad, payload]
+  size_t signed_size =
+      sizeof(COSE_SIG_STRUCTURE_PREFIX) + cose.payload_item_size;
+  uint8_t *signed_data = reserve_scratch(verifier, signed_size);
+  if (signed_data == NULL) {
+    return VERIFY_NO_MEMORY;
+  }
+  memcpy(signed_data, COSE_SIG_STRUCTURE_PREFIX,
+         sizeof(COSE_SIG_STRUCTURE_PREFIX));
+  memcpy(signed_data + sizeof(COSE_SIG_STRUCTURE_PREFIX), cose.payload_item,
+         cose.payload_item_size);
+
+  return verify_with_key_id(verifier, cose.key_id, cose.signature,
+                            signed_data, signed_size);
+}
+
+verify_result verifier_verify(verifier *verifier, const uint8_t *message,
+                              size_t size) {
+  if (message == NULL || size == 0) {
+    return VERIFY_MALFORMED;
+  }
+
+  size_t end = 0;
+  switch (message[0]) {
+  case CBOR_INDEFINITE_MAP_START:
+    if (!find_map_end(message, size, &end)) {
+      return VERIFY_MALFORMED;
+    }
+    return verify_map(verifier, message, end);
+  case COSE_SIGN1_TAG:
+    return verify_cose_sign1(verifier, message, size);
+  default:
+    return VERIFY_MALFORMED;
+  }
+}
+
+verify_result verifier_verify_detached(verifier *verifier, const char *topic,
+                                       const uint8_t *payload, size_t size,
+                                       const detached_signature *signature) {
+  if (topic == NULL || (payload == NULL && size > 0) ||
+      !detached_signature_is_complete(signature)) {
+    return VERIFY_MALFORMED;
+  }
+
+  detached_signature_input input;
+  detached_signature_input_init(&input, topic, signature, payload, size);
+  return verify_input(verifier, &input, signature);
+}
+
+/**
+ * Messages left to a worker, [begin, end). The owner takes chunks from the
+ * front, other workers steal half of the range from the back.
+ */
+typedef struct {
+  pthread_mutex_t lock;
+  size_t begin;
+  size_t end;
+} work_range;
+
+typedef struct {
+  const verifier_key_cache *cache;
+  const verifier_message *messages;
+  verify_result *results;
+  work_range *ranges;
+  size_t worker_count;
+} work_pool;
+
+typedef struct {
+  work_pool *pool;
+  size_t index;
+} worker;
+
+/**
+ * Takes the next chunk of the worker's own range
+ */
+static bool take_chunk(work_range *range, size_t *begin, size_t *end) {
+  pthread_mutex_lock(&range->lock);
+  *begin = range->begin;
+  *end = range->end - range->begin > WORK_CHUNK_SIZE
+             ? range->begin + WORK_CHUNK_SIZE
+             : range->end;
+  range->begin = *end;
+  pthread_mutex_unlock(&range->lock);
+  return *begin < *end;
+}
+
+/**
+ * Moves the back half of the largest range of the other workers to the range
+ * of a worker
+ */
+static bool steal(work_pool *pool, size_t thief) {
+  for (;;) {
+    size_t victim = pool->worker_count;
+    size_t largest = 0;
+    for (size_t i = 0; i < pool->worker_count; i++) {
+      if (i == thief) {
+        continue;
+      }
+      pthread_mutex_lock(&pool->ranges[i].lock);
+      size_t left = pool->ranges[i].end - pool->ranges[i].begin;
+      pthread_mutex_unlock(&pool->ranges[i].lock);
+      if (left > largest) {
+        largest = left;
+        victim = i;
+      }
+    }
+    if (victim == pool->worker_count) {
+      return false;
+    }
+
+    work_range *range = &pool->ranges[victim];
+    size_t begin = 0;
+    size_t end = 0;
+    pthread_mutex_lock(&range->lock);
+    size_t left = range->end - range->begin;
+    if (left > 0) {
+      end = range->end;
+      begin = range->end - (left + 1) / 2;
+      range->end = begin;
+    }
+    pthread_mutex_unlock(&range->lock);
+
+    // The victim may have finished in the meantime, look again
+    if (begin < end) {
+      work_range *own = &pool->ranges[thief];
+      pthread_mutex_lock(&own->lock);
+      own->begin = begin;
+      own->end = end;
+      pthread_mutex_unlock(&own->lock);
+      return true;
+    }
+  }
+}
+
+static void *run_worker(void *arg) {
+  worker *self = (worker *)arg;
+  work_pool *pool = self->pool;
+  verifier verifier;
+  size_t begin = 0;
+  size_t end = 0;
+
+  verifier_init(&verifier, pool->cache);
+  do {
+    while (take_chunk(&pool->ranges[self->index], &begin, &end)) {
+      for (size_t i = begin; i < end; i++) {
+        pool->results[i] = verifier_verify(&verifier, pool->messages[i].data,
+                                           pool->messages[i].size);
+      }
+    }
+  } while (steal(pool, self->index));
+  verifier_destroy(&verifier);
+
+  return NULL;
+}
+
+error_code verifier_verify_all(const verifier_key_cache *cache,
+                               const verifier_message *messages, size_t count,
+                               size_t threads, verify_result *results) {
+  if (cache == NULL || (count > 0 && (messages == NULL || results == NULL)) ||
+      threads == 0) {
+    return ERROR_INVALID_ARGUMENT;
+  }
+
+  if (threads > count) {
+    threads = count > 0 ? count : 1;
+  }
+
+  work_pool pool = {.cache = cache,
+                    .messages = messages,
+                    .results = results,
+                    .worker_count = threads};
+  pool.ranges = (work_range *)calloc(threads, sizeof(work_range));
+  worker *workers = (worker *)calloc(threads, sizeof(worker));
+  pthread_t *ids = (pthread_t *)calloc(threads, sizeof(pthread_t));
+  if (pool.ranges == NULL || workers == NULL || ids == NULL) {
+    free(pool.ranges);
+    free(workers);
+    free(ids);
+    return ERROR_NO_MEMORY;
+  }
+
+  for (size_t i = 0; i < threads; i++) {
+    pthread_mutex_init(&pool.ranges[i].lock, NULL);
+    pool.ranges[i].begin = count * i / threads;
+    pool.ranges[i].end = count * (i + 1) / threads;
+    workers[i].pool = &pool;
+    workers[i].index = i;
+  }
+
+  // The calling thread is the first worker. Workers that could not be
+  // started leave their range to be stolen by the others.
+  size_t started = 1;
+  for (; started < threads; started++) {
+    if (pthread_create(&ids[started], NULL, run_worker, &workers[started]) !=
+        0) {
+      break;
+    }
+  }
+
+  run_worker(&workers[0]);
+  for (size_t i = 1; i < started; i++) {
+    pthread_join(ids[i], NULL);
+  }
+
+  for (size_t i = 0; i < threads; i++) {
+    pthread_mutex_destroy(&pool.ranges[i].lock);
+  }
+  free(pool.ranges);
+  free(workers);
+  free(ids);
+
+  return SUCCESS;
+}
+
+const char *verify_result_to_string(verify_result result) {
+  switch (result) {
+  case VERIFY_OK:
+    return "ok";
+  case VERIFY_MALFORMED:
+    return "malformed";
+  case VERIFY_UNKNOWN_KEY:
+    return "unknown key";
+  case VERIFY_BAD_SIGNATURE:
+    return "bad signature";
+  case VERIFY_NO_MEMORY:
+    return "out of memory";
+  default:
+    return "unknown";
+  }
+}
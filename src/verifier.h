@@ -0,0 +1,223 @@
+#pragma once
+#include "detached_signature.h"
+#include "error.h"
+#include "signing_key.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Public key of a stored certificate, or MAC key of a shared key file
+ */
+typedef struct {
+  uint8_t public_key[SIGNING_KEY_PUBLIC_BYTES];
+  uint8_t key_id[SIGNING_KEY_ID_BYTES];
+  uint64_t create_time_unix;
+  signing_algorithm algorithm;
+
+  /** Secret key of SIGNING_ALGORITHM_BLAKE2B_MAC keys, zero otherwise */
+  uint8_t mac_key[SIGNING_CONTEXT_MAC_KEY_BYTES];
+} verifier_key;
+
+/**
+ * In-memory cache of the public keys able to verify messages, sorted by key
+ * id once sealed. It is read-only after verifier_key_cache_seal and can be
+ * shared by every verifying thread.
+ */
+typedef struct {
+  verifier_key *keys;
+  size_t count;
+  size_t capacity;
+} verifier_key_cache;
+
+/**
+ * Outcome of the verification of a message
+ */
+typedef enum {
+  VERIFY_OK = 0,
+
+  /** Neither a signed map nor a COSE_Sign1 message written by the plugin */
+  VERIFY_MALFORMED,
+
+  /** The key id of the message is not in the cache */
+  VERIFY_UNKNOWN_KEY,
+
+  /** No key of the cache verifies the signature */
+  VERIFY_BAD_SIGNATURE,
+
+  /** The signed bytes could not be assembled */
+  VERIFY_NO_MEMORY,
+
+  VERIFY_RESULT_COUNT
+} verify_result;
+
+/**
+ * Verification state of a single thread
+ */
+typedef struct {
+  const verifier_key_cache *cache;
+
+  /** Key that verified the last signed map without key id, tried first for
+   * the next one since consecutive messages are usually signed by the same
+   * key */
+  size_t last_key;
+
+  /** Buffer where the signed bytes are assembled */
+  uint8_t *scratch;
+  size_t scratch_capacity;
+} verifier;
+
+/**
+ * Message to verify
+ */
+typedef struct {
+  const uint8_t *data;
+  size_t size;
+} verifier_message;
+
+/**
+ * Initializes an empty key cache
+ */
+void verifier_key_cache_init(verifier_key_cache *cache);
+
+/**
+ * Adds a public key to the cache
+ *
+ * \param cache key cache, not sealed yet
+ * \param public_key_hex hex encoded ED25519 public key
+ * \param create_time_unix creation time of the key in Unix seconds
+ * \param algorithm algorithm of the signatures made with the key
+ * \returns ERROR_INVALID_ARGUMENT if the key is not a hex encoded public key
+ * or the algorithm is the MAC, which cannot be verified with a public key,
+ * ERROR_NO_MEMORY if the cache cannot grow, SUCCESS otherwise
+ */
+error_code verifier_key_cache_add(verifier_key_cache *cache,
+                                  const char *public_key_hex,
+                                  uint64_t create_time_unix,
+                                  signing_algorithm algorithm);
+
+/**
+ * Adds a signing key to the cache with the algorithm of its context, which
+ * is how MAC keys are added
+ *
+ * \param cache key cache, not sealed yet
+ * \param key signing key, e.g. read from a shared key file
+ * \returns ERROR_NO_MEMORY if the cache cannot grow, SUCCESS otherwise
+ */
+error_code verifier_key_cache_add_signing_key(verifier_key_cache *cache,
+                                              const signing_key *key);
+
+/**
+ * Sorts the keys by key id and removes the duplicates, must be called once
+ * every key has been added
+ *
+ * \param cache key cache
+ */
+void verifier_key_cache_seal(verifier_key_cache *cache);
+
+/**
+ * Looks up a key by key id with a binary search
+ *
+ * \param cache sealed key cache
+ * \param key_id key id of SIGNING_KEY_ID_BYTES bytes
+ * \returns the key, null if it is not in the cache
+ */
+const verifier_key *verifier_key_cache_find(const verifier_key_cache *cache,
+                                            const uint8_t *key_id);
+
+/**
+ * Wipes and frees the keys of the cache
+ */
+void verifier_key_cache_destroy(verifier_key_cache *cache);
+
+/**
+ * Initializes the verification state of a thread
+ *
+ * \param verifier state to initialize
+ * \param cache sealed key cache
+ */
+void verifier_init(verifier *verifier, const verifier_key_cache *cache);
+
+/**
+ * Verifies a message written by the plugin in message sign mode: a map ending
+ * with the key id and signature pairs, with text or integer keys, or a
+ * COSE_Sign1 message. The signature of a map is checked against the exact
+ * bytes that were signed, the map up to the signature pair closed by a break,
+ * without decoding nor encoding the map again. Only the keys with the key id
+ * of the message are tried, every key for maps signed without key id.
+ * A map countersigned by another broker is valid when both its
+ * countersignature and the map it countersigns are.
+ *
+ * \param verifier verification state
+ * \param message encoded message
+ * \param size size of the message in bytes
+ * \returns VERIFY_OK if the signature is valid, the reason otherwise
+ */
+verify_result verifier_verify(verifier *verifier, const uint8_t *message,
+                              size_t size);
+
+/**
+ * Verifies a message signed with the properties envelope: its payload is
+ * untouched and its signature was read from its user properties with
+ * detached_signature_read_property. Only the keys with the key id of the
+ * signature are tried.
+ *
+ * \param verifier verification state
+ * \param topic topic of the message
+ * \param payload payload of the message
+ * \param size size of the payload in bytes
+ * \param signature complete signature of the message
+ * \returns VERIFY_OK if the signature is valid, the reason otherwise
+ */
+verify_result verifier_verify_detached(verifier *verifier, const char *topic,
+                                       const uint8_t *payload, size_t size,
+                                       const detached_signature *signature);
+
+/**
+ * Reads the key id of a message without verifying it
+ *
+ * \param message encoded message
+ * \param size size of the message in bytes
+ * \param key_id out key id of SIGNING_KEY_ID_BYTES bytes
+ * \returns false if the message carries no key id, or several as
+ * countersigned maps do
+ */
+bool verifier_message_key_id(const uint8_t *message, size_t size,
+                             uint8_t *key_id);
+
+/**
+ * Checks whether an encoded map ends with a signature or a countersignature
+ * pair of the plugin, with text or integer keys. Only the last bytes of the
+ * map are read, the map itself is neither validated nor verified.
+ *
+ * \param message encoded message
+ * \param size size of the message in bytes
+ * \returns true if the message looks like a signed map
+ */
+bool verifier_is_signed_map(const uint8_t *message, size_t size);
+
+/**
+ * Frees the verification state of a thread
+ */
+void verifier_destroy(verifier *verifier);
+
+/**
+ * Verifies messages on several threads. Every thread starts with an equal
+ * share of the messages and steals half of the work left by another thread
+ * when it is done with its own.
+ *
+ * \param cache sealed key cache
+ * \param messages messages to verify
+ * \param count number of messages
+ * \param threads number of threads, at least 1
+ * \param results out result of every message
+ * \returns ERROR_NO_MEMORY if the work could not be shared, SUCCESS otherwise
+ */
+error_code verifier_verify_all(const verifier_key_cache *cache,
+                               const verifier_message *messages, size_t count,
+                               size_t threads, verify_result *results);
+
+/**
+ * Returns a human readable description of a verification result
+ */
+const char *verify_result_to_string(verify_result result);
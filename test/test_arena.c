@@ -0,0 +1,163 @@
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <cmocka.h>
+
+#include <cbor.h>
+
+#include "arena.h"
+
+// Test that allocations are aligned and do not overlap
+static void test_arena_alloc(void **state) {
+  (void)state; // Unused
+
+  arena *a = arena_new(1024, 4096);
+  assert_non_null(a);
+
+  uint8_t *first = arena_alloc(a, 3);
+  uint8_t *second = arena_alloc(a, 5);
+  assert_non_null(first);
+  assert_non_null(second);
+  assert_int_equal((uintptr_t)first % _Alignof(max_align_t), 0);
+  assert_int_equal((uintptr_t)second % _Alignof(max_align_t), 0);
+  assert_true(second >= first + 3);
+
+  arena_destroy(a);
+}
+
+// Test that allocations bigger than a block are satisfied
+static void test_arena_alloc_grow(void **state) {
+  (void)state; // Unused
+
+  arena *a = arena_new(64, 4096);
+  assert_non_null(a);
+
+  uint8_t *big = arena_alloc(a, 1000);
+  assert_non_null(big);
+  memset(big, 0xab, 1000);
+
+  arena_destroy(a);
+}
+
+// Test that after a reset the retained block is reused
+static void test_arena_reset_reuses_memory(void **state) {
+  (void)state; // Unused
+
+  arena *a = arena_new(64, 4096);
+  assert_non_null(a);
+
+  // Force the arena to use more than one block
+  arena_alloc(a, 100);
+  arena_alloc(a, 100);
+  arena_reset(a);
+
+  uint8_t *first = arena_alloc(a, 100);
+  arena_alloc(a, 100);
+  arena_reset(a);
+
+  // Steady state: the same single block is used again
+  assert_ptr_equal(arena_alloc(a, 100), first);
+
+  arena_destroy(a);
+}
+
+// Test that a cycle bigger than the retained size does not prevent the
+// next cycles from reaching a steady state
+static void test_arena_reset_after_large_cycle(void **state) {
+  (void)state; // Unused
+
+  arena *a = arena_new(64, 4096);
+  assert_non_null(a);
+
+  arena_alloc(a, 10000);
+  arena_reset(a);
+
+  // Medium cycles spanning several blocks, then a single retained block
+  uint8_t *first = NULL;
+  for (int cycle = 0; cycle < 3; cycle++) {
+    uint8_t *ptr = arena_alloc(a, 100);
+    arena_alloc(a, 100);
+    arena_alloc(a, 100);
+    arena_reset(a);
+    if (cycle == 1) {
+      first = ptr;
+    } else if (cycle == 2) {
+      assert_ptr_equal(ptr, first);
+    }
+  }
+
+  arena_destroy(a);
+}
+
+// Test that the retained block is reused when the maximum retained size is
+// below the initial size
+static void test_arena_reset_small_max_retained(void **state) {
+  (void)state; // Unused
+
+  arena *a = arena_new(4096, 256);
+  assert_non_null(a);
+
+  arena_alloc(a, 100);
+  arena_reset(a);
+
+  uint8_t *first = arena_alloc(a, 100);
+  arena_reset(a);
+  assert_ptr_equal(arena_alloc(a, 100), first);
+  arena_reset(a);
+  assert_ptr_equal(arena_alloc(a, 100), first);
+
+  arena_destroy(a);
+}
+
+// Test that libcbor allocations go through the active arena
+static void test_arena_cbor_allocator(void **state) {
+  (void)state; // Unused
+
+  arena_register_cbor_allocator();
+
+  arena *a = arena_new(4096, 4096);
+  assert_non_null(a);
+
+  arena_activate(a);
+
+  cbor_item_t *map = cbor_new_indefinite_map();
+  for (int i = 0; i < 16; i++) {
+    cbor_map_add(map, (struct cbor_pair){.key = cbor_move(cbor_build_uint8(i)),
+                                         .value = cbor_move(cbor_build_uint8(i))});
+  }
+
+  unsigned char *buffer = NULL;
+  size_t buffer_size = 0;
+  size_t size = cbor_serialize_alloc(map, &buffer, &buffer_size);
+  assert_non_null(buffer);
+  assert_int_equal(size, 2 + 16 * 2);
+
+  arena_cbor_free(buffer);
+  cbor_decref(&map);
+
+  arena_activate(NULL);
+  arena_reset(a);
+  arena_destroy(a);
+
+  // Without an active arena the standard allocator is used
+  cbor_item_t *item = cbor_build_string("standard allocator");
+  assert_non_null(item);
+  cbor_decref(&item);
+}
+
+// Main function to run tests
+int main(void) {
+  const struct CMUnitTest tests[] = {
+      cmocka_unit_test(test_arena_alloc),
+      cmocka_unit_test(test_arena_alloc_grow),
+      cmocka_unit_test(test_arena_reset_reuses_memory),
+      cmocka_unit_test(test_arena_reset_after_large_cycle),
+      cmocka_unit_test(test_arena_reset_small_max_retained),
+      cmocka_unit_test(test_arena_cbor_allocator),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,329 @@
+#include <dirent.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cmocka.h>
+
+#include "audit_log.h"
+
+#define MAX_SEGMENTS 64
+
+typedef struct {
+  char directory[32];
+  char *paths[MAX_SEGMENTS];
+  size_t count;
+} segment_list;
+
+typedef struct {
+  uint64_t sequences[1024];
+  size_t count;
+} scan_result;
+
+static int compare_paths(const void *a, const void *b) {
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static audit_log *open_log(segment_list *segments, size_t segment_size,
+                           uint64_t segment_duration_ms) {
+  memset(segments, 0, sizeof(*segments));
+  strcpy(segments->directory, "test_audit_log_XXXXXX");
+  assert_non_null(mkdtemp(segments->directory));
+
+  audit_log_options options = {
+      .directory = segments->directory,
+      .segment_size = segment_size,
+      .segment_duration_ms = segment_duration_ms,
+      .flush_interval_ms = 10,
+  };
+  audit_log *log = audit_log_open(&options);
+  assert_non_null(log);
+  return log;
+}
+
+/**
+ * Lists the segment files of the directory, sorted by name
+ */
+static void list_segments(segment_list *segments) {
+  for (size_t i = 0; i < segments->count; i++) {
+    free(segments->paths[i]);
+  }
+  segments->count = 0;
+
+  DIR *dir = opendir(segments->directory);
+  assert_non_null(dir);
+  struct dirent *entry = NULL;
+  while ((entry = readdir(dir)) != NULL) {
+    if (strstr(entry->d_name, AUDIT_LOG_SEGMENT_EXTENSION) == NULL) {
+      continue;
+    }
+    assert_true(segments->count < MAX_SEGMENTS);
+    char *path = (char *)malloc(strlen(segments->directory) +
+                                strlen(entry->d_name) + 2);
+    assert_non_null(path);
+    sprintf(path, "%s/%s", segments->directory, entry->d_name);
+    segments->paths[segments->count++] = path;
+  }
+  closedir(dir);
+  qsort(segments->paths, segments->count, sizeof(char *), compare_paths);
+}
+
+static void remove_segments(segment_list *segments) {
+  list_segments(segments);
+  for (size_t i = 0; i < segments->count; i++) {
+    unlink(segments->paths[i]);
+    free(segments->paths[i]);
+  }
+  segments->count = 0;
+  rmdir(segments->directory);
+}
+
+static void *map_segment(const char *path, size_t *size) {
+  FILE *file = fopen(path, "r");
+  assert_non_null(file);
+
+  struct stat st;
+  assert_int_equal(fstat(fileno(file), &st), 0);
+  *size = (size_t)st.st_size;
+
+  void *data = mmap(NULL, *size, PROT_READ, MAP_SHARED, fileno(file), 0);
+  fclose(file);
+  assert_true(data != MAP_FAILED);
+  assert_true(audit_log_check(data, *size));
+  return data;
+}
+
+static void collect(const audit_record *record, void *userdata) {
+  scan_result *result = (scan_result *)userdata;
+  assert_true(result->count < sizeof(result->sequences) / sizeof(uint64_t));
+  result->sequences[result->count++] = record->sequence;
+}
+
+static int compare_first_sequences(const void *a, const void *b) {
+  uint64_t first_a = (*(const audit_log_header *const *)a)->first_sequence;
+  uint64_t first_b = (*(const audit_log_header *const *)b)->first_sequence;
+  return first_a < first_b ? -1 : first_a > first_b;
+}
+
+/**
+ * Scans every segment in the order of their first records, which may not be
+ * the order of their names when the writer had to create a segment itself
+ */
+static size_t scan_segments(segment_list *segments, uint64_t from_ns,
+                            uint64_t to_ns, scan_result *result) {
+  list_segments(segments);
+  void *data[MAX_SEGMENTS];
+  size_t sizes[MAX_SEGMENTS];
+  for (size_t i = 0; i < segments->count; i++) {
+    data[i] = map_segment(segments->paths[i], &sizes[i]);
+    assert_true(((const audit_log_header *)data[i])->record_count > 0);
+  }
+  qsort(data, segments->count, sizeof(void *), compare_first_sequences);
+
+  size_t reported = 0;
+  for (size_t i = 0; i < segments->count; i++) {
+    reported += audit_log_scan(data[i], from_ns, to_ns, collect, result);
+    munmap(data[i], sizes[i]);
+  }
+  return reported;
+}
+
+static void append(audit_log *log, uint64_t time_ns, size_t payload_size) {
+  static uint8_t payload[4096];
+  audit_record record = {
+      .time_ns = time_ns,
+      .topic = "tenant/1",
+      .topic_length = 8,
+      .payload = payload,
+      .payload_size = payload_size,
+  };
+  assert_int_equal(audit_log_append(log, &record), SUCCESS);
+}
+
+static void check_record(const audit_record *record, void *userdata) {
+  size_t *count = (size_t *)userdata;
+  assert_int_equal(record->time_ns, 2000);
+  assert_int_equal(record->sequence, 1);
+  assert_int_equal(record->topic_length, 3);
+  assert_memory_equal(record->topic, "a/b", 3);
+  assert_int_equal(record->payload_size, 2);
+  assert_memory_equal(record->payload, "\xca\xfe", 2);
+  assert_int_equal(record->signature_size, 3);
+  assert_memory_equal(record->signature, "sig", 3);
+  (*count)++;
+}
+
+// Test that appended records are read back
+static void test_audit_log_append_scan(void **state) {
+  (void)state; // Unused
+
+  segment_list segments;
+  audit_log *log = open_log(&segments, AUDIT_LOG_DEFAULT_SEGMENT_SIZE, 0);
+
+  append(log, 1000, 10);
+  audit_record record = {
+      .time_ns = 2000,
+      .topic = "a/b",
+      .topic_length = 3,
+      .payload = (const uint8_t *)"\xca\xfe",
+      .payload_size = 2,
+      .signature = (const uint8_t *)"sig",
+      .signature_size = 3,
+  };
+  assert_int_equal(audit_log_append(log, &record), SUCCESS);
+  append(log, 3000, 0);
+  audit_log_close(log);
+
+  list_segments(&segments);
+  assert_int_equal(segments.count, 1);
+  size_t size = 0;
+  void *data = map_segment(segments.paths[0], &size);
+
+  const audit_log_header *header = (const audit_log_header *)data;
+  assert_int_equal(header->record_count, 3);
+  assert_int_equal(header->start_time_ns, 1000);
+  assert_int_equal(header->first_sequence, 0);
+  assert_int_equal(header->sealed, 1);
+
+  size_t count = 0;
+  assert_int_equal(audit_log_scan(data, 1500, 2500, check_record, &count), 1);
+  assert_int_equal(count, 1);
+
+  scan_result result = {0};
+  assert_int_equal(audit_log_scan(data, 0, UINT64_MAX, collect, &result), 3);
+  assert_int_equal(result.sequences[2], 2);
+
+  munmap(data, size);
+  remove_segments(&segments);
+}
+
+// Test that full segments are replaced, with consecutive sequences
+static void test_audit_log_rotation_by_size(void **state) {
+  (void)state; // Unused
+
+  segment_list segments;
+  audit_log *log = open_log(&segments, 64 * 1024, 0);
+  for (uint64_t i = 0; i < 200; i++) {
+    append(log, 1000 + i, 1000);
+  }
+  audit_log_close(log);
+
+  scan_result result = {0};
+  assert_int_equal(scan_segments(&segments, 0, UINT64_MAX, &result), 200);
+  assert_true(segments.count >= 4);
+  for (size_t i = 0; i < result.count; i++) {
+    assert_int_equal(result.sequences[i], i);
+  }
+
+  for (size_t i = 0; i < segments.count; i++) {
+    size_t size = 0;
+    void *data = map_segment(segments.paths[i], &size);
+    assert_int_equal(((const audit_log_header *)data)->sealed, 1);
+    munmap(data, size);
+  }
+  remove_segments(&segments);
+}
+
+// Test that old segments are replaced
+static void test_audit_log_rotation_by_time(void **state) {
+  (void)state; // Unused
+
+  segment_list segments;
+  audit_log *log = open_log(&segments, 256 * 1024, 1000);
+  append(log, 1000000000u, 10);
+  append(log, 1500000000u, 10);
+  append(log, 2000000000u, 10);
+  append(log, 2100000000u, 10);
+  audit_log_close(log);
+
+  scan_result result = {0};
+  assert_int_equal(scan_segments(&segments, 0, UINT64_MAX, &result), 4);
+  assert_int_equal(segments.count, 2);
+
+  result.count = 0;
+  assert_int_equal(
+      scan_segments(&segments, 1900000000u, 2000000000u, &result), 1);
+  assert_int_equal(result.sequences[0], 2);
+  remove_segments(&segments);
+}
+
+// Test range scans over several blocks of the index, with a clock going
+// backwards once
+static void test_audit_log_index(void **state) {
+  (void)state; // Unused
+
+  segment_list segments;
+  audit_log *log = open_log(&segments, AUDIT_LOG_DEFAULT_SEGMENT_SIZE, 0);
+  for (uint64_t i = 0; i < 500; i++) {
+    append(log, i == 400 ? 5 : 1000 + i, 2000);
+  }
+
+  // Read while the segment is still written
+  list_segments(&segments);
+  for (size_t i = 0; i < segments.count; i++) {
+    size_t size = 0;
+    void *data = map_segment(segments.paths[i], &size);
+    const audit_log_header *header = (const audit_log_header *)data;
+    if (header->record_count > 0) {
+      assert_int_equal(header->record_count, 500);
+      assert_true(header->index_count > 10);
+      assert_int_equal(header->sealed, 0);
+
+      scan_result result = {0};
+      assert_int_equal(audit_log_scan(data, 1100, 1109, collect, &result), 10);
+      assert_int_equal(result.sequences[0], 100);
+      result.count = 0;
+      assert_int_equal(audit_log_scan(data, 0, 10, collect, &result), 1);
+      assert_int_equal(result.sequences[0], 400);
+    }
+    munmap(data, size);
+  }
+
+  audit_log_close(log);
+  remove_segments(&segments);
+}
+
+// Test that records bigger than a segment are dropped, and that empty
+// segments are removed
+static void test_audit_log_dropped(void **state) {
+  (void)state; // Unused
+
+  segment_list segments;
+  audit_log *log = open_log(&segments, 64 * 1024, 0);
+
+  static uint8_t payload[64 * 1024];
+  audit_record record = {
+      .time_ns = 1,
+      .topic = "a",
+      .topic_length = 1,
+      .payload = payload,
+      .payload_size = sizeof(payload),
+  };
+  assert_int_equal(audit_log_append(log, &record), ERROR_INVALID_ARGUMENT);
+  assert_int_equal(audit_log_dropped(log), 1);
+  audit_log_close(log);
+
+  list_segments(&segments);
+  assert_int_equal(segments.count, 0);
+  remove_segments(&segments);
+}
+
+// Main function to run tests
+int main(void) {
+  const struct CMUnitTest tests[] = {
+      cmocka_unit_test(test_audit_log_append_scan),
+      cmocka_unit_test(test_audit_log_rotation_by_size),
+      cmocka_unit_test(test_audit_log_rotation_by_time),
+      cmocka_unit_test(test_audit_log_index),
+      cmocka_unit_test(test_audit_log_dropped),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
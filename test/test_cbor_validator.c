@@ -0,0 +1,195 @@
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <cmocka.h>
+
+#include "cbor_validator.h"
+
+// Test a valid indefinite map with nested items
+static void test_cbor_validate_indefinite_map_success(void **state) {
+  (void)state; // Unused
+
+  // {_ "a": [1, -1], "b": {_ "c": h'00'}, "d": 1(0)}
+  const uint8_t payload[] = {0xbf, 0x61, 0x61, 0x82, 0x01, 0x20, 0x61,
+                             0x62, 0xbf, 0x61, 0x63, 0x41, 0x00, 0xff,
+                             0x61, 0x64, 0xc1, 0x00, 0xff};
+
+  cbor_validation_result result =
+      cbor_validate_indefinite_map(payload, sizeof(payload), NULL);
+
+  assert_int_equal(result, CBOR_VALIDATION_OK);
+}
+
+// Test a valid indefinite map with an indefinite string value
+static void test_cbor_validate_indefinite_map_chunked_string(void **state) {
+  (void)state; // Unused
+
+  // {_ "a": (_ "b", "c")}
+  const uint8_t payload[] = {0xbf, 0x61, 0x61, 0x7f, 0x61,
+                             0x62, 0x61, 0x63, 0xff, 0xff};
+
+  cbor_validation_result result =
+      cbor_validate_indefinite_map(payload, sizeof(payload), NULL);
+
+  assert_int_equal(result, CBOR_VALIDATION_OK);
+}
+
+// Test when the payload is empty
+static void test_cbor_validate_indefinite_map_empty(void **state) {
+  (void)state; // Unused
+
+  const uint8_t payload[] = {0x00};
+
+  cbor_validation_result result =
+      cbor_validate_indefinite_map(payload, 0, NULL);
+
+  assert_int_equal(result, CBOR_VALIDATION_MALFORMED);
+}
+
+// Test when the top level item is a definite map
+static void test_cbor_validate_indefinite_map_definite(void **state) {
+  (void)state; // Unused
+
+  // {"a": 1}
+  const uint8_t payload[] = {0xa1, 0x61, 0x61, 0x01};
+
+  cbor_validation_result result =
+      cbor_validate_indefinite_map(payload, sizeof(payload), NULL);
+
+  assert_int_equal(result, CBOR_VALIDATION_NOT_INDEFINITE_MAP);
+}
+
+// Test when the payload is truncated
+static void test_cbor_validate_indefinite_map_truncated(void **state) {
+  (void)state; // Unused
+
+  // {_ "a": 1 without the closing break
+  const uint8_t payload[] = {0xbf, 0x61, 0x61, 0x01};
+
+  cbor_validation_result result =
+      cbor_validate_indefinite_map(payload, sizeof(payload), NULL);
+
+  assert_int_equal(result, CBOR_VALIDATION_MALFORMED);
+}
+
+// Test when a map key has no value
+static void test_cbor_validate_indefinite_map_odd_items(void **state) {
+  (void)state; // Unused
+
+  // {_ "a"}
+  const uint8_t payload[] = {0xbf, 0x61, 0x61, 0xff};
+
+  cbor_validation_result result =
+      cbor_validate_indefinite_map(payload, sizeof(payload), NULL);
+
+  assert_int_equal(result, CBOR_VALIDATION_MALFORMED);
+}
+
+// Test when bytes follow the top level map
+static void test_cbor_validate_indefinite_map_trailing_data(void **state) {
+  (void)state; // Unused
+
+  const uint8_t payload[] = {0xbf, 0x61, 0x61, 0x01, 0xff, 0x01};
+
+  cbor_validation_result result =
+      cbor_validate_indefinite_map(payload, sizeof(payload), NULL);
+
+  assert_int_equal(result, CBOR_VALIDATION_TRAILING_DATA);
+}
+
+// Test the payload size limit
+static void test_cbor_validate_indefinite_map_too_large(void **state) {
+  (void)state; // Unused
+
+  const uint8_t payload[] = {0xbf, 0x61, 0x61, 0x01, 0xff};
+  cbor_validator_limits limits = CBOR_VALIDATOR_DEFAULT_LIMITS;
+  limits.max_payload_size = sizeof(payload) - 1;
+
+  cbor_validation_result result =
+      cbor_validate_indefinite_map(payload, sizeof(payload), &limits);
+
+  assert_int_equal(result, CBOR_VALIDATION_TOO_LARGE);
+}
+
+// Test the nesting depth limit
+static void test_cbor_validate_indefinite_map_too_deep(void **state) {
+  (void)state; // Unused
+
+  // {_ "a": [[1]]}
+  const uint8_t payload[] = {0xbf, 0x61, 0x61, 0x81, 0x81, 0x01, 0xff};
+  cbor_validator_limits limits = CBOR_VALIDATOR_DEFAULT_LIMITS;
+
+  limits.max_depth = 3;
+  assert_int_equal(
+      cbor_validate_indefinite_map(payload, sizeof(payload), &limits),
+      CBOR_VALIDATION_OK);
+
+  limits.max_depth = 2;
+  assert_int_equal(
+      cbor_validate_indefinite_map(payload, sizeof(payload), &limits),
+      CBOR_VALIDATION_TOO_DEEP);
+}
+
+// Test the item count limit
+static void test_cbor_validate_indefinite_map_too_many_items(void **state) {
+  (void)state; // Unused
+
+  // {_ "a": 1, "b": 2}
+  const uint8_t payload[] = {0xbf, 0x61, 0x61, 0x01, 0x61, 0x62, 0x02, 0xff};
+  cbor_validator_limits limits = CBOR_VALIDATOR_DEFAULT_LIMITS;
+
+  limits.max_items = 5;
+  assert_int_equal(
+      cbor_validate_indefinite_map(payload, sizeof(payload), &limits),
+      CBOR_VALIDATION_OK);
+
+  limits.max_items = 4;
+  assert_int_equal(
+      cbor_validate_indefinite_map(payload, sizeof(payload), &limits),
+      CBOR_VALIDATION_TOO_MANY_ITEMS);
+}
+
+// Test splitting a CBOR sequence into its items
+static void test_cbor_validate_item_sequence(void **state) {
+  (void)state; // Unused
+
+  // {_ "a": 1}, 18([h'', {}, h'', h'']), then a truncated map
+  const uint8_t sequence[] = {0xbf, 0x61, 0x61, 0x01, 0xff, 0xd2, 0x84,
+                              0x40, 0xa0, 0x40, 0x40, 0xbf, 0x61};
+  size_t item_size = 0;
+
+  assert_int_equal(
+      cbor_validate_item(sequence, sizeof(sequence), NULL, &item_size),
+      CBOR_VALIDATION_OK);
+  assert_int_equal(item_size, 5);
+
+  assert_int_equal(cbor_validate_item(sequence + 5, sizeof(sequence) - 5,
+                                      NULL, &item_size),
+                   CBOR_VALIDATION_OK);
+  assert_int_equal(item_size, 6);
+
+  assert_int_equal(cbor_validate_item(sequence + 11, sizeof(sequence) - 11,
+                                      NULL, &item_size),
+                   CBOR_VALIDATION_MALFORMED);
+}
+
+// Main function to run tests
+int main(void) {
+  const struct CMUnitTest tests[] = {
+      cmocka_unit_test(test_cbor_validate_indefinite_map_success),
+      cmocka_unit_test(test_cbor_validate_indefinite_map_chunked_string),
+      cmocka_unit_test(test_cbor_validate_indefinite_map_empty),
+      cmocka_unit_test(test_cbor_validate_indefinite_map_definite),
+      cmocka_unit_test(test_cbor_validate_indefinite_map_truncated),
+      cmocka_unit_test(test_cbor_validate_indefinite_map_odd_items),
+      cmocka_unit_test(test_cbor_validate_indefinite_map_trailing_data),
+      cmocka_unit_test(test_cbor_validate_indefinite_map_too_large),
+      cmocka_unit_test(test_cbor_validate_indefinite_map_too_deep),
+      cmocka_unit_test(test_cbor_validate_indefinite_map_too_many_items),
+      cmocka_unit_test(test_cbor_validate_item_sequence),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,146 @@
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cmocka.h>
+#include <sodium.h>
+
+#include "cbor_splice.h"
+#include "certificate_message.h"
+
+static uint8_t *encode(const certificate *cert, size_t *size) {
+  *size = certificate_message_size(cert);
+  uint8_t *message = (uint8_t *)malloc(*size);
+  assert_non_null(message);
+  assert_int_equal(certificate_message_encode(cert, message, *size), SUCCESS);
+  return message;
+}
+
+// Test that an encoded certificate is decoded back
+static void test_certificate_message_round_trip(void **state) {
+  (void)state; // Unused
+
+  signing_key *key = signing_key_generate();
+  assert_non_null(key);
+  certificate cert = {
+      .entity = "acme",
+      .create_time_unix = 1700000000,
+      .public_key = key->public_key_hex,
+      .algorithm = "ed25519ph",
+  };
+
+  size_t size = 0;
+  uint8_t *data = encode(&cert, &size);
+  assert_int_equal(data[0], 0xbf);
+  assert_int_equal(data[size - 1], 0xff);
+
+  certificate_message message;
+  assert_int_equal(certificate_message_decode(data, size, &message), SUCCESS);
+  assert_int_equal(message.entity_length, 4);
+  assert_memory_equal(message.entity, "acme", 4);
+  assert_int_equal(message.create_time_unix, 1700000000);
+  assert_memory_equal(message.public_key, key->public_key,
+                      SIGNING_KEY_PUBLIC_BYTES);
+  assert_memory_equal(message.key_id, key->key_id, SIGNING_KEY_ID_BYTES);
+  assert_int_equal(message.algorithm, SIGNING_ALGORITHM_ED25519PH);
+
+  free(data);
+  signing_key_destroy(key);
+}
+
+// Test that certificates without algorithm are ED25519 ones
+static void test_certificate_message_default_algorithm(void **state) {
+  (void)state; // Unused
+
+  signing_key *key = signing_key_generate();
+  assert_non_null(key);
+  certificate cert = {.entity = "", .public_key = key->public_key_hex};
+
+  size_t size = 0;
+  uint8_t *data = encode(&cert, &size);
+  certificate_message message;
+  assert_int_equal(certificate_message_decode(data, size, &message), SUCCESS);
+  assert_int_equal(message.entity_length, 0);
+  assert_int_equal(message.algorithm, SIGNING_ALGORITHM_ED25519);
+
+  free(data);
+  signing_key_destroy(key);
+}
+
+// Test that invalid certificates are not encoded
+static void test_certificate_message_invalid_certificate(void **state) {
+  (void)state; // Unused
+
+  uint8_t out[256];
+  certificate cert = {.entity = "acme", .public_key = "abcd"};
+  assert_int_equal(certificate_message_encode(&cert, out, sizeof(out)),
+                   ERROR_INVALID_ARGUMENT);
+
+  signing_key *key = signing_key_generate();
+  assert_non_null(key);
+  cert.public_key = key->public_key_hex;
+  cert.algorithm = "rsa";
+  assert_int_equal(certificate_message_encode(&cert, out, sizeof(out)),
+                   ERROR_INVALID_ARGUMENT);
+
+  cert.algorithm = NULL;
+  assert_int_equal(certificate_message_encode(&cert, out, 16),
+                   ERROR_NO_MEMORY);
+  signing_key_destroy(key);
+}
+
+// Test that truncated, extended and forged messages are refused
+static void test_certificate_message_malformed(void **state) {
+  (void)state; // Unused
+
+  signing_key *key = signing_key_generate();
+  assert_non_null(key);
+  certificate cert = {.entity = "acme", .public_key = key->public_key_hex};
+  size_t size = 0;
+  uint8_t *data = encode(&cert, &size);
+  certificate_message message;
+
+  for (size_t i = 0; i < size; i++) {
+    assert_int_equal(certificate_message_decode(data, i, &message),
+                     ERROR_INVALID_ARGUMENT);
+  }
+
+  uint8_t *extended = (uint8_t *)malloc(size + 1);
+  assert_non_null(extended);
+  memcpy(extended, data, size);
+  extended[size] = 0xff;
+  assert_int_equal(certificate_message_decode(extended, size + 1, &message),
+                   ERROR_INVALID_ARGUMENT);
+  free(extended);
+
+  // A key id that is not the one of the public key, the key id being the
+  // byte string before the "algorithm" pair
+  size_t key_id_offset = size - 1 - cbor_splice_string_size("algorithm") -
+                         cbor_splice_string_size("ed25519") -
+                         SIGNING_KEY_ID_BYTES;
+  data[key_id_offset] ^= 1;
+  assert_int_equal(certificate_message_decode(data, size, &message),
+                   ERROR_INVALID_ARGUMENT);
+
+  free(data);
+  signing_key_destroy(key);
+}
+
+// Main function to run tests
+int main(void) {
+  if (sodium_init() == -1) {
+    return 1;
+  }
+
+  const struct CMUnitTest tests[] = {
+      cmocka_unit_test(test_certificate_message_round_trip),
+      cmocka_unit_test(test_certificate_message_default_algorithm),
+      cmocka_unit_test(test_certificate_message_invalid_certificate),
+      cmocka_unit_test(test_certificate_message_malformed),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,379 @@
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <cmocka.h>
+
+#include "mosquitto_broker.h"
+#include <postgresql/libpq-fe.h>
+
+#include "certificate_repository.h"
+
+/*
+ * In memory replacement of libpq in pipeline mode: every statement sent
+ * succeeds, except the inserts of the failing public key, which abort the
+ * statements after them up to the next sync.
+ */
+struct pg_conn {
+  int unused;
+};
+
+struct pg_result {
+  ExecStatusType status;
+};
+
+#define MAX_RESULTS 1024
+
+static struct pg_conn connection;
+static struct pg_result results[MAX_RESULTS];
+static size_t result_head = 0;
+static size_t result_count = 0;
+static bool pipeline_aborted = false;
+
+/** Public key whose insert always fails, null when every insert succeeds */
+static const char *failing_public_key = NULL;
+
+/** Inserts sent since the last sync, and the number of inserts of the
+ * failing key that were not alone between two syncs */
+static size_t segment_inserts = 0;
+static bool segment_has_failing = false;
+static size_t failing_inserts = 0;
+static size_t failing_inserts_not_alone = 0;
+
+/** Public keys reported by the stored callback */
+static char stored[8][65];
+static size_t stored_count = 0;
+
+static void push_result(ExecStatusType status) {
+  assert_true(result_count < MAX_RESULTS);
+  results[(result_head + result_count++) % MAX_RESULTS].status = status;
+}
+
+void mosquitto_log_printf(int level, const char *fmt, ...) {
+  (void)level; // Unused
+  (void)fmt;   // Unused
+}
+
+PGconn *PQconnectStart(const char *conninfo) {
+  (void)conninfo; // Unused
+  result_count = 0;
+  pipeline_aborted = false;
+  return &connection;
+}
+
+PGconn *PQconnectdb(const char *conninfo) {
+  (void)conninfo; // Unused
+  return NULL;
+}
+
+ConnStatusType PQstatus(const PGconn *conn) {
+  return conn != NULL ? CONNECTION_OK : CONNECTION_BAD;
+}
+
+char *PQerrorMessage(const PGconn *conn) {
+  (void)conn; // Unused
+  return "";
+}
+
+void PQfinish(PGconn *conn) { (void)conn; }
+
+int PQsocket(const PGconn *conn) {
+  (void)conn; // Unused
+  return -1;
+}
+
+PostgresPollingStatusType PQconnectPoll(PGconn *conn) {
+  (void)conn; // Unused
+  return PGRES_POLLING_OK;
+}
+
+int PQsetnonblocking(PGconn *conn, int arg) {
+  (void)conn; // Unused
+  (void)arg;  // Unused
+  return 0;
+}
+
+int PQenterPipelineMode(PGconn *conn) {
+  (void)conn; // Unused
+  return 1;
+}
+
+int PQsendQueryParams(PGconn *conn, const char *command, int nParams,
+                      const Oid *paramTypes, const char *const *paramValues,
+                      const int *paramLengths, const int *paramFormats,
+                      int resultFormat) {
+  (void)conn;         // Unused
+  (void)command;      // Unused
+  (void)nParams;      // Unused
+  (void)paramTypes;   // Unused
+  (void)paramValues;  // Unused
+  (void)paramLengths; // Unused
+  (void)paramFormats; // Unused
+  (void)resultFormat; // Unused
+  push_result(PGRES_COMMAND_OK);
+  return 1;
+}
+
+int PQsendPrepare(PGconn *conn, const char *stmtName, const char *query,
+                  int nParams, const Oid *paramTypes) {
+  (void)conn;       // Unused
+  (void)stmtName;   // Unused
+  (void)query;      // Unused
+  (void)nParams;    // Unused
+  (void)paramTypes; // Unused
+  push_result(PGRES_COMMAND_OK);
+  return 1;
+}
+
+int PQsendQueryPrepared(PGconn *conn, const char *stmtName, int nParams,
+                        const char *const *paramValues,
+                        const int *paramLengths, const int *paramFormats,
+                        int resultFormat) {
+  (void)conn;         // Unused
+  (void)stmtName;     // Unused
+  (void)nParams;      // Unused
+  (void)paramFormats; // Unused
+  (void)resultFormat; // Unused
+
+  // The public key is the third parameter, not null terminated
+  bool failing = failing_public_key != NULL &&
+                 (size_t)paramLengths[2] == strlen(failing_public_key) &&
+                 memcmp(paramValues[2], failing_public_key,
+                        (size_t)paramLengths[2]) == 0;
+  segment_inserts++;
+  segment_has_failing = segment_has_failing || failing;
+
+  if (pipeline_aborted) {
+    push_result(PGRES_PIPELINE_ABORTED);
+  } else if (failing) {
+    push_result(PGRES_FATAL_ERROR);
+    pipeline_aborted = true;
+  } else {
+    push_result(PGRES_COMMAND_OK);
+  }
+  return 1;
+}
+
+int PQpipelineSync(PGconn *conn) {
+  (void)conn; // Unused
+  if (segment_has_failing) {
+    failing_inserts++;
+    if (segment_inserts > 1) {
+      failing_inserts_not_alone++;
+    }
+  }
+  segment_inserts = 0;
+  segment_has_failing = false;
+  pipeline_aborted = false;
+  push_result(PGRES_PIPELINE_SYNC);
+  return 1;
+}
+
+int PQconsumeInput(PGconn *conn) {
+  (void)conn; // Unused
+  return 1;
+}
+
+int PQisBusy(PGconn *conn) {
+  (void)conn; // Unused
+  return result_count == 0;
+}
+
+PGresult *PQgetResult(PGconn *conn) {
+  (void)conn; // Unused
+  if (result_count == 0) {
+    return NULL;
+  }
+  PGresult *result = &results[result_head];
+  result_head = (result_head + 1) % MAX_RESULTS;
+  result_count--;
+  return result;
+}
+
+ExecStatusType PQresultStatus(const PGresult *res) {
+  return res != NULL ? res->status : PGRES_FATAL_ERROR;
+}
+
+char *PQresultErrorMessage(const PGresult *res) {
+  (void)res; // Unused
+  return "check constraint violated";
+}
+
+void PQclear(PGresult *res) { (void)res; }
+
+int PQflush(PGconn *conn) {
+  (void)conn; // Unused
+  return 0;
+}
+
+PGresult *PQexecParams(PGconn *conn, const char *command, int nParams,
+                       const Oid *paramTypes, const char *const *paramValues,
+                       const int *paramLengths, const int *paramFormats,
+                       int resultFormat) {
+  (void)conn;         // Unused
+  (void)command;      // Unused
+  (void)nParams;      // Unused
+  (void)paramTypes;   // Unused
+  (void)paramValues;  // Unused
+  (void)paramLengths; // Unused
+  (void)paramFormats; // Unused
+  (void)resultFormat; // Unused
+  return NULL;
+}
+
+PGresult *PQprepare(PGconn *conn, const char *stmtName, const char *query,
+                    int nParams, const Oid *paramTypes) {
+  (void)conn;       // Unused
+  (void)stmtName;   // Unused
+  (void)query;      // Unused
+  (void)nParams;    // Unused
+  (void)paramTypes; // Unused
+  return NULL;
+}
+
+PGresult *PQexecPrepared(PGconn *conn, const char *stmtName, int nParams,
+                         const char *const *paramValues,
+                         const int *paramLengths, const int *paramFormats,
+                         int resultFormat) {
+  (void)conn;         // Unused
+  (void)stmtName;     // Unused
+  (void)nParams;      // Unused
+  (void)paramValues;  // Unused
+  (void)paramLengths; // Unused
+  (void)paramFormats; // Unused
+  (void)resultFormat; // Unused
+  return NULL;
+}
+
+int PQntuples(const PGresult *res) {
+  (void)res; // Unused
+  return 0;
+}
+
+char *PQgetvalue(const PGresult *res, int tup_num, int field_num) {
+  (void)res;       // Unused
+  (void)tup_num;   // Unused
+  (void)field_num; // Unused
+  return NULL;
+}
+
+static void certificate_stored(const certificate *cert, void *userdata) {
+  (void)userdata; // Unused
+  assert_true(stored_count < sizeof(stored) / sizeof(stored[0]));
+  strcpy(stored[stored_count++], cert->public_key);
+}
+
+static bool is_stored(const char *public_key) {
+  for (size_t i = 0; i < stored_count; i++) {
+    if (strcmp(stored[i], public_key) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static const char *PUBLIC_KEYS[] = {
+    "1111111111111111111111111111111111111111111111111111111111111111",
+    "2222222222222222222222222222222222222222222222222222222222222222",
+    "3333333333333333333333333333333333333333333333333333333333333333",
+};
+
+static certificate_repository *new_repository(void) {
+  certificate_repository_options options = {
+      .connection = "dbname=test",
+      .outbox_path = NULL,
+      .retry_initial_ms = 10,
+      .retry_max_ms = 40,
+      .timeout_ms = 0,
+      .stored_callback = certificate_stored,
+      .userdata = NULL,
+  };
+  stored_count = 0;
+  failing_inserts = 0;
+  failing_inserts_not_alone = 0;
+  return certificate_repository_new(&options);
+}
+
+static void add_certificates(certificate_repository *repo) {
+  certificate certs[3];
+  for (size_t i = 0; i < 3; i++) {
+    certs[i] = (certificate){
+        .entity = "tenant",
+        .create_time_unix = 1700000000 + i,
+        .public_key = PUBLIC_KEYS[i],
+        .algorithm = NULL,
+    };
+  }
+  assert_int_equal(certificate_repository_add_batch(repo, certs, 3), SUCCESS);
+}
+
+// Test that a batch is stored at once and every certificate is reported
+static void test_certificate_repository_stored(void **state) {
+  (void)state; // Unused
+
+  failing_public_key = NULL;
+  certificate_repository *repo = new_repository();
+  assert_non_null(repo);
+  add_certificates(repo);
+  assert_int_equal(certificate_repository_pending(repo), 3);
+
+  for (uint64_t now_ms = 0; now_ms < 3; now_ms++) {
+    certificate_repository_poll(repo, now_ms);
+  }
+  assert_int_equal(certificate_repository_pending(repo), 0);
+  assert_int_equal(stored_count, 3);
+  for (size_t i = 0; i < 3; i++) {
+    assert_string_equal(stored[i], PUBLIC_KEYS[i]);
+  }
+
+  certificate_repository_destroy(repo);
+}
+
+// Test that a certificate whose insert fails permanently is retried alone
+// and never reported as stored, while the others are stored
+static void test_certificate_repository_failing_insert(void **state) {
+  (void)state; // Unused
+
+  failing_public_key = PUBLIC_KEYS[1];
+  certificate_repository *repo = new_repository();
+  assert_non_null(repo);
+  add_certificates(repo);
+
+  for (uint64_t now_ms = 0; now_ms < 10000; now_ms++) {
+    certificate_repository_poll(repo, now_ms);
+  }
+  assert_int_equal(stored_count, 2);
+  assert_true(is_stored(PUBLIC_KEYS[0]));
+  assert_true(is_stored(PUBLIC_KEYS[2]));
+  assert_false(is_stored(PUBLIC_KEYS[1]));
+  assert_int_equal(certificate_repository_pending(repo), 1);
+
+  // Retried with a backoff delay of its own, alone after the first failure
+  assert_true(failing_inserts > 10);
+  assert_true(failing_inserts < 10000 / 40 + 10);
+  assert_int_equal(failing_inserts_not_alone, 1);
+
+  // Stored once the database accepts it
+  failing_public_key = NULL;
+  for (uint64_t now_ms = 10000; now_ms < 10100; now_ms++) {
+    certificate_repository_poll(repo, now_ms);
+  }
+  assert_int_equal(stored_count, 3);
+  assert_true(is_stored(PUBLIC_KEYS[1]));
+  assert_int_equal(certificate_repository_pending(repo), 0);
+
+  certificate_repository_destroy(repo);
+}
+
+// Main function to run tests
+int main(void) {
+  const struct CMUnitTest tests[] = {
+      cmocka_unit_test(test_certificate_repository_stored),
+      cmocka_unit_test(test_certificate_repository_failing_insert),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
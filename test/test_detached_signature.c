@@ -0,0 +1,210 @@
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <cmocka.h>
+
+#include "detached_signature.h"
+
+static size_t concatenate(const detached_signature_input *input,
+                          uint8_t *out) {
+  size_t size = 0;
+  for (size_t i = 0; i < DETACHED_SIGNATURE_PARTS; i++) {
+    if (input->parts[i].size > 0) {
+      memcpy(out + size, input->parts[i].data, input->parts[i].size);
+    }
+    size += input->parts[i].size;
+  }
+  return size;
+}
+
+// Test the encoding of the signed array
+static void test_detached_signature_input(void **state) {
+  (void)state; // Unused
+
+  static const uint8_t expected[] = {
+      // Array of 5 items, "message-sign detached", "t/1"
+      0x85, 0x75, 'm', 'e', 's', 's', 'a', 'g', 'e', '-', 's', 'i', 'g', 'n',
+      ' ', 'd', 'e', 't', 'a', 'c', 'h', 'e', 'd', 0x63, 't', '/', '1',
+      // Ingestion time 1234 on 64 bits
+      0x1b, 0, 0, 0, 0, 0, 0, 0x04, 0xd2,
+      // Key id
+      0x48, 1, 2, 3, 4, 5, 6, 7, 8,
+      // Payload
+      0x42, 0xca, 0xfe};
+  static const uint8_t payload[] = {0xca, 0xfe};
+
+  detached_signature signature = {.ingestion_time = 1234,
+                                  .key_id = {1, 2, 3, 4, 5, 6, 7, 8}};
+  detached_signature_input input;
+  detached_signature_input_init(&input, "t/1", &signature, payload,
+                                sizeof(payload));
+
+  uint8_t signed_data[sizeof(expected)];
+  assert_int_equal(concatenate(&input, signed_data), sizeof(expected));
+  assert_memory_equal(signed_data, expected, sizeof(expected));
+
+  // The topic and the payload are referenced, not copied
+  assert_ptr_equal(input.parts[3].data, payload);
+}
+
+// Test the encoding of the array signed by a countersignature, the map
+// being closed by a break of its own
+static void test_detached_signature_countersign_input(void **state) {
+  (void)state; // Unused
+
+  static const uint8_t expected[] = {
+      // Array of 4 items, "message-sign countersigned"
+      0x84, 0x78, 0x1a, 'm', 'e', 's', 's', 'a', 'g', 'e', '-', 's', 'i',
+      'g', 'n', ' ', 'c', 'o', 'u', 'n', 't', 'e', 'r', 's', 'i', 'g', 'n',
+      'e', 'd',
+      // Ingestion time 1234 on 64 bits
+      0x1b, 0, 0, 0, 0, 0, 0, 0x04, 0xd2,
+      // Key id
+      0x48, 1, 2, 3, 4, 5, 6, 7, 8,
+      // Map {_ "a": 1}
+      0x45, 0xbf, 0x61, 0x61, 0x01, 0xff};
+
+  // The map is followed by the countersignature key instead of its break
+  static const uint8_t countersigned[] = {0xbf, 0x61, 0x61, 0x01, 0x25};
+
+  detached_signature signature = {.ingestion_time = 1234,
+                                  .key_id = {1, 2, 3, 4, 5, 6, 7, 8}};
+  detached_signature_input input;
+  detached_signature_countersign_input_init(&input, &signature, countersigned,
+                                            sizeof(countersigned) - 1);
+
+  uint8_t signed_data[sizeof(expected)];
+  assert_int_equal(concatenate(&input, signed_data), sizeof(expected));
+  assert_memory_equal(signed_data, expected, sizeof(expected));
+  assert_ptr_equal(input.parts[2].data, countersigned);
+}
+
+// Test the heads of long topics and payloads
+static void test_detached_signature_input_lengths(void **state) {
+  (void)state; // Unused
+
+  static uint8_t payload[70000];
+  char topic[300];
+  memset(topic, 'a', sizeof(topic) - 1);
+  topic[sizeof(topic) - 1] = '\0';
+
+  detached_signature signature = {0};
+  detached_signature_input input;
+  detached_signature_input_init(&input, topic, &signature, payload,
+                                sizeof(payload));
+
+  // Text of 299 bytes: 0x79 and a 16 bits length
+  const signing_part *head = &input.parts[0];
+  assert_memory_equal(head->data + head->size - 3,
+                      ((const uint8_t[]){0x79, 0x01, 0x2b}), 3);
+
+  // Byte string of 70000 bytes: 0x5a and a 32 bits length
+  const signing_part *middle = &input.parts[2];
+  assert_memory_equal(middle->data + middle->size - 5,
+                      ((const uint8_t[]){0x5a, 0, 0x01, 0x11, 0x70}), 5);
+}
+
+// Test that formatted properties are read back
+static void test_detached_signature_properties(void **state) {
+  (void)state; // Unused
+
+  detached_signature signature = {.ingestion_time = UINT64_MAX};
+  for (size_t i = 0; i < SIGNING_KEY_ID_BYTES; i++) {
+    signature.key_id[i] = (uint8_t)(0xf0 + i);
+  }
+  for (size_t i = 0; i < SIGNING_CONTEXT_SIGNATURE_BYTES; i++) {
+    signature.signature[i] = (uint8_t)(3 * i);
+  }
+
+  char time[DETACHED_SIGNATURE_TIME_TEXT_SIZE];
+  char key_id[DETACHED_SIGNATURE_KEY_ID_TEXT_SIZE];
+  char token[DETACHED_SIGNATURE_TOKEN_TEXT_SIZE];
+  detached_signature_format(&signature, time, key_id, token);
+  assert_string_equal(time, "18446744073709551615");
+  assert_string_equal(key_id, "f0f1f2f3f4f5f6f7");
+  assert_int_equal(strlen(token), DETACHED_SIGNATURE_TOKEN_TEXT_SIZE - 1);
+
+  detached_signature read = {0};
+  assert_true(detached_signature_read_property(&read, "other", "value"));
+  assert_true(detached_signature_read_property(
+      &read, DETACHED_SIGNATURE_TIME_PROPERTY, time));
+  assert_true(detached_signature_read_property(
+      &read, DETACHED_SIGNATURE_KEY_ID_PROPERTY, key_id));
+  assert_false(detached_signature_is_complete(&read));
+  assert_true(detached_signature_read_property(
+      &read, DETACHED_SIGNATURE_TOKEN_PROPERTY, token));
+  assert_true(detached_signature_is_complete(&read));
+
+  assert_int_equal(read.ingestion_time, signature.ingestion_time);
+  assert_memory_equal(read.key_id, signature.key_id, SIGNING_KEY_ID_BYTES);
+  assert_memory_equal(read.signature, signature.signature,
+                      SIGNING_CONTEXT_SIGNATURE_BYTES);
+}
+
+// Test that invalid property values are refused
+static void test_detached_signature_invalid_properties(void **state) {
+  (void)state; // Unused
+
+  detached_signature read = {0};
+  const char *time = DETACHED_SIGNATURE_TIME_PROPERTY;
+  const char *key_id = DETACHED_SIGNATURE_KEY_ID_PROPERTY;
+  const char *token = DETACHED_SIGNATURE_TOKEN_PROPERTY;
+
+  assert_false(detached_signature_read_property(&read, time, ""));
+  assert_false(detached_signature_read_property(&read, time, "-1"));
+  assert_false(detached_signature_read_property(&read, time, "12a"));
+  assert_false(
+      detached_signature_read_property(&read, time, "18446744073709551616"));
+  assert_false(detached_signature_read_property(&read, key_id, "f0f1"));
+  assert_false(
+      detached_signature_read_property(&read, key_id, "f0f1f2f3f4f5f6fz"));
+  assert_false(
+      detached_signature_read_property(&read, key_id, "f0f1f2f3f4f5f6f7f8"));
+  assert_false(detached_signature_read_property(&read, token, "AAAA"));
+  assert_int_equal(read.present, 0);
+}
+
+// Test that packed signatures are unpacked back
+static void test_detached_signature_pack(void **state) {
+  (void)state; // Unused
+
+  detached_signature signature = {.ingestion_time = 0x0102030405060708u,
+                                  .key_id = {9, 10, 11, 12, 13, 14, 15, 16}};
+  for (size_t i = 0; i < SIGNING_CONTEXT_SIGNATURE_BYTES; i++) {
+    signature.signature[i] = (uint8_t)(i + 17);
+  }
+
+  uint8_t packed[DETACHED_SIGNATURE_PACKED_BYTES];
+  detached_signature_pack(&signature, packed);
+  for (size_t i = 0; i < sizeof(packed); i++) {
+    assert_int_equal(packed[i], i + 1);
+  }
+
+  detached_signature unpacked = {0};
+  assert_false(
+      detached_signature_unpack(&unpacked, packed, sizeof(packed) - 1));
+  assert_true(detached_signature_unpack(&unpacked, packed, sizeof(packed)));
+  assert_true(detached_signature_is_complete(&unpacked));
+  assert_int_equal(unpacked.ingestion_time, signature.ingestion_time);
+  assert_memory_equal(unpacked.key_id, signature.key_id,
+                      SIGNING_KEY_ID_BYTES);
+  assert_memory_equal(unpacked.signature, signature.signature,
+                      SIGNING_CONTEXT_SIGNATURE_BYTES);
+}
+
+// Main function to run tests
+int main(void) {
+  const struct CMUnitTest tests[] = {
+      cmocka_unit_test(test_detached_signature_input),
+      cmocka_unit_test(test_detached_signature_countersign_input),
+      cmocka_unit_test(test_detached_signature_input_lengths),
+      cmocka_unit_test(test_detached_signature_properties),
+      cmocka_unit_test(test_detached_signature_invalid_properties),
+      cmocka_unit_test(test_detached_signature_pack),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
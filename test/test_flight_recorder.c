@@ -0,0 +1,109 @@
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cmocka.h>
+
+#include "flight_recorder.h"
+
+static const char *PATH = "test_flight_recorder.bin";
+
+static void *map_file(size_t *size) {
+  FILE *file = fopen(PATH, "r");
+  assert_non_null(file);
+
+  struct stat st;
+  assert_int_equal(fstat(fileno(file), &st), 0);
+  *size = (size_t)st.st_size;
+
+  void *data = mmap(NULL, *size, PROT_READ, MAP_SHARED, fileno(file), 0);
+  fclose(file);
+  assert_true(data != MAP_FAILED);
+  return data;
+}
+
+// Test that written records can be read back
+static void test_flight_recorder_write_read(void **state) {
+  (void)state; // Unused
+
+  flight_recorder *recorder = flight_recorder_open(PATH, 8);
+  assert_non_null(recorder);
+
+  flight_record record = {
+      .timestamp_ns = 1000,
+      .topic_hash = flight_recorder_topic_hash("a/b"),
+      .payload_size = 42,
+      .outcome = FLIGHT_RECORD_SIGNED,
+      .stage_ns = {1, 2, 3, 6},
+  };
+  flight_recorder_write(recorder, &record);
+
+  size_t size = 0;
+  void *data = map_file(&size);
+  assert_true(flight_recorder_check(data, size));
+
+  const flight_recorder_header *header = (const flight_recorder_header *)data;
+  assert_int_equal(header->write_count, 1);
+
+  flight_record read = {0};
+  assert_true(flight_recorder_read(data, 0, &read));
+  assert_memory_equal(&read, &record, sizeof(record));
+
+  munmap(data, size);
+  flight_recorder_close(recorder);
+  unlink(PATH);
+}
+
+// Test that the oldest records are overwritten when the ring is full
+static void test_flight_recorder_wrap_around(void **state) {
+  (void)state; // Unused
+
+  flight_recorder *recorder = flight_recorder_open(PATH, 4);
+  assert_non_null(recorder);
+
+  for (uint32_t i = 0; i < 10; i++) {
+    flight_record record = {.payload_size = i};
+    flight_recorder_write(recorder, &record);
+  }
+  flight_recorder_close(recorder);
+
+  size_t size = 0;
+  void *data = map_file(&size);
+  assert_true(flight_recorder_check(data, size));
+
+  flight_record read = {0};
+  assert_false(flight_recorder_read(data, 5, &read));
+  for (uint64_t index = 6; index < 10; index++) {
+    assert_true(flight_recorder_read(data, index, &read));
+    assert_int_equal(read.payload_size, index);
+  }
+
+  munmap(data, size);
+  unlink(PATH);
+}
+
+// Test that other files are refused
+static void test_flight_recorder_check_invalid(void **state) {
+  (void)state; // Unused
+
+  uint8_t data[sizeof(flight_recorder_header)] = {0};
+  assert_false(flight_recorder_check(data, sizeof(data)));
+  assert_false(flight_recorder_check(data, 4));
+}
+
+// Main function to run tests
+int main(void) {
+  const struct CMUnitTest tests[] = {
+      cmocka_unit_test(test_flight_recorder_write_read),
+      cmocka_unit_test(test_flight_recorder_wrap_around),
+      cmocka_unit_test(test_flight_recorder_check_invalid),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
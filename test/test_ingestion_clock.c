@@ -0,0 +1,116 @@
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <cmocka.h>
+
+#include "ingestion_clock.h"
+
+// 2024-01-02T03:04:05.123456789Z
+static const uint64_t TEST_TIME_NS = UINT64_C(1704164645123456789);
+
+static uint64_t realtime_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t decode_uint64_be(const uint8_t *data) {
+  uint64_t value = 0;
+  for (int i = 0; i < 8; i++) {
+    value = (value << 8) | data[i];
+  }
+  return value;
+}
+
+// Test the unsigned integer encoding in every precision
+static void test_ingestion_clock_encode_uint(void **state) {
+  (void)state; // Unused
+
+  const time_precision precisions[] = {TIME_PRECISION_MS, TIME_PRECISION_US,
+                                       TIME_PRECISION_NS};
+  const uint64_t expected[] = {UINT64_C(1704164645123),
+                               UINT64_C(1704164645123456),
+                               UINT64_C(1704164645123456789)};
+
+  for (size_t i = 0; i < 3; i++) {
+    ingestion_clock clock;
+    assert_int_equal(ingestion_clock_init(&clock, CLOCK_SOURCE_REALTIME,
+                                          precisions[i], TIME_ENCODING_UINT),
+                     SUCCESS);
+
+    uint8_t out[INGESTION_CLOCK_MAX_ENCODED_SIZE];
+    size_t size = ingestion_clock_encode(&clock, TEST_TIME_NS, out);
+
+    assert_int_equal(size, 9);
+    assert_int_equal(size, ingestion_clock_encoded_size(&clock));
+    assert_int_equal(out[0], 0x1b);
+    assert_true(decode_uint64_be(out + 1) == expected[i]);
+    assert_true(ingestion_clock_units(&clock, TEST_TIME_NS) == expected[i]);
+  }
+}
+
+// Test the epoch-based date/time tag encoding
+static void test_ingestion_clock_encode_tag(void **state) {
+  (void)state; // Unused
+
+  ingestion_clock clock;
+  assert_int_equal(ingestion_clock_init(&clock, CLOCK_SOURCE_REALTIME,
+                                        TIME_PRECISION_MS, TIME_ENCODING_TAG),
+                   SUCCESS);
+
+  uint8_t out[INGESTION_CLOCK_MAX_ENCODED_SIZE];
+  size_t size = ingestion_clock_encode(&clock, TEST_TIME_NS, out);
+
+  assert_int_equal(size, 10);
+  assert_int_equal(size, ingestion_clock_encoded_size(&clock));
+  assert_int_equal(out[0], 0xc1);
+  assert_int_equal(out[1], 0xfb);
+
+  uint64_t bits = decode_uint64_be(out + 2);
+  double seconds;
+  memcpy(&seconds, &bits, sizeof(seconds));
+  assert_true(seconds == 1704164645123.0 / 1000.0);
+}
+
+// Test that every source gives the current epoch time
+static void test_ingestion_clock_sources(void **state) {
+  (void)state; // Unused
+
+  const clock_source sources[] = {CLOCK_SOURCE_REALTIME,
+                                  CLOCK_SOURCE_REALTIME_COARSE,
+                                  CLOCK_SOURCE_TSC};
+
+  for (size_t i = 0; i < 3; i++) {
+    ingestion_clock clock;
+    if (ingestion_clock_init(&clock, sources[i], TIME_PRECISION_NS,
+                             TIME_ENCODING_UINT) != SUCCESS) {
+      // No invariant TSC on this machine
+      assert_int_equal(sources[i], CLOCK_SOURCE_TSC);
+      continue;
+    }
+    ingestion_clock_recalibrate(&clock);
+
+    uint64_t expected = realtime_ns();
+    uint64_t actual = ingestion_clock_now_ns(&clock);
+    uint64_t difference =
+        actual > expected ? actual - expected : expected - actual;
+
+    // Within the resolution of the coarse clock
+    assert_true(difference < 50000000u);
+  }
+}
+
+// Main function to run tests
+int main(void) {
+  const struct CMUnitTest tests[] = {
+      cmocka_unit_test(test_ingestion_clock_encode_uint),
+      cmocka_unit_test(test_ingestion_clock_encode_tag),
+      cmocka_unit_test(test_ingestion_clock_sources),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
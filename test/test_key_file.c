@@ -0,0 +1,186 @@
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cmocka.h>
+
+#include <sodium.h>
+
+#include "key_file.h"
+
+static const char *PATH = "test_key_file.key";
+static const char *SECRET_PATH = "test_key_file.secret";
+
+static const char *SECRET_HEX =
+    "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f";
+
+static void write_text(const char *path, const char *text) {
+  FILE *file = fopen(path, "w");
+  assert_non_null(file);
+  fputs(text, file);
+  fclose(file);
+}
+
+// Test that a sealed keypair is read back identical
+static void test_key_file_round_trip(void **state) {
+  (void)state; // Unused
+
+  uint8_t secret[KEY_FILE_SECRET_BYTES];
+  randombytes_buf(secret, sizeof(secret));
+
+  signing_key *key = signing_key_generate();
+  signing_key_set_algorithm(key, SIGNING_ALGORITHM_ED25519PH);
+  unlink(PATH);
+  assert_int_equal(key_file_write(PATH, key, secret), SUCCESS);
+
+  struct stat st;
+  assert_int_equal(stat(PATH, &st), 0);
+  assert_int_equal(st.st_size, KEY_FILE_SIZE);
+  assert_int_equal(st.st_mode & 0777, 0600);
+
+  signing_key *read = NULL;
+  bool algorithm_sealed = false;
+  assert_int_equal(key_file_read(PATH, secret, &read, &algorithm_sealed),
+                   SUCCESS);
+  assert_true(algorithm_sealed);
+  assert_int_equal(read->context.algorithm, SIGNING_ALGORITHM_ED25519PH);
+  assert_memory_equal(read->public_key, key->public_key,
+                      sizeof(key->public_key));
+  assert_memory_equal(read->private_key, key->private_key,
+                      sizeof(key->private_key));
+  assert_memory_equal(read->key_id, key->key_id, SIGNING_KEY_ID_BYTES);
+  assert_string_equal(read->public_key_hex, key->public_key_hex);
+  assert_int_equal(read->create_time_unix, key->create_time_unix);
+
+  // An existing key file is never replaced
+  assert_int_equal(key_file_write(PATH, read, secret), ERROR_UNKNOWN);
+
+  signing_key_destroy(read);
+  signing_key_destroy(key);
+  unlink(PATH);
+}
+
+// Test that a key file cannot be read with another secret or once modified
+static void test_key_file_rejected(void **state) {
+  (void)state; // Unused
+
+  uint8_t secret[KEY_FILE_SECRET_BYTES];
+  randombytes_buf(secret, sizeof(secret));
+
+  signing_key *key = signing_key_generate();
+  unlink(PATH);
+  assert_int_equal(key_file_write(PATH, key, secret), SUCCESS);
+  signing_key_destroy(key);
+
+  signing_key *read = NULL;
+  uint8_t other[KEY_FILE_SECRET_BYTES];
+  memcpy(other, secret, sizeof(other));
+  other[0] ^= 1;
+  assert_int_equal(key_file_read(PATH, other, &read, NULL),
+                   ERROR_INVALID_ARGUMENT);
+
+  FILE *file = fopen(PATH, "r+b");
+  assert_non_null(file);
+  fseek(file, KEY_FILE_SIZE - 1, SEEK_SET);
+  fputc(0, file);
+  fclose(file);
+  assert_int_equal(key_file_read(PATH, secret, &read, NULL),
+                   ERROR_INVALID_ARGUMENT);
+  unlink(PATH);
+
+  assert_int_equal(key_file_read(PATH, secret, &read, NULL), ERROR_UNKNOWN);
+  assert_null(read);
+}
+
+// Test that a key file written before the algorithm was sealed is still read
+static void test_key_file_without_algorithm(void **state) {
+  (void)state; // Unused
+
+  uint8_t secret[KEY_FILE_SECRET_BYTES];
+  randombytes_buf(secret, sizeof(secret));
+  signing_key *key = signing_key_generate();
+
+  // Magic, nonce, then the creation time and the seed sealed
+  uint8_t plain[8 + SIGNING_KEY_SEED_BYTES];
+  for (int i = 0; i < 8; i++) {
+    plain[i] = (uint8_t)(key->create_time_unix >> (56 - 8 * i));
+  }
+  crypto_sign_ed25519_sk_to_seed(plain + 8, key->private_key);
+  uint8_t data[KEY_FILE_SIZE - 1] = {'M', 'S', 'K', 'E', 'Y', 0, 0, 1};
+  randombytes_buf(data + 8, crypto_secretbox_NONCEBYTES);
+  crypto_secretbox_easy(data + 8 + crypto_secretbox_NONCEBYTES, plain,
+                        sizeof(plain), data + 8, secret);
+
+  FILE *file = fopen(PATH, "wb");
+  assert_non_null(file);
+  assert_int_equal(fwrite(data, 1, sizeof(data), file), sizeof(data));
+  fclose(file);
+
+  signing_key *read = NULL;
+  bool algorithm_sealed = true;
+  assert_int_equal(key_file_read(PATH, secret, &read, &algorithm_sealed),
+                   SUCCESS);
+  assert_false(algorithm_sealed);
+  assert_int_equal(read->context.algorithm, SIGNING_ALGORITHM_ED25519);
+  assert_memory_equal(read->private_key, key->private_key,
+                      sizeof(key->private_key));
+  assert_int_equal(read->create_time_unix, key->create_time_unix);
+
+  signing_key_destroy(read);
+  signing_key_destroy(key);
+  unlink(PATH);
+}
+
+// Test the secret read from a file or from the environment
+static void test_key_file_load_secret(void **state) {
+  (void)state; // Unused
+
+  uint8_t expected[KEY_FILE_SECRET_BYTES];
+  for (size_t i = 0; i < sizeof(expected); i++) {
+    expected[i] = (uint8_t)i;
+  }
+
+  uint8_t secret[KEY_FILE_SECRET_BYTES];
+  char line[80];
+  snprintf(line, sizeof(line), "%s\n", SECRET_HEX);
+  write_text(SECRET_PATH, line);
+  assert_int_equal(key_file_load_secret(SECRET_PATH, secret), SUCCESS);
+  assert_memory_equal(secret, expected, sizeof(expected));
+
+  write_text(SECRET_PATH, "0001");
+  assert_int_equal(key_file_load_secret(SECRET_PATH, secret),
+                   ERROR_INVALID_ARGUMENT);
+  unlink(SECRET_PATH);
+  assert_int_equal(key_file_load_secret(SECRET_PATH, secret),
+                   ERROR_INVALID_ARGUMENT);
+
+  setenv(KEY_FILE_SECRET_ENV, SECRET_HEX, 1);
+  memset(secret, 0, sizeof(secret));
+  assert_int_equal(key_file_load_secret(NULL, secret), SUCCESS);
+  assert_memory_equal(secret, expected, sizeof(expected));
+
+  unsetenv(KEY_FILE_SECRET_ENV);
+  assert_int_equal(key_file_load_secret(NULL, secret),
+                   ERROR_INVALID_ARGUMENT);
+}
+
+// Main function to run tests
+int main(void) {
+  if (sodium_init() == -1) {
+    return 1;
+  }
+
+  const struct CMUnitTest tests[] = {
+      cmocka_unit_test(test_key_file_round_trip),
+      cmocka_unit_test(test_key_file_rejected),
+      cmocka_unit_test(test_key_file_without_algorithm),
+      cmocka_unit_test(test_key_file_load_secret),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
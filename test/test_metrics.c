@@ -0,0 +1,168 @@
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cmocka.h>
+
+#include "metrics.h"
+
+// Test that small values are recorded exactly
+static void test_histogram_exact_small_values(void **state) {
+  (void)state; // Unused
+
+  latency_histogram *histogram = calloc(1, sizeof(latency_histogram));
+
+  for (uint64_t value = 1; value <= 20; value++) {
+    latency_histogram_record(histogram, value);
+  }
+
+  assert_int_equal(latency_histogram_percentile(histogram, 50.0), 10);
+  assert_int_equal(latency_histogram_percentile(histogram, 100.0), 20);
+  assert_int_equal(latency_histogram_percentile(histogram, 0.0), 1);
+
+  free(histogram);
+}
+
+// Test that percentiles of large values are within the histogram precision
+static void test_histogram_relative_precision(void **state) {
+  (void)state; // Unused
+
+  latency_histogram *histogram = calloc(1, sizeof(latency_histogram));
+
+  for (uint64_t value = 1; value <= 100000; value++) {
+    latency_histogram_record(histogram, value * 1000);
+  }
+
+  const double percentiles[] = {50.0, 90.0, 99.0, 99.9};
+  for (size_t i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++) {
+    double expected = percentiles[i] * 1000.0 * 1000.0;
+    double actual =
+        (double)latency_histogram_percentile(histogram, percentiles[i]);
+
+    assert_true(actual >= expected);
+    assert_true(actual <= expected * (1.0 + 1.0 / 16.0));
+  }
+
+  // The maximum is never exceeded
+  assert_int_equal(latency_histogram_percentile(histogram, 100.0),
+                   100000 * 1000);
+
+  free(histogram);
+}
+
+// Test the full range of values
+static void test_histogram_extreme_values(void **state) {
+  (void)state; // Unused
+
+  latency_histogram *histogram = calloc(1, sizeof(latency_histogram));
+
+  latency_histogram_record(histogram, 0);
+  latency_histogram_record(histogram, UINT64_MAX);
+
+  assert_int_equal(latency_histogram_percentile(histogram, 50.0), 0);
+  assert_true(latency_histogram_percentile(histogram, 100.0) == UINT64_MAX);
+
+  free(histogram);
+}
+
+// Test that an interval reset keeps the totals
+static void test_histogram_reset_interval(void **state) {
+  (void)state; // Unused
+
+  latency_histogram *histogram = calloc(1, sizeof(latency_histogram));
+
+  latency_histogram_record(histogram, 100);
+  latency_histogram_record(histogram, 300);
+  latency_histogram_reset_interval(histogram);
+
+  assert_int_equal(histogram->interval_count, 0);
+  assert_int_equal(latency_histogram_percentile(histogram, 99.0), 0);
+  assert_int_equal(histogram->total_count, 2);
+  assert_int_equal(histogram->total_sum, 400);
+
+  free(histogram);
+}
+
+static void find_value(const char *name, uint64_t value, void *userdata) {
+  const char **expected = (const char **)userdata;
+  if (strcmp(name, expected[0]) == 0) {
+    expected[1] = (const char *)(uintptr_t)(value + 1);
+  }
+}
+
+// Test the names and values reported for publication
+static void test_metrics_for_each(void **state) {
+  (void)state; // Unused
+
+  plugin_metrics *metrics = calloc(1, sizeof(plugin_metrics));
+  metrics->messages_signed = 3;
+  metrics_count_rejection(metrics, METRICS_REJECTED_DECODE);
+  metrics_record_latency(metrics, METRICS_STAGE_SIGN, 25);
+
+  const char *lookup[2] = {"messages/signed", NULL};
+  metrics_for_each(metrics, find_value, lookup);
+  assert_int_equal((uintptr_t)lookup[1], 4);
+
+  lookup[0] = "messages/rejected/decode";
+  lookup[1] = NULL;
+  metrics_for_each(metrics, find_value, lookup);
+  assert_int_equal((uintptr_t)lookup[1], 2);
+
+  lookup[0] = "latency/sign/p99";
+  lookup[1] = NULL;
+  metrics_for_each(metrics, find_value, lookup);
+  assert_int_equal((uintptr_t)lookup[1], 26);
+
+  free(metrics);
+}
+
+// Test the Prometheus text output
+static void test_metrics_prometheus(void **state) {
+  (void)state; // Unused
+
+  plugin_metrics *metrics = calloc(1, sizeof(plugin_metrics));
+  metrics->messages_signed = 7;
+  metrics->bytes_in = 1024;
+  metrics->messages_unsigned = 2;
+  metrics->messages_presigned = 3;
+  metrics_record_latency(metrics, METRICS_STAGE_TOTAL, 2000);
+
+  char *text = NULL;
+  size_t size = 0;
+  FILE *out = open_memstream(&text, &size);
+  assert_int_equal(metrics_write_prometheus(metrics, out), 0);
+  fclose(out);
+
+  assert_non_null(
+      strstr(text, "message_sign_messages_total{outcome=\"signed\"} 7\n"));
+  assert_non_null(
+      strstr(text, "message_sign_messages_total{outcome=\"unsigned\"} 2\n"));
+  assert_non_null(
+      strstr(text, "message_sign_messages_total{outcome=\"presigned\"} 3\n"));
+  assert_non_null(
+      strstr(text, "message_sign_bytes_total{direction=\"in\"} 1024\n"));
+  assert_non_null(strstr(text, "message_sign_stage_latency_seconds_count"
+                               "{stage=\"total\"} 1\n"));
+  assert_non_null(strstr(text, "# TYPE message_sign_stage_latency_seconds "
+                               "summary\n"));
+
+  free(text);
+  free(metrics);
+}
+
+// Main function to run tests
+int main(void) {
+  const struct CMUnitTest tests[] = {
+      cmocka_unit_test(test_histogram_exact_small_values),
+      cmocka_unit_test(test_histogram_relative_precision),
+      cmocka_unit_test(test_histogram_extreme_values),
+      cmocka_unit_test(test_histogram_reset_interval),
+      cmocka_unit_test(test_metrics_for_each),
+      cmocka_unit_test(test_metrics_prometheus),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,182 @@
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <cmocka.h>
+
+#include "reject_log.h"
+
+typedef struct {
+  size_t prefixes;
+  uint64_t total;
+  const char *find;
+  uint64_t found[METRICS_REJECTED_COUNT];
+  uint64_t other[METRICS_REJECTED_COUNT];
+} summary;
+
+static void collect(const char *prefix, const uint64_t *counts,
+                    void *userdata) {
+  summary *result = userdata;
+  for (int i = 0; i < METRICS_REJECTED_COUNT; i++) {
+    result->total += counts[i];
+  }
+  if (prefix == NULL) {
+    memcpy(result->other, counts, sizeof(result->other));
+    return;
+  }
+  result->prefixes++;
+  if (result->find != NULL && strcmp(prefix, result->find) == 0) {
+    memcpy(result->found, counts, sizeof(result->found));
+  }
+}
+
+// Test that the bucket allows a burst then refills at the rate
+static void test_reject_log_rate(void **state) {
+  (void)state; // Unused
+
+  reject_log log;
+  reject_log_init(&log, 10, 3, 1, 60000, 1000);
+
+  for (int i = 0; i < 3; i++) {
+    assert_true(reject_log_count(&log, 1000, "a/b", METRICS_REJECTED_DECODE));
+  }
+  assert_false(reject_log_count(&log, 1000, "a/b", METRICS_REJECTED_DECODE));
+  assert_false(reject_log_count(&log, 1050, "a/b", METRICS_REJECTED_DECODE));
+
+  // One line every 100ms at 10 lines per second
+  assert_true(reject_log_count(&log, 1100, "a/b", METRICS_REJECTED_DECODE));
+  assert_false(reject_log_count(&log, 1100, "a/b", METRICS_REJECTED_DECODE));
+
+  // The bucket does not refill past the burst
+  for (int i = 0; i < 3; i++) {
+    assert_true(reject_log_count(&log, 9000, "a/b", METRICS_REJECTED_DECODE));
+  }
+  assert_false(reject_log_count(&log, 9000, "a/b", METRICS_REJECTED_DECODE));
+
+  assert_int_equal(log.interval_rejected, 11);
+  assert_int_equal(log.interval_suppressed, 4);
+}
+
+// Test that a null rate only logs summaries
+static void test_reject_log_summaries_only(void **state) {
+  (void)state; // Unused
+
+  reject_log log;
+  reject_log_init(&log, 0, 0, 1, 60000, 0);
+
+  assert_false(reject_log_count(&log, 0, "a", METRICS_REJECTED_NO_KEY));
+  assert_false(reject_log_count(&log, 5000, "a", METRICS_REJECTED_NO_KEY));
+  assert_int_equal(log.interval_suppressed, 2);
+}
+
+// Test the aggregation per topic prefix and reason
+static void test_reject_log_prefixes(void **state) {
+  (void)state; // Unused
+
+  reject_log log;
+  reject_log_init(&log, 10, 10, 2, 60000, 0);
+
+  reject_log_count(&log, 0, "tenant/1/a", METRICS_REJECTED_DECODE);
+  reject_log_count(&log, 0, "tenant/1/b/c", METRICS_REJECTED_DECODE);
+  reject_log_count(&log, 0, "tenant/1", METRICS_REJECTED_SIGN);
+  reject_log_count(&log, 0, "tenant/2/a", METRICS_REJECTED_DECODE);
+  reject_log_count(&log, 0, "tenant", METRICS_REJECTED_NO_KEY);
+
+  summary result = {.find = "tenant/1"};
+  reject_log_summarize(&log, 0, collect, &result);
+  assert_int_equal(result.prefixes, 3);
+  assert_int_equal(result.total, 5);
+  assert_int_equal(result.found[METRICS_REJECTED_DECODE], 2);
+  assert_int_equal(result.found[METRICS_REJECTED_SIGN], 1);
+  assert_int_equal(result.found[METRICS_REJECTED_NO_KEY], 0);
+}
+
+// Test that whole topics are counted with no prefix levels, and that long
+// topics are truncated
+static void test_reject_log_whole_topics(void **state) {
+  (void)state; // Unused
+
+  reject_log log;
+  reject_log_init(&log, 10, 10, 0, 60000, 0);
+
+  char topic[2 * REJECT_LOG_MAX_PREFIX_LENGTH];
+  memset(topic, 'x', sizeof(topic) - 1);
+  topic[sizeof(topic) - 1] = '\0';
+
+  reject_log_count(&log, 0, "a/b/c", METRICS_REJECTED_DECODE);
+  reject_log_count(&log, 0, "a/b/d", METRICS_REJECTED_DECODE);
+  reject_log_count(&log, 0, topic, METRICS_REJECTED_DECODE);
+
+  topic[REJECT_LOG_MAX_PREFIX_LENGTH - 1] = '\0';
+  summary result = {.find = topic};
+  reject_log_summarize(&log, 0, collect, &result);
+  assert_int_equal(result.prefixes, 3);
+  assert_int_equal(result.found[METRICS_REJECTED_DECODE], 1);
+}
+
+// Test that prefixes past the size of the table are counted together
+static void test_reject_log_other(void **state) {
+  (void)state; // Unused
+
+  reject_log log;
+  reject_log_init(&log, 10, 10, 1, 60000, 0);
+
+  const size_t count = 2 * REJECT_LOG_MAX_PREFIXES;
+  char topic[32];
+  for (size_t i = 0; i < count; i++) {
+    snprintf(topic, sizeof(topic), "prefix%zu/a", i);
+    reject_log_count(&log, 0, topic, METRICS_REJECTED_SERIALIZE);
+  }
+
+  // Known prefixes are still found once the table is full
+  reject_log_count(&log, 0, "prefix0/b", METRICS_REJECTED_SIGN);
+
+  summary result = {.find = "prefix0"};
+  reject_log_summarize(&log, 0, collect, &result);
+  assert_int_equal(result.prefixes, REJECT_LOG_MAX_PREFIXES - 1);
+  assert_int_equal(result.total, count + 1);
+  assert_int_equal(result.other[METRICS_REJECTED_SERIALIZE],
+                   count - (REJECT_LOG_MAX_PREFIXES - 1));
+  assert_int_equal(result.found[METRICS_REJECTED_SIGN], 1);
+}
+
+// Test the summary interval and the reset of the counts
+static void test_reject_log_summary_interval(void **state) {
+  (void)state; // Unused
+
+  reject_log log;
+  reject_log_init(&log, 10, 10, 1, 1000, 500);
+
+  reject_log_count(&log, 600, "a", METRICS_REJECTED_DECODE);
+  assert_false(reject_log_summary_due(&log, 1499));
+  assert_true(reject_log_summary_due(&log, 1500));
+
+  summary result = {0};
+  reject_log_summarize(&log, 1500, collect, &result);
+  assert_int_equal(result.total, 1);
+  assert_int_equal(log.interval_rejected, 0);
+  assert_false(reject_log_summary_due(&log, 2000));
+  assert_true(reject_log_summary_due(&log, 2500));
+
+  summary empty = {0};
+  reject_log_summarize(&log, 2500, collect, &empty);
+  assert_int_equal(empty.prefixes, 0);
+  assert_int_equal(empty.total, 0);
+}
+
+// Main function to run tests
+int main(void) {
+  const struct CMUnitTest tests[] = {
+      cmocka_unit_test(test_reject_log_rate),
+      cmocka_unit_test(test_reject_log_summaries_only),
+      cmocka_unit_test(test_reject_log_prefixes),
+      cmocka_unit_test(test_reject_log_whole_topics),
+      cmocka_unit_test(test_reject_log_other),
+      cmocka_unit_test(test_reject_log_summary_interval),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,215 @@
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <cmocka.h>
+
+#include <sodium.h>
+
+#include "signing_context.h"
+
+// Test that signatures are those of crypto_sign_detached, for messages of
+// every size up to a few SHA-512 blocks
+static void test_signing_context_matches_libsodium(void **state) {
+  (void)state; // Unused
+
+  uint8_t message[300];
+  randombytes_buf(message, sizeof(message));
+
+  for (int key_index = 0; key_index < 8; key_index++) {
+    uint8_t public_key[crypto_sign_PUBLICKEYBYTES];
+    uint8_t private_key[crypto_sign_SECRETKEYBYTES];
+    crypto_sign_keypair(public_key, private_key);
+
+    signing_context context;
+    signing_context_init(&context, private_key, SIGNING_ALGORITHM_ED25519);
+    assert_memory_equal(context.secret_key, private_key, sizeof(private_key));
+
+    for (size_t size = 0; size <= sizeof(message); size += 13) {
+      uint8_t expected[crypto_sign_BYTES];
+      uint8_t signature[crypto_sign_BYTES];
+      crypto_sign_detached(expected, NULL, message, size, private_key);
+
+      assert_int_equal(
+          signing_context_sign(&context, message, size, signature), SUCCESS);
+      assert_memory_equal(signature, expected, crypto_sign_BYTES);
+      assert_int_equal(
+          crypto_sign_verify_detached(signature, message, size, public_key),
+          0);
+    }
+
+    signing_context_wipe(&context);
+  }
+}
+
+// Test that ED25519ph signatures are those of crypto_sign_final_create
+static void test_signing_context_prehashed(void **state) {
+  (void)state; // Unused
+
+  uint8_t message[300];
+  randombytes_buf(message, sizeof(message));
+
+  uint8_t public_key[crypto_sign_PUBLICKEYBYTES];
+  uint8_t private_key[crypto_sign_SECRETKEYBYTES];
+  crypto_sign_keypair(public_key, private_key);
+
+  signing_context context;
+  signing_context_init(&context, private_key, SIGNING_ALGORITHM_ED25519PH);
+
+  for (size_t size = 0; size <= sizeof(message); size += 37) {
+    uint8_t expected[crypto_sign_BYTES];
+    uint8_t signature[crypto_sign_BYTES];
+    crypto_sign_state sign_state;
+    crypto_sign_init(&sign_state);
+    crypto_sign_update(&sign_state, message, size);
+    crypto_sign_final_create(&sign_state, expected, NULL, private_key);
+
+    assert_int_equal(signing_context_sign(&context, message, size, signature),
+                     SUCCESS);
+    assert_memory_equal(signature, expected, crypto_sign_BYTES);
+  }
+
+  signing_context_wipe(&context);
+}
+
+// Test that MAC signatures only depend on the seed and the message
+static void test_signing_context_mac(void **state) {
+  (void)state; // Unused
+
+  const uint8_t message[] = "message";
+  uint8_t public_key[crypto_sign_PUBLICKEYBYTES];
+  uint8_t private_key[crypto_sign_SECRETKEYBYTES];
+  crypto_sign_keypair(public_key, private_key);
+
+  signing_context context;
+  signing_context_init(&context, private_key, SIGNING_ALGORITHM_BLAKE2B_MAC);
+
+  uint8_t signature[SIGNING_CONTEXT_SIGNATURE_BYTES];
+  uint8_t mac[SIGNING_CONTEXT_SIGNATURE_BYTES];
+  assert_int_equal(
+      signing_context_sign(&context, message, sizeof(message), signature),
+      SUCCESS);
+  signing_context_mac(context.mac_key, message, sizeof(message), mac);
+  assert_memory_equal(signature, mac, sizeof(mac));
+
+  // The MAC key is not the seed itself
+  assert_memory_not_equal(context.mac_key, private_key,
+                          SIGNING_CONTEXT_MAC_KEY_BYTES);
+
+  signing_context other;
+  signing_context_init(&other, private_key, SIGNING_ALGORITHM_BLAKE2B_MAC);
+  assert_memory_equal(other.mac_key, context.mac_key,
+                      SIGNING_CONTEXT_MAC_KEY_BYTES);
+
+  signing_context_wipe(&context);
+  signing_context_wipe(&other);
+}
+
+// Test that signing in parts gives the signature of the concatenated parts
+static void test_signing_context_parts(void **state) {
+  (void)state; // Unused
+
+  const uint8_t message[] = "a message signed in several parts";
+  uint8_t public_key[crypto_sign_PUBLICKEYBYTES];
+  uint8_t private_key[crypto_sign_SECRETKEYBYTES];
+  crypto_sign_keypair(public_key, private_key);
+
+  const signing_part parts[] = {
+      {message, 2}, {message + 2, 0}, {message + 2, 8},
+      {message + 10, sizeof(message) - 10}};
+
+  for (int i = 0; i < SIGNING_ALGORITHM_COUNT; i++) {
+    signing_context context;
+    signing_context_init(&context, private_key, (signing_algorithm)i);
+
+    uint8_t expected[SIGNING_CONTEXT_SIGNATURE_BYTES];
+    uint8_t signature[SIGNING_CONTEXT_SIGNATURE_BYTES];
+    assert_int_equal(
+        signing_context_sign(&context, message, sizeof(message), expected),
+        SUCCESS);
+    assert_int_equal(signing_context_sign_parts(&context, parts, 4, signature),
+                     SUCCESS);
+    assert_memory_equal(signature, expected, sizeof(expected));
+
+    signing_context_wipe(&context);
+  }
+}
+
+// Test that a message in parts too large for the stack is signed as a whole
+static void test_signing_context_large_parts(void **state) {
+  (void)state; // Unused
+
+  static uint8_t message[5000];
+  randombytes_buf(message, sizeof(message));
+  uint8_t public_key[crypto_sign_PUBLICKEYBYTES];
+  uint8_t private_key[crypto_sign_SECRETKEYBYTES];
+  crypto_sign_keypair(public_key, private_key);
+
+  const signing_part parts[] = {{message, 100},
+                                {message + 100, sizeof(message) - 100}};
+
+  signing_context context;
+  signing_context_init(&context, private_key, SIGNING_ALGORITHM_ED25519);
+
+  uint8_t expected[crypto_sign_BYTES];
+  uint8_t signature[crypto_sign_BYTES];
+  crypto_sign_detached(expected, NULL, message, sizeof(message), private_key);
+  assert_int_equal(signing_context_sign_parts(&context, parts, 2, signature),
+                   SUCCESS);
+  assert_memory_equal(signature, expected, sizeof(expected));
+
+  signing_context_wipe(&context);
+}
+
+// Test the names of the algorithms
+static void test_signing_context_algorithm_names(void **state) {
+  (void)state; // Unused
+
+  for (int i = 0; i < SIGNING_ALGORITHM_COUNT; i++) {
+    signing_algorithm algorithm = SIGNING_ALGORITHM_COUNT;
+    assert_true(
+        signing_algorithm_parse(signing_algorithm_name(i), &algorithm));
+    assert_int_equal(algorithm, i);
+  }
+
+  signing_algorithm algorithm = SIGNING_ALGORITHM_ED25519;
+  assert_false(signing_algorithm_parse("rsa", &algorithm));
+  assert_string_equal(signing_algorithm_name(SIGNING_ALGORITHM_COUNT),
+                      "unknown");
+}
+
+// Test that wiping clears the prepared key
+static void test_signing_context_wipe(void **state) {
+  (void)state; // Unused
+
+  uint8_t public_key[crypto_sign_PUBLICKEYBYTES];
+  uint8_t private_key[crypto_sign_SECRETKEYBYTES];
+  crypto_sign_keypair(public_key, private_key);
+
+  signing_context context;
+  signing_context_init(&context, private_key, SIGNING_ALGORITHM_ED25519);
+  signing_context_wipe(&context);
+
+  const signing_context zero = {0};
+  assert_memory_equal(&context, &zero, sizeof(context));
+}
+
+// Main function to run tests
+int main(void) {
+  if (sodium_init() == -1) {
+    return 1;
+  }
+
+  const struct CMUnitTest tests[] = {
+      cmocka_unit_test(test_signing_context_matches_libsodium),
+      cmocka_unit_test(test_signing_context_prehashed),
+      cmocka_unit_test(test_signing_context_mac),
+      cmocka_unit_test(test_signing_context_parts),
+      cmocka_unit_test(test_signing_context_large_parts),
+      cmocka_unit_test(test_signing_context_algorithm_names),
+      cmocka_unit_test(test_signing_context_wipe),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
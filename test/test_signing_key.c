@@ -0,0 +1,109 @@
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <cmocka.h>
+
+#include <sodium.h>
+
+#include "signing_key.h"
+
+// Test key generation
+static void test_signing_key_generate(void **state) {
+  (void)state; // Unused
+
+  signing_key *key = signing_key_generate();
+  assert_non_null(key);
+  assert_int_equal(strlen(key->public_key_hex), 64);
+  assert_true(key->create_time_unix > 0);
+
+  // The key id is the start of the SHA-256 hash of the public key
+  uint8_t hash[crypto_hash_sha256_BYTES];
+  crypto_hash_sha256(hash, key->public_key, sizeof(key->public_key));
+  assert_memory_equal(key->key_id, hash, SIGNING_KEY_ID_BYTES);
+
+  signing_key_destroy(key);
+}
+
+// Test that the first installed key becomes current without retiring anything
+static void test_signing_keyring_first_key(void **state) {
+  (void)state; // Unused
+
+  signing_keyring keyring;
+  signing_keyring_init(&keyring);
+  assert_null(signing_keyring_current(&keyring));
+
+  signing_key *key = signing_key_generate();
+  assert_int_equal(signing_keyring_install(&keyring, key, 0, 1000), SUCCESS);
+  assert_ptr_equal(signing_keyring_current(&keyring), key);
+  assert_int_equal(keyring.retired_count, 0);
+
+  signing_keyring_destroy(&keyring);
+  assert_null(signing_keyring_current(&keyring));
+}
+
+// Test that a replaced key is kept for the grace period
+static void test_signing_keyring_rotation_grace(void **state) {
+  (void)state; // Unused
+
+  signing_keyring keyring;
+  signing_keyring_init(&keyring);
+
+  signing_key *first = signing_key_generate();
+  signing_key *second = signing_key_generate();
+  assert_int_equal(signing_keyring_install(&keyring, first, 0, 1000), SUCCESS);
+  assert_int_equal(signing_keyring_install(&keyring, second, 500, 1000),
+                   SUCCESS);
+
+  assert_ptr_equal(signing_keyring_current(&keyring), second);
+  assert_int_equal(keyring.retired_count, 1);
+  assert_ptr_equal(keyring.retired[0].key, first);
+
+  // Still in the grace period
+  signing_keyring_reclaim(&keyring, 1499);
+  assert_int_equal(keyring.retired_count, 1);
+
+  signing_keyring_reclaim(&keyring, 1500);
+  assert_int_equal(keyring.retired_count, 0);
+  assert_ptr_equal(signing_keyring_current(&keyring), second);
+
+  signing_keyring_destroy(&keyring);
+}
+
+// Test that installation fails when too many keys are retired
+static void test_signing_keyring_too_many_retired(void **state) {
+  (void)state; // Unused
+
+  signing_keyring keyring;
+  signing_keyring_init(&keyring);
+
+  for (size_t i = 0; i <= SIGNING_KEYRING_MAX_RETIRED; i++) {
+    assert_int_equal(
+        signing_keyring_install(&keyring, signing_key_generate(), i, 1000),
+        SUCCESS);
+  }
+
+  const signing_key *current = signing_keyring_current(&keyring);
+  signing_key *key = signing_key_generate();
+  assert_int_equal(signing_keyring_install(&keyring, key, 100, 1000),
+                   ERROR_NO_MEMORY);
+  assert_ptr_equal(signing_keyring_current(&keyring), current);
+
+  signing_keyring_reclaim(&keyring, UINT64_MAX);
+  assert_int_equal(signing_keyring_install(&keyring, key, 100, 1000), SUCCESS);
+
+  signing_keyring_destroy(&keyring);
+}
+
+// Main function to run tests
+int main(void) {
+  const struct CMUnitTest tests[] = {
+      cmocka_unit_test(test_signing_key_generate),
+      cmocka_unit_test(test_signing_keyring_first_key),
+      cmocka_unit_test(test_signing_keyring_rotation_grace),
+      cmocka_unit_test(test_signing_keyring_too_many_retired),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
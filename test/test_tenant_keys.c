@@ -0,0 +1,238 @@
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cmocka.h>
+#include <sodium.h>
+
+#include "tenant_keys.h"
+
+// Test adding and finding keys
+static void test_tenant_keys_find(void **state) {
+  (void)state; // Unused
+
+  tenant_keys *tenants = tenant_keys_new(2);
+  assert_non_null(tenants);
+
+  signing_key *acme = signing_key_generate();
+  signing_key *globex = signing_key_generate();
+  assert_int_equal(tenant_keys_add(tenants, "acme", acme), SUCCESS);
+  assert_int_equal(tenant_keys_add(tenants, "globex", globex), SUCCESS);
+
+  assert_ptr_equal(tenant_keys_find(tenants, "acme", 4, NULL), acme);
+  assert_ptr_equal(tenant_keys_find(tenants, "globex", 6, NULL), globex);
+
+  // Names are compared on their length, not up to a null byte
+  assert_ptr_equal(tenant_keys_find(tenants, "acme/telemetry", 4, NULL),
+                   acme);
+  assert_null(tenant_keys_find(tenants, "acm", 3, NULL));
+  assert_null(tenant_keys_find(tenants, "acme/", 5, NULL));
+  assert_null(tenant_keys_find(tenants, "initech", 7, NULL));
+  assert_null(tenant_keys_find(tenants, "", 0, NULL));
+
+  assert_int_equal(tenant_keys_count(tenants), 2);
+  assert_string_equal(tenant_keys_name(tenants, 0), "acme");
+  assert_string_equal(tenant_keys_name(tenants, 1), "globex");
+  assert_ptr_equal(tenant_keys_key(tenants, 1), globex);
+
+  tenant_keys_destroy(tenants);
+}
+
+// Test that the certificate of a key is recorded as stored
+static void test_tenant_keys_stored(void **state) {
+  (void)state; // Unused
+
+  tenant_keys *tenants = tenant_keys_new(2);
+  assert_non_null(tenants);
+  signing_key *acme = signing_key_generate();
+  signing_key *globex = signing_key_generate();
+  assert_int_equal(tenant_keys_add(tenants, "acme", acme), SUCCESS);
+  assert_int_equal(tenant_keys_add(tenants, "globex", globex), SUCCESS);
+
+  bool stored = true;
+  assert_ptr_equal(tenant_keys_find(tenants, "acme", 4, &stored), acme);
+  assert_false(stored);
+
+  // Only the certificate of the key of the tenant counts
+  assert_false(
+      tenant_keys_set_stored(tenants, "acme", globex->public_key_hex));
+  assert_false(
+      tenant_keys_set_stored(tenants, "initech", acme->public_key_hex));
+  assert_true(tenant_keys_set_stored(tenants, "acme", acme->public_key_hex));
+
+  assert_ptr_equal(tenant_keys_find(tenants, "acme", 4, &stored), acme);
+  assert_true(stored);
+  assert_ptr_equal(tenant_keys_find(tenants, "globex", 6, &stored), globex);
+  assert_false(stored);
+
+  tenant_keys_destroy(tenants);
+}
+
+// Test that tenant keys derived from a master key are stable and distinct
+static void test_tenant_keys_derive_key(void **state) {
+  (void)state; // Unused
+
+  signing_key *master = signing_key_generate();
+  signing_key *other_master = signing_key_generate();
+  signing_key *acme = tenant_keys_derive_key(master, "acme");
+  signing_key *acme_again = tenant_keys_derive_key(master, "acme");
+  signing_key *globex = tenant_keys_derive_key(master, "globex");
+  signing_key *other_acme = tenant_keys_derive_key(other_master, "acme");
+  assert_non_null(acme);
+  assert_non_null(acme_again);
+  assert_non_null(globex);
+  assert_non_null(other_acme);
+
+  assert_string_equal(acme->public_key_hex, acme_again->public_key_hex);
+  assert_string_not_equal(acme->public_key_hex, globex->public_key_hex);
+  assert_string_not_equal(acme->public_key_hex, other_acme->public_key_hex);
+  assert_string_not_equal(acme->public_key_hex, master->public_key_hex);
+  assert_int_equal(acme->create_time_unix, master->create_time_unix);
+
+  signing_key_destroy(master);
+  signing_key_destroy(other_master);
+  signing_key_destroy(acme);
+  signing_key_destroy(acme_again);
+  signing_key_destroy(globex);
+  signing_key_destroy(other_acme);
+}
+
+// Test that the registry marks the tenants registered with their current key
+static void test_tenant_keys_load_registered(void **state) {
+  (void)state; // Unused
+
+  static const char *PATH = "test_tenant_keys.registered";
+  tenant_keys *tenants = tenant_keys_new(3);
+  assert_non_null(tenants);
+  signing_key *acme = signing_key_generate();
+  signing_key *globex = signing_key_generate();
+  signing_key *initech = signing_key_generate();
+  signing_key *replaced = signing_key_generate();
+  assert_int_equal(tenant_keys_add(tenants, "acme", acme), SUCCESS);
+  assert_int_equal(tenant_keys_add(tenants, "globex", globex), SUCCESS);
+  assert_int_equal(tenant_keys_add(tenants, "initech", initech), SUCCESS);
+
+  size_t count = 1;
+  unlink(PATH);
+  assert_int_equal(tenant_keys_load_registered(tenants, PATH, &count),
+                   SUCCESS);
+  assert_int_equal(count, 0);
+
+  FILE *file = fopen(PATH, "w");
+  assert_non_null(file);
+  fprintf(file, "%s acme\n", acme->public_key_hex);
+  fprintf(file, "%s globex\n", replaced->public_key_hex);
+  fprintf(file, "%s umbrella\n", initech->public_key_hex);
+  fprintf(file, "truncated");
+  fclose(file);
+
+  assert_int_equal(tenant_keys_load_registered(tenants, PATH, &count),
+                   SUCCESS);
+  assert_int_equal(count, 1);
+  assert_true(tenant_keys_stored(tenants, 0));
+  assert_false(tenant_keys_stored(tenants, 1));
+  assert_false(tenant_keys_stored(tenants, 2));
+
+  unlink(PATH);
+  signing_key_destroy(replaced);
+  tenant_keys_destroy(tenants);
+}
+
+// Test that duplicates, empty names and extra tenants are refused
+static void test_tenant_keys_invalid(void **state) {
+  (void)state; // Unused
+
+  tenant_keys *tenants = tenant_keys_new(1);
+  assert_non_null(tenants);
+  signing_key *key = signing_key_generate();
+  signing_key *other = signing_key_generate();
+
+  assert_int_equal(tenant_keys_add(tenants, "", key), ERROR_INVALID_ARGUMENT);
+  assert_int_equal(tenant_keys_add(tenants, "acme", key), SUCCESS);
+  assert_int_equal(tenant_keys_add(tenants, "acme", other),
+                   ERROR_INVALID_ARGUMENT);
+  assert_int_equal(tenant_keys_add(tenants, "globex", other),
+                   ERROR_INVALID_ARGUMENT);
+  assert_int_equal(tenant_keys_count(tenants), 1);
+  assert_ptr_equal(tenant_keys_find(tenants, "acme", 4, NULL), key);
+
+  // Keys that were refused are still owned by the caller
+  signing_key_destroy(other);
+  tenant_keys_destroy(tenants);
+
+  assert_null(tenant_keys_new(0));
+}
+
+// Test a table with many tenants, whose names are moved as the pool grows
+static void test_tenant_keys_many(void **state) {
+  (void)state; // Unused
+
+  enum { COUNT = 1000 };
+  tenant_keys *tenants = tenant_keys_new(COUNT);
+  assert_non_null(tenants);
+
+  char name[32];
+  for (int i = 0; i < COUNT; i++) {
+    snprintf(name, sizeof(name), "tenant-with-a-long-name-%d", i);
+    signing_key *key = signing_key_generate();
+    assert_non_null(key);
+    assert_int_equal(tenant_keys_add(tenants, name, key), SUCCESS);
+  }
+
+  for (int i = 0; i < COUNT; i++) {
+    snprintf(name, sizeof(name), "tenant-with-a-long-name-%d", i);
+    assert_ptr_equal(tenant_keys_find(tenants, name, strlen(name), NULL),
+                     tenant_keys_key(tenants, (size_t)i));
+    assert_string_equal(tenant_keys_name(tenants, (size_t)i), name);
+  }
+  assert_null(
+      tenant_keys_find(tenants, "tenant-with-a-long-name-1000", 28, NULL));
+
+  tenant_keys_destroy(tenants);
+}
+
+// Test the extraction of topic levels
+static void test_tenant_keys_topic_level(void **state) {
+  (void)state; // Unused
+
+  size_t length = 0;
+  const char *level = tenant_keys_topic_level("acme/site/1", 0, &length);
+  assert_int_equal(length, 4);
+  assert_memory_equal(level, "acme", 4);
+
+  level = tenant_keys_topic_level("acme/site/1", 1, &length);
+  assert_int_equal(length, 4);
+  assert_memory_equal(level, "site", 4);
+
+  level = tenant_keys_topic_level("acme/site/1", 2, &length);
+  assert_int_equal(length, 1);
+  assert_memory_equal(level, "1", 1);
+
+  level = tenant_keys_topic_level("/acme", 0, &length);
+  assert_int_equal(length, 0);
+
+  assert_null(tenant_keys_topic_level("acme/site/1", 3, &length));
+  assert_null(tenant_keys_topic_level("acme", 1, &length));
+}
+
+// Main function to run tests
+int main(void) {
+  if (sodium_init() == -1) {
+    return 1;
+  }
+
+  const struct CMUnitTest tests[] = {
+      cmocka_unit_test(test_tenant_keys_find),
+      cmocka_unit_test(test_tenant_keys_stored),
+      cmocka_unit_test(test_tenant_keys_derive_key),
+      cmocka_unit_test(test_tenant_keys_load_registered),
+      cmocka_unit_test(test_tenant_keys_invalid),
+      cmocka_unit_test(test_tenant_keys_many),
+      cmocka_unit_test(test_tenant_keys_topic_level),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,128 @@
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <cmocka.h>
+
+#include "topic_trie.h"
+
+static topic_trie *make_trie(const char *filters) {
+  topic_trie *trie = topic_trie_new();
+  assert_non_null(trie);
+  assert_int_equal(topic_trie_add_list(trie, filters), SUCCESS);
+  topic_trie_compile(trie);
+  return trie;
+}
+
+// Test exact filters
+static void test_topic_trie_exact(void **state) {
+  (void)state; // Unused
+
+  topic_trie *trie = make_trie("a/b a/c/d");
+
+  assert_true(topic_trie_matches(trie, "a/b"));
+  assert_true(topic_trie_matches(trie, "a/c/d"));
+  assert_false(topic_trie_matches(trie, "a"));
+  assert_false(topic_trie_matches(trie, "a/c"));
+  assert_false(topic_trie_matches(trie, "a/b/c"));
+  assert_false(topic_trie_matches(trie, "b"));
+
+  topic_trie_destroy(trie);
+}
+
+// Test the single level wildcard
+static void test_topic_trie_plus(void **state) {
+  (void)state; // Unused
+
+  topic_trie *trie = make_trie("tenant/+/telemetry");
+
+  assert_true(topic_trie_matches(trie, "tenant/1/telemetry"));
+  assert_true(topic_trie_matches(trie, "tenant//telemetry"));
+  assert_false(topic_trie_matches(trie, "tenant/1/2/telemetry"));
+  assert_false(topic_trie_matches(trie, "tenant/1"));
+
+  topic_trie_destroy(trie);
+}
+
+// Test the multi level wildcard
+static void test_topic_trie_hash(void **state) {
+  (void)state; // Unused
+
+  topic_trie *trie = make_trie("devices/#");
+
+  assert_true(topic_trie_matches(trie, "devices"));
+  assert_true(topic_trie_matches(trie, "devices/1"));
+  assert_true(topic_trie_matches(trie, "devices/1/2/3"));
+  assert_false(topic_trie_matches(trie, "device"));
+
+  topic_trie_destroy(trie);
+}
+
+// Test that wildcards at the first level do not match $ topics
+static void test_topic_trie_dollar_topics(void **state) {
+  (void)state; // Unused
+
+  topic_trie *trie = make_trie("# +/x");
+
+  assert_true(topic_trie_matches(trie, "a/b"));
+  assert_false(topic_trie_matches(trie, "$SYS/broker/uptime"));
+  assert_false(topic_trie_matches(trie, "$SYS/x"));
+
+  topic_trie_destroy(trie);
+
+  trie = make_trie("$SYS/#");
+  assert_true(topic_trie_matches(trie, "$SYS/broker/uptime"));
+
+  topic_trie_destroy(trie);
+}
+
+// Test many filters sharing prefixes
+static void test_topic_trie_many_filters(void **state) {
+  (void)state; // Unused
+
+  topic_trie *trie = topic_trie_new();
+  char filter[64];
+
+  for (int i = 0; i < 500; i++) {
+    snprintf(filter, sizeof(filter), "tenant/%d/+/data", i);
+    assert_int_equal(topic_trie_add(trie, filter, strlen(filter)), SUCCESS);
+  }
+  topic_trie_compile(trie);
+
+  assert_true(topic_trie_matches(trie, "tenant/0/sensor/data"));
+  assert_true(topic_trie_matches(trie, "tenant/499/sensor/data"));
+  assert_false(topic_trie_matches(trie, "tenant/500/sensor/data"));
+
+  topic_trie_destroy(trie);
+}
+
+// Test invalid filters
+static void test_topic_trie_invalid_filters(void **state) {
+  (void)state; // Unused
+
+  topic_trie *trie = topic_trie_new();
+
+  assert_int_equal(topic_trie_add(trie, "a/#/b", 5), ERROR_INVALID_ARGUMENT);
+  assert_int_equal(topic_trie_add(trie, "a/b+", 4), ERROR_INVALID_ARGUMENT);
+  assert_int_equal(topic_trie_add(trie, "a#", 2), ERROR_INVALID_ARGUMENT);
+  assert_int_equal(topic_trie_add(trie, "", 0), ERROR_INVALID_ARGUMENT);
+  assert_true(topic_trie_is_empty(trie));
+
+  topic_trie_destroy(trie);
+}
+
+// Main function to run tests
+int main(void) {
+  const struct CMUnitTest tests[] = {
+      cmocka_unit_test(test_topic_trie_exact),
+      cmocka_unit_test(test_topic_trie_plus),
+      cmocka_unit_test(test_topic_trie_hash),
+      cmocka_unit_test(test_topic_trie_dollar_topics),
+      cmocka_unit_test(test_topic_trie_many_filters),
+      cmocka_unit_test(test_topic_trie_invalid_filters),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -1,6 +1,7 @@
 #include <setjmp.h>
 #include <stdarg.h>
 #include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <cmocka.h>
@@ -13,6 +14,21 @@
 // Mock private key for testing (normally you'd load this securely)
 static unsigned char test_private_key[crypto_sign_SECRETKEYBYTES];
 static unsigned char test_public_key[crypto_sign_PUBLICKEYBYTES];
+static signing_context test_signer;
+
+// Ingestion time 1234 encoded on 64 bits, like cbor_build_uint64 does
+static const uint8_t TEST_INGESTION_TIME[] = {0x1b, 0, 0, 0, 0,
+                                              0,    0, 0x04, 0xd2};
+
+// Key id appended to signed messages
+static const uint8_t TEST_KEY_ID[] = {1, 2, 3, 4, 5, 6, 7, 8};
+
+// Helper function to encode a text map key
+static cbor_splice_key text_key(const char *text) {
+  cbor_splice_key key;
+  assert_true(cbor_splice_key_text(&key, text));
+  return key;
+}
 
 // Helper function to initialize libsodium and generate a test key pair
 static void initialize_test_keys(void) {
@@ -21,6 +37,8 @@ static void initialize_test_keys(void) {
   }
 
   crypto_sign_keypair(test_public_key, test_private_key);
+  signing_context_init(&test_signer, test_private_key,
+                       SIGNING_ALGORITHM_ED25519);
 }
 
 // Test when all arguments are valid
@@ -35,8 +53,8 @@ static void test_utils_make_signed_cbor_message_success(void **state) {
                (struct cbor_pair){.key = cbor_build_string("message"),
                                   .value = cbor_build_string("Hello, World!")});
 
-  error_code result = utils_make_signed_cbor_message(
-      map, (const char *)test_private_key, "signature");
+  error_code result =
+      utils_make_signed_cbor_message(map, &test_signer, "signature");
 
   assert_int_equal(result, SUCCESS);
 
@@ -70,14 +88,14 @@ static void test_utils_make_signed_cbor_message_null_cbor_map(void **state) {
 
   initialize_test_keys();
 
-  error_code result = utils_make_signed_cbor_message(
-      NULL, (const char *)test_private_key, "signature");
+  error_code result =
+      utils_make_signed_cbor_message(NULL, &test_signer, "signature");
 
   assert_int_equal(result, ERROR_INVALID_ARGUMENT);
 }
 
-// Test when private_key is NULL
-static void test_utils_make_signed_cbor_message_null_private_key(void **state) {
+// Test when signer is NULL
+static void test_utils_make_signed_cbor_message_null_signer(void **state) {
   (void)state; // Unused
 
   // Create a sample CBOR map
@@ -108,7 +126,7 @@ test_utils_make_signed_cbor_message_null_signature_key(void **state) {
                                   .value = cbor_build_string("Hello, World!")});
 
   error_code result =
-      utils_make_signed_cbor_message(map, (const char *)test_private_key, NULL);
+      utils_make_signed_cbor_message(map, &test_signer, NULL);
 
   assert_int_equal(result, ERROR_INVALID_ARGUMENT);
 
@@ -126,8 +144,8 @@ test_utils_make_signed_cbor_message_invalid_cbor_type(void **state) {
   // Create a CBOR string instead of a map
   cbor_item_t *str_item = cbor_build_string("Not a map");
 
-  error_code result = utils_make_signed_cbor_message(
-      str_item, (const char *)test_private_key, "signature");
+  error_code result =
+      utils_make_signed_cbor_message(str_item, &test_signer, "signature");
 
   assert_int_equal(result, ERROR_INVALID_ARGUMENT);
 
@@ -154,7 +172,7 @@ test_utils_make_signed_cbor_message_signature_correctness(void **state) {
   serialized_size = cbor_serialize_alloc(map, &sermap, &serialized_size);
 
   error_code result =
-      utils_make_signed_cbor_message(map, test_private_key, "signature");
+      utils_make_signed_cbor_message(map, &test_signer, "signature");
   assert_int_equal(result, SUCCESS);
 
   // Find the signature in the map
@@ -190,6 +208,279 @@ test_utils_make_signed_cbor_message_signature_correctness(void **state) {
   free(sermap);
 }
 
+// Test that splicing produces the same bytes as the CBOR tree path
+static void test_utils_splice_signed_cbor_message_matches_tree(void **state) {
+  (void)state; // Unused
+
+  initialize_test_keys();
+
+  cbor_item_t *map = cbor_new_indefinite_map();
+  cbor_map_add(map,
+               (struct cbor_pair){.key = cbor_build_string("message"),
+                                  .value = cbor_build_string("Hello, World!")});
+  cbor_map_add(map, (struct cbor_pair){.key = cbor_build_string("value"),
+                                       .value = cbor_build_uint64(70000)});
+
+  unsigned char *payload = NULL;
+  size_t payload_size = 0;
+  payload_size = cbor_serialize_alloc(map, &payload, &payload_size);
+
+  // Tree path
+  cbor_map_add(map,
+               (struct cbor_pair){.key = cbor_build_string("INGESTION_TIME"),
+                                  .value = cbor_build_uint64(1234)});
+  cbor_map_add(map, (struct cbor_pair){
+                        .key = cbor_build_string("KEY_ID"),
+                        .value = cbor_build_bytestring(TEST_KEY_ID,
+                                                       sizeof(TEST_KEY_ID))});
+  error_code result =
+      utils_make_signed_cbor_message(map, &test_signer, "signature");
+  assert_int_equal(result, SUCCESS);
+
+  unsigned char *expected = NULL;
+  size_t expected_size = 0;
+  expected_size = cbor_serialize_alloc(map, &expected, &expected_size);
+
+  // Splice path
+  cbor_splice_key ingestion_time_key = text_key("INGESTION_TIME");
+  cbor_splice_key key_id_key = text_key("KEY_ID");
+  cbor_splice_key signature_key = text_key("signature");
+  size_t out_size = utils_splice_signed_cbor_message_size(
+      payload_size, &ingestion_time_key, sizeof(TEST_INGESTION_TIME),
+      &key_id_key, sizeof(TEST_KEY_ID), &signature_key);
+  assert_int_equal(out_size, expected_size);
+
+  uint8_t *out = malloc(out_size);
+  result = utils_splice_signed_cbor_message(
+      payload, payload_size, &ingestion_time_key, TEST_INGESTION_TIME,
+      sizeof(TEST_INGESTION_TIME), &key_id_key, TEST_KEY_ID,
+      sizeof(TEST_KEY_ID), &test_signer, &signature_key, out, out_size);
+  assert_int_equal(result, SUCCESS);
+  assert_memory_equal(out, expected, expected_size);
+
+  // Clean up
+  cbor_decref(&map);
+  free(payload);
+  free(expected);
+  free(out);
+}
+
+// Test when the payload is not an indefinite map
+static void test_utils_splice_signed_cbor_message_not_indefinite(void **state) {
+  (void)state; // Unused
+
+  initialize_test_keys();
+
+  // Definite map with one pair {"a": 1}
+  const uint8_t payload[] = {0xa1, 0x61, 0x61, 0x01};
+  uint8_t out[256];
+  cbor_splice_key ingestion_time_key = text_key("INGESTION_TIME");
+  cbor_splice_key key_id_key = text_key("KEY_ID");
+  cbor_splice_key signature_key = text_key("signature");
+
+  error_code result = utils_splice_signed_cbor_message(
+      payload, sizeof(payload), &ingestion_time_key, TEST_INGESTION_TIME,
+      sizeof(TEST_INGESTION_TIME), &key_id_key, TEST_KEY_ID,
+      sizeof(TEST_KEY_ID), &test_signer, &signature_key, out,
+      sizeof(out));
+
+  assert_int_equal(result, ERROR_INVALID_ARGUMENT);
+}
+
+// Test when the output buffer is too small
+static void test_utils_splice_signed_cbor_message_small_buffer(void **state) {
+  (void)state; // Unused
+
+  initialize_test_keys();
+
+  // Indefinite map with one pair {_ "a": 1}
+  const uint8_t payload[] = {0xbf, 0x61, 0x61, 0x01, 0xff};
+  uint8_t out[32];
+  cbor_splice_key ingestion_time_key = text_key("INGESTION_TIME");
+  cbor_splice_key key_id_key = text_key("KEY_ID");
+  cbor_splice_key signature_key = text_key("signature");
+
+  error_code result = utils_splice_signed_cbor_message(
+      payload, sizeof(payload), &ingestion_time_key, TEST_INGESTION_TIME,
+      sizeof(TEST_INGESTION_TIME), &key_id_key, TEST_KEY_ID,
+      sizeof(TEST_KEY_ID), &test_signer, &signature_key, out,
+      sizeof(out));
+
+  assert_int_equal(result, ERROR_INVALID_ARGUMENT);
+}
+
+// Test that the chain link covers the previous link and the message
+static void test_utils_splice_chained_cbor_message_link(void **state) {
+  (void)state; // Unused
+
+  initialize_test_keys();
+
+  hash_chain chain;
+  hash_chain_init(&chain, test_public_key, sizeof(test_public_key));
+
+  uint8_t genesis[HASH_CHAIN_LINK_BYTES];
+  memcpy(genesis, chain.head, HASH_CHAIN_LINK_BYTES);
+
+  // Indefinite map with one pair {_ "a": 1}
+  const uint8_t payload[] = {0xbf, 0x61, 0x61, 0x01, 0xff};
+
+  cbor_splice_key ingestion_time_key = text_key("INGESTION_TIME");
+  cbor_splice_key sequence_key = text_key("CHAIN_SEQUENCE");
+  cbor_splice_key link_key = text_key("CHAIN_LINK");
+
+  size_t out_size = utils_splice_chained_cbor_message_size(
+      sizeof(payload), &ingestion_time_key, sizeof(TEST_INGESTION_TIME),
+      &sequence_key, &link_key);
+  uint8_t *out = malloc(out_size);
+
+  error_code result = utils_splice_chained_cbor_message(
+      payload, sizeof(payload), &ingestion_time_key, TEST_INGESTION_TIME,
+      sizeof(TEST_INGESTION_TIME), &chain, &sequence_key, &link_key, out,
+      out_size);
+  assert_int_equal(result, SUCCESS);
+  assert_int_equal(chain.sequence, 1);
+  assert_int_equal(hash_chain_pending(&chain), 1);
+
+  // The link is appended as the last pair: key, byte string head, link, break
+  size_t link_pair_size = 1 + strlen("CHAIN_LINK") + 2 + HASH_CHAIN_LINK_BYTES;
+  size_t chained_size = out_size - 1 - link_pair_size;
+
+  uint8_t *chained = malloc(chained_size + 1);
+  memcpy(chained, out, chained_size);
+  chained[chained_size] = 0xff;
+
+  uint8_t expected[HASH_CHAIN_LINK_BYTES];
+  crypto_generichash_state hash_state;
+  crypto_generichash_init(&hash_state, NULL, 0, HASH_CHAIN_LINK_BYTES);
+  crypto_generichash_update(&hash_state, genesis, HASH_CHAIN_LINK_BYTES);
+  crypto_generichash_update(&hash_state, chained, chained_size + 1);
+  crypto_generichash_final(&hash_state, expected, HASH_CHAIN_LINK_BYTES);
+
+  assert_memory_equal(chain.head, expected, HASH_CHAIN_LINK_BYTES);
+  assert_memory_equal(out + out_size - 1 - HASH_CHAIN_LINK_BYTES, expected,
+                      HASH_CHAIN_LINK_BYTES);
+  assert_int_equal(out[out_size - 1], 0xff);
+
+  // Clean up
+  free(chained);
+  free(out);
+}
+
+// Test that integer keys are encoded as negative integers
+static void test_utils_splice_signed_cbor_message_integer_keys(void **state) {
+  (void)state; // Unused
+
+  initialize_test_keys();
+
+  // Indefinite map with one pair {_ "a": 1}
+  const uint8_t payload[] = {0xbf, 0x61, 0x61, 0x01, 0xff};
+
+  cbor_splice_key ingestion_time_key;
+  cbor_splice_key key_id_key;
+  cbor_splice_key signature_key;
+  cbor_splice_key_int(&ingestion_time_key, -1);
+  cbor_splice_key_int(&key_id_key, -5);
+  cbor_splice_key_int(&signature_key, -2);
+  assert_int_equal(ingestion_time_key.size, 1);
+  assert_int_equal(ingestion_time_key.data[0], 0x20);
+  assert_int_equal(key_id_key.data[0], 0x24);
+  assert_int_equal(signature_key.data[0], 0x21);
+
+  size_t out_size = utils_splice_signed_cbor_message_size(
+      sizeof(payload), &ingestion_time_key, sizeof(TEST_INGESTION_TIME),
+      &key_id_key, sizeof(TEST_KEY_ID), &signature_key);
+  assert_int_equal(out_size, sizeof(payload) + 1 +
+                                 sizeof(TEST_INGESTION_TIME) + 1 + 1 +
+                                 sizeof(TEST_KEY_ID) + 1 + 2 +
+                                 crypto_sign_BYTES);
+
+  uint8_t *out = malloc(out_size);
+  error_code result = utils_splice_signed_cbor_message(
+      payload, sizeof(payload), &ingestion_time_key, TEST_INGESTION_TIME,
+      sizeof(TEST_INGESTION_TIME), &key_id_key, TEST_KEY_ID,
+      sizeof(TEST_KEY_ID), &test_signer, &signature_key, out, out_size);
+  assert_int_equal(result, SUCCESS);
+
+  // Ingestion time, key id byte string, then the signature
+  const uint8_t *pairs = out + sizeof(payload) - 1;
+  assert_int_equal(pairs[0], 0x20);
+  pairs += 1 + sizeof(TEST_INGESTION_TIME);
+  assert_int_equal(pairs[0], 0x24);
+  assert_int_equal(pairs[1], 0x48);
+  assert_memory_equal(pairs + 2, TEST_KEY_ID, sizeof(TEST_KEY_ID));
+  assert_int_equal(pairs[2 + sizeof(TEST_KEY_ID)], 0x21);
+
+  free(out);
+}
+
+// Test the layout and the signature of a COSE_Sign1 message
+static void test_utils_splice_cose_sign1_message(void **state) {
+  (void)state; // Unused
+
+  initialize_test_keys();
+
+  // Indefinite map with one pair {_ "a": 1}
+  const uint8_t payload[] = {0xbf, 0x61, 0x61, 0x01, 0xff};
+  const uint8_t key_id[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+
+  cbor_splice_key ingestion_time_key;
+  cbor_splice_key_int(&ingestion_time_key, -1);
+
+  size_t out_size = utils_splice_cose_sign1_message_size(
+      sizeof(payload), &ingestion_time_key, sizeof(TEST_INGESTION_TIME),
+      sizeof(key_id));
+  uint8_t *out = malloc(out_size);
+
+  error_code result = utils_splice_cose_sign1_message(
+      payload, sizeof(payload), &ingestion_time_key, TEST_INGESTION_TIME,
+      sizeof(TEST_INGESTION_TIME), &test_signer, key_id, sizeof(key_id),
+      out, out_size);
+  assert_int_equal(result, SUCCESS);
+
+  // Tag 18, array of 4, protected {1: -8}, unprotected {4: key id}
+  const uint8_t prefix[] = {0xd2, 0x84, 0x43, 0xa1, 0x01, 0x27, 0xa1,
+                            0x04, 0x48, 1,    2,    3,    4,    5,
+                            6,    7,    8};
+  assert_memory_equal(out, prefix, sizeof(prefix));
+
+  // Payload byte string: the map with the ingestion time
+  size_t map_size = sizeof(payload) + 1 + sizeof(TEST_INGESTION_TIME);
+  const uint8_t *map = out + sizeof(prefix) + 1;
+  assert_int_equal(out[sizeof(prefix)], 0x40 + map_size);
+  assert_memory_equal(map, payload, sizeof(payload) - 1);
+  assert_int_equal(map[sizeof(payload) - 1], 0x20);
+  assert_int_equal(map[map_size - 1], 0xff);
+
+  // Signature byte string over the Sig_structure
+  const uint8_t *signature = map + map_size + 2;
+  assert_int_equal(map[map_size], 0x58);
+  assert_int_equal(map[map_size + 1], crypto_sign_BYTES);
+  assert_int_equal(signature + crypto_sign_BYTES - out, out_size);
+
+  const uint8_t sig_prefix[] = {0x84, 0x6a, 'S',  'i',  'g',  'n',
+                                'a',  't',  'u',  'r',  'e',  '1',
+                                0x43, 0xa1, 0x01, 0x27, 0x40};
+  size_t sig_structure_size = sizeof(sig_prefix) + 1 + map_size;
+  uint8_t *sig_structure = malloc(sig_structure_size);
+  memcpy(sig_structure, sig_prefix, sizeof(sig_prefix));
+  memcpy(sig_structure + sizeof(sig_prefix), out + sizeof(prefix),
+         1 + map_size);
+  assert_int_equal(crypto_sign_verify_detached(signature, sig_structure,
+                                               sig_structure_size,
+                                               test_public_key),
+                   0);
+
+  // The key id must leave room for the Sig_structure
+  result = utils_splice_cose_sign1_message(
+      payload, sizeof(payload), &ingestion_time_key, TEST_INGESTION_TIME,
+      sizeof(TEST_INGESTION_TIME), &test_signer, key_id, 4, out,
+      out_size);
+  assert_int_equal(result, ERROR_INVALID_ARGUMENT);
+
+  free(sig_structure);
+  free(out);
+}
+
 static void test_utils_iso_timestamp(void **state) {
   uint64_t unix_seconds = 1733393632;
   char iso_string[64];
@@ -202,11 +493,17 @@ int main(void) {
   const struct CMUnitTest tests[] = {
       cmocka_unit_test(test_utils_make_signed_cbor_message_success),
       cmocka_unit_test(test_utils_make_signed_cbor_message_null_cbor_map),
-      cmocka_unit_test(test_utils_make_signed_cbor_message_null_private_key),
+      cmocka_unit_test(test_utils_make_signed_cbor_message_null_signer),
       cmocka_unit_test(test_utils_make_signed_cbor_message_null_signature_key),
       cmocka_unit_test(test_utils_make_signed_cbor_message_invalid_cbor_type),
       cmocka_unit_test(
           test_utils_make_signed_cbor_message_signature_correctness),
+      cmocka_unit_test(test_utils_splice_signed_cbor_message_matches_tree),
+      cmocka_unit_test(test_utils_splice_signed_cbor_message_not_indefinite),
+      cmocka_unit_test(test_utils_splice_signed_cbor_message_small_buffer),
+      cmocka_unit_test(test_utils_splice_chained_cbor_message_link),
+      cmocka_unit_test(test_utils_splice_signed_cbor_message_integer_keys),
+      cmocka_unit_test(test_utils_splice_cose_sign1_message),
       cmocka_unit_test(test_utils_iso_timestamp),
   };
 
@@ -0,0 +1,520 @@
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cmocka.h>
+
+#include <sodium.h>
+
+#include "signing_key.h"
+#include "utils.h"
+#include "verifier.h"
+
+// Indefinite map with one pair {_ "a": 1}
+static const uint8_t TEST_PAYLOAD[] = {0xbf, 0x61, 0x61, 0x01, 0xff};
+
+// Ingestion time 1234 encoded on 64 bits
+static const uint8_t TEST_INGESTION_TIME[] = {0x1b, 0, 0, 0, 0,
+                                              0,    0, 0x04, 0xd2};
+
+// Helper function to sign the test payload as a map with text or integer keys
+static uint8_t *sign_map(const signing_key *key, bool integer_keys,
+                         size_t *size) {
+  cbor_splice_key ingestion_time_key;
+  cbor_splice_key key_id_key;
+  cbor_splice_key signature_key;
+  if (integer_keys) {
+    cbor_splice_key_int(&ingestion_time_key, -1);
+    cbor_splice_key_int(&key_id_key, -5);
+    cbor_splice_key_int(&signature_key, -2);
+  } else {
+    assert_true(cbor_splice_key_text(&ingestion_time_key, "INGESTION_TIME"));
+    assert_true(cbor_splice_key_text(&key_id_key, "KEY_ID"));
+    assert_true(cbor_splice_key_text(&signature_key, "VERIFICATION_TOKEN"));
+  }
+
+  *size = utils_splice_signed_cbor_message_size(
+      sizeof(TEST_PAYLOAD), &ingestion_time_key, sizeof(TEST_INGESTION_TIME),
+      &key_id_key, SIGNING_KEY_ID_BYTES, &signature_key);
+  uint8_t *out = malloc(*size);
+  assert_int_equal(utils_splice_signed_cbor_message(
+                       TEST_PAYLOAD, sizeof(TEST_PAYLOAD), &ingestion_time_key,
+                       TEST_INGESTION_TIME, sizeof(TEST_INGESTION_TIME),
+                       &key_id_key, key->key_id, SIGNING_KEY_ID_BYTES,
+                       &key->context, &signature_key, out, *size),
+                   SUCCESS);
+  return out;
+}
+
+// Helper function to sign the test payload as a map without key id, like
+// messages signed before key ids were added
+static uint8_t *sign_map_without_key_id(const signing_key *key,
+                                        size_t *size) {
+  // {_ "a": 1, -1: 1234} then -2: signature
+  size_t prefix_size = sizeof(TEST_PAYLOAD) - 1;
+  size_t signed_size = prefix_size + 1 + sizeof(TEST_INGESTION_TIME);
+  *size = signed_size + 1 + 2 + crypto_sign_BYTES + 1;
+  uint8_t *out = malloc(*size);
+
+  memcpy(out, TEST_PAYLOAD, prefix_size);
+  out[prefix_size] = 0x20;
+  memcpy(out + prefix_size + 1, TEST_INGESTION_TIME,
+         sizeof(TEST_INGESTION_TIME));
+  out[signed_size] = 0xff;
+  crypto_sign_detached(out + signed_size + 3, NULL, out, signed_size + 1,
+                       key->private_key);
+
+  out[signed_size] = 0x21;
+  out[signed_size + 1] = 0x58;
+  out[signed_size + 2] = crypto_sign_BYTES;
+  out[*size - 1] = 0xff;
+  return out;
+}
+
+// Helper function to sign the test payload as a COSE_Sign1 message
+static uint8_t *sign_cose(const signing_key *key, size_t *size) {
+  cbor_splice_key ingestion_time_key;
+  cbor_splice_key_int(&ingestion_time_key, -1);
+
+  *size = utils_splice_cose_sign1_message_size(
+      sizeof(TEST_PAYLOAD), &ingestion_time_key, sizeof(TEST_INGESTION_TIME),
+      SIGNING_KEY_ID_BYTES);
+  uint8_t *out = malloc(*size);
+  assert_int_equal(utils_splice_cose_sign1_message(
+                       TEST_PAYLOAD, sizeof(TEST_PAYLOAD), &ingestion_time_key,
+                       TEST_INGESTION_TIME, sizeof(TEST_INGESTION_TIME),
+                       &key->context, key->key_id, SIGNING_KEY_ID_BYTES,
+                       out, *size),
+                   SUCCESS);
+  return out;
+}
+
+// Helper function to countersign a signed map, as the core broker of a
+// bridge does
+static uint8_t *countersign(const signing_key *key, const uint8_t *map,
+                            size_t map_size, bool integer_keys,
+                            size_t *size) {
+  cbor_splice_key countersignature_key;
+  if (integer_keys) {
+    cbor_splice_key_int(&countersignature_key, -6);
+  } else {
+    assert_true(
+        cbor_splice_key_text(&countersignature_key, "COUNTERSIGNATURE"));
+  }
+
+  detached_signature countersignature = {.ingestion_time = 5678};
+  memcpy(countersignature.key_id, key->key_id, SIGNING_KEY_ID_BYTES);
+
+  *size = utils_splice_countersigned_cbor_message_size(map_size,
+                                                       &countersignature_key);
+  uint8_t *out = malloc(*size);
+  assert_int_equal(utils_splice_countersigned_cbor_message(
+                       map, map_size, &countersignature, &key->context,
+                       &countersignature_key, out, *size),
+                   SUCCESS);
+  return out;
+}
+
+// Helper function to sign a payload with the properties envelope, the
+// signature being read back from the text of its properties
+static void sign_detached(const signing_key *key, const char *topic,
+                          const uint8_t *payload, size_t size,
+                          detached_signature *out) {
+  detached_signature signature = {.ingestion_time = 1234};
+  memcpy(signature.key_id, key->key_id, SIGNING_KEY_ID_BYTES);
+
+  detached_signature_input input;
+  detached_signature_input_init(&input, topic, &signature, payload, size);
+  assert_int_equal(signing_context_sign_parts(&key->context, input.parts,
+                                              DETACHED_SIGNATURE_PARTS,
+                                              signature.signature),
+                   SUCCESS);
+
+  char time[DETACHED_SIGNATURE_TIME_TEXT_SIZE];
+  char key_id[DETACHED_SIGNATURE_KEY_ID_TEXT_SIZE];
+  char token[DETACHED_SIGNATURE_TOKEN_TEXT_SIZE];
+  detached_signature_format(&signature, time, key_id, token);
+
+  memset(out, 0, sizeof(*out));
+  assert_true(detached_signature_read_property(
+      out, DETACHED_SIGNATURE_TIME_PROPERTY, time));
+  assert_true(detached_signature_read_property(
+      out, DETACHED_SIGNATURE_KEY_ID_PROPERTY, key_id));
+  assert_true(detached_signature_read_property(
+      out, DETACHED_SIGNATURE_TOKEN_PROPERTY, token));
+}
+
+static void cache_keys(verifier_key_cache *cache, signing_key **keys,
+                       size_t count) {
+  verifier_key_cache_init(cache);
+  for (size_t i = 0; i < count; i++) {
+    assert_int_equal(
+        verifier_key_cache_add(cache, keys[i]->public_key_hex, 1700000000,
+                               SIGNING_ALGORITHM_ED25519),
+        SUCCESS);
+  }
+  verifier_key_cache_seal(cache);
+}
+
+// Test the lookup of keys by key id
+static void test_verifier_key_cache(void **state) {
+  (void)state; // Unused
+
+  signing_key *keys[3] = {signing_key_generate(), signing_key_generate(),
+                          signing_key_generate()};
+  verifier_key_cache cache;
+  cache_keys(&cache, keys, 3);
+
+  // Duplicates are removed when sealing
+  assert_int_equal(verifier_key_cache_add(&cache, keys[0]->public_key_hex, 0,
+                                          SIGNING_ALGORITHM_ED25519),
+                   SUCCESS);
+  verifier_key_cache_seal(&cache);
+  assert_int_equal(cache.count, 3);
+
+  for (size_t i = 0; i < 3; i++) {
+    const verifier_key *key = verifier_key_cache_find(&cache, keys[i]->key_id);
+    assert_non_null(key);
+    assert_memory_equal(key->public_key, keys[i]->public_key,
+                        SIGNING_KEY_PUBLIC_BYTES);
+  }
+
+  const uint8_t unknown[SIGNING_KEY_ID_BYTES] = {0};
+  assert_null(verifier_key_cache_find(&cache, unknown));
+  assert_int_equal(verifier_key_cache_add(&cache, "not hex", 0,
+                                          SIGNING_ALGORITHM_ED25519),
+                   ERROR_INVALID_ARGUMENT);
+
+  // MAC keys cannot be verified with a public key
+  assert_int_equal(verifier_key_cache_add(&cache, keys[0]->public_key_hex, 0,
+                                          SIGNING_ALGORITHM_BLAKE2B_MAC),
+                   ERROR_INVALID_ARGUMENT);
+
+  verifier_key_cache_destroy(&cache);
+  for (size_t i = 0; i < 3; i++) {
+    signing_key_destroy(keys[i]);
+  }
+}
+
+// Test every envelope signed by the second of two keys
+static void test_verifier_verify_envelopes(void **state) {
+  (void)state; // Unused
+
+  signing_key *keys[2] = {signing_key_generate(), signing_key_generate()};
+  verifier_key_cache cache;
+  cache_keys(&cache, keys, 2);
+
+  verifier verifier;
+  verifier_init(&verifier, &cache);
+
+  size_t size = 0;
+  uint8_t *text_map = sign_map(keys[1], false, &size);
+  assert_int_equal(verifier_verify(&verifier, text_map, size), VERIFY_OK);
+
+  // A flipped payload byte breaks the signature
+  text_map[2] ^= 1;
+  assert_int_equal(verifier_verify(&verifier, text_map, size),
+                   VERIFY_BAD_SIGNATURE);
+  free(text_map);
+
+  uint8_t *integer_map = sign_map(keys[1], true, &size);
+  assert_int_equal(verifier_verify(&verifier, integer_map, size), VERIFY_OK);
+
+  uint8_t key_id[SIGNING_KEY_ID_BYTES];
+  assert_true(verifier_message_key_id(integer_map, size, key_id));
+  assert_memory_equal(key_id, keys[1]->key_id, SIGNING_KEY_ID_BYTES);
+  assert_int_equal(verifier_verify(&verifier, integer_map, size - 1),
+                   VERIFY_MALFORMED);
+  free(integer_map);
+
+  uint8_t *legacy_map = sign_map_without_key_id(keys[1], &size);
+  assert_int_equal(verifier_verify(&verifier, legacy_map, size), VERIFY_OK);
+  assert_false(verifier_message_key_id(legacy_map, size, key_id));
+  free(legacy_map);
+
+  uint8_t *cose = sign_cose(keys[1], &size);
+  assert_int_equal(verifier_verify(&verifier, cose, size), VERIFY_OK);
+  assert_true(verifier_message_key_id(cose, size, key_id));
+  assert_memory_equal(key_id, keys[1]->key_id, SIGNING_KEY_ID_BYTES);
+  cose[size - 1] ^= 1;
+  assert_int_equal(verifier_verify(&verifier, cose, size),
+                   VERIFY_BAD_SIGNATURE);
+  free(cose);
+
+  assert_int_equal(verifier_verify(&verifier, TEST_PAYLOAD,
+                                   sizeof(TEST_PAYLOAD)),
+                   VERIFY_MALFORMED);
+
+  verifier_destroy(&verifier);
+  verifier_key_cache_destroy(&cache);
+  signing_key_destroy(keys[0]);
+  signing_key_destroy(keys[1]);
+}
+
+// Test messages signed by a key missing from the cache
+static void test_verifier_verify_unknown_key(void **state) {
+  (void)state; // Unused
+
+  signing_key *known = signing_key_generate();
+  signing_key *unknown = signing_key_generate();
+  verifier_key_cache cache;
+  cache_keys(&cache, &known, 1);
+
+  verifier verifier;
+  verifier_init(&verifier, &cache);
+
+  size_t size = 0;
+  uint8_t *cose = sign_cose(unknown, &size);
+  assert_int_equal(verifier_verify(&verifier, cose, size), VERIFY_UNKNOWN_KEY);
+  free(cose);
+
+  uint8_t *map = sign_map(unknown, false, &size);
+  assert_int_equal(verifier_verify(&verifier, map, size), VERIFY_UNKNOWN_KEY);
+  free(map);
+
+  // Without key id, every key is tried
+  map = sign_map_without_key_id(unknown, &size);
+  assert_int_equal(verifier_verify(&verifier, map, size),
+                   VERIFY_BAD_SIGNATURE);
+  free(map);
+
+  verifier_destroy(&verifier);
+  verifier_key_cache_destroy(&cache);
+  signing_key_destroy(known);
+  signing_key_destroy(unknown);
+}
+
+// Test maps signed with the ED25519ph and MAC algorithms
+static void test_verifier_verify_algorithms(void **state) {
+  (void)state; // Unused
+
+  signing_key *prehashed = signing_key_generate();
+  signing_key *mac = signing_key_generate();
+  signing_key_set_algorithm(prehashed, SIGNING_ALGORITHM_ED25519PH);
+  signing_key_set_algorithm(mac, SIGNING_ALGORITHM_BLAKE2B_MAC);
+
+  verifier_key_cache cache;
+  verifier_key_cache_init(&cache);
+  assert_int_equal(verifier_key_cache_add(&cache, prehashed->public_key_hex, 0,
+                                          SIGNING_ALGORITHM_ED25519PH),
+                   SUCCESS);
+  assert_int_equal(verifier_key_cache_add_signing_key(&cache, mac), SUCCESS);
+  verifier_key_cache_seal(&cache);
+
+  verifier verifier;
+  verifier_init(&verifier, &cache);
+
+  size_t size = 0;
+  uint8_t *map = sign_map(prehashed, true, &size);
+  assert_int_equal(verifier_verify(&verifier, map, size), VERIFY_OK);
+  free(map);
+
+  map = sign_map(mac, false, &size);
+  assert_int_equal(verifier_verify(&verifier, map, size), VERIFY_OK);
+  map[2] ^= 1;
+  assert_int_equal(verifier_verify(&verifier, map, size),
+                   VERIFY_BAD_SIGNATURE);
+  free(map);
+
+  verifier_destroy(&verifier);
+  verifier_key_cache_destroy(&cache);
+
+  // The public key of a MAC key does not verify its messages
+  verifier_key_cache_init(&cache);
+  assert_int_equal(verifier_key_cache_add(&cache, mac->public_key_hex, 0,
+                                          SIGNING_ALGORITHM_ED25519),
+                   SUCCESS);
+  verifier_key_cache_seal(&cache);
+  verifier_init(&verifier, &cache);
+
+  map = sign_map(mac, true, &size);
+  assert_int_equal(verifier_verify(&verifier, map, size),
+                   VERIFY_BAD_SIGNATURE);
+  free(map);
+
+  verifier_destroy(&verifier);
+  verifier_key_cache_destroy(&cache);
+  signing_key_destroy(prehashed);
+  signing_key_destroy(mac);
+}
+
+// Test payloads signed with the properties envelope
+static void test_verifier_verify_detached(void **state) {
+  (void)state; // Unused
+
+  // Not a CBOR map, the payload is opaque
+  static const uint8_t payload[] = "{\"a\": 1}";
+  signing_key *keys[SIGNING_ALGORITHM_COUNT];
+  verifier_key_cache cache;
+  verifier_key_cache_init(&cache);
+  for (int i = 0; i < SIGNING_ALGORITHM_COUNT; i++) {
+    keys[i] = signing_key_generate();
+    signing_key_set_algorithm(keys[i], (signing_algorithm)i);
+    assert_int_equal(verifier_key_cache_add_signing_key(&cache, keys[i]),
+                     SUCCESS);
+  }
+  verifier_key_cache_seal(&cache);
+
+  verifier verifier;
+  verifier_init(&verifier, &cache);
+
+  detached_signature signature;
+  for (int i = 0; i < SIGNING_ALGORITHM_COUNT; i++) {
+    sign_detached(keys[i], "a/b", payload, sizeof(payload), &signature);
+    assert_int_equal(verifier_verify_detached(&verifier, "a/b", payload,
+                                              sizeof(payload), &signature),
+                     VERIFY_OK);
+
+    // The topic and the ingestion time are signed with the payload
+    assert_int_equal(verifier_verify_detached(&verifier, "a/c", payload,
+                                              sizeof(payload), &signature),
+                     VERIFY_BAD_SIGNATURE);
+    signature.ingestion_time++;
+    assert_int_equal(verifier_verify_detached(&verifier, "a/b", payload,
+                                              sizeof(payload), &signature),
+                     VERIFY_BAD_SIGNATURE);
+  }
+
+  // Empty payloads are signed too
+  sign_detached(keys[0], "a", NULL, 0, &signature);
+  assert_int_equal(verifier_verify_detached(&verifier, "a", NULL, 0,
+                                            &signature),
+                   VERIFY_OK);
+
+  signature.key_id[0] ^= 1;
+  assert_int_equal(verifier_verify_detached(&verifier, "a", NULL, 0,
+                                            &signature),
+                   VERIFY_UNKNOWN_KEY);
+
+  signature.present = 0;
+  assert_int_equal(verifier_verify_detached(&verifier, "a", NULL, 0,
+                                            &signature),
+                   VERIFY_MALFORMED);
+
+  verifier_destroy(&verifier);
+  verifier_key_cache_destroy(&cache);
+  for (int i = 0; i < SIGNING_ALGORITHM_COUNT; i++) {
+    signing_key_destroy(keys[i]);
+  }
+}
+
+// Test maps signed by an edge broker and countersigned by a core broker
+static void test_verifier_verify_countersigned(void **state) {
+  (void)state; // Unused
+
+  signing_key *keys[2] = {signing_key_generate(), signing_key_generate()};
+  verifier_key_cache cache;
+  cache_keys(&cache, keys, 2);
+
+  verifier verifier;
+  verifier_init(&verifier, &cache);
+
+  for (int integer_keys = 0; integer_keys <= 1; integer_keys++) {
+    size_t map_size = 0;
+    uint8_t *map = sign_map(keys[0], integer_keys, &map_size);
+    size_t size = 0;
+    uint8_t *countersigned =
+        countersign(keys[1], map, map_size, integer_keys, &size);
+
+    // The signed map is kept as is, the countersignature pair is appended
+    assert_memory_equal(countersigned, map, map_size - 1);
+    assert_int_equal(countersigned[size - 1], 0xff);
+    assert_true(verifier_is_signed_map(map, map_size));
+    assert_true(verifier_is_signed_map(countersigned, size));
+    assert_int_equal(verifier_verify(&verifier, countersigned, size),
+                     VERIFY_OK);
+
+    // Both keys are needed, there is no single key id to look up
+    uint8_t key_id[SIGNING_KEY_ID_BYTES];
+    assert_false(verifier_message_key_id(countersigned, size, key_id));
+
+    // A flipped byte of the countersigned map breaks the countersignature
+    countersigned[2] ^= 1;
+    assert_int_equal(verifier_verify(&verifier, countersigned, size),
+                     VERIFY_BAD_SIGNATURE);
+    countersigned[2] ^= 1;
+
+    // So does a flipped byte of the countersignature
+    countersigned[size - 2] ^= 1;
+    assert_int_equal(verifier_verify(&verifier, countersigned, size),
+                     VERIFY_BAD_SIGNATURE);
+    free(countersigned);
+
+    // The countersignature is valid, the original signature is not
+    map[map_size - 2] ^= 1;
+    countersigned = countersign(keys[1], map, map_size, integer_keys, &size);
+    assert_int_equal(verifier_verify(&verifier, countersigned, size),
+                     VERIFY_BAD_SIGNATURE);
+    free(countersigned);
+    free(map);
+  }
+
+  assert_false(verifier_is_signed_map(TEST_PAYLOAD, sizeof(TEST_PAYLOAD)));
+  assert_false(verifier_is_signed_map(NULL, 0));
+
+  verifier_destroy(&verifier);
+  verifier_key_cache_destroy(&cache);
+  signing_key_destroy(keys[0]);
+  signing_key_destroy(keys[1]);
+}
+
+// Test the verification of many messages on several threads
+static void test_verifier_verify_all(void **state) {
+  (void)state; // Unused
+
+  signing_key *keys[2] = {signing_key_generate(), signing_key_generate()};
+  verifier_key_cache cache;
+  cache_keys(&cache, keys, 2);
+
+  const size_t count = 1000;
+  verifier_message *messages = calloc(count, sizeof(verifier_message));
+  verify_result *results = calloc(count, sizeof(verify_result));
+  for (size_t i = 0; i < count; i++) {
+    size_t size = 0;
+    uint8_t *data = i % 3 == 0 ? sign_cose(keys[i % 2], &size)
+                               : sign_map(keys[i % 2], i % 3 == 1, &size);
+    // Every tenth message is corrupted
+    if (i % 10 == 0) {
+      data[size - 2] ^= 1;
+    }
+    messages[i].data = data;
+    messages[i].size = size;
+  }
+
+  assert_int_equal(verifier_verify_all(&cache, messages, count, 4, results),
+                   SUCCESS);
+  for (size_t i = 0; i < count; i++) {
+    assert_int_equal(results[i],
+                     i % 10 == 0 ? VERIFY_BAD_SIGNATURE : VERIFY_OK);
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    free((uint8_t *)messages[i].data);
+  }
+  free(messages);
+  free(results);
+  verifier_key_cache_destroy(&cache);
+  signing_key_destroy(keys[0]);
+  signing_key_destroy(keys[1]);
+}
+
+// Main function to run tests
+int main(void) {
+  if (sodium_init() == -1) {
+    return 1;
+  }
+
+  const struct CMUnitTest tests[] = {
+      cmocka_unit_test(test_verifier_key_cache),
+      cmocka_unit_test(test_verifier_verify_envelopes),
+      cmocka_unit_test(test_verifier_verify_unknown_key),
+      cmocka_unit_test(test_verifier_verify_algorithms),
+      cmocka_unit_test(test_verifier_verify_detached),
+      cmocka_unit_test(test_verifier_verify_countersigned),
+      cmocka_unit_test(test_verifier_verify_all),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,159 @@
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "audit_log.h"
+
+typedef struct {
+  const char *path;
+  void *data;
+  size_t size;
+} segment;
+
+static void usage(const char *program) {
+  fprintf(stderr,
+          "Usage: %s [-f FROM_NS] [-t TO_NS] FILE...\n"
+          "Prints the messages kept in audit log segments of the message "
+          "sign plugin, in the order they were signed.\n"
+          "Only the messages ingested between FROM_NS and TO_NS, in "
+          "nanoseconds since the Unix epoch, are printed when given.\n",
+          program);
+}
+
+static void print_hex(const uint8_t *data, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    printf("%02x", data[i]);
+  }
+}
+
+static void print_record(const audit_record *record, void *userdata) {
+  (void)userdata; // Unused
+
+  time_t seconds = (time_t)(record->time_ns / 1000000000u);
+  struct tm tm;
+  char date[32];
+  gmtime_r(&seconds, &tm);
+  strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", &tm);
+
+  printf("%s.%09" PRIu64 "Z\t%" PRIu64 "\t%.*s\t", date,
+         record->time_ns % 1000000000u, record->sequence,
+         (int)record->topic_length, record->topic);
+  print_hex(record->payload, record->payload_size);
+  printf("\t");
+  print_hex(record->signature, record->signature_size);
+  printf("\n");
+}
+
+static bool map_segment(segment *seg) {
+  int fd = open(seg->path, O_RDONLY);
+  if (fd < 0) {
+    perror(seg->path);
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    perror(seg->path);
+    close(fd);
+    return false;
+  }
+
+  // Mapped shared, so that the segment written by a live broker can be read
+  seg->size = (size_t)st.st_size;
+  seg->data = seg->size > 0
+                  ? mmap(NULL, seg->size, PROT_READ, MAP_SHARED, fd, 0)
+                  : MAP_FAILED;
+  close(fd);
+
+  if (seg->data == MAP_FAILED || !audit_log_check(seg->data, seg->size)) {
+    fprintf(stderr, "%s is not an audit log segment\n", seg->path);
+    if (seg->data != MAP_FAILED) {
+      munmap(seg->data, seg->size);
+    }
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Orders segments by their first record, the file names giving the creation
+ * time of a segment rather than the time it was first written
+ */
+static int compare_segments(const void *a, const void *b) {
+  const audit_log_header *first =
+      (const audit_log_header *)((const segment *)a)->data;
+  const audit_log_header *second =
+      (const audit_log_header *)((const segment *)b)->data;
+  if (first->start_time_ns != second->start_time_ns) {
+    return first->start_time_ns < second->start_time_ns ? -1 : 1;
+  }
+  return first->first_sequence < second->first_sequence   ? -1
+         : first->first_sequence > second->first_sequence ? 1
+                                                          : 0;
+}
+
+static bool parse_time(const char *text, uint64_t *value) {
+  char *end = NULL;
+  *value = strtoull(text, &end, 10);
+  return end != text && *end == '\0';
+}
+
+int main(int argc, char **argv) {
+  uint64_t from_ns = 0;
+  uint64_t to_ns = UINT64_MAX;
+  int opt = 0;
+  while ((opt = getopt(argc, argv, "f:t:")) != -1) {
+    if ((opt == 'f' && parse_time(optarg, &from_ns)) ||
+        (opt == 't' && parse_time(optarg, &to_ns))) {
+      continue;
+    }
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  if (optind >= argc) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  size_t count = 0;
+  segment *segments =
+      (segment *)calloc((size_t)(argc - optind), sizeof(segment));
+  if (segments == NULL) {
+    perror("calloc");
+    return EXIT_FAILURE;
+  }
+
+  int status = EXIT_SUCCESS;
+  for (int i = optind; i < argc; i++) {
+    segments[count].path = argv[i];
+    if (!map_segment(&segments[count])) {
+      status = EXIT_FAILURE;
+      continue;
+    }
+    const audit_log_header *header =
+        (const audit_log_header *)segments[count].data;
+    if (atomic_load_explicit(&header->record_count, memory_order_acquire) ==
+        0) {
+      // Prepared ahead of time by the broker and not written yet
+      munmap(segments[count].data, segments[count].size);
+      continue;
+    }
+    count++;
+  }
+  qsort(segments, count, sizeof(segment), compare_segments);
+
+  printf("time\tsequence\ttopic\tpayload\tsignature\n");
+  for (size_t i = 0; i < count; i++) {
+    audit_log_scan(segments[i].data, from_ns, to_ns, print_record, NULL);
+    munmap(segments[i].data, segments[i].size);
+  }
+
+  free(segments);
+  return status;
+}
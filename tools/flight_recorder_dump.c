@@ -0,0 +1,115 @@
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "flight_recorder.h"
+
+static void usage(const char *program) {
+  fprintf(stderr,
+          "Usage: %s FILE [TOPIC]\n"
+          "Decodes a flight recorder file of the message sign plugin, oldest "
+          "record first.\n"
+          "Only the records of TOPIC are printed when given.\n",
+          program);
+}
+
+static const char *outcome_name(uint32_t outcome) {
+  if (outcome == FLIGHT_RECORD_SIGNED) {
+    return "signed";
+  }
+  if (outcome == FLIGHT_RECORD_PASSED) {
+    return "passed";
+  }
+  return metrics_rejection_name((metrics_rejection)(outcome - 1));
+}
+
+static void print_record(const flight_record *record) {
+  time_t seconds = (time_t)(record->timestamp_ns / 1000000000u);
+  struct tm tm;
+  char date[32];
+  gmtime_r(&seconds, &tm);
+  strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", &tm);
+
+  printf("%s.%09" PRIu64 "Z\t%016" PRIx64 "\t%" PRIu32 "\t%s", date,
+         record->timestamp_ns % 1000000000u, record->topic_hash,
+         record->payload_size, outcome_name(record->outcome));
+  for (int stage = 0; stage < METRICS_STAGE_COUNT; stage++) {
+    printf("\t%" PRIu64, record->stage_ns[stage]);
+  }
+  printf("\n");
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2 || argc > 3) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  int fd = open(argv[1], O_RDONLY);
+  if (fd < 0) {
+    perror(argv[1]);
+    return EXIT_FAILURE;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    perror(argv[1]);
+    close(fd);
+    return EXIT_FAILURE;
+  }
+
+  // Mapped shared, so that a live broker file can be read while written
+  size_t size = (size_t)st.st_size;
+  void *data =
+      size > 0 ? mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+  close(fd);
+
+  if (data == MAP_FAILED || !flight_recorder_check(data, size)) {
+    fprintf(stderr, "%s is not a flight recorder file\n", argv[1]);
+    if (data != MAP_FAILED) {
+      munmap(data, size);
+    }
+    return EXIT_FAILURE;
+  }
+
+  const flight_recorder_header *header = (const flight_recorder_header *)data;
+  uint64_t end = atomic_load_explicit(&header->write_count,
+                                      memory_order_acquire);
+  uint64_t begin = end > header->capacity ? end - header->capacity : 0;
+
+  bool filter = argc == 3;
+  uint64_t topic_hash = filter ? flight_recorder_topic_hash(argv[2]) : 0;
+
+  printf("timestamp\ttopic_hash\tpayload_size\toutcome");
+  for (int stage = 0; stage < METRICS_STAGE_COUNT; stage++) {
+    printf("\t%s_ns", metrics_stage_name((metrics_stage)stage));
+  }
+  printf("\n");
+
+  uint64_t skipped = 0;
+  for (uint64_t index = begin; index < end; index++) {
+    flight_record record;
+    if (!flight_recorder_read(data, index, &record)) {
+      // Overwritten by the broker while reading
+      skipped++;
+      continue;
+    }
+    if (!filter || record.topic_hash == topic_hash) {
+      print_record(&record);
+    }
+  }
+
+  if (skipped > 0) {
+    fprintf(stderr, "%" PRIu64 " records overwritten while reading\n",
+            skipped);
+  }
+
+  munmap(data, size);
+  return EXIT_SUCCESS;
+}
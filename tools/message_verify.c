@@ -0,0 +1,479 @@
+#include <ctype.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sodium.h>
+
+#include "cbor_validator.h"
+#include "certificate_repository.h"
+#include "key_file.h"
+#include "verifier.h"
+
+/** Input read entirely in memory, the messages point into it */
+typedef struct {
+  uint8_t *data;
+  size_t size;
+  size_t capacity;
+} buffer;
+
+/** Messages to verify, with the input they were read from */
+typedef struct {
+  verifier_message *messages;
+  const char **sources;
+  size_t count;
+  size_t capacity;
+} message_list;
+
+typedef struct {
+  verifier_key_cache *cache;
+  const char *entity;
+  size_t rejected;
+
+  /** Certificates of MAC keys, which only key files can verify */
+  size_t mac;
+} key_loader;
+
+static void usage(const char *program) {
+  fprintf(stderr,
+          "Usage: %s (-k FILE | -d CONNINFO | -m KEY_FILE)... [-e ENTITY] "
+          "[-S SECRET_FILE]\n"
+          "       [-j THREADS] [-x] [FILE...]\n"
+          "Verifies the signatures of messages written by the message sign "
+          "plugin.\n"
+          "  -k FILE      certificates in the outbox format\n"
+          "  -d CONNINFO  certificates of the entity_certificates table\n"
+          "  -e ENTITY    only use the certificates of ENTITY\n"
+          "  -m KEY_FILE  sealed key file, to verify the messages of the "
+          "blake2b-mac\n"
+          "               algorithm\n"
+          "  -S SECRET_FILE\n"
+          "               file holding the hex encoded secret of the key file, "
+          "read\n"
+          "               from the " KEY_FILE_SECRET_ENV " environment "
+          "variable by default\n"
+          "  -j THREADS   number of verifying threads, one per CPU by "
+          "default\n"
+          "  -x           one hex encoded message per line, as printed by "
+          "psql for\n"
+          "               bytea columns, instead of a CBOR sequence\n"
+          "Messages are read from standard input when no FILE is given. The "
+          "messages\n"
+          "that fail are printed, the exit status is 0 only when every "
+          "message is valid.\n",
+          program);
+}
+
+static void add_certificate(const certificate *cert, void *userdata) {
+  key_loader *loader = (key_loader *)userdata;
+  if (loader->entity != NULL && strcmp(cert->entity, loader->entity) != 0) {
+    return;
+  }
+
+  signing_algorithm algorithm = SIGNING_ALGORITHM_ED25519;
+  if (cert->algorithm != NULL &&
+      !signing_algorithm_parse(cert->algorithm, &algorithm)) {
+    loader->rejected++;
+    return;
+  }
+  if (algorithm == SIGNING_ALGORITHM_BLAKE2B_MAC) {
+    loader->mac++;
+    return;
+  }
+
+  if (verifier_key_cache_add(loader->cache, cert->public_key,
+                             cert->create_time_unix, algorithm) != SUCCESS) {
+    loader->rejected++;
+  }
+}
+
+static bool append(buffer *buffer, const uint8_t *data, size_t size) {
+  if (buffer->size + size > buffer->capacity) {
+    size_t capacity = buffer->capacity == 0 ? 65536 : buffer->capacity;
+    while (capacity < buffer->size + size) {
+      capacity *= 2;
+    }
+    uint8_t *grown = (uint8_t *)realloc(buffer->data, capacity);
+    if (grown == NULL) {
+      return false;
+    }
+    buffer->data = grown;
+    buffer->capacity = capacity;
+  }
+  memcpy(buffer->data + buffer->size, data, size);
+  buffer->size += size;
+  return true;
+}
+
+static bool read_all(FILE *file, buffer *buffer) {
+  uint8_t chunk[65536];
+  size_t read = 0;
+  while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+    if (!append(buffer, chunk, read)) {
+      return false;
+    }
+  }
+  return !ferror(file);
+}
+
+static bool add_message(message_list *list, const uint8_t *data, size_t size,
+                        const char *source) {
+  if (list->count == list->capacity) {
+    size_t capacity = list->capacity == 0 ? 1024 : 2 * list->capacity;
+    verifier_message *messages = (verifier_message *)realloc(
+        list->messages, capacity * sizeof(verifier_message));
+    if (messages == NULL) {
+      return false;
+    }
+    list->messages = messages;
+    const char **sources =
+        (const char **)realloc(list->sources, capacity * sizeof(char *));
+    if (sources == NULL) {
+      return false;
+    }
+    list->sources = sources;
+    list->capacity = capacity;
+  }
+  list->messages[list->count].data = data;
+  list->messages[list->count].size = size;
+  list->sources[list->count] = source;
+  list->count++;
+  return true;
+}
+
+/**
+ * Splits a CBOR sequence into messages
+ */
+static bool split_sequence(const uint8_t *data, size_t size,
+                           const char *source, message_list *list) {
+  size_t offset = 0;
+  while (offset < size) {
+    size_t item_size = 0;
+    cbor_validation_result result =
+        cbor_validate_item(data + offset, size - offset, NULL, &item_size);
+    if (result != CBOR_VALIDATION_OK) {
+      fprintf(stderr, "%s: %s at offset %zu, ignoring the rest\n", source,
+              cbor_validation_result_to_string(result), offset);
+      return true;
+    }
+    if (!add_message(list, data + offset, item_size, source)) {
+      return false;
+    }
+    offset += item_size;
+  }
+  return true;
+}
+
+/**
+ * Decodes hex lines in place into messages. Blank lines are skipped and the
+ * \x prefix of the bytea output of psql is accepted.
+ */
+static bool split_hex_lines(uint8_t *data, size_t size, const char *source,
+                            message_list *list) {
+  size_t line_start = 0;
+  size_t line_number = 0;
+  while (line_start < size) {
+    size_t line_end = line_start;
+    while (line_end < size && data[line_end] != '\n') {
+      line_end++;
+    }
+    line_number++;
+
+    const char *hex = (const char *)data + line_start;
+    size_t hex_size = line_end - line_start;
+    while (hex_size > 0 && isspace((unsigned char)*hex)) {
+      hex++;
+      hex_size--;
+    }
+    while (hex_size > 0 && isspace((unsigned char)hex[hex_size - 1])) {
+      hex_size--;
+    }
+    if (hex_size >= 2 && hex[0] == '\\' && hex[1] == 'x') {
+      hex += 2;
+      hex_size -= 2;
+    }
+
+    // The decoded bytes take half the room of the hex digits they replace
+    size_t decoded_size = 0;
+    if (hex_size > 0) {
+      uint8_t *decoded = data + line_start;
+      if (sodium_hex2bin(decoded, hex_size / 2, hex, hex_size, NULL,
+                         &decoded_size, NULL) != 0) {
+        fprintf(stderr, "%s:%zu: not a hex encoded message, ignoring it\n",
+                source, line_number);
+      } else if (!add_message(list, decoded, decoded_size, source)) {
+        return false;
+      }
+    }
+
+    line_start = line_end + 1;
+  }
+  return true;
+}
+
+static int compare_key_ids(const void *a, const void *b) {
+  return memcmp(a, b, SIGNING_KEY_ID_BYTES);
+}
+
+/**
+ * Collects the distinct key ids of the messages, sorted
+ *
+ * \returns false if a message has no key id or on allocation failure
+ */
+static bool collect_key_ids(const message_list *list, uint8_t **key_ids,
+                            size_t *count) {
+  uint8_t *ids = (uint8_t *)malloc(list->count * SIGNING_KEY_ID_BYTES + 1);
+  if (ids == NULL) {
+    return false;
+  }
+
+  for (size_t i = 0; i < list->count; i++) {
+    if (!verifier_message_key_id(list->messages[i].data,
+                                 list->messages[i].size,
+                                 ids + i * SIGNING_KEY_ID_BYTES)) {
+      free(ids);
+      return false;
+    }
+  }
+  qsort(ids, list->count, SIGNING_KEY_ID_BYTES, compare_key_ids);
+
+  size_t unique = 0;
+  for (size_t i = 0; i < list->count; i++) {
+    uint8_t *id = ids + i * SIGNING_KEY_ID_BYTES;
+    if (unique == 0 || compare_key_ids(ids + (unique - 1) *
+                                                 SIGNING_KEY_ID_BYTES,
+                                       id) != 0) {
+      memmove(ids + unique * SIGNING_KEY_ID_BYTES, id, SIGNING_KEY_ID_BYTES);
+      unique++;
+    }
+  }
+
+  *key_ids = ids;
+  *count = unique;
+  return true;
+}
+
+/**
+ * Adds the MAC key of a sealed key file to the cache
+ */
+static bool add_mac_key(verifier_key_cache *cache, const char *path,
+                        const char *secret_file) {
+  uint8_t secret[KEY_FILE_SECRET_BYTES];
+  if (key_file_load_secret(secret_file, secret) != SUCCESS) {
+    fprintf(stderr, "Missing or invalid secret in %s\n",
+            secret_file != NULL ? secret_file : KEY_FILE_SECRET_ENV);
+    return false;
+  }
+
+  signing_key *key = NULL;
+  error_code error = key_file_read(path, secret, &key, NULL);
+  sodium_memzero(secret, sizeof(secret));
+  if (error != SUCCESS) {
+    fprintf(stderr, "Failed to read key file %s\n", path);
+    return false;
+  }
+
+  signing_key_set_algorithm(key, SIGNING_ALGORITHM_BLAKE2B_MAC);
+  error = verifier_key_cache_add_signing_key(cache, key);
+  signing_key_destroy(key);
+  return error == SUCCESS;
+}
+
+static uint64_t monotonic_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+int main(int argc, char **argv) {
+  verifier_key_cache cache;
+  key_loader loader = {.cache = &cache, .entity = NULL, .rejected = 0};
+  const char *mac_key_file = NULL;
+  const char *secret_file = NULL;
+  const char *key_files[16];
+  const char *connections[16];
+  size_t key_file_count = 0;
+  size_t connection_count = 0;
+  long threads = sysconf(_SC_NPROCESSORS_ONLN);
+  bool hex = false;
+  int option;
+
+  while ((option = getopt(argc, argv, "k:d:e:m:S:j:xh")) != -1) {
+    switch (option) {
+    case 'k':
+      if (key_file_count == sizeof(key_files) / sizeof(key_files[0])) {
+        fprintf(stderr, "Too many certificate files\n");
+        return EXIT_FAILURE;
+      }
+      key_files[key_file_count++] = optarg;
+      break;
+    case 'd':
+      if (connection_count == sizeof(connections) / sizeof(connections[0])) {
+        fprintf(stderr, "Too many connections\n");
+        return EXIT_FAILURE;
+      }
+      connections[connection_count++] = optarg;
+      break;
+    case 'e':
+      loader.entity = optarg;
+      break;
+    case 'm':
+      mac_key_file = optarg;
+      break;
+    case 'S':
+      secret_file = optarg;
+      break;
+    case 'j':
+      threads = strtol(optarg, NULL, 10);
+      break;
+    case 'x':
+      hex = true;
+      break;
+    default:
+      usage(argv[0]);
+      return option == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+
+  if ((key_file_count == 0 && connection_count == 0 &&
+       mac_key_file == NULL) ||
+      threads <= 0) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  if (sodium_init() == -1) {
+    fprintf(stderr, "Failed to initialize libsodium\n");
+    return EXIT_FAILURE;
+  }
+
+  // Every input is read before verifying, the messages point into them
+  int input_count = argc > optind ? argc - optind : 1;
+  buffer *inputs = (buffer *)calloc((size_t)input_count, sizeof(buffer));
+  message_list list = {0};
+  bool ok = inputs != NULL;
+
+  for (int i = 0; ok && i < input_count; i++) {
+    const char *source = argc > optind ? argv[optind + i] : "<stdin>";
+    FILE *file = argc > optind ? fopen(source, "rb") : stdin;
+    if (file == NULL) {
+      perror(source);
+      ok = false;
+      break;
+    }
+    ok = read_all(file, &inputs[i]);
+    if (file != stdin) {
+      fclose(file);
+    }
+    if (!ok) {
+      fprintf(stderr, "Failed to read %s\n", source);
+      break;
+    }
+
+    ok = hex ? split_hex_lines(inputs[i].data, inputs[i].size, source, &list)
+             : split_sequence(inputs[i].data, inputs[i].size, source, &list);
+    if (!ok) {
+      fprintf(stderr, "Out of memory\n");
+    }
+  }
+
+  verifier_key_cache_init(&cache);
+  if (ok && mac_key_file != NULL) {
+    ok = add_mac_key(&cache, mac_key_file, secret_file);
+  }
+  for (size_t i = 0; ok && i < key_file_count; i++) {
+    ok = certificate_repository_read_file(key_files[i], add_certificate,
+                                          &loader) == SUCCESS;
+  }
+
+  // Only the certificates of the key ids found in the messages are looked up,
+  // unless some messages were signed before key ids were added
+  uint8_t *key_ids = NULL;
+  size_t key_id_count = 0;
+  bool by_key_id = ok && collect_key_ids(&list, &key_ids, &key_id_count);
+  for (size_t i = 0; ok && i < connection_count; i++) {
+    ok = (by_key_id ? certificate_repository_find(connections[i], key_ids,
+                                                  key_id_count,
+                                                  add_certificate, &loader)
+                    : certificate_repository_fetch(connections[i],
+                                                   loader.entity,
+                                                   add_certificate,
+                                                   &loader)) == SUCCESS;
+  }
+  free(key_ids);
+  verifier_key_cache_seal(&cache);
+
+  if (loader.rejected > 0) {
+    fprintf(stderr,
+            "Ignored %zu certificates with an invalid public key or "
+            "algorithm\n",
+            loader.rejected);
+  }
+  if (loader.mac > 0 && mac_key_file == NULL) {
+    fprintf(stderr,
+            "Ignored %zu blake2b-mac certificates, their messages need the "
+            "key file\n",
+            loader.mac);
+  }
+  if (ok && cache.count == 0) {
+    fprintf(stderr, "No certificate to verify the messages with\n");
+    ok = false;
+  }
+
+  size_t counts[VERIFY_RESULT_COUNT] = {0};
+  verify_result *results = NULL;
+  uint64_t elapsed_ns = 0;
+
+  if (ok) {
+    results = (verify_result *)calloc(list.count + 1, sizeof(verify_result));
+    uint64_t start_ns = monotonic_ns();
+    ok = results != NULL &&
+         verifier_verify_all(&cache, list.messages, list.count,
+                             (size_t)threads, results) == SUCCESS;
+    elapsed_ns = monotonic_ns() - start_ns;
+  }
+
+  if (ok) {
+    // Failures are printed with the index of the message in its input
+    size_t index = 0;
+    for (size_t i = 0; i < list.count; i++) {
+      index = i > 0 && list.sources[i] == list.sources[i - 1] ? index + 1 : 0;
+      counts[results[i]]++;
+      if (results[i] != VERIFY_OK) {
+        printf("%s\t%zu\t%s\n", list.sources[i], index,
+               verify_result_to_string(results[i]));
+      }
+    }
+
+    fprintf(stderr, "%zu messages verified with %zu keys on %ld threads\n",
+            list.count, cache.count, threads);
+    for (int result = 0; result < VERIFY_RESULT_COUNT; result++) {
+      if (counts[result] > 0) {
+        fprintf(stderr, "  %-14s %zu\n",
+                verify_result_to_string((verify_result)result),
+                counts[result]);
+      }
+    }
+    double seconds = (double)elapsed_ns / 1e9;
+    fprintf(stderr, "  %.3f s, %.0f messages/s\n", seconds,
+            seconds > 0 ? (double)list.count / seconds : 0.0);
+  }
+
+  for (int i = 0; inputs != NULL && i < input_count; i++) {
+    free(inputs[i].data);
+  }
+  free(inputs);
+  free(list.messages);
+  free(list.sources);
+  free(results);
+  verifier_key_cache_destroy(&cache);
+
+  if (!ok) {
+    return EXIT_FAILURE;
+  }
+  return counts[VERIFY_OK] == list.count ? EXIT_SUCCESS : EXIT_FAILURE;
+}
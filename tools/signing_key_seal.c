@@ -0,0 +1,173 @@
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sodium.h>
+
+#include "certificate_repository.h"
+#include "key_file.h"
+
+/** Time given to the database to store the certificate */
+#define REGISTER_TIMEOUT_MS 30000
+
+/** Delay between two polls of the repository */
+#define POLL_INTERVAL_US 10000
+
+static void usage(const char *program) {
+  fprintf(stderr,
+          "Usage: %s [-s SECRET_FILE] [-e ENTITY] [-a ALGORITHM] "
+          "[-d CONNINFO] KEY_FILE\n"
+          "Generates a signing key shared by several brokers and seals it in "
+          "a new\n"
+          "KEY_FILE. Its certificate is printed in the outbox format.\n"
+          "  -s SECRET_FILE  file holding the hex encoded secret, "
+          "read from the\n"
+          "                  " KEY_FILE_SECRET_ENV " environment variable "
+          "by default\n"
+          "  -e ENTITY       entity of the certificate, "
+          CERTIFICATE_DEFAULT_ENTITY " by default\n"
+          "  -a ALGORITHM    algorithm of the certificate, as set by the "
+          "algorithm\n"
+          "                  option of the brokers: ed25519 (default), "
+          "ed25519ph or\n"
+          "                  blake2b-mac\n"
+          "  -d CONNINFO     stores the certificate in the entity_certificates "
+          "table\n",
+          program);
+}
+
+static uint64_t monotonic_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u;
+}
+
+static void certificate_stored(const certificate *cert, void *userdata) {
+  (void)cert; // Unused
+  *(bool *)userdata = true;
+}
+
+/**
+ * Stores a certificate with the repository used by the plugin, so that the
+ * table is created or migrated the same way
+ *
+ * \returns true once the repository reported the certificate as stored
+ */
+static bool register_certificate(const char *connection,
+                                 const certificate *cert) {
+  bool stored = false;
+  certificate_repository_options options = {
+      .connection = connection,
+      .outbox_path = NULL,
+      .retry_initial_ms = 500,
+      .retry_max_ms = 5000,
+      .stored_callback = certificate_stored,
+      .userdata = &stored,
+  };
+  certificate_repository *repo = certificate_repository_new(&options);
+  if (repo == NULL) {
+    return false;
+  }
+
+  if (certificate_repository_add(repo, cert) == SUCCESS) {
+    uint64_t deadline_ms = monotonic_ms() + REGISTER_TIMEOUT_MS;
+    while (!stored && monotonic_ms() < deadline_ms) {
+      certificate_repository_poll(repo, monotonic_ms());
+      if (!stored) {
+        usleep(POLL_INTERVAL_US);
+      }
+    }
+  }
+
+  certificate_repository_destroy(repo);
+  return stored;
+}
+
+int main(int argc, char **argv) {
+  const char *secret_file = NULL;
+  const char *entity = CERTIFICATE_DEFAULT_ENTITY;
+  const char *connection = NULL;
+  signing_algorithm algorithm = SIGNING_ALGORITHM_ED25519;
+  int option;
+
+  while ((option = getopt(argc, argv, "s:e:a:d:h")) != -1) {
+    switch (option) {
+    case 's':
+      secret_file = optarg;
+      break;
+    case 'e':
+      entity = optarg;
+      break;
+    case 'a':
+      if (!signing_algorithm_parse(optarg, &algorithm)) {
+        fprintf(stderr, "Unknown algorithm %s\n", optarg);
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'd':
+      connection = optarg;
+      break;
+    default:
+      usage(argv[0]);
+      return option == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+
+  if (optind != argc - 1) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  const char *path = argv[optind];
+
+  if (sodium_init() == -1) {
+    fprintf(stderr, "Failed to initialize libsodium\n");
+    return EXIT_FAILURE;
+  }
+
+  uint8_t secret[KEY_FILE_SECRET_BYTES];
+  if (key_file_load_secret(secret_file, secret) != SUCCESS) {
+    fprintf(stderr, "Missing or invalid secret in %s\n",
+            secret_file != NULL ? secret_file : KEY_FILE_SECRET_ENV);
+    return EXIT_FAILURE;
+  }
+
+  signing_key *key = signing_key_generate();
+  if (key == NULL) {
+    fprintf(stderr, "Failed to generate crypto sign keypair\n");
+    return EXIT_FAILURE;
+  }
+
+  // The algorithm is sealed with the key, brokers configured with another
+  // one refuse to load it
+  signing_key_set_algorithm(key, algorithm);
+  error_code error = key_file_write(path, key, secret);
+  sodium_memzero(secret, sizeof(secret));
+  if (error != SUCCESS) {
+    fprintf(stderr, "Failed to create %s, it must not exist yet\n", path);
+    signing_key_destroy(key);
+    return EXIT_FAILURE;
+  }
+
+  certificate cert = {
+      .entity = entity,
+      .create_time_unix = key->create_time_unix,
+      .public_key = key->public_key_hex,
+      .algorithm = signing_algorithm_name(algorithm),
+  };
+
+  // Brokers must never sign with a key whose certificate is not stored
+  if (connection != NULL && !register_certificate(connection, &cert)) {
+    fprintf(stderr, "Failed to store the certificate, removing %s\n", path);
+    unlink(path);
+    signing_key_destroy(key);
+    return EXIT_FAILURE;
+  }
+
+  printf("%s\t%" PRIu64 "\t%s\t%s\n", cert.entity, cert.create_time_unix,
+         cert.public_key, cert.algorithm);
+  signing_key_destroy(key);
+  return EXIT_SUCCESS;
+}
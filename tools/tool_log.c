@@ -0,0 +1,19 @@
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "mosquitto.h"
+#include "mosquitto_broker.h"
+
+/* Broker logging used by the shared sources, written to stderr by the tools */
+
+void mosquitto_log_printf(int level, const char *fmt, ...) {
+  if (level == MOSQ_LOG_DEBUG) {
+    return;
+  }
+
+  va_list args;
+  va_start(args, fmt);
+  vfprintf(stderr, fmt, args);
+  va_end(args);
+  fputc('\n', stderr);
+}